@@ -0,0 +1,307 @@
+/**
+*************************************************************************
+* @file       binlog.c
+* @brief      Source file for the binlog.c module.
+* @details    This file contains the implementation of functions for 
+*             the binlog.c module. Each record is framed as:
+*             sync(2) len(1) type|level(1) timestamp_ms(4) tag(4) fmt(4)
+*             followed by the raw arguments, little endian. On the
+*             console, every byte after the sync that the line ending
+*             translation could touch is escaped (see BINLOG_ESCAPE).
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+// FreeRTOS Includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/ringbuf.h"
+
+// ESP Includes
+#include "esp_err.h"
+#include "esp_log.h"
+
+// Application Includes
+#include "tasks_common.h"
+#include "api/binlog.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+/**
+ * @brief Maximum size of a record, header included
+ */
+#define BINLOG_MAX_RECORD_SIZE 128
+
+/* Typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief Header of each record
+ */
+typedef struct __attribute__((packed)) binlog_header {
+    uint8_t sync[2];     /**< BINLOG_SYNC_0, BINLOG_SYNC_1 */
+    uint8_t len;         /**< Length of the record, header included */
+    uint8_t type_level;  /**< Record type (high nibble) and log level (low nibble) */
+    uint32_t timestamp;  /**< Timestamp in milliseconds */
+    uint32_t tag;        /**< Address of the tag string */
+    uint32_t fmt;        /**< Address of the format string, the record ID */
+} binlog_header_t;
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Ring buffer holding the records until they are drained
+ */
+static RingbufHandle_t g_ringbuf = NULL;
+
+/**
+ * @brief Number of records dropped since boot
+ */
+static volatile uint32_t g_dropped = 0;
+
+/**
+ * @brief Format string of the record reporting dropped records
+ */
+static const char g_dropped_fmt[] __attribute__((section(".rodata.binlog"))) = "%lu records dropped";
+
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "binlog";
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Task that drains the ring buffer to the console
+ * @param pvParameters parameter which can be passed to the task
+ */
+static void binlog_task(void *pvParameters);
+
+/**
+ * @brief Fills the header and queues the record
+ * @param record Record with the arguments already in place
+ * @param len Length of the record, header included
+ * @param type Record type
+ * @param level Log level
+ * @param tag Address of the tag string
+ * @param fmt Address of the format string
+ */
+static void binlog_send(uint8_t *record, size_t len, uint8_t type, esp_log_level_t level, const char *tag, const char *fmt);
+
+/**
+ * @brief Escapes a record for the console
+ * @param record Record, header included
+ * @param len Length of the record
+ * @param out Buffer of at least twice the length of the record
+ * @return Length of the escaped record
+ */
+static size_t binlog_escape(const uint8_t *record, size_t len, uint8_t *out);
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup binlog.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Creates the ring buffer and starts the drain task
+ */
+void binlog_start(void){
+	g_ringbuf = xRingbufferCreate(BINLOG_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
+	if (g_ringbuf == NULL) {
+		ESP_LOGE(TAG, "Failed to create the ring buffer");
+		return;
+	}
+	xTaskCreate(&binlog_task, "binlog_task", BINLOG_TASK_STACK_SIZE, NULL, BINLOG_TASK_PRIORITY, NULL);
+}
+
+/**
+ * @brief Queues a printf-like record without formatting it
+ * @param level Log level
+ * @param tag Tag of the module, must live in flash (static const)
+ * @param fmt Format string, must live in flash (use the BINLOG macros)
+ */
+void binlog_write(esp_log_level_t level, const char *tag, const char *fmt, ...){
+	uint8_t record[BINLOG_MAX_RECORD_SIZE];
+	size_t len = sizeof(binlog_header_t);
+	va_list args;
+	
+	if (g_ringbuf == NULL || level > BINLOG_LEVEL) {
+		return;
+	}
+	
+	// Copy each argument as raw bytes, only the conversion type is parsed
+	va_start(args, fmt);
+	for (const char *p = fmt; *p; p++) {
+		if (*p != '%') {
+			continue;
+		}
+		p++;
+		while (*p && strchr("-+ #0123456789.hlzjt", *p)) {
+			p++;
+		}
+		if (*p == '\0') {
+			break;
+		}
+		if (*p == '%') {
+			continue;
+		}
+		
+		if (*p == 's') {
+			const char *str = va_arg(args, const char *);
+			size_t n = str ? strnlen(str, BINLOG_MAX_STRING_LEN) : 0;
+			if (len + 1 + n > sizeof(record)) {
+				break;
+			}
+			record[len++] = n;
+			memcpy(&record[len], str, n);
+			len += n;
+		}
+		else if (strchr("fFeEgG", *p)) {
+			double value = va_arg(args, double);
+			if (len + sizeof(value) > sizeof(record)) {
+				break;
+			}
+			memcpy(&record[len], &value, sizeof(value));
+			len += sizeof(value);
+		}
+		else {
+			uint32_t value = va_arg(args, uint32_t);
+			if (len + sizeof(value) > sizeof(record)) {
+				break;
+			}
+			memcpy(&record[len], &value, sizeof(value));
+			len += sizeof(value);
+		}
+	}
+	va_end(args);
+	
+	binlog_send(record, len, BINLOG_TYPE_PRINTF, level, tag, fmt);
+}
+
+/**
+ * @brief Queues a raw buffer record
+ * @param level Log level
+ * @param tag Tag of the module, must live in flash (static const)
+ * @param label Label printed before the buffer, must live in flash
+ * @param buffer Buffer to log
+ * @param len Length of the buffer, truncated to fit in one record
+ */
+void binlog_write_hex(esp_log_level_t level, const char *tag, const char *label, const void *buffer, size_t len){
+	uint8_t record[BINLOG_MAX_RECORD_SIZE];
+	
+	if (g_ringbuf == NULL || level > BINLOG_LEVEL) {
+		return;
+	}
+	if (len > sizeof(record) - sizeof(binlog_header_t)) {
+		len = sizeof(record) - sizeof(binlog_header_t);
+	}
+	memcpy(&record[sizeof(binlog_header_t)], buffer, len);
+	
+	binlog_send(record, sizeof(binlog_header_t) + len, BINLOG_TYPE_HEX, level, tag, label);
+}
+
+/**
+ * @brief Gets the number of records dropped because the ring buffer was full
+ * @return Number of dropped records
+ */
+uint32_t binlog_get_dropped(void){
+	return g_dropped;
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup binlog.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Fills the header and queues the record
+ * @param record Record with the arguments already in place
+ * @param len Length of the record, header included
+ * @param type Record type
+ * @param level Log level
+ * @param tag Address of the tag string
+ * @param fmt Address of the format string
+ */
+static void binlog_send(uint8_t *record, size_t len, uint8_t type, esp_log_level_t level, const char *tag, const char *fmt){
+	binlog_header_t header = {
+		.sync = {BINLOG_SYNC_0, BINLOG_SYNC_1},
+		.len = len,
+		.type_level = (type << 4) | (level & 0x0F),
+		.timestamp = esp_log_timestamp(),
+		.tag = (uint32_t)(uintptr_t)tag,
+		.fmt = (uint32_t)(uintptr_t)fmt,
+	};
+	memcpy(record, &header, sizeof(header));
+	
+	// Never block the hot path, drop the record if the buffer is full
+	if (xRingbufferSend(g_ringbuf, record, len, 0) != pdTRUE) {
+		g_dropped++;
+	}
+}
+
+/**
+ * @brief Task that drains the ring buffer to the console
+ * @param pvParameters parameter which can be passed to the task
+ */
+static void binlog_task(void *pvParameters){
+	static uint8_t escaped[2 * BINLOG_MAX_RECORD_SIZE];
+	uint32_t reported_dropped = 0;
+	
+	while (1) {
+		size_t size;
+		uint8_t *item = xRingbufferReceive(g_ringbuf, &size, pdMS_TO_TICKS(BINLOG_FLUSH_PERIOD_MS));
+		if (item) {
+			// stdout translates the line endings, so the record never carries a raw 0x0A
+			size_t escaped_len = binlog_escape(item, size, escaped);
+			vRingbufferReturnItem(g_ringbuf, item);
+			fwrite(escaped, 1, escaped_len, stdout);
+			continue;
+		}
+		
+		// Idle: report the dropped records and flush the console
+		if (g_dropped != reported_dropped) {
+			reported_dropped = g_dropped;
+			binlog_write(ESP_LOG_WARN, TAG, g_dropped_fmt, (unsigned long)reported_dropped);
+		}
+		fflush(stdout);
+	}
+}
+
+/**
+ * @brief Escapes a record for the console
+ * @param record Record, header included
+ * @param len Length of the record
+ * @param out Buffer of at least twice the length of the record
+ * @return Length of the escaped record
+ */
+static size_t binlog_escape(const uint8_t *record, size_t len, uint8_t *out){
+	size_t n = 0;
+	
+	for (size_t i = 0; i < len; i++) {
+		uint8_t byte = record[i];
+		// The sync bytes go as they are, the decoder looks for them
+		if (i >= 2 && (byte == '\n' || byte == '\r' || byte == BINLOG_ESCAPE)) {
+			out[n++] = BINLOG_ESCAPE;
+			byte ^= BINLOG_ESCAPE_XOR;
+		}
+		out[n++] = byte;
+	}
+	return n;
+}
+
+/** @} */
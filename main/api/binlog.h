@@ -0,0 +1,130 @@
+/**
+*************************************************************************
+* @file       binlog.h
+* @brief      Header file for the binlog.h module.
+* @details    This file contains declarations and prototypes for the 
+*             binlog.h module, a deferred binary logger. The format
+*             string is never expanded on the device: its address in
+*             flash, fixed at link time, is its ID. The arguments are
+*             copied as raw bytes into a ring buffer and a background
+*             task drains them to the console, where
+*             tools/binlog_decode.py rebuilds the text from the ELF.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_BINLOG_H_
+#define MAIN_API_BINLOG_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_log.h"
+#include "sysconfig.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/**
+ * @brief Sync bytes at the start of each binary record
+ */
+#define BINLOG_SYNC_0 0xB1
+#define BINLOG_SYNC_1 0x0C
+
+/**
+ * @brief Escape byte of the records on the console
+ * @note The console turns 0x0A into CR LF, so 0x0A, 0x0D and the escape byte
+ *       itself go out as BINLOG_ESCAPE followed by the byte XOR BINLOG_ESCAPE_XOR.
+ */
+#define BINLOG_ESCAPE     0x7D
+#define BINLOG_ESCAPE_XOR 0x20
+
+/**
+ * @brief Record types
+ */
+#define BINLOG_TYPE_PRINTF 0x0 /**< Arguments of a printf-like format */
+#define BINLOG_TYPE_HEX    0x1 /**< Raw buffer, printed as hex by the decoder */
+
+#if BINLOG_ENABLED
+
+/**
+ * @brief Places the format string in flash and queues the record
+ * @note Supported conversions: integers up to 32 bits, %c, %p, %s (truncated
+ *       to BINLOG_MAX_STRING_LEN) and %f. 64-bit integers are not supported.
+ */
+#define BINLOG(level, tag, fmt, ...) do { \
+        static const char binlog_fmt[] __attribute__((section(".rodata.binlog"))) = fmt; \
+        binlog_write(level, tag, binlog_fmt, ##__VA_ARGS__); \
+    } while (0)
+
+#define BINLOG_HEX(level, tag, label, buffer, len) do { \
+        static const char binlog_fmt[] __attribute__((section(".rodata.binlog"))) = label; \
+        binlog_write_hex(level, tag, binlog_fmt, buffer, len); \
+    } while (0)
+
+#else
+
+#define BINLOG(level, tag, fmt, ...) ESP_LOG_LEVEL_LOCAL(level, tag, fmt, ##__VA_ARGS__)
+
+#define BINLOG_HEX(level, tag, label, buffer, len) do { \
+        ESP_LOG_LEVEL_LOCAL(level, tag, label); \
+        ESP_LOG_BUFFER_HEX_LEVEL(tag, buffer, len, level); \
+    } while (0)
+
+#endif // BINLOG_ENABLED
+
+/**
+ * @brief Shortcuts for the common levels
+ */
+#define BINLOGE(tag, fmt, ...) BINLOG(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define BINLOGI(tag, fmt, ...) BINLOG(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+
+/* Public Types --------------------------------------------------------------*/
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup binlog.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Creates the ring buffer and starts the drain task
+ * @note Records written before this call are counted as dropped.
+ */
+void binlog_start(void);
+
+/**
+ * @brief Queues a printf-like record without formatting it
+ * @param level Log level
+ * @param tag Tag of the module, must live in flash (static const)
+ * @param fmt Format string, must live in flash (use the BINLOG macros)
+ */
+void binlog_write(esp_log_level_t level, const char *tag, const char *fmt, ...);
+
+/**
+ * @brief Queues a raw buffer record
+ * @param level Log level
+ * @param tag Tag of the module, must live in flash (static const)
+ * @param label Label printed before the buffer, must live in flash
+ * @param buffer Buffer to log
+ * @param len Length of the buffer, truncated to fit in one record
+ */
+void binlog_write_hex(esp_log_level_t level, const char *tag, const char *label, const void *buffer, size_t len);
+
+/**
+ * @brief Gets the number of records dropped because the ring buffer was full
+ * @return Number of dropped records
+ */
+uint32_t binlog_get_dropped(void);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* MAIN_API_BINLOG_H_ */
@@ -0,0 +1,393 @@
+/**
+*************************************************************************
+* @file       blake3.c
+* @brief      Source file for the blake3.c module.
+* @details    This file contains the implementation of functions for
+*             the blake3.c module. It follows the BLAKE3 reference
+*             implementation: one compression at a time, no SIMD, and the
+*             chaining value stack merged as each chunk is finished.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+// Standard C Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Application Includes
+#include "api/blake3.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+/**
+ * @brief Domain flags of a compression
+ */
+#define BLAKE3_CHUNK_START (1 << 0)
+#define BLAKE3_CHUNK_END   (1 << 1)
+#define BLAKE3_PARENT      (1 << 2)
+#define BLAKE3_ROOT        (1 << 3)
+
+/* Typedefs --------------------------------------------------------------*/
+
+/* Private variables -----------------------------------------------------*/
+
+/**
+ * @brief Initial chaining value, the SHA-256 IV
+ */
+static const uint32_t g_iv[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+	0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+/**
+ * @brief Message word order of each of the seven rounds
+ */
+static const uint8_t g_schedule[7][16] = {
+	{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+	{2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+	{3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+	{10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+	{12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+	{9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+	{11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Compresses a block into a chaining value
+ * @param cv Input chaining value
+ * @param block Block, BLAKE3_BLOCK_LEN bytes
+ * @param block_len Bytes of the block in use
+ * @param counter Chunk counter, 0 for a parent
+ * @param flags Domain flags
+ * @param out Output chaining value
+ */
+static void blake3_compress(const uint32_t cv[8], const uint8_t *block, uint8_t block_len, uint64_t counter, uint8_t flags, uint32_t out[8]);
+
+/**
+ * @brief Computes the chaining value of a parent node
+ * @param left Chaining value of the left child, BLAKE3_OUT_LEN bytes
+ * @param right Chaining value of the right child, BLAKE3_OUT_LEN bytes
+ * @param flags Extra flags, BLAKE3_ROOT for the root
+ * @param out Chaining value, BLAKE3_OUT_LEN bytes
+ */
+static void blake3_parent(const uint8_t *left, const uint8_t *right, uint8_t flags, uint8_t *out);
+
+/**
+ * @brief Computes the chaining value of the current chunk
+ * @param hasher Hasher
+ * @param flags Extra flags, BLAKE3_ROOT for the root
+ * @param out Chaining value, BLAKE3_OUT_LEN bytes
+ */
+static void blake3_chunk_output(const blake3_hasher_t *hasher, uint8_t flags, uint8_t *out);
+
+/**
+ * @brief Joins the chunk and the stack into the output of the hasher
+ * @param hasher Hasher
+ * @param root true for the hash of the whole input, false for a subtree chaining value
+ * @param out Output, BLAKE3_OUT_LEN bytes
+ */
+static void blake3_finalize(const blake3_hasher_t *hasher, bool root, uint8_t *out);
+
+/**
+ * @brief Joins the chaining values of consecutive subtrees, left-balanced like the BLAKE3 tree
+ * @param cvs Chaining values
+ * @param count Number of chaining values
+ * @param flags Extra flags of the top node
+ * @param out Chaining value, BLAKE3_OUT_LEN bytes
+ */
+static void blake3_join(const uint8_t *cvs, size_t count, uint8_t flags, uint8_t *out);
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup blake3.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Starts a hasher of a whole input
+ * @param hasher Hasher
+ */
+void blake3_hasher_init(blake3_hasher_t *hasher){
+	blake3_hasher_init_subtree(hasher, 0);
+}
+
+/**
+ * @brief Starts a hasher of a subtree
+ * @param hasher Hasher
+ * @param chunk_counter Index of the first chunk of the subtree, a multiple of its size in chunks
+ * @note A subtree holds a power of two chunks, only the last one of the input may hold fewer.
+ */
+void blake3_hasher_init_subtree(blake3_hasher_t *hasher, uint64_t chunk_counter){
+	memcpy(hasher->cv, g_iv, sizeof(hasher->cv));
+	hasher->chunk_counter = chunk_counter;
+	hasher->chunks_done = 0;
+	hasher->block_len = 0;
+	hasher->blocks_compressed = 0;
+	hasher->cv_stack_len = 0;
+}
+
+/**
+ * @brief Adds data to the hasher
+ * @param hasher Hasher
+ * @param input Data
+ * @param len Length of the data
+ */
+void blake3_hasher_update(blake3_hasher_t *hasher, const void *input, size_t len){
+	const uint8_t *data = input;
+
+	while(len > 0){
+		// A full chunk is only closed when more input follows, the last one may be the root
+		if(hasher->blocks_compressed * BLAKE3_BLOCK_LEN + hasher->block_len == BLAKE3_CHUNK_LEN){
+			uint8_t cv[BLAKE3_OUT_LEN];
+			blake3_chunk_output(hasher, 0, cv);
+
+			// Each trailing zero bit of the finished count closes one subtree
+			uint64_t total = ++hasher->chunks_done;
+			while((total & 1) == 0){
+				hasher->cv_stack_len--;
+				blake3_parent(&hasher->cv_stack[hasher->cv_stack_len * BLAKE3_OUT_LEN], cv, 0, cv);
+				total >>= 1;
+			}
+			memcpy(&hasher->cv_stack[hasher->cv_stack_len * BLAKE3_OUT_LEN], cv, BLAKE3_OUT_LEN);
+			hasher->cv_stack_len++;
+
+			memcpy(hasher->cv, g_iv, sizeof(hasher->cv));
+			hasher->chunk_counter++;
+			hasher->block_len = 0;
+			hasher->blocks_compressed = 0;
+		}
+
+		// Same laziness inside the chunk, the last block takes the CHUNK_END flag
+		if(hasher->block_len == BLAKE3_BLOCK_LEN){
+			uint8_t flags = (hasher->blocks_compressed == 0) ? BLAKE3_CHUNK_START : 0;
+			blake3_compress(hasher->cv, hasher->block, BLAKE3_BLOCK_LEN, hasher->chunk_counter, flags, hasher->cv);
+			hasher->blocks_compressed++;
+			hasher->block_len = 0;
+		}
+		size_t take = BLAKE3_BLOCK_LEN - hasher->block_len;
+		if(take > len){
+			take = len;
+		}
+		memcpy(&hasher->block[hasher->block_len], data, take);
+		hasher->block_len += take;
+		data += take;
+		len -= take;
+	}
+}
+
+/**
+ * @brief Gets the hash of the whole input
+ * @param hasher Hasher started with blake3_hasher_init(), left unchanged
+ * @param out Hash, BLAKE3_OUT_LEN bytes
+ */
+void blake3_hasher_finalize(const blake3_hasher_t *hasher, uint8_t *out){
+	blake3_finalize(hasher, true, out);
+}
+
+/**
+ * @brief Gets the chaining value of a subtree
+ * @param hasher Hasher started with blake3_hasher_init_subtree(), left unchanged
+ * @param cv Chaining value, BLAKE3_OUT_LEN bytes
+ */
+void blake3_hasher_finalize_subtree(const blake3_hasher_t *hasher, uint8_t *cv){
+	blake3_finalize(hasher, false, cv);
+}
+
+/**
+ * @brief Hashes a whole input at once
+ * @param input Data
+ * @param len Length of the data
+ * @param out Hash, BLAKE3_OUT_LEN bytes
+ */
+void blake3_hash(const void *input, size_t len, uint8_t *out){
+	blake3_hasher_t hasher;
+
+	blake3_hasher_init(&hasher);
+	blake3_hasher_update(&hasher, input, len);
+	blake3_hasher_finalize(&hasher, out);
+}
+
+/**
+ * @brief Joins the chaining values of consecutive subtrees into the hash of the whole input
+ * @param cvs Chaining values, BLAKE3_OUT_LEN bytes each, in input order
+ * @param count Number of subtrees, at least 2
+ * @param out Hash, BLAKE3_OUT_LEN bytes
+ * @note All subtrees hold the same power of two chunks, only the last one may hold fewer.
+ *       A single subtree is the whole input and must be hashed with blake3_hasher_init().
+ */
+void blake3_join_subtrees(const uint8_t *cvs, size_t count, uint8_t *out){
+	blake3_join(cvs, count, BLAKE3_ROOT, out);
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup blake3.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Rotates a word to the right
+ */
+static inline uint32_t blake3_rotr(uint32_t w, int c){
+	return (w >> c) | (w << (32 - c));
+}
+
+/**
+ * @brief Mixing function, applied to a column or a diagonal of the state
+ */
+static inline void blake3_g(uint32_t *s, int a, int b, int c, int d, uint32_t x, uint32_t y){
+	s[a] = s[a] + s[b] + x;
+	s[d] = blake3_rotr(s[d] ^ s[a], 16);
+	s[c] = s[c] + s[d];
+	s[b] = blake3_rotr(s[b] ^ s[c], 12);
+	s[a] = s[a] + s[b] + y;
+	s[d] = blake3_rotr(s[d] ^ s[a], 8);
+	s[c] = s[c] + s[d];
+	s[b] = blake3_rotr(s[b] ^ s[c], 7);
+}
+
+/**
+ * @brief Compresses a block into a chaining value
+ * @param cv Input chaining value
+ * @param block Block, BLAKE3_BLOCK_LEN bytes
+ * @param block_len Bytes of the block in use
+ * @param counter Chunk counter, 0 for a parent
+ * @param flags Domain flags
+ * @param out Output chaining value
+ */
+static void blake3_compress(const uint32_t cv[8], const uint8_t *block, uint8_t block_len, uint64_t counter, uint8_t flags, uint32_t out[8]){
+	uint32_t m[16];
+	uint32_t s[16];
+
+	// Little-endian words, whatever the host order
+	for(int i = 0; i < 16; i++){
+		m[i] = (uint32_t)block[4 * i] | ((uint32_t)block[4 * i + 1] << 8) |
+		       ((uint32_t)block[4 * i + 2] << 16) | ((uint32_t)block[4 * i + 3] << 24);
+	}
+	memcpy(s, cv, 8 * sizeof(uint32_t));
+	memcpy(&s[8], g_iv, 4 * sizeof(uint32_t));
+	s[12] = (uint32_t)counter;
+	s[13] = (uint32_t)(counter >> 32);
+	s[14] = block_len;
+	s[15] = flags;
+
+	for(int r = 0; r < 7; r++){
+		const uint8_t *k = g_schedule[r];
+		blake3_g(s, 0, 4, 8, 12, m[k[0]], m[k[1]]);
+		blake3_g(s, 1, 5, 9, 13, m[k[2]], m[k[3]]);
+		blake3_g(s, 2, 6, 10, 14, m[k[4]], m[k[5]]);
+		blake3_g(s, 3, 7, 11, 15, m[k[6]], m[k[7]]);
+		blake3_g(s, 0, 5, 10, 15, m[k[8]], m[k[9]]);
+		blake3_g(s, 1, 6, 11, 12, m[k[10]], m[k[11]]);
+		blake3_g(s, 2, 7, 8, 13, m[k[12]], m[k[13]]);
+		blake3_g(s, 3, 4, 9, 14, m[k[14]], m[k[15]]);
+	}
+	for(int i = 0; i < 8; i++){
+		out[i] = s[i] ^ s[i + 8];
+	}
+}
+
+/**
+ * @brief Stores a chaining value as bytes
+ */
+static void blake3_store_cv(const uint32_t cv[8], uint8_t *out){
+	for(int i = 0; i < 8; i++){
+		out[4 * i] = cv[i];
+		out[4 * i + 1] = cv[i] >> 8;
+		out[4 * i + 2] = cv[i] >> 16;
+		out[4 * i + 3] = cv[i] >> 24;
+	}
+}
+
+/**
+ * @brief Computes the chaining value of a parent node
+ * @param left Chaining value of the left child, BLAKE3_OUT_LEN bytes
+ * @param right Chaining value of the right child, BLAKE3_OUT_LEN bytes
+ * @param flags Extra flags, BLAKE3_ROOT for the root
+ * @param out Chaining value, BLAKE3_OUT_LEN bytes
+ */
+static void blake3_parent(const uint8_t *left, const uint8_t *right, uint8_t flags, uint8_t *out){
+	uint8_t block[BLAKE3_BLOCK_LEN];
+	uint32_t cv[8];
+
+	memcpy(block, left, BLAKE3_OUT_LEN);
+	memcpy(&block[BLAKE3_OUT_LEN], right, BLAKE3_OUT_LEN);
+	blake3_compress(g_iv, block, BLAKE3_BLOCK_LEN, 0, BLAKE3_PARENT | flags, cv);
+	blake3_store_cv(cv, out);
+}
+
+/**
+ * @brief Computes the chaining value of the current chunk
+ * @param hasher Hasher
+ * @param flags Extra flags, BLAKE3_ROOT for the root
+ * @param out Chaining value, BLAKE3_OUT_LEN bytes
+ */
+static void blake3_chunk_output(const blake3_hasher_t *hasher, uint8_t flags, uint8_t *out){
+	uint8_t block[BLAKE3_BLOCK_LEN] = {0};
+	uint32_t cv[8];
+
+	memcpy(block, hasher->block, hasher->block_len);
+	flags |= BLAKE3_CHUNK_END | ((hasher->blocks_compressed == 0) ? BLAKE3_CHUNK_START : 0);
+	blake3_compress(hasher->cv, block, hasher->block_len, hasher->chunk_counter, flags, cv);
+	blake3_store_cv(cv, out);
+}
+
+/**
+ * @brief Joins the chunk and the stack into the output of the hasher
+ * @param hasher Hasher
+ * @param root true for the hash of the whole input, false for a subtree chaining value
+ * @param out Output, BLAKE3_OUT_LEN bytes
+ */
+static void blake3_finalize(const blake3_hasher_t *hasher, bool root, uint8_t *out){
+	uint8_t root_flag = root ? BLAKE3_ROOT : 0;
+	uint8_t cv[BLAKE3_OUT_LEN];
+
+	if(hasher->cv_stack_len == 0){
+		blake3_chunk_output(hasher, root_flag, out);
+		return;
+	}
+
+	// The 32-byte hash is the chaining value of the root node, ROOT flag set
+	blake3_chunk_output(hasher, 0, cv);
+	for(int i = hasher->cv_stack_len - 1; i >= 0; i--){
+		blake3_parent(&hasher->cv_stack[i * BLAKE3_OUT_LEN], cv, (i == 0) ? root_flag : 0, cv);
+	}
+	memcpy(out, cv, BLAKE3_OUT_LEN);
+}
+
+/**
+ * @brief Joins the chaining values of consecutive subtrees, left-balanced like the BLAKE3 tree
+ * @param cvs Chaining values
+ * @param count Number of chaining values
+ * @param flags Extra flags of the top node
+ * @param out Chaining value, BLAKE3_OUT_LEN bytes
+ */
+static void blake3_join(const uint8_t *cvs, size_t count, uint8_t flags, uint8_t *out){
+	uint8_t children[2 * BLAKE3_OUT_LEN];
+	size_t left = 1;
+
+	if(count == 1){
+		memcpy(out, cvs, BLAKE3_OUT_LEN);
+		return;
+	}
+	// The left side takes the largest power of two below the count
+	while(2 * left < count){
+		left *= 2;
+	}
+	blake3_join(cvs, left, 0, children);
+	blake3_join(&cvs[left * BLAKE3_OUT_LEN], count - left, 0, &children[BLAKE3_OUT_LEN]);
+	blake3_parent(children, &children[BLAKE3_OUT_LEN], flags, out);
+}
+
+/** @} */
@@ -0,0 +1,129 @@
+/**
+*************************************************************************
+* @file       blake3.h
+* @brief      Header file for the blake3.h module.
+* @details    This file contains declarations and prototypes for the
+*             blake3.h module, a portable BLAKE3 hash with the 32-byte
+*             output. Besides the whole-input hasher, it hashes a subtree
+*             of chunks on its own and joins subtree chaining values into
+*             the root, so the image can be hashed in parallel and one
+*             range can be checked without the rest of the image. The
+*             module has no ESP-IDF dependency and also builds on the host.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_BLAKE3_H_
+#define MAIN_API_BLAKE3_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+
+/* Public Macros -------------------------------------------------------------*/
+
+/**
+ * @brief Length of the hash and of a chaining value
+ */
+#define BLAKE3_OUT_LEN 32
+
+/**
+ * @brief Length of a block and of a chunk, the leaf of the tree
+ */
+#define BLAKE3_BLOCK_LEN 64
+#define BLAKE3_CHUNK_LEN 1024
+
+/**
+ * @brief Depth of the chaining value stack, enough for 2^54 chunks
+ */
+#define BLAKE3_MAX_DEPTH 54
+
+/* Public Types --------------------------------------------------------------*/
+
+/**
+ * @brief Incremental hasher of a whole input or of a subtree
+ */
+typedef struct blake3_hasher {
+    uint32_t cv[8];                  /**< Chaining value of the current chunk */
+    uint64_t chunk_counter;          /**< Index of the current chunk in the whole input */
+    uint64_t chunks_done;            /**< Chunks finished since the start, drives the merges */
+    uint8_t block[BLAKE3_BLOCK_LEN]; /**< Block being filled */
+    uint8_t block_len;               /**< Bytes in the block */
+    uint8_t blocks_compressed;       /**< Blocks of the current chunk already compressed */
+    uint8_t cv_stack_len;            /**< Chaining values waiting for their right sibling */
+    uint8_t cv_stack[(BLAKE3_MAX_DEPTH + 1) * BLAKE3_OUT_LEN]; /**< Chaining value stack */
+} blake3_hasher_t;
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup blake3.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Starts a hasher of a whole input
+ * @param hasher Hasher
+ */
+void blake3_hasher_init(blake3_hasher_t *hasher);
+
+/**
+ * @brief Starts a hasher of a subtree
+ * @param hasher Hasher
+ * @param chunk_counter Index of the first chunk of the subtree, a multiple of its size in chunks
+ * @note A subtree holds a power of two chunks, only the last one of the input may hold fewer.
+ */
+void blake3_hasher_init_subtree(blake3_hasher_t *hasher, uint64_t chunk_counter);
+
+/**
+ * @brief Adds data to the hasher
+ * @param hasher Hasher
+ * @param input Data
+ * @param len Length of the data
+ */
+void blake3_hasher_update(blake3_hasher_t *hasher, const void *input, size_t len);
+
+/**
+ * @brief Gets the hash of the whole input
+ * @param hasher Hasher started with blake3_hasher_init(), left unchanged
+ * @param out Hash, BLAKE3_OUT_LEN bytes
+ */
+void blake3_hasher_finalize(const blake3_hasher_t *hasher, uint8_t *out);
+
+/**
+ * @brief Gets the chaining value of a subtree
+ * @param hasher Hasher started with blake3_hasher_init_subtree(), left unchanged
+ * @param cv Chaining value, BLAKE3_OUT_LEN bytes
+ */
+void blake3_hasher_finalize_subtree(const blake3_hasher_t *hasher, uint8_t *cv);
+
+/**
+ * @brief Hashes a whole input at once
+ * @param input Data
+ * @param len Length of the data
+ * @param out Hash, BLAKE3_OUT_LEN bytes
+ */
+void blake3_hash(const void *input, size_t len, uint8_t *out);
+
+/**
+ * @brief Joins the chaining values of consecutive subtrees into the hash of the whole input
+ * @param cvs Chaining values, BLAKE3_OUT_LEN bytes each, in input order
+ * @param count Number of subtrees, at least 2
+ * @param out Hash, BLAKE3_OUT_LEN bytes
+ * @note All subtrees hold the same power of two chunks, only the last one may hold fewer.
+ *       A single subtree is the whole input and must be hashed with blake3_hasher_init().
+ */
+void blake3_join_subtrees(const uint8_t *cvs, size_t count, uint8_t *out);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_BLAKE3_H_ */
@@ -0,0 +1,729 @@
+/**
+*************************************************************************
+* @file       coap_client.c
+* @brief      Source file for the coap_client.c module.
+* @details    This file contains the implementation of functions for
+*             the coap_client.c module. Only what the register-device
+*             exchange needs is implemented: a confirmable POST with
+*             Uri-Path, Content-Format and Accept options, answered by a
+*             piggybacked or a separate response that fits one datagram.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// ESP Includes
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+
+// Application Includes
+#include "api/coap_client.h"
+#include "api/metrics.h"
+
+#if COAP_TRANSPORT_ENABLED
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
+
+#if !defined(MBEDTLS_SSL_PROTO_DTLS)
+#error "The CoAP transport needs CONFIG_MBEDTLS_SSL_PROTO_DTLS"
+#endif
+
+/* Definitions ----------------------------------------------------------*/
+
+// Message types
+#define COAP_TYPE_CON 0
+#define COAP_TYPE_NON 1
+#define COAP_TYPE_ACK 2
+#define COAP_TYPE_RST 3
+
+// Codes
+#define COAP_CODE_EMPTY 0x00
+#define COAP_CODE_POST  0x02
+
+// Options
+#define COAP_OPTION_URI_PATH       11
+#define COAP_OPTION_CONTENT_FORMAT 12
+#define COAP_OPTION_ACCEPT         17
+#define COAP_OPTION_BLOCK2         23
+
+// Content format application/json
+#define COAP_FORMAT_JSON 50
+
+// Length of the tokens
+#define COAP_TOKEN_LEN 4
+
+// IPv4 and UDP headers of each datagram
+#define COAP_IP_UDP_OVERHEAD 28
+
+/* Typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief Parsed CoAP message
+ */
+typedef struct coap_message {
+    uint8_t type;           /**< Message type */
+    uint8_t code;           /**< Code */
+    uint16_t mid;           /**< Message ID */
+    uint8_t token[8];       /**< Token */
+    uint8_t tkl;            /**< Token length */
+    bool more;              /**< Block2 option asks for more blocks */
+    const uint8_t *payload; /**< Payload */
+    size_t payload_len;     /**< Payload length */
+} coap_message_t;
+
+/**
+ * @brief Retransmission timer used by the DTLS handshake
+ */
+typedef struct coap_client_timer {
+    int64_t start;   /**< Time the timer was set */
+    uint32_t int_ms; /**< Intermediate delay */
+    uint32_t fin_ms; /**< Final delay, 0 when cancelled */
+} coap_client_timer_t;
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "coap_client";
+
+/**
+ * @brief DTLS configuration, built once
+ */
+static bool g_configured = false;
+static mbedtls_ssl_config g_conf;
+static mbedtls_entropy_context g_entropy;
+static mbedtls_ctr_drbg_context g_ctr_drbg;
+static mbedtls_x509_crt g_ca_cert;
+static mbedtls_x509_crt g_client_cert;
+static mbedtls_pk_context g_client_key;
+
+/**
+ * @brief DTLS association and the session saved for its resumption
+ */
+static bool g_connected = false;
+static mbedtls_ssl_context g_ssl;
+static mbedtls_net_context g_net;
+static coap_client_timer_t g_timer;
+static mbedtls_ssl_session g_session;
+static bool g_session_valid = false;
+
+/**
+ * @brief Message ID of the next request
+ */
+static uint16_t g_mid = 0;
+
+/**
+ * @brief Datagram buffers, kept off the stack of the calling task
+ */
+static uint8_t g_tx[COAP_MESSAGE_LEN];
+static uint8_t g_rx[COAP_MESSAGE_LEN];
+
+/**
+ * @brief Statistics of the exchange in progress, counted by the BIO
+ */
+static coap_client_stats_t *g_stats = NULL;
+static bool g_last_was_received = true;
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Builds the DTLS configuration
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t coap_client_configure(void);
+
+/**
+ * @brief Sets up the DTLS association, resuming the saved session when there is one
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t coap_client_connect(void);
+
+/**
+ * @brief Sends the request and waits for its response, retransmitting it on timeout
+ * @param request Request
+ * @param request_len Length of the request
+ * @param mid Message ID of the request
+ * @param token Token of the request
+ * @param response Parsed response
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t coap_client_exchange(const uint8_t *request, size_t request_len, uint16_t mid, const uint8_t *token, coap_message_t *response);
+
+/**
+ * @brief Builds a confirmable POST
+ * @param mid Message ID
+ * @param token Token
+ * @param path Path of the resource
+ * @param payload Payload
+ * @return Length of the message, or 0 if it does not fit
+ */
+static size_t coap_client_build(uint16_t mid, const uint8_t *token, const char *path, const char *payload);
+
+/**
+ * @brief Appends an option to a message
+ * @param pos Position in g_tx, updated
+ * @param delta Difference to the previous option number
+ * @param value Value of the option
+ * @param len Length of the value
+ * @return true if the option fits
+ */
+static bool coap_client_put_option(size_t *pos, uint16_t delta, const uint8_t *value, size_t len);
+
+/**
+ * @brief Parses a message
+ * @param data Message
+ * @param len Length of the message
+ * @param msg Parsed message
+ * @return true if the message is well formed
+ */
+static bool coap_client_parse(const uint8_t *data, size_t len, coap_message_t *msg);
+
+/**
+ * @brief Reads a datagram from the association
+ * @param timeout_ms Time to wait
+ * @return Number of bytes read, 0 on timeout, or a negative mbedTLS error
+ */
+static int coap_client_read(uint32_t timeout_ms);
+
+/**
+ * @brief BIO functions counting the datagrams of the exchange
+ */
+static int coap_client_bio_send(void *ctx, const unsigned char *buf, size_t len);
+static int coap_client_bio_recv(void *ctx, unsigned char *buf, size_t len, uint32_t timeout);
+
+/**
+ * @brief Timer functions of the DTLS retransmissions
+ */
+static void coap_client_timer_set(void *data, uint32_t int_ms, uint32_t fin_ms);
+static int coap_client_timer_get(void *data);
+#endif
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup coap_client.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Sends a confirmable POST and waits for its response
+ * @param path Path of the resource, segments separated by '/'
+ * @param payload JSON payload
+ * @param response Buffer where the response payload will be stored, null terminated
+ * @param size Size of the buffer
+ * @param len Length of the response payload
+ * @param stats Cost of the exchange
+ * @return ESP_OK on a 2.xx response, or an error code on failure
+ */
+esp_err_t coap_client_post(const char *path, const char *payload, char *response, size_t size, size_t *len, coap_client_stats_t *stats){
+#if COAP_TRANSPORT_ENABLED
+	uint8_t token[COAP_TOKEN_LEN];
+	coap_message_t msg;
+	int64_t start = esp_timer_get_time();
+	esp_err_t err;
+
+	memset(stats, 0x00, sizeof(coap_client_stats_t));
+	g_stats = stats;
+	g_last_was_received = true;
+	*len = 0;
+
+	if(!g_connected && (err = coap_client_connect()) != ESP_OK){
+		g_stats = NULL;
+		return err;
+	}
+	stats->handshake_trips = stats->round_trips;
+
+	esp_fill_random(token, sizeof(token));
+	uint16_t mid = g_mid++;
+	size_t request_len = coap_client_build(mid, token, path, payload);
+	if(request_len == 0){
+		ESP_LOGE(TAG, "Request does not fit in %d bytes", COAP_MESSAGE_LEN);
+		g_stats = NULL;
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	err = coap_client_exchange(g_tx, request_len, mid, token, &msg);
+	if(err != ESP_OK && stats->handshake_trips == 0){
+		// The kept association may be gone on the server, set it up again once
+		ESP_LOGI(TAG, "Kept association failed, reconnecting");
+		coap_client_close();
+		err = coap_client_connect();
+		if(err == ESP_OK){
+			stats->handshake_trips = stats->round_trips;
+			err = coap_client_exchange(g_tx, request_len, mid, token, &msg);
+		}
+	}
+	stats->latency_ms = (esp_timer_get_time() - start) / 1000;
+	g_stats = NULL;
+	if(err != ESP_OK){
+		coap_client_close();
+		return err;
+	}
+
+	stats->code = msg.code;
+	if(msg.more){
+		ESP_LOGE(TAG, "Block-wise responses are not supported");
+		return ESP_ERR_INVALID_SIZE;
+	}
+	if((msg.code >> 5) != 2){
+		ESP_LOGE(TAG, "Response code %d.%02d", msg.code >> 5, msg.code & 0x1F);
+		return ESP_FAIL;
+	}
+	*len = (msg.payload_len < size - 1) ? msg.payload_len : size - 1;
+	memcpy(response, msg.payload, *len);
+	response[*len] = '\0';
+
+	return ESP_OK;
+#else
+	return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * @brief Closes the DTLS association, keeping the session for a later resumption
+ */
+void coap_client_close(void){
+#if COAP_TRANSPORT_ENABLED
+	if(g_connected){
+		mbedtls_ssl_close_notify(&g_ssl);
+		mbedtls_ssl_free(&g_ssl);
+		mbedtls_net_free(&g_net);
+		g_connected = false;
+	}
+#endif
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup coap_client.c Private Functions
+ * @{
+ */
+
+#if COAP_TRANSPORT_ENABLED
+/**
+ * @brief Builds the DTLS configuration
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t coap_client_configure(void){
+	int ret;
+
+	mbedtls_ssl_config_init(&g_conf);
+	mbedtls_entropy_init(&g_entropy);
+	mbedtls_ctr_drbg_init(&g_ctr_drbg);
+	mbedtls_x509_crt_init(&g_ca_cert);
+	mbedtls_x509_crt_init(&g_client_cert);
+	mbedtls_pk_init(&g_client_key);
+	mbedtls_ssl_session_init(&g_session);
+
+	if((ret = mbedtls_ctr_drbg_seed(&g_ctr_drbg, mbedtls_entropy_func, &g_entropy, NULL, 0)) != 0 ||
+	   (ret = mbedtls_x509_crt_parse(&g_ca_cert, (const unsigned char *)ca_cert_pem_start, ca_cert_pem_end - ca_cert_pem_start)) != 0 ||
+	   (ret = mbedtls_x509_crt_parse(&g_client_cert, (const unsigned char *)client_cert_pem_start, client_cert_pem_end - client_cert_pem_start)) != 0 ||
+	   (ret = mbedtls_pk_parse_key(&g_client_key, (const unsigned char *)client_key_pem_start, client_key_pem_end - client_key_pem_start,
+	                               NULL, 0, mbedtls_ctr_drbg_random, &g_ctr_drbg)) != 0 ||
+	   (ret = mbedtls_ssl_config_defaults(&g_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_DATAGRAM, MBEDTLS_SSL_PRESET_DEFAULT)) != 0 ||
+	   (ret = mbedtls_ssl_conf_own_cert(&g_conf, &g_client_cert, &g_client_key)) != 0){
+		ESP_LOGE(TAG, "DTLS configuration failed: -0x%04x", -ret);
+		return ESP_FAIL;
+	}
+
+	// Same mutual authentication as the HTTPS path
+	mbedtls_ssl_conf_authmode(&g_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+	mbedtls_ssl_conf_ca_chain(&g_conf, &g_ca_cert, NULL);
+	mbedtls_ssl_conf_rng(&g_conf, mbedtls_ctr_drbg_random, &g_ctr_drbg);
+	mbedtls_ssl_conf_handshake_timeout(&g_conf, COAP_ACK_TIMEOUT_MS, COAP_HANDSHAKE_TIMEOUT_MAX_MS);
+#if defined(MBEDTLS_SSL_DTLS_CONNECTION_ID)
+	// The client asks for no CID of its own, it only uses the one the server gives
+	mbedtls_ssl_conf_cid(&g_conf, 0, MBEDTLS_SSL_UNEXPECTED_CID_IGNORE);
+#endif
+
+	g_configured = true;
+	return ESP_OK;
+}
+
+/**
+ * @brief Sets up the DTLS association, resuming the saved session when there is one
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t coap_client_connect(void){
+	int ret;
+
+	if(!g_configured && coap_client_configure() != ESP_OK){
+		return ESP_FAIL;
+	}
+
+	mbedtls_net_init(&g_net);
+	mbedtls_ssl_init(&g_ssl);
+	if((ret = mbedtls_net_connect(&g_net, COAP_SERVER_HOST, COAP_SERVER_PORT, MBEDTLS_NET_PROTO_UDP)) != 0 ||
+	   (ret = mbedtls_ssl_setup(&g_ssl, &g_conf)) != 0){
+		ESP_LOGE(TAG, "DTLS setup failed: -0x%04x", -ret);
+		mbedtls_ssl_free(&g_ssl);
+		mbedtls_net_free(&g_net);
+		return ESP_FAIL;
+	}
+	mbedtls_ssl_set_hostname(&g_ssl, NULL);
+	mbedtls_ssl_set_mtu(&g_ssl, COAP_MESSAGE_LEN);
+	mbedtls_ssl_set_bio(&g_ssl, &g_net, coap_client_bio_send, NULL, coap_client_bio_recv);
+	mbedtls_ssl_set_timer_cb(&g_ssl, &g_timer, coap_client_timer_set, coap_client_timer_get);
+#if defined(MBEDTLS_SSL_DTLS_CONNECTION_ID)
+	mbedtls_ssl_set_cid(&g_ssl, MBEDTLS_SSL_CID_ENABLED, NULL, 0);
+#endif
+	if(g_session_valid){
+		mbedtls_ssl_set_session(&g_ssl, &g_session);
+	}
+
+	while((ret = mbedtls_ssl_handshake(&g_ssl)) != 0){
+		if(ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE){
+			ESP_LOGE(TAG, "DTLS handshake failed: -0x%04x", -ret);
+			mbedtls_ssl_free(&g_ssl);
+			mbedtls_net_free(&g_net);
+			// A rejected resumption is not tried again
+			g_session_valid = false;
+			return ESP_FAIL;
+		}
+	}
+
+#if defined(MBEDTLS_SSL_DTLS_CONNECTION_ID)
+	int cid_enabled = MBEDTLS_SSL_CID_DISABLED;
+	mbedtls_ssl_get_peer_cid(&g_ssl, &cid_enabled, NULL, NULL);
+	ESP_LOGI(TAG, "DTLS connection ID %s", (cid_enabled == MBEDTLS_SSL_CID_ENABLED) ? "in use" : "refused by the server");
+#endif
+
+	// Keep the session, the next association resumes it in fewer round trips
+	mbedtls_ssl_session_free(&g_session);
+	mbedtls_ssl_session_init(&g_session);
+	g_session_valid = (mbedtls_ssl_get_session(&g_ssl, &g_session) == 0);
+	g_connected = true;
+	metrics_add(METRICS_TLS_HANDSHAKES, 1);
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Sends the request and waits for its response, retransmitting it on timeout
+ * @param request Request
+ * @param request_len Length of the request
+ * @param mid Message ID of the request
+ * @param token Token of the request
+ * @param response Parsed response
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t coap_client_exchange(const uint8_t *request, size_t request_len, uint16_t mid, const uint8_t *token, coap_message_t *response){
+	uint32_t timeout_ms = COAP_ACK_TIMEOUT_MS + esp_random() % (COAP_ACK_TIMEOUT_MS / 2);
+	bool acked = false;
+
+	for(int attempt = 0; attempt <= COAP_MAX_RETRANSMIT; attempt++){
+		if(!acked){
+			int ret = mbedtls_ssl_write(&g_ssl, request, request_len);
+			if(ret < 0){
+				ESP_LOGE(TAG, "DTLS write failed: -0x%04x", -ret);
+				return ESP_FAIL;
+			}
+		}
+
+		// Once the empty ACK came, the separate response only has to be waited for
+		int64_t deadline = esp_timer_get_time() + (int64_t)(acked ? COAP_RESPONSE_TIMEOUT_MS : timeout_ms) * 1000;
+		int64_t now;
+		while((now = esp_timer_get_time()) < deadline){
+			int len = coap_client_read((deadline - now) / 1000 + 1);
+			if(len < 0){
+				return ESP_FAIL;
+			}
+			if(len == 0 || !coap_client_parse(g_rx, len, response)){
+				continue;
+			}
+
+			bool same_token = (response->tkl == COAP_TOKEN_LEN && memcmp(response->token, token, COAP_TOKEN_LEN) == 0);
+			if(response->type == COAP_TYPE_RST && response->mid == mid){
+				ESP_LOGE(TAG, "Request reset by the server");
+				return ESP_FAIL;
+			}
+			if(response->type == COAP_TYPE_ACK && response->mid == mid && response->code == COAP_CODE_EMPTY){
+				acked = true;
+				continue;
+			}
+			if(response->type == COAP_TYPE_ACK && response->mid == mid && same_token){
+				return ESP_OK;
+			}
+			if((response->type == COAP_TYPE_CON || response->type == COAP_TYPE_NON) && same_token){
+				// A separate response is confirmed with an empty ACK of its own message ID
+				if(response->type == COAP_TYPE_CON){
+					uint8_t ack[4] = {0x40 | (COAP_TYPE_ACK << 4), COAP_CODE_EMPTY, response->mid >> 8, response->mid & 0xFF};
+					mbedtls_ssl_write(&g_ssl, ack, sizeof(ack));
+				}
+				return ESP_OK;
+			}
+		}
+		if(acked){
+			break;
+		}
+		timeout_ms *= 2;
+		ESP_LOGI(TAG, "Retransmitting the request, attempt %d", attempt + 1);
+	}
+
+	ESP_LOGE(TAG, "No response from the server");
+	return ESP_ERR_TIMEOUT;
+}
+
+/**
+ * @brief Builds a confirmable POST
+ * @param mid Message ID
+ * @param token Token
+ * @param path Path of the resource
+ * @param payload Payload
+ * @return Length of the message, or 0 if it does not fit
+ */
+static size_t coap_client_build(uint16_t mid, const uint8_t *token, const char *path, const char *payload){
+	uint8_t format = COAP_FORMAT_JSON;
+	uint16_t number = 0;
+	size_t pos = 0;
+
+	g_tx[pos++] = 0x40 | (COAP_TYPE_CON << 4) | COAP_TOKEN_LEN;
+	g_tx[pos++] = COAP_CODE_POST;
+	g_tx[pos++] = mid >> 8;
+	g_tx[pos++] = mid & 0xFF;
+	memcpy(&g_tx[pos], token, COAP_TOKEN_LEN);
+	pos += COAP_TOKEN_LEN;
+
+	// One Uri-Path option per segment of the path
+	while(*path != '\0'){
+		const char *end = strchr(path, '/');
+		size_t len = end ? (size_t)(end - path) : strlen(path);
+		if(len > 0){
+			if(!coap_client_put_option(&pos, COAP_OPTION_URI_PATH - number, (const uint8_t *)path, len)){
+				return 0;
+			}
+			number = COAP_OPTION_URI_PATH;
+		}
+		path += len;
+		if(*path == '/'){
+			path++;
+		}
+	}
+	if(!coap_client_put_option(&pos, COAP_OPTION_CONTENT_FORMAT - number, &format, 1) ||
+	   !coap_client_put_option(&pos, COAP_OPTION_ACCEPT - COAP_OPTION_CONTENT_FORMAT, &format, 1)){
+		return 0;
+	}
+
+	size_t payload_len = strlen(payload);
+	if(payload_len > 0){
+		if(pos + 1 + payload_len > sizeof(g_tx)){
+			return 0;
+		}
+		g_tx[pos++] = 0xFF;
+		memcpy(&g_tx[pos], payload, payload_len);
+		pos += payload_len;
+	}
+	return pos;
+}
+
+/**
+ * @brief Appends an option to a message
+ * @param pos Position in g_tx, updated
+ * @param delta Difference to the previous option number
+ * @param value Value of the option
+ * @param len Length of the value
+ * @return true if the option fits
+ */
+static bool coap_client_put_option(size_t *pos, uint16_t delta, const uint8_t *value, size_t len){
+	uint8_t ext[4];
+	size_t ext_len = 0;
+	uint8_t delta_nibble, len_nibble;
+
+	// Values from 13 take one extra byte, from 269 two
+	if(delta < 13){
+		delta_nibble = delta;
+	}
+	else if(delta < 269){
+		delta_nibble = 13;
+		ext[ext_len++] = delta - 13;
+	}
+	else{
+		delta_nibble = 14;
+		ext[ext_len++] = (delta - 269) >> 8;
+		ext[ext_len++] = (delta - 269) & 0xFF;
+	}
+	if(len < 13){
+		len_nibble = len;
+	}
+	else if(len < 269){
+		len_nibble = 13;
+		ext[ext_len++] = len - 13;
+	}
+	else{
+		len_nibble = 14;
+		ext[ext_len++] = (len - 269) >> 8;
+		ext[ext_len++] = (len - 269) & 0xFF;
+	}
+
+	if(*pos + 1 + ext_len + len > sizeof(g_tx)){
+		return false;
+	}
+	g_tx[(*pos)++] = (delta_nibble << 4) | len_nibble;
+	memcpy(&g_tx[*pos], ext, ext_len);
+	*pos += ext_len;
+	memcpy(&g_tx[*pos], value, len);
+	*pos += len;
+	return true;
+}
+
+/**
+ * @brief Parses a message
+ * @param data Message
+ * @param len Length of the message
+ * @param msg Parsed message
+ * @return true if the message is well formed
+ */
+static bool coap_client_parse(const uint8_t *data, size_t len, coap_message_t *msg){
+	uint16_t number = 0;
+	size_t pos = 4;
+
+	memset(msg, 0x00, sizeof(coap_message_t));
+	if(len < 4 || (data[0] >> 6) != 1){
+		return false;
+	}
+	msg->type = (data[0] >> 4) & 0x03;
+	msg->tkl = data[0] & 0x0F;
+	msg->code = data[1];
+	msg->mid = (data[2] << 8) | data[3];
+	if(msg->tkl > 8 || pos + msg->tkl > len){
+		return false;
+	}
+	memcpy(msg->token, &data[pos], msg->tkl);
+	pos += msg->tkl;
+
+	while(pos < len && data[pos] != 0xFF){
+		uint16_t fields[2] = {data[pos] >> 4, data[pos] & 0x0F};
+		pos++;
+		for(int i = 0; i < 2; i++){
+			if(fields[i] == 13){
+				if(pos + 1 > len){
+					return false;
+				}
+				fields[i] = data[pos++] + 13;
+			}
+			else if(fields[i] == 14){
+				if(pos + 2 > len){
+					return false;
+				}
+				fields[i] = ((data[pos] << 8) | data[pos + 1]) + 269;
+				pos += 2;
+			}
+			else if(fields[i] == 15){
+				return false;
+			}
+		}
+		number += fields[0];
+		if(pos + fields[1] > len){
+			return false;
+		}
+
+		// Block2: NUM | M | SZX, M is bit 3 of the last byte
+		if(number == COAP_OPTION_BLOCK2 && fields[1] > 0){
+			msg->more = (data[pos + fields[1] - 1] & 0x08) != 0;
+		}
+		pos += fields[1];
+	}
+	if(pos < len){
+		msg->payload = &data[pos + 1];
+		msg->payload_len = len - pos - 1;
+	}
+	return true;
+}
+
+/**
+ * @brief Reads a datagram from the association
+ * @param timeout_ms Time to wait
+ * @return Number of bytes read, 0 on timeout, or a negative mbedTLS error
+ */
+static int coap_client_read(uint32_t timeout_ms){
+	mbedtls_ssl_conf_read_timeout(&g_conf, timeout_ms);
+	int ret = mbedtls_ssl_read(&g_ssl, g_rx, sizeof(g_rx));
+	if(ret == MBEDTLS_ERR_SSL_TIMEOUT || ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE){
+		return 0;
+	}
+	if(ret < 0){
+		ESP_LOGE(TAG, "DTLS read failed: -0x%04x", -ret);
+	}
+	return ret;
+}
+
+/**
+ * @brief BIO function sending a datagram
+ */
+static int coap_client_bio_send(void *ctx, const unsigned char *buf, size_t len){
+	int ret = mbedtls_net_send(ctx, buf, len);
+	if(ret > 0 && g_stats != NULL){
+		// A flight sent after an answer is a new round trip
+		if(g_last_was_received){
+			g_stats->round_trips++;
+			g_last_was_received = false;
+		}
+		g_stats->datagrams_sent++;
+		g_stats->bytes_sent += ret + COAP_IP_UDP_OVERHEAD;
+	}
+	return ret;
+}
+
+/**
+ * @brief BIO function receiving a datagram
+ */
+static int coap_client_bio_recv(void *ctx, unsigned char *buf, size_t len, uint32_t timeout){
+	int ret = mbedtls_net_recv_timeout(ctx, buf, len, timeout);
+	if(ret > 0 && g_stats != NULL){
+		g_last_was_received = true;
+		g_stats->datagrams_received++;
+		g_stats->bytes_received += ret + COAP_IP_UDP_OVERHEAD;
+	}
+	return ret;
+}
+
+/**
+ * @brief Sets the retransmission timer of the handshake
+ */
+static void coap_client_timer_set(void *data, uint32_t int_ms, uint32_t fin_ms){
+	coap_client_timer_t *timer = data;
+	timer->start = esp_timer_get_time();
+	timer->int_ms = int_ms;
+	timer->fin_ms = fin_ms;
+}
+
+/**
+ * @brief Gets the state of the retransmission timer: -1 cancelled, 0 running, 1 intermediate, 2 final
+ */
+static int coap_client_timer_get(void *data){
+	coap_client_timer_t *timer = data;
+	if(timer->fin_ms == 0){
+		return -1;
+	}
+	int64_t elapsed = (esp_timer_get_time() - timer->start) / 1000;
+	if(elapsed >= timer->fin_ms){
+		return 2;
+	}
+	if(elapsed >= timer->int_ms){
+		return 1;
+	}
+	return 0;
+}
+#endif
+
+/** @} */
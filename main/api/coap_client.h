@@ -0,0 +1,76 @@
+/**
+*************************************************************************
+* @file       coap_client.h
+* @brief      Header file for the coap_client.h module.
+* @details    This file contains declarations and prototypes for the
+*             coap_client.h module, a CoAP client over DTLS used for the
+*             register-device exchange. The DTLS association is kept
+*             between requests, uses a connection ID so it survives an
+*             address change, and is resumed from the saved session when
+*             it has to be set up again.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_COAP_CLIENT_H_
+#define MAIN_API_COAP_CLIENT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/* Public Types --------------------------------------------------------------*/
+
+/**
+ * @brief Cost of the last exchange, handshake included
+ */
+typedef struct coap_client_stats {
+    uint32_t latency_ms;        /**< Time from the request to the response */
+    uint16_t round_trips;       /**< Flights sent that waited for an answer */
+    uint16_t handshake_trips;   /**< Round trips spent in the DTLS handshake, 0 on a kept association */
+    uint16_t datagrams_sent;    /**< Datagrams sent */
+    uint16_t datagrams_received;/**< Datagrams received */
+    uint32_t bytes_sent;        /**< Bytes sent at the IP layer, IP and UDP headers included */
+    uint32_t bytes_received;    /**< Bytes received at the IP layer, IP and UDP headers included */
+    uint8_t code;               /**< CoAP response code, class in the upper 3 bits */
+} coap_client_stats_t;
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup coap_client.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Sends a confirmable POST and waits for its response
+ * @param path Path of the resource, segments separated by '/'
+ * @param payload JSON payload
+ * @param response Buffer where the response payload will be stored, null terminated
+ * @param size Size of the buffer
+ * @param len Length of the response payload
+ * @param stats Cost of the exchange
+ * @return ESP_OK on a 2.xx response, or an error code on failure
+ */
+esp_err_t coap_client_post(const char *path, const char *payload, char *response, size_t size, size_t *len, coap_client_stats_t *stats);
+
+/**
+ * @brief Closes the DTLS association, keeping the session for a later resumption
+ */
+void coap_client_close(void);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_COAP_CLIENT_H_ */
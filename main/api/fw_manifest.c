@@ -0,0 +1,337 @@
+/**
+*************************************************************************
+* @file       fw_manifest.c
+* @brief      Source file for the fw_manifest.c module.
+* @details    This file contains the implementation of functions for 
+*             the fw_manifest.c module. The manifest is a list of
+*             SHA-256 leaf hashes, one per chunk of the image published
+*             on IPFS, followed by the leaf of the decrypted image, whose
+*             Merkle root is the published hash. Chunk leaves are
+*             SHA-256(0x00 || chunk), the image leaf is
+*             SHA-256(0x02 || SHA-256(decrypted image)) and inner nodes
+*             are SHA-256(0x01 || left || right); an odd node is promoted
+*             to the next level unchanged.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+// Include Systems configuration
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ESP Includes
+#include "esp_err.h"
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+
+// Application Includes
+#include "api/fw_update.h"
+#include "api/fw_manifest.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+/**
+ * @brief Domain separation prefixes for leaves and inner nodes
+ */
+#define FW_MANIFEST_LEAF_PREFIX 0x00
+#define FW_MANIFEST_NODE_PREFIX 0x01
+#define FW_MANIFEST_IMAGE_PREFIX 0x02
+
+/* Typedefs --------------------------------------------------------------*/
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "fw_manifest";
+
+/**
+ * @brief Expected Merkle root of the current download
+ */
+static uint8_t g_expected_root[FW_MANIFEST_HASH_SIZE];
+
+/**
+ * @brief Leaf hashes of the chunks and leaf of the decrypted image of the current download
+ */
+static uint8_t *g_leaves = NULL;
+static uint8_t g_image_leaf[FW_MANIFEST_HASH_SIZE];
+
+/**
+ * @brief Chunk size and number of chunks of the current download
+ */
+static uint32_t g_chunk_size = 0;
+static uint32_t g_chunk_count = 0;
+
+/**
+ * @brief Flags for the manifest state
+ */
+static bool g_expected = false;
+static bool g_active = false;
+
+/**
+ * @brief Number of chunk verification failures since boot
+ */
+static uint32_t g_failure_count = 0;
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Computes the Merkle root of a list of leaf hashes.
+ * @param leaves Concatenated leaf hashes
+ * @param count Number of leaves
+ * @param root Buffer where the root will be stored
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+static fw_update_ret_e fw_manifest_compute_root(const uint8_t *leaves, uint32_t count, uint8_t *root);
+
+/**
+ * @brief Computes a SHA-256 hash of a domain separation prefix followed by data.
+ * @param prefix Domain separation prefix
+ * @param data Data to be hashed
+ * @param len Length of the data
+ * @param hash Buffer where the hash will be stored, FW_MANIFEST_HASH_SIZE bytes
+ */
+static void fw_manifest_hash(uint8_t prefix, const uint8_t *data, size_t len, uint8_t *hash);
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup fw_manifest.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Sets the expected Merkle root and chunk size of the next download.
+ * @param root Merkle root published in the metadata, FW_MANIFEST_HASH_SIZE bytes
+ * @param chunk_size Size of each chunk in bytes
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+fw_update_ret_e fw_manifest_expect(const uint8_t *root, uint32_t chunk_size){
+	fw_manifest_release();
+	
+	if(root == NULL || chunk_size == 0 || chunk_size > FW_MANIFEST_MAX_CHUNK_SIZE){
+		ESP_LOGE(TAG, "Invalid manifest parameters");
+		return FW_UPDATE_HASH_ERROR;
+	}
+	memcpy(g_expected_root, root, FW_MANIFEST_HASH_SIZE);
+	g_chunk_size = chunk_size;
+	g_expected = true;
+	
+	return FW_UPDATE_OK;
+}
+
+/**
+ * @brief Loads the leaf hashes of the manifest and checks them against the expected root.
+ * @param leaves Concatenated SHA-256 leaf hashes, one per chunk, followed by the leaf of the decrypted image
+ * @param len Length of the leaves buffer in bytes
+ * @return fw_update_ret_e FW_UPDATE_OK on success, FW_UPDATE_HASH_ERROR if the root does not match
+ */
+fw_update_ret_e fw_manifest_load(const uint8_t *leaves, size_t len){
+	uint8_t root[FW_MANIFEST_HASH_SIZE];
+	size_t count = len / FW_MANIFEST_HASH_SIZE;
+	
+	// At least one chunk leaf and the image leaf
+	if(!g_expected || (len % FW_MANIFEST_HASH_SIZE) != 0 || count < 2 || count > (size_t)FW_MANIFEST_MAX_CHUNKS + 1){
+		ESP_LOGE(TAG, "Invalid manifest, len %u", (unsigned)len);
+		return FW_UPDATE_HASH_ERROR;
+	}
+	
+	fw_update_ret_e ret = fw_manifest_compute_root(leaves, count, root);
+	if(ret != FW_UPDATE_OK){
+		return ret;
+	}
+	if(memcmp(root, g_expected_root, FW_MANIFEST_HASH_SIZE) != 0){
+		ESP_LOGE(TAG, "Manifest root mismatch");
+		return FW_UPDATE_HASH_ERROR;
+	}
+	
+	g_chunk_count = count - 1;
+	g_leaves = malloc(g_chunk_count * FW_MANIFEST_HASH_SIZE);
+	if(g_leaves == NULL){
+		ESP_LOGE(TAG, "Failed to allocate memory for the manifest");
+		g_chunk_count = 0;
+		return FW_UPDATE_HASH_ERROR;
+	}
+	memcpy(g_leaves, leaves, g_chunk_count * FW_MANIFEST_HASH_SIZE);
+	memcpy(g_image_leaf, &leaves[g_chunk_count * FW_MANIFEST_HASH_SIZE], FW_MANIFEST_HASH_SIZE);
+	g_active = true;
+	
+	ESP_LOGI(TAG, "Manifest loaded: %lu chunks of %lu bytes", (unsigned long)g_chunk_count, (unsigned long)g_chunk_size);
+	return FW_UPDATE_OK;
+}
+
+/**
+ * @brief Verifies a downloaded chunk against its leaf hash.
+ * @param index Index of the chunk
+ * @param data Chunk data
+ * @param len Length of the chunk, only the last chunk may be shorter than the chunk size
+ * @return true if the chunk matches its leaf hash
+ */
+bool fw_manifest_verify_chunk(uint32_t index, const uint8_t *data, size_t len){
+	uint8_t hash[FW_MANIFEST_HASH_SIZE];
+	
+	if(!g_active || index >= g_chunk_count || len == 0 || len > (size_t)g_chunk_size){
+		g_failure_count++;
+		return false;
+	}
+	
+	fw_manifest_hash(FW_MANIFEST_LEAF_PREFIX, data, len, hash);
+	if(memcmp(hash, &g_leaves[(size_t)index * FW_MANIFEST_HASH_SIZE], FW_MANIFEST_HASH_SIZE) != 0){
+		g_failure_count++;
+		ESP_LOGE(TAG, "Chunk %lu verification failed (failures: %lu)", (unsigned long)index, (unsigned long)g_failure_count);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Verifies the decrypted image in the OTA slot against the image leaf of the manifest.
+ * @return fw_update_ret_e FW_UPDATE_OK on success, FW_UPDATE_HASH_ERROR if the image does not match
+ */
+fw_update_ret_e fw_manifest_verify_image(void){
+	uint8_t digest[FW_UPDATE_DIGEST_SIZE];
+	uint8_t leaf[FW_MANIFEST_HASH_SIZE];
+	
+	if(!g_active){
+		return FW_UPDATE_HASH_ERROR;
+	}
+	fw_update_ret_e ret = fw_update_get_image_digest(digest);
+	if(ret != FW_UPDATE_OK){
+		return ret;
+	}
+	fw_manifest_hash(FW_MANIFEST_IMAGE_PREFIX, digest, sizeof(digest), leaf);
+	if(memcmp(leaf, g_image_leaf, FW_MANIFEST_HASH_SIZE) != 0){
+		ESP_LOGE(TAG, "Decrypted image does not match the manifest");
+		return FW_UPDATE_HASH_ERROR;
+	}
+	ESP_LOGI(TAG, "Decrypted image matches the manifest");
+	// A later cycle publishing the same root takes the slot as it is
+	fw_update_record_slot(FW_UPDATE_HASH_MANIFEST, g_expected_root);
+	return FW_UPDATE_OK;
+}
+
+/**
+ * @brief Checks if a manifest is loaded for the current download.
+ * @return true if the chunks must be verified against the manifest
+ */
+bool fw_manifest_is_active(void){
+	return g_active;
+}
+
+/**
+ * @brief Checks if a manifest is expected for the current download.
+ * @return true if fw_manifest_expect() was called and the manifest was not released
+ */
+bool fw_manifest_is_expected(void){
+	return g_expected;
+}
+
+/**
+ * @brief Gets the chunk size of the manifest.
+ * @return Chunk size in bytes
+ */
+uint32_t fw_manifest_get_chunk_size(void){
+	return g_chunk_size;
+}
+
+/**
+ * @brief Gets the number of chunks in the manifest.
+ * @return Number of chunks
+ */
+uint32_t fw_manifest_get_chunk_count(void){
+	return g_chunk_count;
+}
+
+/**
+ * @brief Gets the number of chunk verification failures since boot.
+ * @return Number of failures
+ */
+uint32_t fw_manifest_get_failure_count(void){
+	return g_failure_count;
+}
+
+/**
+ * @brief Releases the manifest of the current download.
+ */
+void fw_manifest_release(void){
+	if(g_leaves){
+		free(g_leaves);
+		g_leaves = NULL;
+	}
+	g_chunk_count = 0;
+	g_active = false;
+	g_expected = false;
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup fw_manifest.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Computes the Merkle root of a list of leaf hashes.
+ * @param leaves Concatenated leaf hashes
+ * @param count Number of leaves
+ * @param root Buffer where the root will be stored
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+static fw_update_ret_e fw_manifest_compute_root(const uint8_t *leaves, uint32_t count, uint8_t *root){
+	// Work on a copy, each level is written over the previous one
+	uint8_t *level = malloc((size_t)count * FW_MANIFEST_HASH_SIZE);
+	if(level == NULL){
+		ESP_LOGE(TAG, "Failed to allocate memory for the Merkle tree");
+		return FW_UPDATE_HASH_ERROR;
+	}
+	memcpy(level, leaves, (size_t)count * FW_MANIFEST_HASH_SIZE);
+	
+	while(count > 1){
+		uint32_t next = 0;
+		for(uint32_t i = 0; i < count; i += 2){
+			uint8_t *out = &level[(size_t)next * FW_MANIFEST_HASH_SIZE];
+			if(i + 1 == count){
+				// Odd node, promote it unchanged
+				memmove(out, &level[(size_t)i * FW_MANIFEST_HASH_SIZE], FW_MANIFEST_HASH_SIZE);
+			}
+			else{
+				fw_manifest_hash(FW_MANIFEST_NODE_PREFIX, &level[(size_t)i * FW_MANIFEST_HASH_SIZE], 2 * FW_MANIFEST_HASH_SIZE, out);
+			}
+			next++;
+		}
+		count = next;
+	}
+	memcpy(root, level, FW_MANIFEST_HASH_SIZE);
+	free(level);
+	
+	return FW_UPDATE_OK;
+}
+
+/**
+ * @brief Computes a SHA-256 hash of a domain separation prefix followed by data.
+ * @param prefix Domain separation prefix
+ * @param data Data to be hashed
+ * @param len Length of the data
+ * @param hash Buffer where the hash will be stored, FW_MANIFEST_HASH_SIZE bytes
+ */
+static void fw_manifest_hash(uint8_t prefix, const uint8_t *data, size_t len, uint8_t *hash){
+	mbedtls_sha256_context sha256_ctx;
+	mbedtls_sha256_init(&sha256_ctx);
+	mbedtls_sha256_starts(&sha256_ctx, 0);
+	mbedtls_sha256_update(&sha256_ctx, &prefix, 1);
+	mbedtls_sha256_update(&sha256_ctx, data, len);
+	mbedtls_sha256_finish(&sha256_ctx, hash);
+	mbedtls_sha256_free(&sha256_ctx);
+}
+
+/** @} */
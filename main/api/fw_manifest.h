@@ -0,0 +1,116 @@
+/**
+*************************************************************************
+* @file       fw_manifest.h
+* @brief      Header file for the fw_manifest.h module.
+* @details    This file contains declarations and prototypes for the 
+*             fw_manifest.h module, which verifies the firmware chunks
+*             against a Merkle manifest while they are downloaded, and the
+*             decrypted image against the same manifest once it is written.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_FW_MANIFEST_H_
+#define MAIN_API_FW_MANIFEST_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "api/fw_update.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/**
+ * @brief Size in bytes of each leaf hash in the manifest
+ */
+#define FW_MANIFEST_HASH_SIZE 32
+
+/* Public Types --------------------------------------------------------------*/
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup fw_manifest.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Sets the expected Merkle root and chunk size of the next download.
+ * @param root Merkle root published in the metadata, FW_MANIFEST_HASH_SIZE bytes
+ * @param chunk_size Size of each chunk in bytes
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+fw_update_ret_e fw_manifest_expect(const uint8_t *root, uint32_t chunk_size);
+
+/**
+ * @brief Loads the leaf hashes of the manifest and checks them against the expected root.
+ * @param leaves Concatenated SHA-256 leaf hashes, one per chunk, followed by the leaf of the decrypted image
+ * @param len Length of the leaves buffer in bytes
+ * @return fw_update_ret_e FW_UPDATE_OK on success, FW_UPDATE_HASH_ERROR if the root does not match
+ */
+fw_update_ret_e fw_manifest_load(const uint8_t *leaves, size_t len);
+
+/**
+ * @brief Verifies a downloaded chunk against its leaf hash.
+ * @param index Index of the chunk
+ * @param data Chunk data
+ * @param len Length of the chunk, only the last chunk may be shorter than the chunk size
+ * @return true if the chunk matches its leaf hash
+ * @note Each mismatch increments the chunk failure counter.
+ */
+bool fw_manifest_verify_chunk(uint32_t index, const uint8_t *data, size_t len);
+
+/**
+ * @brief Verifies the decrypted image in the OTA slot against the image leaf of the manifest.
+ * @return fw_update_ret_e FW_UPDATE_OK on success, FW_UPDATE_HASH_ERROR if the image does not match
+ * @note The chunks only prove the encrypted bytes; this is what proves the key and the decryption.
+ */
+fw_update_ret_e fw_manifest_verify_image(void);
+
+/**
+ * @brief Checks if a manifest is loaded for the current download.
+ * @return true if the chunks must be verified against the manifest
+ */
+bool fw_manifest_is_active(void);
+
+/**
+ * @brief Checks if a manifest is expected for the current download.
+ * @return true if fw_manifest_expect() was called and the manifest was not released
+ */
+bool fw_manifest_is_expected(void);
+
+/**
+ * @brief Gets the chunk size of the manifest.
+ * @return Chunk size in bytes
+ */
+uint32_t fw_manifest_get_chunk_size(void);
+
+/**
+ * @brief Gets the number of chunks in the manifest.
+ * @return Number of chunks
+ */
+uint32_t fw_manifest_get_chunk_count(void);
+
+/**
+ * @brief Gets the number of chunk verification failures since boot.
+ * @return Number of failures
+ */
+uint32_t fw_manifest_get_failure_count(void);
+
+/**
+ * @brief Releases the manifest of the current download.
+ */
+void fw_manifest_release(void);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* MAIN_API_FW_MANIFEST_H_ */
@@ -20,6 +20,8 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <strings.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 // FreeRTOS Includes
@@ -27,26 +29,91 @@
 #include "freertos/event_groups.h"
 #include "freertos/idf_additions.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 
 // ESP Includes
 #include "esp_event.h"
 #include "esp_interface.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_tls.h"
 #include "esp_ota_ops.h"
+#include "esp_app_format.h"
+#include "esp_image_format.h"
+#include "esp_app_desc.h"
+#include "spi_flash_mmap.h"
+#include "nvs.h"
 #include "mbedtls/aes.h"
 #include "mbedtls/md5.h"
 
 // Application Includes
 #include "portmacro.h"
+#include "tasks_common.h"
 #include "main_app.h"
 #include "api/fw_update.h"
+#include "api/binlog.h"
+#include "api/update_throttle.h"
+#include "api/update_progress.h"
+#include "api/peer_cache.h"
+#include "api/metrics.h"
+#include "api/blake3.h"
 
 /* Definitions ----------------------------------------------------------*/
 
+// NVS namespace and key of the decryption journal
+#define FW_UPDATE_NVS_NAMESPACE "fw_update"
+#define FW_UPDATE_NVS_KEY       "journal"
+
+// NVS key of the record of a verified OTA slot, by subtype, and of the bytes the records saved
+#define FW_UPDATE_NVS_SLOT_KEY    "slot_%02x"
+#define FW_UPDATE_NVS_CVS_KEY     "cvs_%02x"
+#define FW_UPDATE_NVS_AVOIDED_KEY "avoided"
+
+// The slot is resumed with esp_partition_write() and checked with esp_image_verify(),
+// an OTA handle of sequential writes cannot write at an offset
+#define FW_UPDATE_JOURNAL_SUPPORTED FW_UPDATE_JOURNAL_ENABLED
+
 /* Typedefs --------------------------------------------------------------*/
 
+/**
+ * @brief Journal of the decryption, saved after each FW_UPDATE_WRITE_BUFFER_SIZE bytes committed
+ */
+typedef struct fw_update_journal {
+    char image_id[FW_UPDATE_IMAGE_ID_LEN]; /**< Identifier of the image, its CID */
+    uint32_t partition_address;            /**< Address of the OTA slot being written */
+    uint32_t committed;                    /**< Bytes written into the slot, also the encrypted offset to resume from */
+    uint8_t iv[16];                        /**< CBC chain: the last encrypted block before the committed offset */
+} fw_update_journal_t;
+
+/**
+ * @brief Record of the image verified in an OTA slot
+ */
+typedef struct fw_update_slot_record {
+    uint8_t algorithm;                      /**< fw_update_hash_e of the digest */
+    uint8_t digest[FW_UPDATE_DIGEST_SIZE];  /**< Integrity hash verified on the slot */
+    uint32_t hashed_len;                    /**< Bytes of the slot covered by the integrity hash */
+    uint32_t image_len;                     /**< Length of the decrypted image */
+    uint32_t encrypted_len;                 /**< Length of the encrypted image, what a download takes */
+    uint8_t spot[FW_UPDATE_DIGEST_SIZE];    /**< SHA-256 of the spot-check windows */
+} fw_update_slot_record_t;
+
+/**
+ * @brief Share of the BLAKE3 verification hashed by one core
+ */
+typedef struct fw_update_hash_worker {
+    const esp_partition_t *partition;            /**< Slot keeping the image */
+    size_t len;                                  /**< Bytes of the image hashed */
+    size_t count;                                /**< Subtrees of the whole image */
+    size_t first;                                /**< First subtree of the share */
+    size_t last;                                 /**< Subtree after the last one of the share */
+    uint8_t *cvs;                                /**< Chaining values of all subtrees */
+    esp_err_t err;                               /**< Result of the share */
+    SemaphoreHandle_t done;                      /**< Given by a helper task when its share is hashed */
+    blake3_hasher_t hasher;                      /**< Hasher of the current subtree */
+    uint8_t buffer[FW_UPDATE_WRITE_BUFFER_SIZE]; /**< Data read from the slot */
+} fw_update_hash_worker_t;
+
 /* Private variables -----------------------------------------------------*/
 /**
  * @brief AES-128 key and IV used for encryption
@@ -54,15 +121,178 @@
 static const unsigned char aes_key[KEY_SIZE] = AES_KEY;
 static const unsigned char aes_iv[16] = AES_IV;
 
+/**
+ * @brief Length of the decrypted image covered by the integrity hash
+ */
 static int g_read_offset = 0;
 
+/**
+ * @brief OTA slot receiving the firmware and its OTA handle
+ */
+static const esp_partition_t *g_target_partition = NULL;
+static size_t g_image_len = 0;
+static esp_ota_handle_t g_ota_handle;
+
+/**
+ * @brief AES context and chained IV of the streaming decryption
+ */
+static mbedtls_aes_context g_aes;
+static unsigned char g_iv[16];
+
+/**
+ * @brief Pending encrypted block and the last decrypted block, held back until
+ *        it is known whether it carries the padding
+ */
+static uint8_t g_block[16];
+static size_t g_block_len = 0;
+static uint8_t g_held[16];
+static bool g_held_valid = false;
+static size_t g_encrypted_len = 0;
+
+/**
+ * @brief Buffer of decrypted data, written into the OTA slot in large pieces
+ */
+static uint8_t g_out[FW_UPDATE_WRITE_BUFFER_SIZE];
+static size_t g_out_len = 0;
+
+/**
+ * @brief Offset of the next write into the OTA slot, and the end of the sectors erased for a resumed image
+ * @note esp_ota_write() always starts at the beginning of the slot, so a resumed image is
+ *       written without an OTA handle, with esp_partition_write(), which does not erase.
+ */
+static size_t g_write_offset = 0;
+static size_t g_erased_end = 0;
+static bool g_resumed = false;
+
+/**
+ * @brief Identifier of the image being written, empty when it is not journaled
+ */
+static char g_image_id[FW_UPDATE_IMAGE_ID_LEN];
+
+/**
+ * @brief Flag to indicate the headers of the image were checked, and the reason the data was refused
+ */
+static bool g_image_checked = false;
+static fw_update_ret_e g_stop_reason = FW_UPDATE_OK;
+
+/**
+ * @brief Running SHA-256 of the decrypted data as it is written, and its result once the image is finished
+ */
+static mbedtls_sha256_context g_image_sha256;
+static bool g_image_hashing = false;
+static uint8_t g_image_digest[FW_UPDATE_DIGEST_SIZE];
+static bool g_image_digest_valid = false;
+
 /**
  * @brief Tag used for ESP serial console messages
  */
 static const char TAG [] = "fw_update"; 
 
 /* Function prototypes ---------------------------------------------------*/
-void hex_string_to_bytes(const char *hex_string, char *byte_array);
+
+/**
+ * @brief Appends decrypted data to the write buffer, writing it into the OTA slot when full.
+ * @param data Decrypted data
+ * @param len Length of the data
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+static fw_update_ret_e fw_update_buffer_write(const uint8_t *data, size_t len);
+
+/**
+ * @brief Writes the write buffer into the OTA slot.
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+static fw_update_ret_e fw_update_buffer_flush(void);
+
+/**
+ * @brief Loads the journal of an interrupted decryption of the image into the OTA slot.
+ * @param image_id Identifier of the image
+ * @param journal Structure where the journal will be stored
+ * @return true if there is a journal for this image and slot
+ */
+static bool fw_update_journal_load(const char *image_id, fw_update_journal_t *journal);
+
+/**
+ * @brief Saves the state of the decryption after a buffer was committed.
+ */
+static void fw_update_journal_save(void);
+
+/**
+ * @brief Erases the journal.
+ */
+static void fw_update_journal_clear(void);
+
+/**
+ * @brief Checks the image and app headers at the start of the decrypted image.
+ * @param data Start of the decrypted image
+ * @param len Length of the data
+ * @return fw_update_ret_e FW_UPDATE_OK if the image can be installed, or the reason it cannot
+ */
+static fw_update_ret_e fw_update_check_image(const uint8_t *data, size_t len);
+
+/**
+ * @brief Compares two dotted versions number by number.
+ * @param a First version
+ * @param b Second version
+ * @return Negative, zero or positive if a is older, equal or newer than b
+ */
+static int fw_update_compare_versions(const char *a, const char *b);
+
+/**
+ * @brief Gets the NVS key of the record of a slot.
+ * @param partition OTA slot
+ * @param key Buffer of NVS_KEY_NAME_MAX_SIZE bytes where the key will be stored
+ */
+static void fw_update_slot_key(const esp_partition_t *partition, char *key);
+
+/**
+ * @brief Records the BLAKE3 chaining values of the subtrees just verified in the target slot.
+ * @param cvs Chaining values, BLAKE3_OUT_LEN bytes per subtree
+ * @param count Number of subtrees
+ */
+static void fw_update_slot_save_cvs(const uint8_t *cvs, size_t count);
+
+/**
+ * @brief Loads the record of the image verified in a slot.
+ * @param partition OTA slot
+ * @param record Structure where the record will be stored
+ * @return true if the slot has a record
+ */
+static bool fw_update_slot_load(const esp_partition_t *partition, fw_update_slot_record_t *record);
+
+/**
+ * @brief Records the image just verified in the target slot.
+ * @param algorithm Algorithm of the integrity hash
+ * @param digest Integrity hash, FW_UPDATE_DIGEST_SIZE bytes
+ */
+static void fw_update_slot_save(fw_update_hash_e algorithm, const uint8_t *digest);
+
+/**
+ * @brief Erases the record of a slot, before anything is written into it.
+ * @param partition OTA slot
+ */
+static void fw_update_slot_forget(const esp_partition_t *partition);
+
+/**
+ * @brief Hashes the spot-check windows of a slot: the headers, the end of the hashed range and windows picked by the digest.
+ * @param partition OTA slot
+ * @param record Record of the slot, with the digest and the hashed length
+ * @param spot SHA-256 of the windows, FW_UPDATE_DIGEST_SIZE bytes
+ * @return esp_err_t ESP_OK on success, or an error code on failure
+ */
+static esp_err_t fw_update_spot_check(const esp_partition_t *partition, const fw_update_slot_record_t *record, uint8_t *spot);
+
+/**
+ * @brief Hashes the subtrees of a share of the BLAKE3 verification.
+ * @param worker Share, its chaining values are stored in worker->cvs
+ */
+static void fw_update_hash_share(fw_update_hash_worker_t *worker);
+
+/**
+ * @brief Helper task hashing a share of the BLAKE3 verification on another core.
+ * @param pvParameters Share, of type fw_update_hash_worker_t
+ */
+static void fw_update_hash_task(void *pvParameters);
 
 /* Public Functions ------------------------------------------------------*/
 
@@ -72,113 +302,211 @@ void hex_string_to_bytes(const char *hex_string, char *byte_array);
  */
 
 /**
- * @brief Decrypts and verifies the firmware from storage.
+ * @brief Starts the streaming decryption of a firmware into the inactive OTA slot.
+ * @param image_id Identifier of the image, used to resume an interrupted decryption, or NULL
+ * @param resume_offset Offset of the encrypted image where the data must continue from
  * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
  */
-fw_update_ret_e decrypt_firmware_from_storage(int len){
+fw_update_ret_e fw_update_begin(const char *image_id, size_t *resume_offset){
+	fw_update_journal_t journal;
+	esp_err_t err;
 	
+	*resume_offset = 0;
 	g_read_offset = 0;
+	g_image_len = 0;
+	g_encrypted_len = 0;
+	g_block_len = 0;
+	g_held_valid = false;
+	g_out_len = 0;
+	g_write_offset = 0;
+	g_erased_end = 0;
+	g_resumed = false;
+	g_image_checked = !FW_UPDATE_IMAGE_CHECK_ENABLED;
+	g_stop_reason = FW_UPDATE_OK;
+	g_image_digest_valid = false;
+	if (g_image_hashing) {
+		mbedtls_sha256_free(&g_image_sha256);
+		g_image_hashing = false;
+	}
 	
-	mbedtls_aes_context aes;
-    mbedtls_aes_init(&aes);
-    mbedtls_aes_setkey_dec(&aes, aes_key, KEY_SIZE * 8);
-    unsigned char iv[16];
-    memcpy(iv, aes_iv, 16); // Inicializa o IV
-
-    uint8_t encrypted_data[16];
-    uint8_t decrypted_data[16];
-    size_t read_offset = 0;
-    size_t read_size = sizeof(encrypted_data);
-    size_t decrypted_size = read_size;
-    
-    esp_err_t err = ESP_OK;
-	esp_ota_handle_t ota_handle;
-	
-	// Gets the pointers for the partitions
-	const esp_partition_t *storage_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
-    const esp_partition_t *ota0_partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
-    if (storage_partition == NULL || ota0_partition == NULL) {
+	// The target is whichever slot is not running (ota_0/ota_1 rotation)
+	g_target_partition = esp_ota_get_next_update_partition(NULL);
+	if (g_target_partition == NULL) {
         ESP_LOGE(TAG, "Required partition not found");
         return FW_UPDATE_PARTION_NOT_FOUND;
     }
-	ESP_LOGI(TAG, "Required partition found successfully");
-	    
-    // Initialize the OTA API
-    err = esp_ota_begin(ota0_partition, OTA_SIZE_UNKNOWN, &ota_handle);
+	ESP_LOGI(TAG, "Target partition: %s", g_target_partition->label);
+#if PEER_CACHE_ENABLED
+	// The image served to the peers from this slot is about to be overwritten
+	peer_cache_forget(g_target_partition);
+#endif
+	// Whatever the slot held is not the recorded image anymore
+	fw_update_slot_forget(g_target_partition);
+	
+	snprintf(g_image_id, sizeof(g_image_id), "%s", image_id ? image_id : "");
+	mbedtls_aes_init(&g_aes);
+    mbedtls_aes_setkey_dec(&g_aes, aes_key, KEY_SIZE * 8);
+    memcpy(g_iv, aes_iv, 16); // Inicializa o IV
+	
+#if FW_UPDATE_JOURNAL_SUPPORTED
+	// Continue after the last journaled offset of an interrupted decryption of this image
+	if (image_id != NULL && fw_update_journal_load(image_id, &journal)) {
+		// No OTA handle is opened, so the committed sectors stay in the slot; the tail is
+		// erased and written directly and the image is verified in fw_update_end()
+		memcpy(g_iv, journal.iv, 16);
+		g_encrypted_len = journal.committed;
+		g_write_offset = journal.committed;
+		g_erased_end = journal.committed;
+		g_resumed = true;
+		*resume_offset = journal.committed;
+		// The headers were checked before the first sector was committed
+		g_image_checked = true;
+		ESP_LOGI(TAG, "OTA slot resumed at %lu", (unsigned long)journal.committed);
+		update_progress_begin_transfer(journal.committed);
+		update_throttle_begin();
+		return FW_UPDATE_OK;
+	}
+#else
+	(void)journal;
+#endif
+	
+	// Initialize the OTA API, erasing the sectors as they are written
+    err = esp_ota_begin(g_target_partition, OTA_WITH_SEQUENTIAL_WRITES, &g_ota_handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
+        mbedtls_aes_free(&g_aes);
         return FW_UPDATE_PARTION_NOT_INIT;
     }
 	ESP_LOGI(TAG, "esp_ota_begin successfully");
 	
-	// Read data until the "len" size
-    while (read_offset < len) {  
+	// The decrypted data is hashed as it is written; a resumed image is read back from the slot instead
+	mbedtls_sha256_init(&g_image_sha256);
+	mbedtls_sha256_starts(&g_image_sha256, 0);
+	g_image_hashing = true;
+    
+    // In background mode the download and decryption run under the budgets
+    update_throttle_begin();
+    update_progress_begin_transfer(0);
+    
+    return FW_UPDATE_OK;
+}
+
+/**
+ * @brief Decrypts a piece of the encrypted firmware and writes it into the OTA slot.
+ * @param data Encrypted data, of any length
+ * @param len Length of the data
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+fw_update_ret_e fw_update_write(const uint8_t *data, size_t len){
+	size_t data_len = len;
+	
+	// Each piece is a chunk boundary, where a cancellation stops the update
+	if (update_progress_is_cancelled()) {
+		ESP_LOGI(TAG, "Update cancelled");
+		g_stop_reason = FW_UPDATE_CANCELLED;
+		return FW_UPDATE_CANCELLED;
+	}
+	
+	while (len > 0) {
+		// Complete the pending encrypted block
+		size_t n = (len < 16 - g_block_len) ? len : 16 - g_block_len;
+		memcpy(&g_block[g_block_len], data, n);
+		g_block_len += n;
+		data += n;
+		len -= n;
+		if (g_block_len < 16) {
+			break;
+		}
 		
-		// Getting the encrypted data from the storage partition  
-        err = esp_partition_read(storage_partition, read_offset, encrypted_data, read_size);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "esp_partition_read failed: %s", esp_err_to_name(err));
-            esp_ota_end(ota_handle);
-            return FW_UPDATE_PARTION_READ_ERROR;
-        }
-#if PRINT_INFO
-        ESP_LOGI(TAG, "esp_partition_read: %d", read_offset);
-#endif
-        // Decrypt the data from the storage partition
-        mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_DECRYPT, read_size, iv, encrypted_data, decrypted_data);
-		// Print the calculated hash for debugging
-
-#if PRINT_INFO    	
-    	ESP_LOGI(TAG, "encrypted_data:");
-    	for (int i = 0; i < 16; i++) {
-        	printf("%02x", encrypted_data[i]);
-    	}
-    	printf("\n");
-
-    	// Print the expected hash for debugging
-    	ESP_LOGI(TAG, "decrypted_data:");
-    	for (int i = 0; i < 16; i++) {
-        	printf("%02x", decrypted_data[i]);
-    	}
-    	printf("\n");
-#endif // PRINT_INFO
-
-       // If it is the last block, remove padding
-		decrypted_size = read_size;
-       if ((read_offset + read_size) >= len) {
-            uint8_t padding_value = decrypted_data[decrypted_size - 1];
-            if (padding_value > 0 && padding_value <= 16) {
-				ESP_LOGI(TAG, "padding_value: %d", padding_value);
-                decrypted_size -= padding_value;
-            } else {
-                ESP_LOGE(TAG, "Invalid padding value: %d", padding_value);
-                esp_ota_end(ota_handle);
-                return FW_UPDATE_DECRYPT_ERROR;
-            }
-        }
-        
-		// Wirte the data decrypted into the OTA partition        
-        err = esp_ota_write(ota_handle, decrypted_data, decrypted_size);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "esp_ota_write failed: %s", esp_err_to_name(err));
-            esp_ota_end(ota_handle);
-            return FW_UPDATE_PARTION_WRITE_ERROR;
-        }
-#if PRINT_INFO
-        ESP_LOGI(TAG, "esp_ota_write: %d", decrypted_size);
-#endif
-        // Update the offset to the next block
-        read_offset += read_size;
-    }
+		// The previous block is not the last one, so it has no padding
+		if (g_held_valid) {
+			fw_update_ret_e ret = fw_update_buffer_write(g_held, 16);
+			if (ret != FW_UPDATE_OK) {
+				return ret;
+			}
+		}
+		
+		// Decrypt the block and hold it until the next one arrives
+		mbedtls_aes_crypt_cbc(&g_aes, MBEDTLS_AES_DECRYPT, 16, g_iv, g_block, g_held);
+		g_held_valid = true;
+		g_block_len = 0;
+		g_encrypted_len += 16;
+	}
+	
+	// Each piece is a preemption point, and the place where a pause holds
+	update_progress_add_bytes(data_len);
+	metrics_add(METRICS_DOWNLOAD_BYTES, data_len);
+	update_throttle_checkpoint(data_len);
+	
+	return FW_UPDATE_OK;
+}
 
-    g_read_offset = read_offset - read_size;
-    
+/**
+ * @brief Finishes the streaming decryption, removing the padding and closing the OTA slot.
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+fw_update_ret_e fw_update_end(void){
+	
+	update_throttle_end();
+	
+	// Complete or broken, this image is not resumed anymore
+	fw_update_journal_clear();
+	
+	// The encrypted image must be a whole number of blocks
+	if (g_block_len != 0 || !g_held_valid) {
+		ESP_LOGE(TAG, "Invalid encrypted length: %d", (int)(g_encrypted_len + g_block_len));
+		fw_update_abort();
+		return FW_UPDATE_DECRYPT_ERROR;
+	}
+	
+	// Remove the padding of the last block
+	uint8_t padding_value = g_held[15];
+	if (padding_value == 0 || padding_value > 16) {
+		ESP_LOGE(TAG, "Invalid padding value: %d", padding_value);
+		fw_update_abort();
+		return FW_UPDATE_DECRYPT_ERROR;
+	}
+	ESP_LOGI(TAG, "padding_value: %d", padding_value);
+	
+	fw_update_ret_e ret = fw_update_buffer_write(g_held, 16 - padding_value);
+	if (ret == FW_UPDATE_OK) {
+		ret = fw_update_buffer_flush();
+	}
+	if (ret != FW_UPDATE_OK) {
+		fw_update_abort();
+		return ret;
+	}
+	g_held_valid = false;
+	g_read_offset = g_encrypted_len - 16;
+	g_image_len = g_encrypted_len - padding_value;
+	if (g_image_hashing) {
+		mbedtls_sha256_finish(&g_image_sha256, g_image_digest);
+		mbedtls_sha256_free(&g_image_sha256);
+		g_image_hashing = false;
+		g_image_digest_valid = true;
+	}
+	
 	// Release the aes api
-    mbedtls_aes_free(&aes);
+    mbedtls_aes_free(&g_aes);
     ESP_LOGI(TAG, "mbedtls_aes_free");
-
+    
 	// End the ota process
-    err = esp_ota_end(ota_handle);
+	esp_err_t err;
+	if (g_resumed) {
+		// A resumed slot has no OTA handle; check the image as esp_ota_end() would
+		esp_image_metadata_t metadata;
+		const esp_partition_pos_t pos = {
+			.offset = g_target_partition->address,
+			.size = g_target_partition->size,
+		};
+		err = esp_image_verify(ESP_IMAGE_VERIFY, &pos, &metadata);
+		if (err != ESP_OK) {
+			ESP_LOGE(TAG, "esp_image_verify failed: %s", esp_err_to_name(err));
+			return FW_UPDATE_IMAGE_INVALID;
+		}
+	} else {
+		err = esp_ota_end(g_ota_handle);
+	}
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_ota_end failed: %s", esp_err_to_name(err));
         return FW_UPDATE_PARTION_NOT_CLOSED;
@@ -188,13 +516,209 @@ fw_update_ret_e decrypt_firmware_from_storage(int len){
     return FW_UPDATE_OK;
 }
 
+/**
+ * @brief Aborts the streaming decryption and releases the OTA slot.
+ * @note The journal is kept, so the next attempt of the same image resumes from it.
+ */
+void fw_update_abort(void){
+	update_throttle_end();
+	mbedtls_aes_free(&g_aes);
+	if (!g_resumed) {
+		esp_ota_abort(g_ota_handle);
+	}
+	g_held_valid = false;
+	g_block_len = 0;
+	g_out_len = 0;
+	if (g_image_hashing) {
+		mbedtls_sha256_free(&g_image_sha256);
+		g_image_hashing = false;
+	}
+}
+
+/**
+ * @brief Gets the reason fw_update_write() stopped taking data: rejected headers or a cancellation.
+ * @return fw_update_ret_e FW_UPDATE_OK if it did not stop, or the reason
+ */
+fw_update_ret_e fw_update_get_stop_reason(void){
+	return g_stop_reason;
+}
+
+/**
+ * @brief Gets the partition and the length of the last image decrypted successfully.
+ * @param len Length of the decrypted image
+ * @return Partition keeping the image, or NULL if no image was finished
+ */
+const esp_partition_t *fw_update_get_image(size_t *len){
+	*len = g_image_len;
+	return (g_image_len > 0) ? g_target_partition : NULL;
+}
+
+/**
+ * @brief Gets the SHA-256 of the last image decrypted successfully, as it was written into the OTA slot.
+ * @param digest Buffer where the hash will be stored, FW_UPDATE_DIGEST_SIZE bytes
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+fw_update_ret_e fw_update_get_image_digest(uint8_t *digest){
+	if (g_image_len == 0 || g_target_partition == NULL) {
+		return FW_UPDATE_PARTION_NOT_FOUND;
+	}
+	if (g_image_digest_valid) {
+		memcpy(digest, g_image_digest, FW_UPDATE_DIGEST_SIZE);
+		return FW_UPDATE_OK;
+	}
+	
+	// A resumed image was only partly written by this boot, hash it back from the slot
+	mbedtls_sha256_context sha256_ctx;
+	mbedtls_sha256_init(&sha256_ctx);
+	mbedtls_sha256_starts(&sha256_ctx, 0);
+	update_throttle_begin();
+	for (size_t offset = 0; offset < g_image_len; offset += sizeof(g_out)) {
+		size_t n = (g_image_len - offset < sizeof(g_out)) ? g_image_len - offset : sizeof(g_out);
+		esp_err_t err = esp_partition_read(g_target_partition, offset, g_out, n);
+		if (err != ESP_OK) {
+			ESP_LOGE(TAG, "esp_partition_read failed: %s", esp_err_to_name(err));
+			update_throttle_end();
+			mbedtls_sha256_free(&sha256_ctx);
+			return FW_UPDATE_PARTION_READ_ERROR;
+		}
+		mbedtls_sha256_update(&sha256_ctx, g_out, n);
+		update_throttle_checkpoint(0);
+	}
+	update_throttle_end();
+	mbedtls_sha256_finish(&sha256_ctx, g_image_digest);
+	mbedtls_sha256_free(&sha256_ctx);
+	g_image_digest_valid = true;
+	
+	memcpy(digest, g_image_digest, FW_UPDATE_DIGEST_SIZE);
+	return FW_UPDATE_OK;
+}
+
+/**
+ * @brief Takes the image already in the target OTA slot when its verified hash is the published one.
+ * @param algorithm Algorithm of the integrity hash
+ * @param expected_hash Hash received from the server, FW_UPDATE_DIGEST_SIZE bytes
+ * @param avoided Bytes of encrypted firmware the download would have taken
+ * @return fw_update_ret_e FW_UPDATE_OK if the slot holds the image, or FW_UPDATE_HASH_ERROR if it must be downloaded
+ * @note The slot is recorded when fw_update_verify_hash() passes and forgotten when fw_update_begin() opens it;
+ *       a spot-check of the slot guards against a change the record did not see.
+ */
+fw_update_ret_e fw_update_reuse_slot(fw_update_hash_e algorithm, const uint8_t *expected_hash, uint32_t *avoided){
+	fw_update_slot_record_t record;
+	uint8_t spot[FW_UPDATE_DIGEST_SIZE];
+	
+	*avoided = 0;
+#if FW_UPDATE_SLOT_REUSE_ENABLED
+	const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+	if (partition == NULL) {
+		ESP_LOGE(TAG, "Required partition not found");
+		return FW_UPDATE_PARTION_NOT_FOUND;
+	}
+	if (!fw_update_slot_load(partition, &record)) {
+		ESP_LOGI(TAG, "No verified image recorded in %s", partition->label);
+		return FW_UPDATE_HASH_ERROR;
+	}
+	if (record.algorithm != algorithm || memcmp(record.digest, expected_hash, FW_UPDATE_DIGEST_SIZE) != 0) {
+		ESP_LOGI(TAG, "%s holds another image", partition->label);
+		return FW_UPDATE_HASH_ERROR;
+	}
+	
+	// The record is only as good as the slot, a few windows of it are hashed again
+	int64_t start = esp_timer_get_time();
+	if (fw_update_spot_check(partition, &record, spot) != ESP_OK || memcmp(spot, record.spot, FW_UPDATE_DIGEST_SIZE) != 0) {
+		ESP_LOGE(TAG, "Spot-check of %s failed, downloading the image", partition->label);
+		fw_update_slot_forget(partition);
+		return FW_UPDATE_HASH_ERROR;
+	}
+	
+	g_target_partition = partition;
+	g_read_offset = record.hashed_len;
+	g_image_len = record.image_len;
+	g_encrypted_len = record.encrypted_len;
+	*avoided = record.encrypted_len;
+	
+	uint32_t total = fw_update_get_avoided_bytes() + record.encrypted_len;
+	nvs_handle_t nvs_handle;
+	if (nvs_open(FW_UPDATE_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) == ESP_OK) {
+		if (nvs_set_u32(nvs_handle, FW_UPDATE_NVS_AVOIDED_KEY, total) == ESP_OK) {
+			nvs_commit(nvs_handle);
+		}
+		nvs_close(nvs_handle);
+	}
+	metrics_add(METRICS_AVOIDED_BYTES, record.encrypted_len);
+	ESP_LOGI(TAG, "%s already holds the image: %lu bytes not downloaded (%lu since the first boot), spot-check %lu ms",
+	         partition->label, (unsigned long)record.encrypted_len, (unsigned long)total,
+	         (unsigned long)((esp_timer_get_time() - start) / 1000));
+	return FW_UPDATE_OK;
+#else
+	(void)record;
+	(void)spot;
+	return FW_UPDATE_HASH_ERROR;
+#endif
+}
+
+/**
+ * @brief Records the image just verified in the target OTA slot by a digest the caller checked, e.g. a manifest root.
+ * @param algorithm Algorithm of the digest
+ * @param digest Digest, FW_UPDATE_DIGEST_SIZE bytes
+ * @note fw_update_verify_hash() records the slot by itself.
+ */
+void fw_update_record_slot(fw_update_hash_e algorithm, const uint8_t *digest){
+	fw_update_slot_save(algorithm, digest);
+}
+
+/**
+ * @brief Gets the integrity hash recorded for the image verified in a slot.
+ * @param partition OTA slot, e.g. the running one
+ * @param algorithm Algorithm of the hash
+ * @param digest Hash, FW_UPDATE_DIGEST_SIZE bytes
+ * @param len Bytes of the slot covered by the hash
+ * @return fw_update_ret_e FW_UPDATE_OK if the slot has a record, or FW_UPDATE_HASH_ERROR if not
+ * @note A record keyed by a manifest root holds no hash of the slot bytes and is not returned.
+ */
+fw_update_ret_e fw_update_get_slot_digest(const esp_partition_t *partition, fw_update_hash_e *algorithm, uint8_t *digest, size_t *len){
+	fw_update_slot_record_t record;
+	
+	if (partition == NULL || !fw_update_slot_load(partition, &record) || record.algorithm == FW_UPDATE_HASH_MANIFEST) {
+		return FW_UPDATE_HASH_ERROR;
+	}
+	*algorithm = (fw_update_hash_e)record.algorithm;
+	memcpy(digest, record.digest, FW_UPDATE_DIGEST_SIZE);
+	*len = record.hashed_len;
+	return FW_UPDATE_OK;
+}
+
+/**
+ * @brief Erases the record of the image verified in a slot, e.g. when the slot no longer matches it.
+ * @param partition OTA slot
+ * @note A serial reflash rewrites the slot without going through fw_update_begin(), leaving the record stale.
+ */
+void fw_update_forget_slot(const esp_partition_t *partition){
+	if (partition != NULL) {
+		fw_update_slot_forget(partition);
+	}
+}
+
+/**
+ * @brief Gets the bytes of encrypted firmware not downloaded because the slot held the image, since the first boot.
+ * @return Bytes avoided
+ */
+uint32_t fw_update_get_avoided_bytes(void){
+	nvs_handle_t nvs_handle;
+	uint32_t total = 0;
+	
+	if (nvs_open(FW_UPDATE_NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK) {
+		nvs_get_u32(nvs_handle, FW_UPDATE_NVS_AVOIDED_KEY, &total);
+		nvs_close(nvs_handle);
+	}
+	return total;
+}
+
 /**
  * @brief Calculates the SHA-256 hash of a firmware in the OTA partition.
- * @param len Length of the firmware.
- * @param hash_buffer Buffer with the hash received from the server
+ * @param expected_hash SHA-256 hash received from the server, FW_UPDATE_DIGEST_SIZE bytes
  * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure.
  */
-fw_update_ret_e calculate_sha256_hash_from_ota(const char *integrity_hash) {
+fw_update_ret_e calculate_sha256_hash_from_ota(const uint8_t *expected_hash) {
 	esp_err_t err = ESP_OK;
 	char data[16];
     size_t read_offset = 0;
@@ -204,25 +728,23 @@ fw_update_ret_e calculate_sha256_hash_from_ota(const char *integrity_hash) {
     mbedtls_sha256_context sha256_ctx;
     mbedtls_sha256_init(&sha256_ctx);
     mbedtls_sha256_starts(&sha256_ctx, 0); // 0 para SHA-256
-    
-	// Convert the string into an array
-	char expected_hash[32] = {0x00};
-	hex_string_to_bytes(integrity_hash, expected_hash);
 	
     // Obtém o ponteiro para a partição OTA
-    const esp_partition_t *ota0_partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
-    if (ota0_partition == NULL) {
+    const esp_partition_t *ota_partition = g_target_partition;
+    if (ota_partition == NULL) {
         ESP_LOGE(TAG, "Required partition not found");
         return FW_UPDATE_PARTION_NOT_FOUND;
     }
     ESP_LOGI(TAG, "Required partition found successfully");
+    update_throttle_begin();
 
     // Read data from the partition
     while(read_offset < g_read_offset){
 		// Lê os dados da partição OTA
-        err = esp_partition_read(ota0_partition, read_offset, data, read_size);
+        err = esp_partition_read(ota_partition, read_offset, data, read_size);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "esp_partition_read failed: %s", esp_err_to_name(err));
+            update_throttle_end();
             return FW_UPDATE_PARTION_READ_ERROR;
         }
         // Atualiza o hash SHA-256 com os dados lidos
@@ -230,24 +752,18 @@ fw_update_ret_e calculate_sha256_hash_from_ota(const char *integrity_hash) {
         
         // Atualiza o offset para o próximo bloco
         read_offset += read_size;
+        if (read_offset % FW_UPDATE_WRITE_BUFFER_SIZE == 0) {
+            update_throttle_checkpoint(0);
+        }
 	}
+    update_throttle_end();
     // Finaliza o cálculo do hash SHA-256
     mbedtls_sha256_finish(&sha256_ctx, (unsigned char*)calculated_hash);
     mbedtls_sha256_free(&sha256_ctx);
 
-    // Print the calculated hash for debugging
-    ESP_LOGI(TAG, "Calculated SHA-256 hash:");
-    for (int i = 0; i < 32; i++) {
-        printf("%02x", calculated_hash[i]);
-    }
-    printf("\n");
-
-    // Print the expected hash for debugging
-    ESP_LOGI(TAG, "Expected SHA-256 hash:");
-    for (int i = 0; i < 32; i++) {
-        printf("%02x", expected_hash[i]);
-    }
-    printf("\n");
+    // Print the calculated and expected hashes for debugging
+    BINLOG_HEX(ESP_LOG_INFO, TAG, "Calculated SHA-256 hash:", calculated_hash, 32);
+    BINLOG_HEX(ESP_LOG_INFO, TAG, "Expected SHA-256 hash:", expected_hash, 32);
 
     // Verify if the calculated hash matches the expected hash
     if (memcmp(calculated_hash, expected_hash, 32) != 0) {
@@ -259,24 +775,254 @@ fw_update_ret_e calculate_sha256_hash_from_ota(const char *integrity_hash) {
     return FW_UPDATE_OK;
 }
 
+/**
+ * @brief Calculates the BLAKE3 hash of a firmware in the OTA partition, one share of subtrees per core.
+ * @param expected_hash BLAKE3 hash received from the server, FW_UPDATE_DIGEST_SIZE bytes
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure.
+ * @note A background update hashes on the calling task only, to keep its CPU budget.
+ */
+fw_update_ret_e calculate_blake3_hash_from_ota(const uint8_t *expected_hash) {
+    fw_update_hash_worker_t *workers[portNUM_PROCESSORS] = {NULL};
+    uint8_t calculated_hash[BLAKE3_OUT_LEN];
+    size_t len = g_read_offset;
+    size_t count = (len > 0) ? (len + FW_UPDATE_BLAKE3_SUBTREE_SIZE - 1) / FW_UPDATE_BLAKE3_SUBTREE_SIZE : 1;
+    int shares = update_throttle_is_background() ? 1 : portNUM_PROCESSORS;
+    int started = 0;
+    int64_t start = esp_timer_get_time();
+    fw_update_ret_e ret = FW_UPDATE_OK;
+
+    const esp_partition_t *ota_partition = g_target_partition;
+    if (ota_partition == NULL) {
+        ESP_LOGE(TAG, "Required partition not found");
+        return FW_UPDATE_PARTION_NOT_FOUND;
+    }
+    if ((size_t)shares > count) {
+        shares = count;
+    }
+
+    uint8_t *cvs = malloc(count * BLAKE3_OUT_LEN);
+    SemaphoreHandle_t done = xSemaphoreCreateCounting(shares, 0);
+    bool allocated = (cvs != NULL && done != NULL);
+    for (int i = 0; allocated && i < shares; i++) {
+        workers[i] = malloc(sizeof(fw_update_hash_worker_t));
+        if (workers[i] == NULL) {
+            allocated = false;
+            break;
+        }
+        workers[i]->partition = ota_partition;
+        workers[i]->len = len;
+        workers[i]->count = count;
+        workers[i]->first = count * i / shares;
+        workers[i]->last = count * (i + 1) / shares;
+        workers[i]->cvs = cvs;
+        workers[i]->err = ESP_OK;
+        workers[i]->done = done;
+    }
+
+    if (allocated) {
+        update_throttle_begin();
+        // The other shares go to helper tasks on the other cores, the last one is hashed here
+        for (int i = 0; i < shares - 1; i++) {
+            if (xTaskCreatePinnedToCore(&fw_update_hash_task, "fw_hash", FW_UPDATE_HASH_TASK_STACK_SIZE, workers[i],
+                                        FW_UPDATE_HASH_TASK_PRIORITY, NULL, (xPortGetCoreID() + 1 + i) % portNUM_PROCESSORS) == pdPASS) {
+                started++;
+            }
+            else {
+                fw_update_hash_share(workers[i]);
+            }
+        }
+        fw_update_hash_share(workers[shares - 1]);
+        for (int i = 0; i < started; i++) {
+            xSemaphoreTake(done, portMAX_DELAY);
+        }
+        update_throttle_end();
+
+        for (int i = 0; i < shares; i++) {
+            if (workers[i]->err != ESP_OK) {
+                ret = FW_UPDATE_PARTION_READ_ERROR;
+            }
+        }
+    }
+    else {
+        ESP_LOGE(TAG, "No memory for the BLAKE3 verification");
+        ret = FW_UPDATE_HASH_ERROR;
+    }
+
+    if (ret == FW_UPDATE_OK) {
+        // A single subtree was hashed as the root already
+        if (count == 1) {
+            memcpy(calculated_hash, cvs, BLAKE3_OUT_LEN);
+        }
+        else {
+            blake3_join_subtrees(cvs, count, calculated_hash);
+        }
+        ESP_LOGI(TAG, "BLAKE3 hash of %u bytes calculated in %lu ms, %d subtrees on %d cores", (unsigned)len,
+                 (unsigned long)((esp_timer_get_time() - start) / 1000), (int)count, shares);
+        BINLOG_HEX(ESP_LOG_INFO, TAG, "Calculated BLAKE3 hash:", calculated_hash, BLAKE3_OUT_LEN);
+        BINLOG_HEX(ESP_LOG_INFO, TAG, "Expected BLAKE3 hash:", expected_hash, BLAKE3_OUT_LEN);
+        if (memcmp(calculated_hash, expected_hash, BLAKE3_OUT_LEN) != 0) {
+            ESP_LOGE(TAG, "Hash mismatch");
+            ret = FW_UPDATE_HASH_ERROR;
+        }
+        else {
+            fw_update_slot_save_cvs(cvs, count);
+        }
+    }
+
+    for (int i = 0; i < shares; i++) {
+        free(workers[i]);
+    }
+    if (done != NULL) {
+        vSemaphoreDelete(done);
+    }
+    free(cvs);
+    return ret;
+}
+
+/**
+ * @brief Verifies the firmware in the OTA partition with the algorithm of the metadata.
+ * @param algorithm Algorithm of the integrity hash
+ * @param expected_hash Hash received from the server, FW_UPDATE_DIGEST_SIZE bytes
+ * @return fw_update_ret_e FW_UPDATE_OK on success, FW_UPDATE_HASH_ERROR for an unknown algorithm, or an error code on failure.
+ */
+fw_update_ret_e fw_update_verify_hash(fw_update_hash_e algorithm, const uint8_t *expected_hash) {
+    fw_update_ret_e ret;
+
+    switch (algorithm) {
+        case FW_UPDATE_HASH_SHA256:
+            ret = calculate_sha256_hash_from_ota(expected_hash);
+            break;
+        case FW_UPDATE_HASH_BLAKE3:
+            ret = calculate_blake3_hash_from_ota(expected_hash);
+            break;
+        default:
+            ESP_LOGE(TAG, "Integrity algorithm not supported");
+            return FW_UPDATE_HASH_ERROR;
+    }
+
+    // A later cycle with the same release takes the slot as it is
+    if (ret == FW_UPDATE_OK) {
+        fw_update_slot_save(algorithm, expected_hash);
+    }
+    return ret;
+}
+
+/**
+ * @brief Verifies a byte range of the image in the target OTA slot against the BLAKE3 verification.
+ * @param offset Offset of the first byte
+ * @param len Number of bytes
+ * @return fw_update_ret_e FW_UPDATE_OK if the range is intact, or an error code on failure.
+ * @note Only the subtrees covering the range are hashed again, and their chaining values compared with the ones
+ *       recorded by calculate_blake3_hash_from_ota(); a slot verified with SHA-256 has none.
+ */
+fw_update_ret_e fw_update_verify_range(size_t offset, size_t len) {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_handle_t nvs_handle;
+    const esp_partition_t *partition = g_target_partition;
+    size_t hashed_len = (g_read_offset > 0) ? (size_t)g_read_offset : 0;
+    size_t count = (hashed_len + FW_UPDATE_BLAKE3_SUBTREE_SIZE - 1) / FW_UPDATE_BLAKE3_SUBTREE_SIZE;
+    size_t size = count * BLAKE3_OUT_LEN;
+    fw_update_ret_e ret = FW_UPDATE_OK;
+
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "Required partition not found");
+        return FW_UPDATE_PARTION_NOT_FOUND;
+    }
+    if (len == 0 || offset >= hashed_len || len > hashed_len - offset) {
+        ESP_LOGE(TAG, "Range %u+%u outside the %u bytes verified", (unsigned)offset, (unsigned)len, (unsigned)hashed_len);
+        return FW_UPDATE_HASH_ERROR;
+    }
+
+    uint8_t *stored = malloc(size);
+    uint8_t *calculated = malloc(size);
+    fw_update_hash_worker_t *worker = malloc(sizeof(fw_update_hash_worker_t));
+    if (stored == NULL || calculated == NULL || worker == NULL) {
+        ESP_LOGE(TAG, "No memory for the range verification");
+        ret = FW_UPDATE_HASH_ERROR;
+    }
+    else {
+        size_t loaded = size;
+        snprintf(key, sizeof(key), FW_UPDATE_NVS_CVS_KEY, (unsigned)partition->subtype);
+        esp_err_t err = nvs_open(FW_UPDATE_NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
+        if (err == ESP_OK) {
+            err = nvs_get_blob(nvs_handle, key, stored, &loaded);
+            nvs_close(nvs_handle);
+        }
+        if (err != ESP_OK || loaded != size) {
+            ESP_LOGE(TAG, "No chaining values recorded for %s", partition->label);
+            ret = FW_UPDATE_HASH_ERROR;
+        }
+    }
+
+    if (ret == FW_UPDATE_OK) {
+        int64_t start = esp_timer_get_time();
+        worker->partition = partition;
+        worker->len = hashed_len;
+        worker->count = count;
+        worker->first = offset / FW_UPDATE_BLAKE3_SUBTREE_SIZE;
+        worker->last = (offset + len - 1) / FW_UPDATE_BLAKE3_SUBTREE_SIZE + 1;
+        worker->cvs = calculated;
+        worker->err = ESP_OK;
+        worker->done = NULL;
+        update_throttle_begin();
+        fw_update_hash_share(worker);
+        update_throttle_end();
+
+        if (worker->err != ESP_OK) {
+            ret = FW_UPDATE_PARTION_READ_ERROR;
+        }
+        else if (memcmp(&calculated[worker->first * BLAKE3_OUT_LEN], &stored[worker->first * BLAKE3_OUT_LEN],
+                        (worker->last - worker->first) * BLAKE3_OUT_LEN) != 0) {
+            ESP_LOGE(TAG, "Range %u+%u of %s does not match its chaining values", (unsigned)offset, (unsigned)len, partition->label);
+            ret = FW_UPDATE_HASH_ERROR;
+        }
+        else {
+            ESP_LOGI(TAG, "Range %u+%u verified in %lu ms, %d of %d subtrees", (unsigned)offset, (unsigned)len,
+                     (unsigned long)((esp_timer_get_time() - start) / 1000), (int)(worker->last - worker->first), (int)count);
+        }
+    }
+
+    free(worker);
+    free(calculated);
+    free(stored);
+    return ret;
+}
+
+/**
+ * @brief Gets the algorithm named by the "integrityAlgorithm" field of the metadata.
+ * @param name Name of the algorithm, "sha256" or "blake3"; NULL or empty when the field is missing
+ * @return fw_update_hash_e Algorithm, FW_UPDATE_HASH_UNKNOWN if not supported
+ */
+fw_update_hash_e fw_update_parse_hash_algorithm(const char *name) {
+    // Servers without the field publish SHA-256
+    if (name == NULL || name[0] == '\0' || strcasecmp(name, "sha256") == 0 || strcasecmp(name, "sha2-256") == 0) {
+        return FW_UPDATE_HASH_SHA256;
+    }
+    if (strcasecmp(name, "blake3") == 0) {
+        return FW_UPDATE_HASH_BLAKE3;
+    }
+    ESP_LOGE(TAG, "Unknown integrity algorithm %s", name);
+    return FW_UPDATE_HASH_UNKNOWN;
+}
+
 /**
  * @brief Applies the firmware update.
  * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
  */
 fw_update_ret_e apply_firmware_update() {	
-    const esp_partition_t *ota0_partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
-    if (ota0_partition == NULL) {
-        ESP_LOGE(TAG, "OTA0 partition not found");
+    const esp_partition_t *ota_partition = g_target_partition;
+    if (ota_partition == NULL) {
+        ESP_LOGE(TAG, "OTA partition not found");
         return FW_UPDATE_PARTION_NOT_FOUND;
     }
 
-    esp_err_t err = esp_ota_set_boot_partition(ota0_partition);
+    esp_err_t err = esp_ota_set_boot_partition(ota_partition);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_ota_set_boot_partition failed: %s", esp_err_to_name(err));
         return FW_UPDATE_SET_PARTION_BOOT_ERROR;
     }
 
-    ESP_LOGI(TAG, "Firmware update applied. Rebooting...");
+    ESP_LOGI(TAG, "Firmware update applied to %s. Rebooting...", ota_partition->label);
     esp_restart();
     return FW_UPDATE_OK;
 }
@@ -290,6 +1036,459 @@ fw_update_ret_e apply_firmware_update() {
  * @{
  */
 
+/**
+ * @brief Appends decrypted data to the write buffer, writing it into the OTA slot when full.
+ * @param data Decrypted data
+ * @param len Length of the data
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+static fw_update_ret_e fw_update_buffer_write(const uint8_t *data, size_t len){
+	while (len > 0) {
+		size_t n = (len < sizeof(g_out) - g_out_len) ? len : sizeof(g_out) - g_out_len;
+		memcpy(&g_out[g_out_len], data, n);
+		g_out_len += n;
+		data += n;
+		len -= n;
+		if (g_out_len == sizeof(g_out)) {
+			fw_update_ret_e ret = fw_update_buffer_flush();
+			if (ret != FW_UPDATE_OK) {
+				return ret;
+			}
+			// Journal every committed buffer, a power cut loses at most the one being written
+			fw_update_journal_save();
+		}
+	}
+	return FW_UPDATE_OK;
+}
+
+/**
+ * @brief Writes the write buffer into the OTA slot.
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+static fw_update_ret_e fw_update_buffer_flush(void){
+	if (g_out_len == 0) {
+		return FW_UPDATE_OK;
+	}
+	
+	// The first buffer holds the headers, a wrong image stops before anything is written
+	if (!g_image_checked) {
+		g_stop_reason = fw_update_check_image(g_out, g_out_len);
+		if (g_stop_reason != FW_UPDATE_OK) {
+			return g_stop_reason;
+		}
+		g_image_checked = true;
+	}
+	esp_err_t err = ESP_OK;
+	if (g_resumed) {
+		// Erase ahead of the data, esp_partition_write() does not
+		while (err == ESP_OK && g_erased_end < g_write_offset + g_out_len) {
+			err = esp_partition_erase_range(g_target_partition, g_erased_end, SPI_FLASH_SEC_SIZE);
+			g_erased_end += SPI_FLASH_SEC_SIZE;
+		}
+		if (err == ESP_OK) {
+			err = esp_partition_write(g_target_partition, g_write_offset, g_out, g_out_len);
+		}
+	}
+	else {
+		err = esp_ota_write(g_ota_handle, g_out, g_out_len);
+	}
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "esp_ota_write failed: %s", esp_err_to_name(err));
+		return FW_UPDATE_PARTION_WRITE_ERROR;
+	}
+	g_write_offset += g_out_len;
+	if (g_image_hashing) {
+		mbedtls_sha256_update(&g_image_sha256, g_out, g_out_len);
+	}
+#if PRINT_INFO
+	ESP_LOGI(TAG, "esp_ota_write: %d", (int)g_out_len);
+#endif
+	g_out_len = 0;
+	return FW_UPDATE_OK;
+}
+
+/**
+ * @brief Loads the journal of an interrupted decryption of the image into the OTA slot.
+ * @param image_id Identifier of the image
+ * @param journal Structure where the journal will be stored
+ * @return true if there is a journal for this image and slot
+ */
+static bool fw_update_journal_load(const char *image_id, fw_update_journal_t *journal){
+#if FW_UPDATE_JOURNAL_SUPPORTED
+	nvs_handle_t nvs_handle;
+	size_t size = sizeof(fw_update_journal_t);
+	bool found = false;
+	
+	if (nvs_open(FW_UPDATE_NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) {
+		return false;
+	}
+	if (nvs_get_blob(nvs_handle, FW_UPDATE_NVS_KEY, journal, &size) == ESP_OK && size == sizeof(fw_update_journal_t)) {
+		found = true;
+	}
+	nvs_close(nvs_handle);
+	if (!found) {
+		return false;
+	}
+	
+	// A journal of another image, or of the slot that is running now, is useless
+	if (strncmp(journal->image_id, image_id, sizeof(journal->image_id)) != 0 ||
+	    journal->partition_address != g_target_partition->address ||
+	    journal->committed == 0 || journal->committed % FW_UPDATE_WRITE_BUFFER_SIZE != 0) {
+		ESP_LOGI(TAG, "Discarding the journal of another image");
+		fw_update_journal_clear();
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * @brief Saves the state of the decryption after a buffer was committed.
+ */
+static void fw_update_journal_save(void){
+#if FW_UPDATE_JOURNAL_SUPPORTED
+	fw_update_journal_t journal;
+	nvs_handle_t nvs_handle;
+	
+	if (g_image_id[0] == '\0') {
+		return;
+	}
+	
+	// All the decrypted bytes are in the slot, the next encrypted block follows the committed offset
+	memset(&journal, 0x00, sizeof(journal));
+	memcpy(journal.image_id, g_image_id, sizeof(journal.image_id));
+	journal.partition_address = g_target_partition->address;
+	journal.committed = g_encrypted_len;
+	memcpy(journal.iv, g_iv, 16);
+	
+	esp_err_t err = nvs_open(FW_UPDATE_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if (err == ESP_OK) {
+		err = nvs_set_blob(nvs_handle, FW_UPDATE_NVS_KEY, &journal, sizeof(journal));
+		if (err == ESP_OK) {
+			err = nvs_commit(nvs_handle);
+		}
+		nvs_close(nvs_handle);
+	}
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to save the journal: %s", esp_err_to_name(err));
+	}
+#endif
+}
+
+/**
+ * @brief Erases the journal.
+ */
+static void fw_update_journal_clear(void){
+#if FW_UPDATE_JOURNAL_SUPPORTED
+	nvs_handle_t nvs_handle;
+	
+	if (nvs_open(FW_UPDATE_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) == ESP_OK) {
+		if (nvs_erase_key(nvs_handle, FW_UPDATE_NVS_KEY) == ESP_OK) {
+			nvs_commit(nvs_handle);
+		}
+		nvs_close(nvs_handle);
+	}
+#endif
+}
+
+/**
+ * @brief Gets the NVS key of the record of a slot.
+ * @param partition OTA slot
+ * @param key Buffer of NVS_KEY_NAME_MAX_SIZE bytes where the key will be stored
+ */
+static void fw_update_slot_key(const esp_partition_t *partition, char *key){
+	snprintf(key, NVS_KEY_NAME_MAX_SIZE, FW_UPDATE_NVS_SLOT_KEY, (unsigned)partition->subtype);
+}
+
+/**
+ * @brief Records the BLAKE3 chaining values of the subtrees just verified in the target slot.
+ * @param cvs Chaining values, BLAKE3_OUT_LEN bytes per subtree
+ * @param count Number of subtrees
+ */
+static void fw_update_slot_save_cvs(const uint8_t *cvs, size_t count){
+	char key[NVS_KEY_NAME_MAX_SIZE];
+	nvs_handle_t nvs_handle;
+	
+	if (g_target_partition == NULL) {
+		return;
+	}
+	snprintf(key, sizeof(key), FW_UPDATE_NVS_CVS_KEY, (unsigned)g_target_partition->subtype);
+	esp_err_t err = nvs_open(FW_UPDATE_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if (err == ESP_OK) {
+		err = nvs_set_blob(nvs_handle, key, cvs, count * BLAKE3_OUT_LEN);
+		if (err == ESP_OK) {
+			err = nvs_commit(nvs_handle);
+		}
+		nvs_close(nvs_handle);
+	}
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to record the chaining values: %s", esp_err_to_name(err));
+	}
+}
+
+/**
+ * @brief Loads the record of the image verified in a slot.
+ * @param partition OTA slot
+ * @param record Structure where the record will be stored
+ * @return true if the slot has a record
+ */
+static bool fw_update_slot_load(const esp_partition_t *partition, fw_update_slot_record_t *record){
+	char key[NVS_KEY_NAME_MAX_SIZE];
+	nvs_handle_t nvs_handle;
+	size_t size = sizeof(fw_update_slot_record_t);
+	bool found = false;
+	
+	fw_update_slot_key(partition, key);
+	if (nvs_open(FW_UPDATE_NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) {
+		return false;
+	}
+	if (nvs_get_blob(nvs_handle, key, record, &size) == ESP_OK && size == sizeof(fw_update_slot_record_t)) {
+		found = (record->hashed_len > 0 && record->hashed_len <= partition->size);
+	}
+	nvs_close(nvs_handle);
+	
+	return found;
+}
+
+/**
+ * @brief Records the image just verified in the target slot.
+ * @param algorithm Algorithm of the integrity hash
+ * @param digest Integrity hash, FW_UPDATE_DIGEST_SIZE bytes
+ */
+static void fw_update_slot_save(fw_update_hash_e algorithm, const uint8_t *digest){
+#if FW_UPDATE_SLOT_REUSE_ENABLED
+	fw_update_slot_record_t record;
+	char key[NVS_KEY_NAME_MAX_SIZE];
+	nvs_handle_t nvs_handle;
+	
+	if (g_target_partition == NULL || g_read_offset <= 0) {
+		return;
+	}
+	memset(&record, 0x00, sizeof(record));
+	record.algorithm = algorithm;
+	memcpy(record.digest, digest, FW_UPDATE_DIGEST_SIZE);
+	record.hashed_len = g_read_offset;
+	record.image_len = g_image_len;
+	record.encrypted_len = g_encrypted_len;
+	if (fw_update_spot_check(g_target_partition, &record, record.spot) != ESP_OK) {
+		return;
+	}
+	
+	fw_update_slot_key(g_target_partition, key);
+	esp_err_t err = nvs_open(FW_UPDATE_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if (err == ESP_OK) {
+		err = nvs_set_blob(nvs_handle, key, &record, sizeof(record));
+		if (err == ESP_OK) {
+			err = nvs_commit(nvs_handle);
+		}
+		nvs_close(nvs_handle);
+	}
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to record the slot: %s", esp_err_to_name(err));
+	}
+#else
+	(void)algorithm;
+	(void)digest;
+#endif
+}
+
+/**
+ * @brief Erases the record of a slot, before anything is written into it.
+ * @param partition OTA slot
+ */
+static void fw_update_slot_forget(const esp_partition_t *partition){
+	char key[NVS_KEY_NAME_MAX_SIZE];
+	nvs_handle_t nvs_handle;
+	
+	fw_update_slot_key(partition, key);
+	if (nvs_open(FW_UPDATE_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) == ESP_OK) {
+		bool erased = (nvs_erase_key(nvs_handle, key) == ESP_OK);
+		// The chaining values describe the same image as the record
+		snprintf(key, sizeof(key), FW_UPDATE_NVS_CVS_KEY, (unsigned)partition->subtype);
+		erased |= (nvs_erase_key(nvs_handle, key) == ESP_OK);
+		if (erased) {
+			nvs_commit(nvs_handle);
+		}
+		nvs_close(nvs_handle);
+	}
+}
+
+/**
+ * @brief Hashes the spot-check windows of a slot: the headers, the end of the hashed range and windows picked by the digest.
+ * @param partition OTA slot
+ * @param record Record of the slot, with the digest and the hashed length
+ * @param spot SHA-256 of the windows, FW_UPDATE_DIGEST_SIZE bytes
+ * @return esp_err_t ESP_OK on success, or an error code on failure
+ */
+static esp_err_t fw_update_spot_check(const esp_partition_t *partition, const fw_update_slot_record_t *record, uint8_t *spot){
+	size_t window = (record->hashed_len < FW_UPDATE_SPOT_CHECK_WINDOW_SIZE) ? record->hashed_len : FW_UPDATE_SPOT_CHECK_WINDOW_SIZE;
+	size_t span = record->hashed_len - window;
+	esp_err_t err = ESP_OK;
+	
+	uint8_t *buffer = malloc(window);
+	if (buffer == NULL) {
+		ESP_LOGE(TAG, "Failed to allocate memory for the spot-check");
+		return ESP_ERR_NO_MEM;
+	}
+	
+	mbedtls_sha256_context sha256_ctx;
+	mbedtls_sha256_init(&sha256_ctx);
+	mbedtls_sha256_starts(&sha256_ctx, 0);
+	for (int i = 0; i < FW_UPDATE_SPOT_CHECK_WINDOWS && err == ESP_OK; i++) {
+		// The same windows each time: the digest picks the ones between the headers and the end
+		size_t offset = 0;
+		if (i == FW_UPDATE_SPOT_CHECK_WINDOWS - 1) {
+			offset = span;
+		}
+		else if (i > 0 && span > 0) {
+			uint32_t pick;
+			memcpy(&pick, &record->digest[(4 * i) % FW_UPDATE_DIGEST_SIZE], sizeof(pick));
+			offset = (pick % span) & ~(size_t)15;
+		}
+		err = esp_partition_read(partition, offset, buffer, window);
+		if (err == ESP_OK) {
+			mbedtls_sha256_update(&sha256_ctx, buffer, window);
+		}
+	}
+	mbedtls_sha256_finish(&sha256_ctx, spot);
+	mbedtls_sha256_free(&sha256_ctx);
+	free(buffer);
+	
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "esp_partition_read failed: %s", esp_err_to_name(err));
+	}
+	return err;
+}
+
+/**
+ * @brief Checks the image and app headers at the start of the decrypted image.
+ * @param data Start of the decrypted image
+ * @param len Length of the data
+ * @return fw_update_ret_e FW_UPDATE_OK if the image can be installed, or the reason it cannot
+ */
+static fw_update_ret_e fw_update_check_image(const uint8_t *data, size_t len){
+	const esp_app_desc_t *running = esp_app_get_description();
+	esp_image_header_t image;
+	esp_app_desc_t app;
+	
+	// The app description opens the first segment, right after the two headers
+	const size_t app_offset = sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t);
+	if (len < app_offset + sizeof(esp_app_desc_t)) {
+		ESP_LOGE(TAG, "Image rejected: too short for its headers");
+		return FW_UPDATE_IMAGE_INVALID;
+	}
+	memcpy(&image, data, sizeof(image));
+	memcpy(&app, data + app_offset, sizeof(app));
+	
+	if (image.magic != ESP_IMAGE_HEADER_MAGIC || app.magic_word != ESP_APP_DESC_MAGIC_WORD) {
+		ESP_LOGE(TAG, "Image rejected: not an app image");
+		return FW_UPDATE_IMAGE_INVALID;
+	}
+	if (image.chip_id != CONFIG_IDF_FIRMWARE_CHIP_ID) {
+		ESP_LOGE(TAG, "Image rejected: chip id %d, expected %d", (int)image.chip_id, CONFIG_IDF_FIRMWARE_CHIP_ID);
+		return FW_UPDATE_IMAGE_WRONG_CHIP;
+	}
+	if (strncmp(app.project_name, running->project_name, sizeof(app.project_name)) != 0) {
+		ESP_LOGE(TAG, "Image rejected: project %.*s, expected %s", (int)sizeof(app.project_name), app.project_name, running->project_name);
+		return FW_UPDATE_IMAGE_WRONG_PROJECT;
+	}
+	if (app.secure_version < running->secure_version) {
+		ESP_LOGE(TAG, "Image rejected: secure version %lu, running %lu", (unsigned long)app.secure_version, (unsigned long)running->secure_version);
+		return FW_UPDATE_IMAGE_SECURE_VERSION;
+	}
+	app.version[sizeof(app.version) - 1] = '\0';
+	if (fw_update_compare_versions(app.version, FIRMWARE_VERSION) <= 0) {
+		ESP_LOGE(TAG, "Image rejected: version %s is not newer than %s", app.version, FIRMWARE_VERSION);
+		return FW_UPDATE_IMAGE_NOT_NEWER;
+	}
+	ESP_LOGI(TAG, "Image accepted: %s %s", app.project_name, app.version);
+	
+	return FW_UPDATE_OK;
+}
+
+/**
+ * @brief Compares two dotted versions number by number.
+ * @param a First version
+ * @param b Second version
+ * @return Negative, zero or positive if a is older, equal or newer than b
+ */
+static int fw_update_compare_versions(const char *a, const char *b){
+	// An optional "v" prefix, and anything after the numbers ("-rc1", "-dirty") is ignored
+	if (*a == 'v') {
+		a++;
+	}
+	if (*b == 'v') {
+		b++;
+	}
+	while (*a != '\0' || *b != '\0') {
+		char *end_a;
+		char *end_b;
+		unsigned long na = strtoul(a, &end_a, 10);
+		unsigned long nb = strtoul(b, &end_b, 10);
+		if (na != nb) {
+			return (na > nb) ? 1 : -1;
+		}
+		a = (*end_a == '.') ? end_a + 1 : "";
+		b = (*end_b == '.') ? end_b + 1 : "";
+	}
+	return 0;
+}
+
+/**
+ * @brief Hashes the subtrees of a share of the BLAKE3 verification.
+ * @param worker Share, its chaining values are stored in worker->cvs
+ */
+static void fw_update_hash_share(fw_update_hash_worker_t *worker) {
+	for (size_t i = worker->first; i < worker->last; i++) {
+		size_t offset = i * FW_UPDATE_BLAKE3_SUBTREE_SIZE;
+		size_t end = (worker->len - offset < FW_UPDATE_BLAKE3_SUBTREE_SIZE) ? worker->len : offset + FW_UPDATE_BLAKE3_SUBTREE_SIZE;
+
+		// A single subtree is the whole image, hashed as the root
+		if (worker->count == 1) {
+			blake3_hasher_init(&worker->hasher);
+		}
+		else {
+			blake3_hasher_init_subtree(&worker->hasher, offset / BLAKE3_CHUNK_LEN);
+		}
+		while (offset < end) {
+			size_t n = (end - offset < sizeof(worker->buffer)) ? end - offset : sizeof(worker->buffer);
+			worker->err = esp_partition_read(worker->partition, offset, worker->buffer, n);
+			if (worker->err != ESP_OK) {
+				ESP_LOGE(TAG, "esp_partition_read failed: %s", esp_err_to_name(worker->err));
+				return;
+			}
+			blake3_hasher_update(&worker->hasher, worker->buffer, n);
+			offset += n;
+			update_throttle_checkpoint(0);
+		}
+		if (worker->count == 1) {
+			blake3_hasher_finalize(&worker->hasher, &worker->cvs[i * BLAKE3_OUT_LEN]);
+		}
+		else {
+			blake3_hasher_finalize_subtree(&worker->hasher, &worker->cvs[i * BLAKE3_OUT_LEN]);
+		}
+	}
+}
+
+/**
+ * @brief Helper task hashing a share of the BLAKE3 verification on another core.
+ * @param pvParameters Share, of type fw_update_hash_worker_t
+ */
+static void fw_update_hash_task(void *pvParameters) {
+	fw_update_hash_worker_t *worker = pvParameters;
+
+	fw_update_hash_share(worker);
+	xSemaphoreGive(worker->done);
+	vTaskDelete(NULL);
+}
+
+/**
+ * @brief Converts a hex string into an array of bytes.
+ * @param hex_string Hex string, two characters per byte
+ * @param byte_array Buffer where the bytes will be stored
+ */
 void hex_string_to_bytes(const char *hex_string, char *byte_array) {
     size_t len = strlen(hex_string);
     for (size_t i = 0; i < len; i += 2) {
@@ -19,10 +19,32 @@ extern "C" {
 #endif
 
 /* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_partition.h"
 
 /* Public Macros -------------------------------------------------------------*/
+/**
+ * @brief Maximum length of the image identifier kept in the journal
+ */
+#define FW_UPDATE_IMAGE_ID_LEN 64
+
+/**
+ * @brief Size of the SHA-256 integrity hash
+ */
+#define FW_UPDATE_DIGEST_SIZE 32
 
 /* Public Types --------------------------------------------------------------*/
+/**
+ * @brief Algorithm of the integrity hash, named by "integrityAlgorithm" in the metadata
+ */
+typedef enum fw_update_hash {
+    FW_UPDATE_HASH_SHA256 = 0,  /**< SHA-256, the default when the field is missing */
+    FW_UPDATE_HASH_BLAKE3,      /**< BLAKE3, verified by subtree on every core */
+    FW_UPDATE_HASH_UNKNOWN,     /**< Named by the server but not supported */
+    FW_UPDATE_HASH_MANIFEST     /**< Merkle root of a chunk manifest, only keys the record of a slot */
+} fw_update_hash_e;
+
 /**
  * @brief Structure to hold firmware metadata information
  */
@@ -32,9 +54,13 @@ typedef struct {
     char author[50];         /**< Author of the firmware */
     char hardwareModel[50];  /**< Hardware model compatible with the firmware */
     char integrityHash[255]; /**< Integrity hash of the firmware */
+    uint8_t integrityDigest[FW_UPDATE_DIGEST_SIZE]; /**< Integrity hash as raw bytes, used by the verification */
+    fw_update_hash_e integrityAlgorithm; /**< Algorithm of the integrity hash */
     char timestamp[20];      /**< Timestamp of the firmware release */
     char description[255];   /**< Description of the firmware */
     char cid[255];           /**< CID of the firmware in IPFS */
+    char manifestCid[255];   /**< CID of the chunk manifest in IPFS, empty if not published */
+    uint32_t chunkSize;      /**< Size of each chunk covered by the manifest */
 } firmware_metadata_info_t;
 
 
@@ -50,7 +76,14 @@ typedef enum fw_update_ret {
     FW_UPDATE_DECRYPT_ERROR,
     FW_UPDATE_PARTION_NOT_CLOSED,
     FW_UPDATE_HASH_ERROR,
-    FW_UPDATE_SET_PARTION_BOOT_ERROR         /**< Error setting the boot partition */
+    FW_UPDATE_SET_PARTION_BOOT_ERROR,        /**< Error setting the boot partition */
+    FW_UPDATE_DOWNLOAD_ERROR,                /**< Error downloading the firmware */
+    FW_UPDATE_IMAGE_INVALID,                 /**< The image or app header is missing */
+    FW_UPDATE_IMAGE_WRONG_CHIP,              /**< The image is built for another chip */
+    FW_UPDATE_IMAGE_WRONG_PROJECT,           /**< The image is from another project */
+    FW_UPDATE_IMAGE_SECURE_VERSION,          /**< The secure version is lower than the running one */
+    FW_UPDATE_IMAGE_NOT_NEWER,               /**< The version is not newer than FIRMWARE_VERSION */
+    FW_UPDATE_CANCELLED                      /**< The update was cancelled */
 } fw_update_ret_e;
 
 /* Public Function Prototypes -------------------------------------------------*/
@@ -60,18 +93,145 @@ typedef enum fw_update_ret {
  */
 
 /**
- * @brief Decrypts and verifies the firmware from storage.
+ * @brief Starts the streaming decryption of a firmware into the inactive OTA slot.
+ * @param image_id Identifier of the image, used to resume an interrupted decryption, or NULL
+ * @param resume_offset Offset of the encrypted image where the data must continue from
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ * @note The target slot is the one returned by esp_ota_get_next_update_partition().
+ *       Each sector committed to the slot is journaled in NVS; after a power cut the
+ *       same image resumes from the last one, and the caller skips resume_offset bytes.
+ */
+fw_update_ret_e fw_update_begin(const char *image_id, size_t *resume_offset);
+
+/**
+ * @brief Decrypts a piece of the encrypted firmware and writes it into the OTA slot.
+ * @param data Encrypted data, of any length
+ * @param len Length of the data
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+fw_update_ret_e fw_update_write(const uint8_t *data, size_t len);
+
+/**
+ * @brief Finishes the streaming decryption, removing the padding and closing the OTA slot.
  * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
  */
-fw_update_ret_e decrypt_firmware_from_storage(int len);
+fw_update_ret_e fw_update_end(void);
+
+/**
+ * @brief Aborts the streaming decryption and releases the OTA slot.
+ */
+void fw_update_abort(void);
+
+/**
+ * @brief Gets the reason fw_update_write() stopped taking data: rejected headers or a cancellation.
+ * @return fw_update_ret_e FW_UPDATE_OK if it did not stop, or the reason
+ */
+fw_update_ret_e fw_update_get_stop_reason(void);
+
+/**
+ * @brief Gets the partition and the length of the last image decrypted successfully.
+ * @param len Length of the decrypted image
+ * @return Partition keeping the image, or NULL if no image was finished
+ */
+const esp_partition_t *fw_update_get_image(size_t *len);
+
+/**
+ * @brief Gets the SHA-256 of the last image decrypted successfully, as it was written into the OTA slot.
+ * @param digest Buffer where the hash will be stored, FW_UPDATE_DIGEST_SIZE bytes
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ * @note The hash runs over the data as it is written; a resumed image is read back from the slot.
+ */
+fw_update_ret_e fw_update_get_image_digest(uint8_t *digest);
+
+/**
+ * @brief Takes the image already in the target OTA slot when its verified hash is the published one.
+ * @param algorithm Algorithm of the integrity hash
+ * @param expected_hash Hash received from the server, FW_UPDATE_DIGEST_SIZE bytes
+ * @param avoided Bytes of encrypted firmware the download would have taken
+ * @return fw_update_ret_e FW_UPDATE_OK if the slot holds the image, or FW_UPDATE_HASH_ERROR if it must be downloaded
+ * @note The slot is recorded when fw_update_verify_hash() passes and forgotten when fw_update_begin() opens it;
+ *       a spot-check of the slot guards against a change the record did not see.
+ */
+fw_update_ret_e fw_update_reuse_slot(fw_update_hash_e algorithm, const uint8_t *expected_hash, uint32_t *avoided);
+
+/**
+ * @brief Records the image just verified in the target OTA slot by a digest the caller checked, e.g. a manifest root.
+ * @param algorithm Algorithm of the digest
+ * @param digest Digest, FW_UPDATE_DIGEST_SIZE bytes
+ * @note fw_update_verify_hash() records the slot by itself.
+ */
+void fw_update_record_slot(fw_update_hash_e algorithm, const uint8_t *digest);
+
+/**
+ * @brief Gets the integrity hash recorded for the image verified in a slot.
+ * @param partition OTA slot, e.g. the running one
+ * @param algorithm Algorithm of the hash
+ * @param digest Hash, FW_UPDATE_DIGEST_SIZE bytes
+ * @param len Bytes of the slot covered by the hash
+ * @return fw_update_ret_e FW_UPDATE_OK if the slot has a record, or FW_UPDATE_HASH_ERROR if not
+ * @note A record keyed by a manifest root holds no hash of the slot bytes and is not returned.
+ */
+fw_update_ret_e fw_update_get_slot_digest(const esp_partition_t *partition, fw_update_hash_e *algorithm, uint8_t *digest, size_t *len);
+
+/**
+ * @brief Erases the record of the image verified in a slot, e.g. when the slot no longer matches it.
+ * @param partition OTA slot
+ * @note A serial reflash rewrites the slot without going through fw_update_begin(), leaving the record stale.
+ */
+void fw_update_forget_slot(const esp_partition_t *partition);
+
+/**
+ * @brief Gets the bytes of encrypted firmware not downloaded because the slot held the image, since the first boot.
+ * @return Bytes avoided
+ */
+uint32_t fw_update_get_avoided_bytes(void);
 
 /**
  * @brief Calculates the SHA-256 hash of a firmware in the OTA partition.
- * @param len Length of the firmware.
- * @param hash_buffer Buffer where the calculated hash will be stored.
+ * @param expected_hash SHA-256 hash received from the server, FW_UPDATE_DIGEST_SIZE bytes
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure.
+ */
+fw_update_ret_e calculate_sha256_hash_from_ota(const uint8_t *expected_hash);
+
+/**
+ * @brief Calculates the BLAKE3 hash of a firmware in the OTA partition, one share of subtrees per core.
+ * @param expected_hash BLAKE3 hash received from the server, FW_UPDATE_DIGEST_SIZE bytes
  * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure.
+ * @note A background update hashes on the calling task only, to keep its CPU budget.
+ */
+fw_update_ret_e calculate_blake3_hash_from_ota(const uint8_t *expected_hash);
+
+/**
+ * @brief Verifies the firmware in the OTA partition with the algorithm of the metadata.
+ * @param algorithm Algorithm of the integrity hash
+ * @param expected_hash Hash received from the server, FW_UPDATE_DIGEST_SIZE bytes
+ * @return fw_update_ret_e FW_UPDATE_OK on success, FW_UPDATE_HASH_ERROR for an unknown algorithm, or an error code on failure.
+ */
+fw_update_ret_e fw_update_verify_hash(fw_update_hash_e algorithm, const uint8_t *expected_hash);
+
+/**
+ * @brief Verifies a byte range of the image in the target OTA slot against the BLAKE3 verification.
+ * @param offset Offset of the first byte
+ * @param len Number of bytes
+ * @return fw_update_ret_e FW_UPDATE_OK if the range is intact, or an error code on failure.
+ * @note Only the subtrees covering the range are hashed again, and their chaining values compared with the ones
+ *       recorded by calculate_blake3_hash_from_ota(); a slot verified with SHA-256 has none.
+ */
+fw_update_ret_e fw_update_verify_range(size_t offset, size_t len);
+
+/**
+ * @brief Gets the algorithm named by the "integrityAlgorithm" field of the metadata.
+ * @param name Name of the algorithm, "sha256" or "blake3"; NULL or empty when the field is missing
+ * @return fw_update_hash_e Algorithm, FW_UPDATE_HASH_UNKNOWN if not supported
+ */
+fw_update_hash_e fw_update_parse_hash_algorithm(const char *name);
+
+/**
+ * @brief Converts a hex string into an array of bytes.
+ * @param hex_string Hex string, two characters per byte
+ * @param byte_array Buffer where the bytes will be stored
  */
-fw_update_ret_e calculate_sha256_hash_from_ota(const char *hash_buffer);
+void hex_string_to_bytes(const char *hex_string, char *byte_array);
 
 /**
  * @brief Applies the firmware update.
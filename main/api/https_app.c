@@ -31,6 +31,7 @@
 #include "esp_http_client.h"
 #include "esp_https_ota.h"
 #include "esp_ota_ops.h"
+#include "esp_timer.h"
 
 // Application Includes
 #include "portmacro.h"
@@ -38,6 +39,20 @@
 #include "main_app.h"
 #include "api/https_app.h"
 #include "api/fw_update.h"
+#include "api/fw_manifest.h"
+#include "api/binlog.h"
+#include "api/update_report.h"
+#include "api/ipfs_gateway.h"
+#include "api/ipfs_block.h"
+#include "api/push_channel.h"
+#include "api/coap_client.h"
+#include "api/metadata_cbor.h"
+#include "api/update_progress.h"
+#include "api/peer_cache.h"
+#include "api/metrics.h"
+#include "api/tls_psk.h"
+#include "api/image_source.h"
+#include "api/session_arena.h"
 
 /* Definitions ----------------------------------------------------------*/
 
@@ -74,6 +89,52 @@ static int g_len = 0;
  */
 static int g_fw_flag = 0;
 
+/**
+ * @brief Client of the metadata server, kept between requests so its connection is reused
+ */
+static esp_http_client_handle_t g_metadata_client = NULL;
+
+/**
+ * @brief Flag to indicate the CA certificate is parsed in the global store
+ */
+static bool g_ca_store_ready = false;
+
+/**
+ * @brief Start time of the metadata request and flag of its first byte
+ */
+static int64_t g_request_start = 0;
+static bool g_first_byte = false;
+
+/**
+ * @brief Connections opened by the metadata request, each one costs a handshake
+ */
+static int g_request_connections = 0;
+
+/**
+ * @brief Flag to indicate the connection of the current request was closed
+ */
+static bool g_disconnected = false;
+
+#if METADATA_CBOR_ENABLED
+/**
+ * @brief CBOR form of the metadata request
+ */
+static uint8_t g_cbor_request[METADATA_CBOR_REQUEST_LEN];
+
+/**
+ * @brief Flags to indicate the current request is CBOR and the server refused it
+ */
+static bool g_cbor_sent = false;
+static bool g_cbor_rejected = false;
+#endif
+
+#if IPFS_BLOCK_FETCH_ENABLED
+/**
+ * @brief Bytes of the image already in the OTA slot, dropped by the block download
+ */
+static size_t g_skip_bytes = 0;
+#endif
+
 /* Function prototypes ---------------------------------------------------*/
 
 /**
@@ -90,11 +151,98 @@ static void https_app_task(void *pvParameters);
  */
 static esp_err_t https_app_perform_request(const char *url, const char *payload);
 
+#if COAP_TRANSPORT_ENABLED
+/**
+ * @brief Internal function to perform the metadata request over CoAP/DTLS
+ * @param payload Data to send
+ * @return esp_err_t ESP_OK on success, or an error code on failure
+ */
+static esp_err_t https_app_perform_coap(const char *payload);
+#endif
+
+#if TLS_PSK_ENABLED
+/**
+ * @brief Internal function to perform the metadata request over TLS with the pre-shared key
+ * @param payload Data to send
+ * @return esp_err_t ESP_OK on success, or an error code on failure
+ */
+static esp_err_t https_app_perform_psk(const char *payload);
+#endif
+
+/**
+ * @brief Internal function to prepare the TLS setup before the first request
+ */
+static void https_app_warm_up(void);
+
+/**
+ * @brief Internal function to create the client of the metadata server
+ * @param url URL of the server
+ * @return Client handle, or NULL on failure
+ */
+static esp_http_client_handle_t https_app_create_client(const char *url);
+
+/**
+ * @brief Internal function to set the body of a request and its content type
+ * @param client HTTP client
+ * @param payload JSON payload
+ * @param cbor_len Length of the CBOR request, 0 to send the JSON payload
+ */
+static void https_app_set_body(esp_http_client_handle_t client, const char *payload, size_t cbor_len);
+
+/**
+ * @brief Internal function to perform a request, keeping the kept connection out of the cycle arena
+ * @param client HTTP client
+ * @return esp_err_t ESP_OK on success, or an error code on failure
+ */
+static esp_err_t https_app_client_perform(esp_http_client_handle_t client);
+
 /**
  * @brief Internal function to download firmware
- * @param url URL to download the firmware
+ * @param cid CID of the firmware
+ * @param manifest_cid CID of the chunk manifest, or NULL to download without per-chunk verification
+ */
+static void http_app_download_firmware(const char *cid, const char *manifest_cid);
+
+/**
+ * @brief Internal function to open the image, from the replay file or from the gateway that answers first, and its manifest
+ * @param cid CID of the firmware
+ * @param manifest_cid CID of the chunk manifest, or NULL
+ * @param src Source of the image, opened on success
+ * @param conn Winner of the gateway race; its index is -1 for the replay file
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+static fw_update_ret_e http_app_open_image(const char *cid, const char *manifest_cid, image_source_t *src, ipfs_gateway_conn_t *conn);
+
+/**
+ * @brief Internal function to read and load the chunk manifest
+ * @param src Source of the manifest, left open
+ * @return esp_err_t ESP_OK on success, or an error code on failure
  */
-static void http_app_download_firmware(const char *url);
+static esp_err_t http_app_load_manifest(image_source_t *src);
+
+#if IPFS_BLOCK_FETCH_ENABLED
+/**
+ * @brief Internal function to download the firmware block by block, checking the CID of each block
+ * @param cid CID of the firmware
+ */
+static void http_app_download_blocks(const char *cid);
+
+/**
+ * @brief Internal function to write the blocks into the OTA slot, dropping the part already there
+ * @param data Data of the file
+ * @param len Length of the data
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+static fw_update_ret_e http_app_write_resumed(const uint8_t *data, size_t len);
+#endif
+
+/**
+ * @brief Internal function to download the firmware chunk by chunk, verifying each one
+ * @param src Source of the image, at its first byte
+ * @param resume_offset Bytes already in the OTA slot, not downloaded or written again
+ * @return Number of bytes decrypted into the OTA slot, or -1 on failure
+ */
+static int http_app_download_chunks(image_source_t *src, size_t resume_offset);
 
 /* Public Functions ------------------------------------------------------*/
 
@@ -172,11 +320,16 @@ void https_app_start(void) {
 	if (https_app_queue_handle == NULL) {
    		 ESP_LOGI(TAG, "Failed to create queue");
 	}
+#if HTTPS_TLS_DEBUG
 	esp_log_level_set("esp-tls", ESP_LOG_DEBUG);
 	esp_log_level_set("esp-tls-mbedtls", ESP_LOG_DEBUG);
+#endif
 
     // Start the HTTPS application task
     xTaskCreate(&https_app_task, "https_app_task", HTTPS_APP_TASK_STACK_SIZE, NULL, HTTPS_APP_TASK_PRIORITY, NULL);
+    
+    // Keep the announcement stream open beside the requests
+    push_channel_start();
 }
 /** @} */
 
@@ -193,18 +346,34 @@ void https_app_start(void) {
  */
 static void https_app_task(void *pvParameters) {
     https_app_queue_message_t msg;
+#if TLS_PSK_ENABLED && TLS_PSK_BENCHMARK_ROUNDS > 0
+    bool benchmarked = false;
+#endif
+
+    // The metadata and firmware connections of a cycle are opened here, so they use the cycle arena
+    session_arena_add_owner(NULL);
+
+    // Runs while Wi-Fi associates, the requests queued meanwhile wait for it
+    https_app_warm_up();
 
     while (1) {
         if (xQueueReceive(https_app_queue_handle, &msg, portMAX_DELAY)) {
             switch (msg.msgID) {
 				case HTTPS_APP_MSG_SEND_REQUEST:
                     ESP_LOGI(TAG, "HTTPS_APP_MSG_SEND_REQUEST");
+#if TLS_PSK_ENABLED && TLS_PSK_BENCHMARK_ROUNDS > 0
+                    // The first request comes once the station is up, the benchmark runs ahead of it
+                    if (!benchmarked) {
+                        benchmarked = true;
+                        tls_psk_benchmark(TLS_PSK_BENCHMARK_ROUNDS);
+                    }
+#endif
                     https_app_perform_request(msg.url, msg.payload);
                     break;
                     
                 case HTTPS_APP_MSG_DOWNLOAD_FW:
                     ESP_LOGI(TAG, "HTTPS_APP_MSG_DOWNLOAD_FW");
-                    http_app_download_firmware(msg.url);
+                    http_app_download_firmware(msg.url, msg.payload);
                     break;
                            
                 default:
@@ -235,44 +404,70 @@ esp_err_t client_event_handler(esp_http_client_event_t *evt) {
 	
     switch (evt->event_id) {
         case HTTP_EVENT_ERROR:
-            ESP_LOGI(TAG, "HTTP_EVENT_ERROR");
+            BINLOGI(TAG, "HTTP_EVENT_ERROR");
             break;
         case HTTP_EVENT_ON_CONNECTED:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_CONNECTED");
+            BINLOGI(TAG, "HTTP_EVENT_ON_CONNECTED");
+            metrics_count_connection(evt->client);
+            if(!g_fw_flag){
+            	g_request_connections++;
+            	// esp-tls gives no split of the socket time, tls_psk_benchmark() times the CPU part
+            	BINLOGI(TAG, "TLS HANDSHAKE: cert, %lu ms", (unsigned long)((esp_timer_get_time() - g_request_start) / 1000));
+            }
             main_app_send_message(MAIN_APP_MSG_HTTPS_CONNECTED, 0,0, NULL);
             break;
         case HTTP_EVENT_HEADER_SENT:
-            ESP_LOGI(TAG, "HTTP_EVENT_HEADER_SENT");
+            BINLOGI(TAG, "HTTP_EVENT_HEADER_SENT");
             break;
         case HTTP_EVENT_ON_HEADER:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+            BINLOGI(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
             break;
         case HTTP_EVENT_ON_DATA:
-           // ESP_LOGI(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
+           // BINLOGI(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
+            if(!g_fw_flag && !g_first_byte){
+                int64_t now = esp_timer_get_time();
+                g_first_byte = true;
+                BINLOGI(TAG, "FIRST METADATA BYTE: %lu ms after the request, %lu ms after boot, prewarm %d",
+                        (unsigned long)((now - g_request_start) / 1000), (unsigned long)(now / 1000), HTTPS_TLS_PREWARM);
+            }
             if(!g_fw_flag){
             	if(g_len + evt->data_len < HTTPS_RESPONSE_BUFFER_SIZE){
-					strncat(g_response_buffer_to_send, (char*)evt->data, evt->data_len);
+					// A CBOR response may hold zero bytes
+					memcpy(&g_response_buffer_to_send[g_len], evt->data, evt->data_len);
 					g_len += evt->data_len;
             	}
             	else{
-					ESP_LOGI(TAG,"RESPONSE BUFFER OVERFLOW");
+					BINLOGI(TAG,"RESPONSE BUFFER OVERFLOW");
 				}
 			}
             break;
         case HTTP_EVENT_ON_FINISH:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_FINISH");
+            BINLOGI(TAG, "HTTP_EVENT_ON_FINISH");
+#if METADATA_CBOR_ENABLED
+            // 415, or 400 from a server parsing any body as JSON: the request is sent
+            // again as JSON and the main task only sees that answer
+            if(!g_fw_flag && g_cbor_sent && (esp_http_client_get_status_code(evt->client) == 415 ||
+               esp_http_client_get_status_code(evt->client) == 400)){
+            	g_cbor_rejected = true;
+            	memset(g_response_buffer_to_send, 0x00, HTTPS_RESPONSE_BUFFER_SIZE);
+            	g_len = 0;
+            	break;
+            }
+#endif
             if(!g_fw_flag){
-            	main_app_send_message(MAIN_APP_MSG_HTTPS_RECEIVED, HTTPS_RECEIVED_MSG_SUCCESS, g_len, g_response_buffer_to_send);
+            	// The HTTP status goes as the code, the main task only trusts a 2xx answer
+            	main_app_send_message(MAIN_APP_MSG_HTTPS_RECEIVED, esp_http_client_get_status_code(evt->client), g_len, g_response_buffer_to_send);
             	memset(g_response_buffer_to_send, 0x00, HTTPS_RESPONSE_BUFFER_SIZE);
             	g_len = 0;
             }
             break;
         case HTTP_EVENT_DISCONNECTED:
-            ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
+            BINLOGI(TAG, "HTTP_EVENT_DISCONNECTED");
+            g_disconnected = true;
             main_app_send_message(MAIN_APP_MSG_HTTPS_DISCONNECTED, 0, 0,NULL);
             break;
   		case HTTP_EVENT_REDIRECT:
-            ESP_LOGI(TAG, "HTTP_EVENT_REDIRECT");
+            BINLOGI(TAG, "HTTP_EVENT_REDIRECT");
             break;
        default:
        break;
@@ -287,31 +482,86 @@ esp_err_t client_event_handler(esp_http_client_event_t *evt) {
  * @return esp_err_t ESP_OK on success, or an error code on failure
  */
 static esp_err_t https_app_perform_request(const char *url, const char *payload) {
-    // HTTPS configuration
-    esp_http_client_config_t config = {
-        .url = url,
-        .method = HTTP_METHOD_POST,
-        .cert_pem = (const char *)ca_cert_pem_start,
-        .cert_len = ca_cert_pem_end - ca_cert_pem_start,
-        .client_cert_pem = (const char *)client_cert_pem_start,
-        .client_cert_len = client_cert_pem_end - client_cert_pem_start,
-        .client_key_pem = (const char *)client_key_pem_start,
-        .client_key_len = client_key_pem_end - client_key_pem_start,
-        .event_handler = client_event_handler,
-        .skip_cert_common_name_check = true, // Ignorar a verificação do nome comum do certificado
-        .use_global_ca_store = false,        // Opcionalmente, desabilitar o uso da loja de CA global
-        .transport_type = HTTP_TRANSPORT_OVER_SSL,
-    };
+    esp_http_client_handle_t client = NULL;
+    bool reuse = false;
+    size_t cbor_len = 0;
+    int sends = 0;
+
+    g_request_start = esp_timer_get_time();
+    g_first_byte = false;
+    g_request_connections = 0;
+    g_disconnected = false;
+
+#if COAP_TRANSPORT_ENABLED
+    // The metadata check goes over CoAP, HTTPS stays as the fallback
+    if (strcmp(url, ADDRESS_REGISTER_DEVICE) == 0) {
+        if (https_app_perform_coap(payload) == ESP_OK) {
+            return ESP_OK;
+        }
+        ESP_LOGI(TAG, "CoAP request failed, falling back to HTTPS");
+        g_request_start = esp_timer_get_time();
+    }
+#endif
 
-    // Initialize HTTPS client
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+#if TLS_PSK_ENABLED
+    // The metadata check authenticates with the pre-shared key, the certificate stays as the fallback
+    if (strcmp(url, ADDRESS_REGISTER_DEVICE) == 0) {
+        if (https_app_perform_psk(payload) == ESP_OK) {
+            return ESP_OK;
+        }
+        ESP_LOGI(TAG, "PSK request failed, falling back to the certificate");
+        g_request_start = esp_timer_get_time();
+    }
+#endif
+
+    // Reuse the warm client, its connection stays open between requests
+    if (g_metadata_client != NULL && strcmp(url, ADDRESS_REGISTER_DEVICE) == 0) {
+        client = g_metadata_client;
+        reuse = true;
+    }
+    else {
+        client = https_app_create_client(url);
+    }
+    if (client == NULL) {
+        ESP_LOGE(TAG, "Failed to initialize HTTPS client");
+        return ESP_FAIL;
+    }
+
+#if METADATA_CBOR_ENABLED
+    // The metadata request goes as CBOR until the server refuses it
+    g_cbor_sent = false;
+    if (strcmp(url, ADDRESS_REGISTER_DEVICE) == 0 && !g_cbor_rejected) {
+        cbor_len = metadata_cbor_encode_request(g_cbor_request, sizeof(g_cbor_request));
+    }
+#endif
 
     // Payload requisition configuration
-    esp_http_client_set_post_field(client, payload, strlen(payload));
-    esp_http_client_set_header(client, "Content-Type", "application/json");
+    https_app_set_body(client, payload, cbor_len);
 
     // Send requisition
-    esp_err_t err = esp_http_client_perform(client);
+    esp_err_t err = https_app_client_perform(client);
+    sends++;
+    if (err != ESP_OK && reuse) {
+        // The server may have closed the idle connection, send again on a new one
+        ESP_LOGI(TAG, "Kept connection failed, reconnecting");
+        esp_http_client_cleanup(client);
+        client = g_metadata_client = https_app_create_client(ADDRESS_REGISTER_DEVICE);
+        if (client == NULL) {
+            return ESP_FAIL;
+        }
+        https_app_set_body(client, payload, cbor_len);
+        err = https_app_client_perform(client);
+        sends++;
+    }
+#if METADATA_CBOR_ENABLED
+    if (err == ESP_OK && g_cbor_sent && g_cbor_rejected) {
+        ESP_LOGI(TAG, "Server refused CBOR, sending JSON");
+        g_disconnected = false;
+        https_app_set_body(client, payload, 0);
+        err = https_app_client_perform(client);
+        sends++;
+    }
+#endif
     if (err == ESP_OK) {
         // Get answer
         int status_code = esp_http_client_get_status_code(client);
@@ -319,94 +569,540 @@ static esp_err_t https_app_perform_request(const char *url, const char *payload)
         esp_http_client_read(client, g_response_buffer, sizeof(g_response_buffer));
 
         ESP_LOGI(TAG, "HTTPS POST Status = %d, content_length = %d", status_code, content_length);
+        // Not measured on the wire: a new connection is taken as the TCP handshake and
+        // two TLS 1.2 round trips, each request sent as one more
+        ESP_LOGI(TAG, "METADATA EXCHANGE: https, %lu ms, ~%d round trips (estimated from %d connections, %d requests)",
+                 (unsigned long)((esp_timer_get_time() - g_request_start) / 1000),
+                 g_request_connections * 3 + sends, g_request_connections, sends);
         if(content_length > 0)
         	ESP_LOGI(TAG, "Response: %s", g_response_buffer);
     } else {
         ESP_LOGE(TAG, "HTTPS POST request failed: %s", esp_err_to_name(err));
     }
 
-    // Cleanup HTTPS
-    esp_http_client_cleanup(client);
+    // Cleanup HTTPS, a warm client is only replaced when its connection failed
+    if (!reuse) {
+        esp_http_client_cleanup(client);
+    }
+    else if (err != ESP_OK) {
+        esp_http_client_cleanup(client);
+        g_metadata_client = https_app_create_client(ADDRESS_REGISTER_DEVICE);
+    }
+
+    // A kept connection does not close, yet the main task waits for the end of the exchange
+    if (!g_disconnected) {
+        main_app_send_message(MAIN_APP_MSG_HTTPS_DISCONNECTED, 0, 0, NULL);
+    }
 
     return err;
 }
 
+#if COAP_TRANSPORT_ENABLED
 /**
- * @brief Internal function to download firmware
- * @param url URL to download the firmware
+ * @brief Internal function to perform the metadata request over CoAP/DTLS
+ * @param payload Data to send
+ * @return esp_err_t ESP_OK on success, or an error code on failure
  */
-static void http_app_download_firmware(const char *url){
-	g_fw_flag = 1;
-	
-   esp_http_client_config_t config = {
+static esp_err_t https_app_perform_coap(const char *payload) {
+    coap_client_stats_t stats;
+    size_t len = 0;
+
+    esp_err_t err = coap_client_post(COAP_REGISTER_PATH, payload, g_response_buffer_to_send, HTTPS_RESPONSE_BUFFER_SIZE, &len, &stats);
+    ESP_LOGI(TAG, "METADATA EXCHANGE: coap, %lu ms, %u round trips (%u in the handshake), %lu bytes sent, %lu received, %u/%u datagrams",
+             (unsigned long)stats.latency_ms, stats.round_trips, stats.handshake_trips,
+             (unsigned long)stats.bytes_sent, (unsigned long)stats.bytes_received,
+             stats.datagrams_sent, stats.datagrams_received);
+    if (err != ESP_OK) {
+        memset(g_response_buffer_to_send, 0x00, HTTPS_RESPONSE_BUFFER_SIZE);
+        return err;
+    }
+
+    // Same messages as the HTTP client, so the main task does not see the transport
+    main_app_send_message(MAIN_APP_MSG_HTTPS_RECEIVED, HTTPS_RECEIVED_MSG_SUCCESS, len, g_response_buffer_to_send);
+    memset(g_response_buffer_to_send, 0x00, HTTPS_RESPONSE_BUFFER_SIZE);
+    main_app_send_message(MAIN_APP_MSG_HTTPS_DISCONNECTED, 0, 0, NULL);
+
+    return ESP_OK;
+}
+#endif
+
+#if TLS_PSK_ENABLED
+/**
+ * @brief Internal function to perform the metadata request over TLS with the pre-shared key
+ * @param payload Data to send
+ * @return esp_err_t ESP_OK on success, or an error code on failure
+ */
+static esp_err_t https_app_perform_psk(const char *payload) {
+    tls_psk_stats_t stats;
+    size_t len = 0;
+    const uint8_t *body = (const uint8_t *)payload;
+    size_t body_len = strlen(payload);
+    const char *content_type = "application/json";
+
+#if METADATA_CBOR_ENABLED
+    size_t cbor_len = g_cbor_rejected ? 0 : metadata_cbor_encode_request(g_cbor_request, sizeof(g_cbor_request));
+    if (cbor_len > 0) {
+        body = g_cbor_request;
+        body_len = cbor_len;
+        content_type = METADATA_CBOR_CONTENT_TYPE;
+    }
+#endif
+
+    esp_err_t err = tls_psk_post(TLS_PSK_REGISTER_PATH, content_type, body, body_len,
+                                 g_response_buffer_to_send, HTTPS_RESPONSE_BUFFER_SIZE, &len, &stats);
+#if METADATA_CBOR_ENABLED
+    if (err != ESP_OK && cbor_len > 0 && (stats.status == 415 || stats.status == 400)) {
+        ESP_LOGI(TAG, "Server refused CBOR, sending JSON");
+        g_cbor_rejected = true;
+        err = tls_psk_post(TLS_PSK_REGISTER_PATH, "application/json", (const uint8_t *)payload, strlen(payload),
+                           g_response_buffer_to_send, HTTPS_RESPONSE_BUFFER_SIZE, &len, &stats);
+    }
+#endif
+    if (err == ESP_ERR_NOT_FOUND || err == ESP_ERR_INVALID_STATE) {
+        return err;
+    }
+    ESP_LOGI(TAG, "TLS HANDSHAKE: psk, %lu ms, %lu ms CPU, %u round trips",
+             (unsigned long)stats.handshake_ms, (unsigned long)stats.handshake_cpu_ms, stats.handshake_trips);
+    ESP_LOGI(TAG, "METADATA EXCHANGE: https-psk, %lu ms, %u round trips, %lu bytes sent, %lu received",
+             (unsigned long)stats.latency_ms, stats.round_trips + 1,
+             (unsigned long)stats.bytes_sent, (unsigned long)stats.bytes_received);
+    if (err != ESP_OK) {
+        memset(g_response_buffer_to_send, 0x00, HTTPS_RESPONSE_BUFFER_SIZE);
+        return err;
+    }
+
+    // Same messages as the HTTP client, so the main task does not see the transport
+    main_app_send_message(MAIN_APP_MSG_HTTPS_RECEIVED, stats.status, len, g_response_buffer_to_send);
+    memset(g_response_buffer_to_send, 0x00, HTTPS_RESPONSE_BUFFER_SIZE);
+    main_app_send_message(MAIN_APP_MSG_HTTPS_DISCONNECTED, 0, 0, NULL);
+
+    return ESP_OK;
+}
+#endif
+
+/**
+ * @brief Internal function to prepare the TLS setup before the first request
+ * @note esp-tls seeds its DRBG from the hardware RNG on each connection and
+ *       parses the client certificate and key per connection, so the CA
+ *       store and the client are what can be prepared ahead.
+ */
+static void https_app_warm_up(void) {
+#if HTTPS_TLS_PREWARM
+    int64_t start = esp_timer_get_time();
+
+    // Parse the CA once, every connection verifies against the global store
+    esp_err_t err = esp_tls_set_global_ca_store((const unsigned char *)ca_cert_pem_start, ca_cert_pem_end - ca_cert_pem_start);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set the global CA store: %s", esp_err_to_name(err));
+    }
+    g_ca_store_ready = (err == ESP_OK);
+    g_metadata_client = https_app_create_client(ADDRESS_REGISTER_DEVICE);
+
+    ESP_LOGI(TAG, "TLS WARM-UP DONE IN %lu ms", (unsigned long)((esp_timer_get_time() - start) / 1000));
+#endif
+}
+
+/**
+ * @brief Internal function to create the client of the metadata server
+ * @param url URL of the server
+ * @return Client handle, or NULL on failure
+ */
+static esp_http_client_handle_t https_app_create_client(const char *url) {
+    // HTTPS configuration
+    esp_http_client_config_t config = {
         .url = url,
+        .method = HTTP_METHOD_POST,
+        .client_cert_pem = (const char *)client_cert_pem_start,
+        .client_cert_len = client_cert_pem_end - client_cert_pem_start,
+        .client_key_pem = (const char *)client_key_pem_start,
+        .client_key_len = client_key_pem_end - client_key_pem_start,
         .event_handler = client_event_handler,
+        .skip_cert_common_name_check = true, // Ignorar a verificação do nome comum do certificado
+        .use_global_ca_store = false,        // Opcionalmente, desabilitar o uso da loja de CA global
+        .transport_type = HTTP_TRANSPORT_OVER_SSL,
     };
 
-    ESP_LOGI(TAG, "INITIALIZE FIRMWARE DOWNLOAD");
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (client == NULL) {
-        ESP_LOGE(TAG, "Failed to initialize HTTP connection");
-        g_fw_flag = 0;
+    // The CA parsed in the warm-up is shared, otherwise each connection parses it
+    if (g_ca_store_ready) {
+        config.use_global_ca_store = true;
+    }
+    else {
+        config.cert_pem = (const char *)ca_cert_pem_start;
+        config.cert_len = ca_cert_pem_end - ca_cert_pem_start;
+    }
+
+    return esp_http_client_init(&config);
+}
+
+/**
+ * @brief Internal function to set the body of a request and its content type
+ * @param client HTTP client
+ * @param payload JSON payload
+ * @param cbor_len Length of the CBOR request, 0 to send the JSON payload
+ */
+static void https_app_set_body(esp_http_client_handle_t client, const char *payload, size_t cbor_len) {
+#if METADATA_CBOR_ENABLED
+    g_cbor_sent = (cbor_len > 0);
+    if (g_cbor_sent) {
+        esp_http_client_set_post_field(client, (const char *)g_cbor_request, cbor_len);
+        esp_http_client_set_header(client, "Content-Type", METADATA_CBOR_CONTENT_TYPE);
+        esp_http_client_set_header(client, "Accept", METADATA_CBOR_CONTENT_TYPE ", application/json");
         return;
     }
-    ESP_LOGI(TAG, "HTTP CONNECTED");
-    
-    esp_err_t err = esp_http_client_open(client, 0);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
-        esp_http_client_cleanup(client);
+    esp_http_client_set_header(client, "Accept", "application/json");
+#endif
+    esp_http_client_set_post_field(client, payload, strlen(payload));
+    esp_http_client_set_header(client, "Content-Type", "application/json");
+}
+
+/**
+ * @brief Internal function to perform a request, keeping the kept connection out of the cycle arena
+ * @param client HTTP client
+ * @return esp_err_t ESP_OK on success, or an error code on failure
+ */
+static esp_err_t https_app_client_perform(esp_http_client_handle_t client) {
+    // The metadata connection outlives the cycle, so its TLS context comes from the heap
+    bool owner = (client == g_metadata_client) && session_arena_remove_owner(NULL);
+    esp_err_t err = esp_http_client_perform(client);
+    if (owner) {
+        session_arena_add_owner(NULL);
+    }
+    return err;
+}
+
+/**
+ * @brief Internal function to download firmware
+ * @param cid CID of the firmware
+ * @param manifest_cid CID of the chunk manifest, or NULL to download without per-chunk verification
+ */
+static void http_app_download_firmware(const char *cid, const char *manifest_cid){
+    image_source_t src;
+    ipfs_gateway_conn_t conn;
+	g_fw_flag = 1;
+	
+#if IPFS_BLOCK_FETCH_ENABLED
+    // Without a manifest every block is checked against its own CID
+    if (manifest_cid == NULL && IMAGE_SOURCE_REPLAY_PATH[0] == '\0') {
+        http_app_download_blocks(cid);
         g_fw_flag = 0;
         return;
     }
-    ESP_LOGI(TAG, "HTTP CLIENT OPENED");
-    
-    int content_length = esp_http_client_fetch_headers(client);
-    if (content_length < 0) {
-        ESP_LOGE(TAG, "HTTP client fetch headers failed");
-        esp_http_client_cleanup(client);
+#endif
+
+    ESP_LOGI(TAG, "INITIALIZE FIRMWARE DOWNLOAD");
+    fw_update_ret_e ret = http_app_open_image(cid, manifest_cid, &src, &conn);
+    if (ret != FW_UPDATE_OK) {
+        fw_manifest_release();
         g_fw_flag = 0;
+        main_app_send_message(MAIN_APP_FW_DONWLOADED, ret, 0, NULL);
         return;
     }
-    ESP_LOGI(TAG, "HTTP Content Length: %d", content_length);
+    int content_length = src.size;
+    ESP_LOGI(TAG, "Image source: %s, length %d", src.ops->name, content_length);
 
-    const esp_partition_t *storage_partition  = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
-    if (storage_partition  == NULL) {
-        ESP_LOGE(TAG, "Storage  partition not found");
-        esp_http_client_cleanup(client);
+    // Decrypt the stream straight into the inactive OTA slot
+    size_t resume_offset = 0;
+    ret = fw_update_begin(cid, &resume_offset);
+    if (ret != FW_UPDATE_OK) {
+        image_source_close(&src);
+        fw_manifest_release();
         g_fw_flag = 0;
+        main_app_send_message(MAIN_APP_FW_DONWLOADED, ret, 0, NULL);
         return;
     }
-    ESP_LOGI(TAG, "STORAGE PARTITION: %s", storage_partition->label);
-
-    esp_partition_erase_range(storage_partition, 0, storage_partition->size);
+    if (content_length > 0) {
+        update_progress_set_total(content_length);
+    }
 
-    size_t write_offset = 0;
-    char buffer[HTTPS_RESPONSE_BUFFER_SIZE];
+    if (fw_manifest_is_active()) {
+        int stored = http_app_download_chunks(&src, resume_offset);
+        image_source_close(&src);
+        g_fw_flag = 0;
+        if (stored < 0) {
+            ESP_LOGE(TAG, "Chunked firmware download failed");
+            // A rejected image or a cancellation is not the fault of the gateway
+            ret = fw_update_get_stop_reason();
+            if (ret == FW_UPDATE_OK) {
+                if (conn.index >= 0) {
+                    ipfs_gateway_record_failure(conn.index);
+                }
+                ret = FW_UPDATE_HASH_ERROR;
+            }
+            fw_manifest_release();
+            fw_update_abort();
+            main_app_send_message(MAIN_APP_FW_DONWLOADED, ret, 0, NULL);
+            return;
+        }
+        if (conn.index >= 0) {
+            ipfs_gateway_record(conn.index, stored - resume_offset, (esp_timer_get_time() - conn.opened_at) / 1000);
+        }
+        ret = fw_update_end();
+        ESP_LOGI(TAG, "FIRMWARE DOWNLOADED SUCCESSFULLY, CHUNK FAILURES: %lu", (unsigned long)fw_manifest_get_failure_count());
+        main_app_send_message(MAIN_APP_FW_DONWLOADED, ret, stored, NULL);
+        return;
+    }
+    
+    uint8_t buffer[HTTPS_RESPONSE_BUFFER_SIZE];
     int bytes_read;
-    while ((bytes_read = esp_http_client_read(client, buffer, HTTPS_RESPONSE_BUFFER_SIZE)) > 0) {
-        err = esp_partition_write(storage_partition, write_offset, (const void *)buffer, bytes_read);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "esp_partition_write failed: %s", esp_err_to_name(err));
-            esp_http_client_cleanup(client);
+    
+    // After a power cut only the part that is not in the slot yet is needed
+    if (resume_offset > 0) {
+        if (image_source_skip_to(&src, resume_offset) != ESP_OK) {
+            ESP_LOGE(TAG, "Stream ended before the resume offset");
+            size_t reached = src.position;
+            image_source_close(&src);
+            fw_update_abort();
+            g_fw_flag = 0;
+            main_app_send_message(MAIN_APP_FW_DONWLOADED, FW_UPDATE_DOWNLOAD_ERROR, reached, NULL);
+            return;
+        }
+        ESP_LOGI(TAG, "Resuming the firmware at %u", (unsigned)resume_offset);
+    }
+    while ((bytes_read = image_source_read(&src, buffer, sizeof(buffer))) > 0) {
+        ret = fw_update_write(buffer, bytes_read);
+        if (ret != FW_UPDATE_OK) {
+            image_source_close(&src);
+            fw_update_abort();
             g_fw_flag = 0;
+            main_app_send_message(MAIN_APP_FW_DONWLOADED, ret, src.position, NULL);
             return;
         }
-        write_offset += bytes_read;
-        //ESP_LOGI(TAG, "DATA WRITE: %d", write_offset);
+        //ESP_LOGI(TAG, "DATA WRITE: %d", src.position);
     }
 
     if (bytes_read < 0) {
-        ESP_LOGE(TAG, "esp_http_client_read failed: %s", esp_err_to_name(bytes_read));
-        esp_http_client_cleanup(client);
+        if (conn.index >= 0) {
+            ipfs_gateway_record_failure(conn.index);
+        }
+        image_source_close(&src);
+        fw_update_abort();
         g_fw_flag = 0;
+        main_app_send_message(MAIN_APP_FW_DONWLOADED, FW_UPDATE_DOWNLOAD_ERROR, src.position, NULL);
         return;
     }
 
     ESP_LOGI(TAG, "FIRMWARE DOWNLOADED SUCCESSFULLY");
-    esp_http_client_cleanup(client);
+    if (conn.index >= 0) {
+        ipfs_gateway_record(conn.index, src.position - resume_offset, (esp_timer_get_time() - conn.opened_at) / 1000);
+    }
+    image_source_close(&src);
     g_fw_flag = 0;
-    main_app_send_message(MAIN_APP_FW_DONWLOADED, 0, write_offset,NULL);
+    ret = fw_update_end();
+    main_app_send_message(MAIN_APP_FW_DONWLOADED, ret, src.position, NULL);
+}
+
+/**
+ * @brief Internal function to open the image, from the replay file or from the gateway that answers first, and its manifest
+ * @param cid CID of the firmware
+ * @param manifest_cid CID of the chunk manifest, or NULL
+ * @param src Source of the image, opened on success
+ * @param conn Winner of the gateway race; its index is -1 for the replay file
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+static fw_update_ret_e http_app_open_image(const char *cid, const char *manifest_cid, image_source_t *src, ipfs_gateway_conn_t *conn){
+    image_source_t manifest;
+    esp_err_t err;
+
+    // A captured download is replayed byte for byte, without the network
+    if (IMAGE_SOURCE_REPLAY_PATH[0] != '\0') {
+        conn->index = -1;
+        conn->opened_at = esp_timer_get_time();
+        if (image_source_open_file(src, IMAGE_SOURCE_REPLAY_PATH) != ESP_OK) {
+            return FW_UPDATE_DOWNLOAD_ERROR;
+        }
+        err = ESP_OK;
+        if (manifest_cid) {
+            err = image_source_open_file(&manifest, IMAGE_SOURCE_REPLAY_MANIFEST_PATH);
+        }
+    }
+    else {
+        char url[URL_LEN];
+
+#if PEER_CACHE_ENABLED
+        // Neighbors that already verified this image are raced first
+        peer_cache_discover(cid);
+#endif
+
+        // Keep the gateway that answers first
+        if (ipfs_gateway_race(cid, conn) != ESP_OK) {
+            return FW_UPDATE_DOWNLOAD_ERROR;
+        }
+        ipfs_gateway_build_url(conn->index, cid, url, sizeof(url));
+        if (image_source_attach_http(src, conn->client, url, conn->content_length) != ESP_OK) {
+            esp_http_client_cleanup(conn->client);
+            return FW_UPDATE_DOWNLOAD_ERROR;
+        }
+
+        // The manifest comes from the same gateway
+        err = ESP_OK;
+        if (manifest_cid) {
+            err = ipfs_gateway_build_url(conn->index, manifest_cid, url, sizeof(url));
+            if (err == ESP_OK) {
+                err = image_source_open_http(&manifest, url);
+            }
+        }
+    }
+
+	// Load the manifest first, so each chunk is verified as it arrives
+    if (manifest_cid) {
+        if (err == ESP_OK) {
+            err = http_app_load_manifest(&manifest);
+            image_source_close(&manifest);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to load the firmware manifest");
+            image_source_close(src);
+            return FW_UPDATE_HASH_ERROR;
+        }
+    }
+
+    return FW_UPDATE_OK;
+}
+
+#if IPFS_BLOCK_FETCH_ENABLED
+/**
+ * @brief Internal function to download the firmware block by block, checking the CID of each block
+ * @param cid CID of the firmware
+ */
+static void http_app_download_blocks(const char *cid){
+    uint32_t bytes = 0;
+
+    ESP_LOGI(TAG, "INITIALIZE TRUSTLESS FIRMWARE DOWNLOAD");
+    fw_update_ret_e ret = fw_update_begin(cid, &g_skip_bytes);
+    if (ret != FW_UPDATE_OK) {
+        main_app_send_message(MAIN_APP_FW_DONWLOADED, ret, 0, NULL);
+        return;
+    }
+
+    if (ipfs_block_fetch_file(cid, http_app_write_resumed, &bytes) != ESP_OK) {
+        ESP_LOGE(TAG, "Trustless firmware download failed");
+        ret = fw_update_get_stop_reason();
+        fw_update_abort();
+        main_app_send_message(MAIN_APP_FW_DONWLOADED, (ret != FW_UPDATE_OK) ? ret : FW_UPDATE_DOWNLOAD_ERROR, bytes, NULL);
+        return;
+    }
+
+    ESP_LOGI(TAG, "FIRMWARE DOWNLOADED SUCCESSFULLY");
+    ret = fw_update_end();
+    main_app_send_message(MAIN_APP_FW_DONWLOADED, ret, bytes, NULL);
+}
+
+/**
+ * @brief Internal function to write the blocks into the OTA slot, dropping the part already there
+ * @param data Data of the file
+ * @param len Length of the data
+ * @return fw_update_ret_e FW_UPDATE_OK on success, or an error code on failure
+ */
+static fw_update_ret_e http_app_write_resumed(const uint8_t *data, size_t len){
+    if (g_skip_bytes >= len) {
+        g_skip_bytes -= len;
+        return FW_UPDATE_OK;
+    }
+    data += g_skip_bytes;
+    len -= g_skip_bytes;
+    g_skip_bytes = 0;
+    return fw_update_write(data, len);
+}
+#endif
+
+/**
+ * @brief Internal function to read and load the chunk manifest
+ * @param src Source of the manifest, left open
+ * @return esp_err_t ESP_OK on success, or an error code on failure
+ */
+static esp_err_t http_app_load_manifest(image_source_t *src){
+    int content_length = src->size;
+    if (content_length <= 0 || content_length > (FW_MANIFEST_MAX_CHUNKS + 1) * FW_MANIFEST_HASH_SIZE) {
+        ESP_LOGE(TAG, "Invalid manifest length: %d", content_length);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    
+    uint8_t *leaves = malloc(content_length);
+    if (leaves == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for the manifest");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    int bytes_read = image_source_read_full(src, leaves, content_length);
+    
+    esp_err_t err = ESP_FAIL;
+    if (bytes_read == content_length && fw_manifest_load(leaves, content_length) == FW_UPDATE_OK) {
+        err = ESP_OK;
+    }
+    free(leaves);
+    
+    return err;
+}
+
+/**
+ * @brief Internal function to download the firmware chunk by chunk, verifying each one
+ * @param src Source of the image, at its first byte
+ * @param resume_offset Bytes already in the OTA slot, not downloaded or written again
+ * @return Number of bytes decrypted into the OTA slot, or -1 on failure
+ * @note The chunks must reach the decryption in order (CBC chain), so a chunk
+ *       that fails is read again right away as a byte range of the source.
+ */
+static int http_app_download_chunks(image_source_t *src, size_t resume_offset){
+    int content_length = src->size;
+    size_t chunk_size = fw_manifest_get_chunk_size();
+    size_t chunk_count = fw_manifest_get_chunk_count();
+    
+    if (content_length <= 0 || ((size_t)content_length + chunk_size - 1) / chunk_size != chunk_count) {
+        ESP_LOGE(TAG, "Firmware length %d does not match the manifest", content_length);
+        return -1;
+    }
+    size_t image_len = (size_t)content_length;
+    
+    uint8_t *chunk = malloc(chunk_size);
+    if (chunk == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate memory for the chunks");
+        return -1;
+    }
+    
+    // After a power cut the stream starts at the first chunk not fully in the slot, which is
+    // read whole to be verified; a source that cannot seek drops the chunks before it
+    bool stream_ended = false;
+    uint32_t first = resume_offset / chunk_size;
+    if (first > 0) {
+        if (image_source_skip_to(src, (size_t)first * chunk_size) != ESP_OK) {
+            stream_ended = true;
+        }
+        ESP_LOGI(TAG, "Resuming the firmware at chunk %lu", (unsigned long)first);
+    }
+    for (uint32_t index = first; index < chunk_count; index++) {
+        size_t offset = (size_t)index * chunk_size;
+        size_t len = (image_len - offset < chunk_size) ? image_len - offset : chunk_size;
+        bool verified = false;
+        
+        // Take the chunk from the stream while it is alive
+        if (!stream_ended && image_source_read_full(src, chunk, len) != (int)len) {
+            stream_ended = true;
+        }
+        if (!stream_ended) {
+            verified = fw_manifest_verify_chunk(index, chunk, len);
+        }
+        
+        // Fetch again only the chunk that failed
+        for (int attempt = 0; !verified && attempt < FW_MANIFEST_MAX_REFETCH; attempt++) {
+            ESP_LOGI(TAG, "Fetching chunk %lu again", (unsigned long)index);
+            update_report_add_retry();
+            verified = (image_source_read_range(src, offset, len, chunk) == (int)len) && fw_manifest_verify_chunk(index, chunk, len);
+        }
+        if (!verified) {
+            ESP_LOGE(TAG, "Chunk %lu failed after %d attempts", (unsigned long)index, FW_MANIFEST_MAX_REFETCH);
+            free(chunk);
+            return -1;
+        }
+        
+        size_t skip = (resume_offset > offset) ? resume_offset - offset : 0;
+        if (fw_update_write(chunk + skip, len - skip) != FW_UPDATE_OK) {
+            free(chunk);
+            return -1;
+        }
+    }
+    free(chunk);
+    
+    return content_length;
 }
 
 /** @} */
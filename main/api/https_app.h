@@ -32,7 +32,7 @@ extern "C" {
  */
 typedef enum https_app_message {
     HTTPS_APP_MSG_SEND_REQUEST = 0, /**< Message ID for sending a request */
-    HTTPS_APP_MSG_DOWNLOAD_FW       /**< Message ID for downloading firmware */
+    HTTPS_APP_MSG_DOWNLOAD_FW       /**< Message ID for downloading firmware, url is the firmware CID and payload the manifest CID */
 } https_app_message_e;
 
 /**
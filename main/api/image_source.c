@@ -0,0 +1,549 @@
+/**
+*************************************************************************
+* @file       image_source.c
+* @brief      Source file for the image_source.c module.
+* @details    This file contains the implementation of functions for
+*             the image_source.c module: the HTTP and HTTPS sources on
+*             esp_http_client, with range requests to reposition the
+*             stream and to fetch a chunk again, the file source on the
+*             VFS and the memory source.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// ESP Includes
+#include "esp_log.h"
+#include "esp_crt_bundle.h"
+#include "esp_http_client.h"
+
+// Application Includes
+#include "api/image_source.h"
+#include "api/metrics.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+/**
+ * @brief Size of the pieces read and dropped when a source cannot seek
+ */
+#define IMAGE_SOURCE_SKIP_PIECE 512
+
+/* Typedefs --------------------------------------------------------------*/
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "image_source";
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Opens an HTTP client on a URL, from an offset when it is not 0
+ * @param url URL of the resource
+ * @param tls Checks the server against the certificate bundle
+ * @param offset Offset of the first byte, sent as a Range header
+ * @param len Number of bytes from the offset, 0 to the end of the resource
+ * @param content_length Content length answered by the server
+ * @return Client with the headers fetched, or NULL if the server did not answer 200, or 206 to a range
+ */
+static esp_http_client_handle_t image_source_http_connect(const char *url, bool tls, size_t offset, size_t len, int *content_length);
+
+/**
+ * @brief Opens an image over HTTP or HTTPS
+ * @param src Source
+ * @param url URL of the image
+ * @param tls Checks the server against the certificate bundle
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t image_source_http_open(image_source_t *src, const char *url, bool tls);
+
+/**
+ * @brief Operations of the HTTP source
+ */
+static int image_source_http_read(image_source_t *src, uint8_t *buffer, size_t len);
+static esp_err_t image_source_http_seek(image_source_t *src, size_t offset);
+static int image_source_http_read_range(image_source_t *src, size_t offset, size_t len, uint8_t *buffer);
+static void image_source_http_close(image_source_t *src);
+
+/**
+ * @brief Operations of the file source
+ */
+static int image_source_file_read(image_source_t *src, uint8_t *buffer, size_t len);
+static esp_err_t image_source_file_seek(image_source_t *src, size_t offset);
+static int image_source_file_read_range(image_source_t *src, size_t offset, size_t len, uint8_t *buffer);
+static void image_source_file_close(image_source_t *src);
+
+/**
+ * @brief Operations of the memory source
+ */
+static int image_source_memory_read(image_source_t *src, uint8_t *buffer, size_t len);
+static esp_err_t image_source_memory_seek(image_source_t *src, size_t offset);
+static int image_source_memory_read_range(image_source_t *src, size_t offset, size_t len, uint8_t *buffer);
+static void image_source_memory_close(image_source_t *src);
+
+/**
+ * @brief HTTP and HTTPS source
+ */
+static const image_source_ops_t g_http_ops = {
+	.name = "http",
+	.read = image_source_http_read,
+	.seek = image_source_http_seek,
+	.read_range = image_source_http_read_range,
+	.close = image_source_http_close,
+};
+
+/**
+ * @brief File source
+ */
+static const image_source_ops_t g_file_ops = {
+	.name = "file",
+	.read = image_source_file_read,
+	.seek = image_source_file_seek,
+	.read_range = image_source_file_read_range,
+	.close = image_source_file_close,
+};
+
+/**
+ * @brief Memory source
+ */
+static const image_source_ops_t g_memory_ops = {
+	.name = "memory",
+	.read = image_source_memory_read,
+	.seek = image_source_memory_seek,
+	.read_range = image_source_memory_read_range,
+	.close = image_source_memory_close,
+};
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup image_source.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Opens an image over HTTP
+ * @param src Source
+ * @param url URL of the image, http:// or https://; an https:// URL is opened as image_source_open_https()
+ * @return ESP_OK on success, or an error code on failure
+ */
+esp_err_t image_source_open_http(image_source_t *src, const char *url){
+	return image_source_http_open(src, url, strncmp(url, "https://", 8) == 0);
+}
+
+/**
+ * @brief Opens an image over HTTPS, the server checked against the certificate bundle
+ * @param src Source
+ * @param url URL of the image
+ * @return ESP_OK on success, or an error code on failure
+ */
+esp_err_t image_source_open_https(image_source_t *src, const char *url){
+	return image_source_http_open(src, url, true);
+}
+
+/**
+ * @brief Wraps a client that already fetched the headers of the image, e.g. the winner of the gateway race
+ * @param src Source
+ * @param client HTTP client, released by image_source_close()
+ * @param url URL the client opened, for the range requests
+ * @param content_length Content length answered by the server, negative when unknown
+ * @return ESP_OK on success, or ESP_ERR_INVALID_ARG if the URL does not fit
+ */
+esp_err_t image_source_attach_http(image_source_t *src, esp_http_client_handle_t client, const char *url, int content_length){
+	memset(src, 0, sizeof(*src));
+	if(strlen(url) >= sizeof(src->ctx.http.url)){
+		ESP_LOGE(TAG, "URL too long");
+		return ESP_ERR_INVALID_ARG;
+	}
+	src->ops = &g_http_ops;
+	src->caps = IMAGE_SOURCE_CAP_SEEK | IMAGE_SOURCE_CAP_RANGE;
+	src->size = (content_length >= 0) ? content_length : -1;
+	if(content_length >= 0){
+		src->caps |= IMAGE_SOURCE_CAP_SIZE;
+	}
+	src->ctx.http.client = client;
+	src->ctx.http.tls = (esp_http_client_get_transport_type(client) == HTTP_TRANSPORT_OVER_SSL);
+	strcpy(src->ctx.http.url, url);
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Opens an image stored in a file
+ * @param src Source
+ * @param path Path in the VFS (SPIFFS, FAT on an SD card, or the host file system on the linux target)
+ * @return ESP_OK on success, or ESP_ERR_NOT_FOUND if the file does not open
+ */
+esp_err_t image_source_open_file(image_source_t *src, const char *path){
+	memset(src, 0, sizeof(*src));
+	FILE *file = fopen(path, "rb");
+	if(file == NULL){
+		ESP_LOGE(TAG, "Failed to open %s", path);
+		return ESP_ERR_NOT_FOUND;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	src->ops = &g_file_ops;
+	src->caps = IMAGE_SOURCE_CAP_SEEK | IMAGE_SOURCE_CAP_RANGE;
+	src->size = (size >= 0) ? (int)size : -1;
+	if(size >= 0){
+		src->caps |= IMAGE_SOURCE_CAP_SIZE;
+	}
+	src->ctx.file.file = file;
+	ESP_LOGI(TAG, "Image from %s, %ld bytes", path, size);
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Opens an image held in memory
+ * @param src Source
+ * @param data Image, kept by the caller until image_source_close()
+ * @param len Length of the image
+ * @return ESP_OK
+ */
+esp_err_t image_source_open_memory(image_source_t *src, const uint8_t *data, size_t len){
+	memset(src, 0, sizeof(*src));
+	src->ops = &g_memory_ops;
+	src->caps = IMAGE_SOURCE_CAP_SIZE | IMAGE_SOURCE_CAP_SEEK | IMAGE_SOURCE_CAP_RANGE;
+	src->size = len;
+	src->ctx.memory.data = data;
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Reads the next bytes of the stream
+ * @param src Source
+ * @param buffer Buffer where the bytes will be stored
+ * @param len Maximum number of bytes
+ * @return Number of bytes read, 0 at the end of the stream, or -1 on failure
+ */
+int image_source_read(image_source_t *src, uint8_t *buffer, size_t len){
+	if(src->ops == NULL){
+		return -1;
+	}
+	int bytes_read = src->ops->read(src, buffer, len);
+	if(bytes_read > 0){
+		src->position += bytes_read;
+	}
+	return bytes_read;
+}
+
+/**
+ * @brief Reads exactly len bytes of the stream
+ * @param src Source
+ * @param buffer Buffer where the bytes will be stored
+ * @param len Number of bytes
+ * @return Number of bytes read, smaller than len if the stream ended or failed
+ */
+int image_source_read_full(image_source_t *src, uint8_t *buffer, size_t len){
+	size_t total = 0;
+	while(total < len){
+		int bytes_read = image_source_read(src, buffer + total, len - total);
+		if(bytes_read <= 0){
+			break;
+		}
+		total += bytes_read;
+	}
+	return total;
+}
+
+/**
+ * @brief Moves the stream forward to an offset, reading and dropping the bytes if the source cannot seek
+ * @param src Source
+ * @param offset Offset of the next byte, not before the current position
+ * @return ESP_OK on success, or ESP_FAIL if the stream ended before the offset
+ */
+esp_err_t image_source_skip_to(image_source_t *src, size_t offset){
+	uint8_t piece[IMAGE_SOURCE_SKIP_PIECE];
+
+	if(src->ops == NULL || offset < src->position){
+		return ESP_ERR_INVALID_ARG;
+	}
+	if(offset == src->position){
+		return ESP_OK;
+	}
+	if((src->caps & IMAGE_SOURCE_CAP_SEEK) && src->ops->seek(src, offset) == ESP_OK){
+		src->position = offset;
+		return ESP_OK;
+	}
+
+	ESP_LOGI(TAG, "%s source cannot seek, skipping the first %u bytes", src->ops->name, (unsigned)offset);
+	while(src->position < offset){
+		size_t len = offset - src->position;
+		if(image_source_read(src, piece, len < sizeof(piece) ? len : sizeof(piece)) <= 0){
+			ESP_LOGE(TAG, "Stream ended at %u, before %u", (unsigned)src->position, (unsigned)offset);
+			return ESP_FAIL;
+		}
+	}
+	return ESP_OK;
+}
+
+/**
+ * @brief Reads a byte range apart from the stream
+ * @param src Source
+ * @param offset Offset of the first byte
+ * @param len Number of bytes
+ * @param buffer Buffer where the bytes will be stored
+ * @return Number of bytes read, or -1 on failure or if the source has no IMAGE_SOURCE_CAP_RANGE
+ */
+int image_source_read_range(image_source_t *src, size_t offset, size_t len, uint8_t *buffer){
+	if(src->ops == NULL || !(src->caps & IMAGE_SOURCE_CAP_RANGE)){
+		return -1;
+	}
+	return src->ops->read_range(src, offset, len, buffer);
+}
+
+/**
+ * @brief Releases the source
+ * @param src Source, may be closed twice
+ */
+void image_source_close(image_source_t *src){
+	if(src->ops != NULL){
+		src->ops->close(src);
+		src->ops = NULL;
+	}
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup image_source.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Opens an HTTP client on a URL, from an offset when it is not 0
+ * @param url URL of the resource
+ * @param tls Checks the server against the certificate bundle
+ * @param offset Offset of the first byte, sent as a Range header
+ * @param len Number of bytes from the offset, 0 to the end of the resource
+ * @param content_length Content length answered by the server
+ * @return Client with the headers fetched, or NULL if the server did not answer 200, or 206 to a range
+ */
+static esp_http_client_handle_t image_source_http_connect(const char *url, bool tls, size_t offset, size_t len, int *content_length){
+	char range[48];
+	esp_http_client_config_t config = {
+		.url = url,
+		.crt_bundle_attach = tls ? esp_crt_bundle_attach : NULL,
+	};
+	bool ranged = (offset > 0 || len > 0);
+
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	if(client == NULL){
+		ESP_LOGE(TAG, "Failed to initialize HTTP connection");
+		return NULL;
+	}
+	if(ranged){
+		if(len > 0){
+			snprintf(range, sizeof(range), "bytes=%u-%u", (unsigned)offset, (unsigned)(offset + len - 1));
+		}
+		else{
+			snprintf(range, sizeof(range), "bytes=%u-", (unsigned)offset);
+		}
+		esp_http_client_set_header(client, "Range", range);
+	}
+
+	if(esp_http_client_open(client, 0) == ESP_OK){
+		metrics_count_connection(client);
+		*content_length = esp_http_client_fetch_headers(client);
+		int status = esp_http_client_get_status_code(client);
+		// A server that ignores the range answers 200 with the whole file
+		if(*content_length >= 0 && status == (ranged ? 206 : 200)){
+			return client;
+		}
+		ESP_LOGE(TAG, "%s answered status %d", ranged ? "Range request" : "Request", status);
+	}
+	else{
+		ESP_LOGE(TAG, "Failed to open HTTP connection");
+	}
+	esp_http_client_cleanup(client);
+
+	return NULL;
+}
+
+/**
+ * @brief Opens an image over HTTP or HTTPS
+ * @param src Source
+ * @param url URL of the image
+ * @param tls Checks the server against the certificate bundle
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t image_source_http_open(image_source_t *src, const char *url, bool tls){
+	int content_length = -1;
+
+	memset(src, 0, sizeof(*src));
+	if(strlen(url) >= sizeof(src->ctx.http.url)){
+		ESP_LOGE(TAG, "URL too long");
+		return ESP_ERR_INVALID_ARG;
+	}
+	esp_http_client_handle_t client = image_source_http_connect(url, tls, 0, 0, &content_length);
+	if(client == NULL){
+		return ESP_FAIL;
+	}
+	image_source_attach_http(src, client, url, content_length);
+	src->ctx.http.tls = tls;
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Reads the next bytes of the HTTP stream
+ */
+static int image_source_http_read(image_source_t *src, uint8_t *buffer, size_t len){
+	int bytes_read = esp_http_client_read(src->ctx.http.client, (char *)buffer, len);
+	if(bytes_read < 0){
+		ESP_LOGE(TAG, "esp_http_client_read failed: %s", esp_err_to_name(bytes_read));
+		return -1;
+	}
+	return bytes_read;
+}
+
+/**
+ * @brief Reopens the HTTP stream from an offset with a range request
+ */
+static esp_err_t image_source_http_seek(image_source_t *src, size_t offset){
+	int content_length;
+
+	esp_http_client_handle_t client = image_source_http_connect(src->ctx.http.url, src->ctx.http.tls, offset, 0, &content_length);
+	// A server that ignores ranges leaves image_source_skip_to() to drop the bytes
+	if(client == NULL){
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+	esp_http_client_cleanup(src->ctx.http.client);
+	src->ctx.http.client = client;
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Fetches a byte range of the HTTP resource on its own connection
+ */
+static int image_source_http_read_range(image_source_t *src, size_t offset, size_t len, uint8_t *buffer){
+	int content_length;
+	size_t total = 0;
+
+	esp_http_client_handle_t client = image_source_http_connect(src->ctx.http.url, src->ctx.http.tls, offset, len, &content_length);
+	if(client == NULL){
+		return -1;
+	}
+	while(total < len){
+		int bytes_read = esp_http_client_read(client, (char *)buffer + total, len - total);
+		if(bytes_read <= 0){
+			break;
+		}
+		total += bytes_read;
+	}
+	esp_http_client_cleanup(client);
+
+	return total;
+}
+
+/**
+ * @brief Releases the HTTP client
+ */
+static void image_source_http_close(image_source_t *src){
+	esp_http_client_cleanup(src->ctx.http.client);
+	src->ctx.http.client = NULL;
+}
+
+/**
+ * @brief Reads the next bytes of the file
+ */
+static int image_source_file_read(image_source_t *src, uint8_t *buffer, size_t len){
+	size_t bytes_read = fread(buffer, 1, len, src->ctx.file.file);
+	if(bytes_read == 0 && ferror(src->ctx.file.file)){
+		ESP_LOGE(TAG, "Failed to read the file");
+		return -1;
+	}
+	return bytes_read;
+}
+
+/**
+ * @brief Moves the file to an offset
+ */
+static esp_err_t image_source_file_seek(image_source_t *src, size_t offset){
+	return (fseek(src->ctx.file.file, offset, SEEK_SET) == 0) ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Reads a byte range of the file and goes back to the stream position
+ */
+static int image_source_file_read_range(image_source_t *src, size_t offset, size_t len, uint8_t *buffer){
+	FILE *file = src->ctx.file.file;
+
+	if(fseek(file, offset, SEEK_SET) != 0){
+		return -1;
+	}
+	size_t bytes_read = fread(buffer, 1, len, file);
+	if(fseek(file, src->position, SEEK_SET) != 0){
+		return -1;
+	}
+	return bytes_read;
+}
+
+/**
+ * @brief Closes the file
+ */
+static void image_source_file_close(image_source_t *src){
+	fclose(src->ctx.file.file);
+	src->ctx.file.file = NULL;
+}
+
+/**
+ * @brief Copies the next bytes of the buffer
+ */
+static int image_source_memory_read(image_source_t *src, uint8_t *buffer, size_t len){
+	size_t left = src->size - src->position;
+	if(len > left){
+		len = left;
+	}
+	memcpy(buffer, src->ctx.memory.data + src->position, len);
+	return len;
+}
+
+/**
+ * @brief Moves the buffer position, up to its end
+ */
+static esp_err_t image_source_memory_seek(image_source_t *src, size_t offset){
+	return (offset <= (size_t)src->size) ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+/**
+ * @brief Copies a byte range of the buffer
+ */
+static int image_source_memory_read_range(image_source_t *src, size_t offset, size_t len, uint8_t *buffer){
+	if(offset > (size_t)src->size){
+		return -1;
+	}
+	if(len > src->size - offset){
+		len = src->size - offset;
+	}
+	memcpy(buffer, src->ctx.memory.data + offset, len);
+	return len;
+}
+
+/**
+ * @brief Nothing to release, the buffer belongs to the caller
+ */
+static void image_source_memory_close(image_source_t *src){
+	src->ctx.memory.data = NULL;
+}
+
+/** @} */
@@ -0,0 +1,193 @@
+/**
+*************************************************************************
+* @file       image_source.h
+* @brief      Header file for the image_source.h module.
+* @details    This file contains declarations and prototypes for the
+*             image_source.h module, the interface the download pipeline
+*             reads the firmware image through. A source is opened by one
+*             of the implementations (HTTP, HTTPS, a local file or a
+*             buffer in memory) and then read, repositioned and asked for
+*             byte ranges the same way, whatever it is, so the decryption,
+*             hashing and OTA writes do not depend on the transport.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_IMAGE_SOURCE_H_
+#define MAIN_API_IMAGE_SOURCE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "sysconfig.h"
+#include "esp_err.h"
+#include "esp_http_client.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/**
+ * @brief Capabilities of a source
+ */
+#define IMAGE_SOURCE_CAP_SIZE  (1 << 0) /**< The size is known before the first read */
+#define IMAGE_SOURCE_CAP_SEEK  (1 << 1) /**< The stream may be repositioned forward without reading the bytes */
+#define IMAGE_SOURCE_CAP_RANGE (1 << 2) /**< A byte range may be read apart from the stream */
+
+/* Public Types --------------------------------------------------------------*/
+
+typedef struct image_source image_source_t;
+
+/**
+ * @brief Operations of a source implementation
+ */
+typedef struct image_source_ops {
+    const char *name; /**< Name of the implementation, for the logs */
+    /**
+     * @brief Reads the next bytes of the stream
+     * @return Number of bytes read, 0 at the end of the stream, or -1 on failure
+     */
+    int (*read)(image_source_t *src, uint8_t *buffer, size_t len);
+    /**
+     * @brief Moves the stream to an offset
+     * @return ESP_OK on success, the stream is left where it was on failure
+     */
+    esp_err_t (*seek)(image_source_t *src, size_t offset);
+    /**
+     * @brief Reads a byte range apart from the stream
+     * @return Number of bytes read, or -1 on failure
+     */
+    int (*read_range)(image_source_t *src, size_t offset, size_t len, uint8_t *buffer);
+    /**
+     * @brief Releases the source
+     */
+    void (*close)(image_source_t *src);
+} image_source_ops_t;
+
+/**
+ * @brief Opened source of an image
+ */
+struct image_source {
+    const image_source_ops_t *ops; /**< Implementation */
+    uint32_t caps;                 /**< IMAGE_SOURCE_CAP_* flags */
+    int size;                      /**< Size of the image, -1 when unknown */
+    size_t position;               /**< Offset of the next byte of the stream */
+    union {
+        struct {
+            esp_http_client_handle_t client; /**< Client with the headers already fetched */
+            char url[URL_LEN + 1];           /**< URL of the image, for the range requests */
+            bool tls;                        /**< HTTPS, the certificate bundle checks the server */
+        } http;
+        struct {
+            FILE *file;                      /**< Opened file */
+        } file;
+        struct {
+            const uint8_t *data;             /**< Image in memory, owned by the caller */
+        } memory;
+    } ctx;                         /**< State of the implementation */
+};
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup image_source.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Opens an image over HTTP
+ * @param src Source
+ * @param url URL of the image, http:// or https://; an https:// URL is opened as image_source_open_https()
+ * @return ESP_OK on success, or an error code on failure
+ */
+esp_err_t image_source_open_http(image_source_t *src, const char *url);
+
+/**
+ * @brief Opens an image over HTTPS, the server checked against the certificate bundle
+ * @param src Source
+ * @param url URL of the image
+ * @return ESP_OK on success, or an error code on failure
+ */
+esp_err_t image_source_open_https(image_source_t *src, const char *url);
+
+/**
+ * @brief Wraps a client that already fetched the headers of the image, e.g. the winner of the gateway race
+ * @param src Source
+ * @param client HTTP client, released by image_source_close()
+ * @param url URL the client opened, for the range requests
+ * @param content_length Content length answered by the server, negative when unknown
+ * @return ESP_OK on success, or ESP_ERR_INVALID_ARG if the URL does not fit
+ */
+esp_err_t image_source_attach_http(image_source_t *src, esp_http_client_handle_t client, const char *url, int content_length);
+
+/**
+ * @brief Opens an image stored in a file
+ * @param src Source
+ * @param path Path in the VFS (SPIFFS, FAT on an SD card, or the host file system on the linux target)
+ * @return ESP_OK on success, or ESP_ERR_NOT_FOUND if the file does not open
+ */
+esp_err_t image_source_open_file(image_source_t *src, const char *path);
+
+/**
+ * @brief Opens an image held in memory
+ * @param src Source
+ * @param data Image, kept by the caller until image_source_close()
+ * @param len Length of the image
+ * @return ESP_OK
+ */
+esp_err_t image_source_open_memory(image_source_t *src, const uint8_t *data, size_t len);
+
+/**
+ * @brief Reads the next bytes of the stream
+ * @param src Source
+ * @param buffer Buffer where the bytes will be stored
+ * @param len Maximum number of bytes
+ * @return Number of bytes read, 0 at the end of the stream, or -1 on failure
+ */
+int image_source_read(image_source_t *src, uint8_t *buffer, size_t len);
+
+/**
+ * @brief Reads exactly len bytes of the stream
+ * @param src Source
+ * @param buffer Buffer where the bytes will be stored
+ * @param len Number of bytes
+ * @return Number of bytes read, smaller than len if the stream ended or failed
+ */
+int image_source_read_full(image_source_t *src, uint8_t *buffer, size_t len);
+
+/**
+ * @brief Moves the stream forward to an offset, reading and dropping the bytes if the source cannot seek
+ * @param src Source
+ * @param offset Offset of the next byte, not before the current position
+ * @return ESP_OK on success, or ESP_FAIL if the stream ended before the offset
+ */
+esp_err_t image_source_skip_to(image_source_t *src, size_t offset);
+
+/**
+ * @brief Reads a byte range apart from the stream
+ * @param src Source
+ * @param offset Offset of the first byte
+ * @param len Number of bytes
+ * @param buffer Buffer where the bytes will be stored
+ * @return Number of bytes read, or -1 on failure or if the source has no IMAGE_SOURCE_CAP_RANGE
+ */
+int image_source_read_range(image_source_t *src, size_t offset, size_t len, uint8_t *buffer);
+
+/**
+ * @brief Releases the source
+ * @param src Source, may be closed twice
+ */
+void image_source_close(image_source_t *src);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_IMAGE_SOURCE_H_ */
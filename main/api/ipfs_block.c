@@ -0,0 +1,827 @@
+/**
+*************************************************************************
+* @file       ipfs_block.c
+* @brief      Source file for the ipfs_block.c module.
+* @details    This file contains the implementation of functions for
+*             the ipfs_block.c module. A pool of worker tasks fetches
+*             the blocks of a window of the DAG at once, each one from
+*             its own gateway, and the calling task walks the results in
+*             file order. A block is only used after its sha2-256
+*             digest matches its CID, so any gateway can serve it.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+// FreeRTOS Includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+// ESP Includes
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_crt_bundle.h"
+#include "esp_http_client.h"
+#include "mbedtls/sha256.h"
+
+// Application Includes
+#include "tasks_common.h"
+#include "api/ipfs_block.h"
+#include "api/ipfs_gateway.h"
+#include "api/update_report.h"
+#include "api/metrics.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+// Multihash code of sha2-256
+#define IPFS_MULTIHASH_SHA2_256 0x12
+
+// Length of a CIDv1 with a sha2-256 multihash: version, codec, code, length, digest
+#define IPFS_CID_BYTES_LEN (4 + IPFS_DIGEST_SIZE)
+
+// Length of a CIDv1 string: 'b' and the base32 encoding, without padding
+#define IPFS_CID_STRING_LEN (1 + (IPFS_CID_BYTES_LEN * 8 + 4) / 5 + 1)
+
+// UnixFS node types that hold file data
+#define UNIXFS_TYPE_RAW  0
+#define UNIXFS_TYPE_FILE 2
+
+/* Typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief Block requested to a worker
+ */
+typedef struct ipfs_block_job {
+    int slot;       /**< Buffer where the block will be stored, -1 stops the worker */
+    ipfs_cid_t cid; /**< CID of the block */
+} ipfs_block_job_t;
+
+/**
+ * @brief Result of a worker
+ */
+typedef struct ipfs_block_result {
+    int slot;      /**< Buffer where the block was stored, -1 when the worker stopped */
+    esp_err_t err; /**< ESP_OK if the block matches its CID */
+    size_t len;    /**< Length of the block */
+    int attempts;  /**< Requests made for the block */
+} ipfs_block_result_t;
+
+/**
+ * @brief State shared by the walk and the workers
+ */
+typedef struct ipfs_block_session {
+    QueueHandle_t jobs;                             /**< Blocks to fetch */
+    QueueHandle_t results;                          /**< Blocks fetched */
+    uint8_t *buffers[IPFS_BLOCK_CONCURRENCY];       /**< One buffer for each block of the window */
+    int order[IPFS_GATEWAY_MAX];                    /**< Gateways from the best to the worst */
+    int gateway_count;                              /**< Number of gateways */
+} ipfs_block_session_t;
+
+/**
+ * @brief State of one worker
+ */
+typedef struct ipfs_block_worker {
+    ipfs_block_session_t *session; /**< Shared state */
+    int id;                        /**< Worker number, spreads the workers over the gateways */
+    uint8_t *buffer;               /**< Buffer of the block being received */
+    size_t len;                    /**< Bytes received */
+    bool overflow;                 /**< The block is larger than IPFS_BLOCK_MAX_SIZE */
+} ipfs_block_worker_t;
+
+/**
+ * @brief Next step for a block of the window
+ */
+typedef enum ipfs_block_action {
+    IPFS_BLOCK_WRITTEN = 0, /**< Data already passed to write */
+    IPFS_BLOCK_EXPAND,      /**< Replace the block by its links */
+    IPFS_BLOCK_REQUEUE      /**< Back to the stack with its buffer kept, its data cannot be written yet */
+} ipfs_block_action_e;
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "ipfs_block";
+
+/**
+ * @brief Alphabets of the multibase encodings supported
+ */
+static const char BASE32_ALPHABET[] = "abcdefghijklmnopqrstuvwxyz234567";
+static const char BASE58_ALPHABET[] = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Task that fetches and verifies the blocks requested
+ * @param pvParameters Worker state, released by the task
+ */
+static void ipfs_block_worker_task(void *pvParameters);
+
+/**
+ * @brief Event handler that stores the block received by a worker
+ * @param evt Pointer to HTTP client event structure
+ * @return ESP_OK
+ */
+static esp_err_t ipfs_block_event_handler(esp_http_client_event_t *evt);
+
+/**
+ * @brief Decodes a dag-pb or raw block
+ * @param codec Codec of the block
+ * @param block Block
+ * @param len Length of the block
+ * @param data File data held by the block
+ * @param data_len Length of the file data
+ * @param links Links of the block in order, or NULL to only count them
+ * @param link_count Number of links
+ * @return ESP_OK on success, or an error code if the block is not a UnixFS file node
+ */
+static esp_err_t ipfs_block_parse_node(uint32_t codec, const uint8_t *block, size_t len, const uint8_t **data, size_t *data_len, ipfs_cid_t *links, int *link_count);
+
+/**
+ * @brief Reads a protobuf field
+ * @param p Read position, moved past the field
+ * @param end End of the message
+ * @param field Field number
+ * @param value Value of a length-delimited field
+ * @param value_len Length of a length-delimited field
+ * @param varint Value of a varint field
+ * @return true if a field was read
+ */
+static bool ipfs_block_next_field(const uint8_t **p, const uint8_t *end, uint32_t *field, const uint8_t **value, size_t *value_len, uint64_t *varint);
+
+/**
+ * @brief Reads an unsigned varint
+ * @param p Read position, moved past the varint
+ * @param end End of the buffer
+ * @param value Value read
+ * @return true on success
+ */
+static bool ipfs_block_read_varint(const uint8_t **p, const uint8_t *end, uint64_t *value);
+
+/**
+ * @brief Decodes the binary form of a CID
+ * @param bytes Binary CID
+ * @param len Length of the binary CID
+ * @param cid Decoded CID
+ * @return ESP_OK on success, or an error code if the CID is not supported
+ */
+static esp_err_t ipfs_block_decode_cid(const uint8_t *bytes, size_t len, ipfs_cid_t *cid);
+
+/**
+ * @brief Encodes a CID as a CIDv1 base32 string
+ * @param cid CID
+ * @param text Buffer with IPFS_CID_STRING_LEN bytes
+ */
+static void ipfs_block_cid_to_string(const ipfs_cid_t *cid, char *text);
+
+/**
+ * @brief Finds the buffer that keeps a block of an earlier window
+ * @param held Buffers that keep a block
+ * @param held_cids CID of the block kept in each buffer
+ * @param cid CID of the block
+ * @return Index of the buffer, or -1 if the block must be fetched
+ */
+static int ipfs_block_find_held(const bool *held, const ipfs_cid_t *held_cids, const ipfs_cid_t *cid);
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup ipfs_block.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Decodes a CIDv0 (base58btc "Qm...") or CIDv1 (base32 "b...") string
+ * @param text CID string
+ * @param cid Decoded CID
+ * @return ESP_OK on success, or an error code if the CID is not supported
+ */
+esp_err_t ipfs_block_parse_cid(const char *text, ipfs_cid_t *cid){
+	uint8_t bytes[IPFS_CID_BYTES_LEN + 4] = {0};
+	size_t len = 0;
+
+	if(text == NULL){
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	if(text[0] == 'Q' && text[1] == 'm'){
+		// CIDv0: base58btc of the bare multihash, 34 bytes
+		len = 2 + IPFS_DIGEST_SIZE;
+		for(const char *c = text; *c; c++){
+			const char *pos = strchr(BASE58_ALPHABET, *c);
+			if(pos == NULL){
+				return ESP_ERR_INVALID_ARG;
+			}
+			uint32_t carry = pos - BASE58_ALPHABET;
+			for(int i = len - 1; i >= 0; i--){
+				carry += 58 * bytes[i];
+				bytes[i] = carry & 0xFF;
+				carry >>= 8;
+			}
+			if(carry != 0){
+				return ESP_ERR_INVALID_SIZE;
+			}
+		}
+	}
+	else if(text[0] == 'b'){
+		// CIDv1: multibase prefix 'b', base32 lower case without padding
+		uint32_t buffer = 0;
+		int bits = 0;
+		for(const char *c = text + 1; *c; c++){
+			const char *pos = strchr(BASE32_ALPHABET, *c);
+			if(pos == NULL){
+				return ESP_ERR_INVALID_ARG;
+			}
+			buffer = (buffer << 5) | (pos - BASE32_ALPHABET);
+			bits += 5;
+			if(bits >= 8){
+				if(len >= sizeof(bytes)){
+					return ESP_ERR_INVALID_SIZE;
+				}
+				bits -= 8;
+				bytes[len++] = (buffer >> bits) & 0xFF;
+			}
+		}
+	}
+	else{
+		ESP_LOGE(TAG, "Unsupported CID encoding: %s", text);
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+
+	return ipfs_block_decode_cid(bytes, len, cid);
+}
+
+/**
+ * @brief Encodes a binary CID (CIDv0 multihash or CIDv1) as a CIDv1 base32 string
+ * @param bytes Binary CID
+ * @param len Length of the binary CID
+ * @param text Buffer where the CID string will be stored
+ * @param size Size of the buffer
+ * @return ESP_OK on success, or an error code if the CID is not supported
+ */
+esp_err_t ipfs_block_cid_to_text(const uint8_t *bytes, size_t len, char *text, size_t size){
+	ipfs_cid_t cid;
+
+	if(size < IPFS_CID_STRING_LEN){
+		return ESP_ERR_INVALID_SIZE;
+	}
+	esp_err_t err = ipfs_block_decode_cid(bytes, len, &cid);
+	if(err != ESP_OK){
+		return err;
+	}
+	ipfs_block_cid_to_string(&cid, text);
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Fetches a UnixFS file walking its DAG and passes the data to write in order
+ * @param text CID string of the file
+ * @param write Callback that receives the file data
+ * @param bytes Number of bytes passed to write
+ * @return ESP_OK on success, or an error code on failure
+ * @note The blocks still to be walked are kept in a stack, its top is the
+ *       next block in file order. A window takes the IPFS_BLOCK_CONCURRENCY
+ *       blocks on the top; the leaves before the first internal node of the
+ *       window are written, the internal nodes are replaced by their links
+ *       and the leaves after them go back to the stack. Their buffers are
+ *       kept, so they are not fetched again when they reach the top.
+ */
+esp_err_t ipfs_block_fetch_file(const char *text, ipfs_block_write_cb_t write, uint32_t *bytes){
+	ipfs_block_session_t session = {0};
+	ipfs_cid_t window[IPFS_BLOCK_CONCURRENCY];
+	int slots[IPFS_BLOCK_CONCURRENCY];
+	ipfs_block_result_t results[IPFS_BLOCK_CONCURRENCY];
+	ipfs_block_action_e actions[IPFS_BLOCK_CONCURRENCY];
+	bool held[IPFS_BLOCK_CONCURRENCY] = {0};
+	ipfs_cid_t held_cids[IPFS_BLOCK_CONCURRENCY];
+	ipfs_cid_t *pending = NULL;
+	ipfs_cid_t *links = NULL;
+	int pending_count = 0;
+	int workers = 0;
+	esp_err_t err;
+
+	*bytes = 0;
+	session.gateway_count = ipfs_gateway_rank(session.order);
+	if(session.gateway_count == 0){
+		ESP_LOGE(TAG, "No IPFS gateway configured");
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	pending = malloc(IPFS_BLOCK_MAX_PENDING * sizeof(ipfs_cid_t));
+	links = malloc(IPFS_BLOCK_MAX_LINKS * sizeof(ipfs_cid_t));
+	session.jobs = xQueueCreate(IPFS_BLOCK_CONCURRENCY, sizeof(ipfs_block_job_t));
+	session.results = xQueueCreate(IPFS_BLOCK_CONCURRENCY, sizeof(ipfs_block_result_t));
+	err = (pending && links && session.jobs && session.results) ? ESP_OK : ESP_ERR_NO_MEM;
+	for(int i = 0; err == ESP_OK && i < IPFS_BLOCK_CONCURRENCY; i++){
+		session.buffers[i] = malloc(IPFS_BLOCK_MAX_SIZE);
+		if(session.buffers[i] == NULL){
+			err = ESP_ERR_NO_MEM;
+		}
+	}
+	if(err == ESP_OK){
+		err = ipfs_block_parse_cid(text, &pending[0]);
+		pending_count = 1;
+	}
+
+	// Start the workers
+	for(int i = 0; err == ESP_OK && i < IPFS_BLOCK_CONCURRENCY; i++){
+		ipfs_block_worker_t *worker = calloc(1, sizeof(ipfs_block_worker_t));
+		if(worker == NULL){
+			break;
+		}
+		worker->session = &session;
+		worker->id = i;
+		if(xTaskCreate(&ipfs_block_worker_task, "ipfs_block", IPFS_BLOCK_TASK_STACK_SIZE, worker, IPFS_BLOCK_TASK_PRIORITY, NULL) != pdPASS){
+			free(worker);
+			break;
+		}
+		workers++;
+	}
+	if(err == ESP_OK && workers == 0){
+		err = ESP_ERR_NO_MEM;
+	}
+
+	while(err == ESP_OK && pending_count > 0){
+		bool busy[IPFS_BLOCK_CONCURRENCY];
+		int count = 0;
+		int fetching = 0;
+
+		// Fetch the window at once; a block kept from an earlier window is taken from its buffer.
+		// An expanded node frees its buffer, so at most IPFS_BLOCK_CONCURRENCY - 1 are kept
+		memcpy(busy, held, sizeof(busy));
+		while(count < IPFS_BLOCK_CONCURRENCY && pending_count > 0){
+			int slot = ipfs_block_find_held(held, held_cids, &pending[pending_count - 1]);
+			if(slot >= 0){
+				held[slot] = false;
+			}
+			else{
+				for(slot = 0; slot < IPFS_BLOCK_CONCURRENCY && busy[slot]; slot++);
+				if(slot == IPFS_BLOCK_CONCURRENCY){
+					break;
+				}
+				ipfs_block_job_t job = { .slot = slot, .cid = pending[pending_count - 1] };
+				xQueueSend(session.jobs, &job, portMAX_DELAY);
+				fetching++;
+			}
+			busy[slot] = true;
+			slots[count] = slot;
+			window[count++] = pending[--pending_count];
+		}
+		for(int i = 0; i < fetching; i++){
+			ipfs_block_result_t result;
+			xQueueReceive(session.results, &result, portMAX_DELAY);
+			results[result.slot] = result;
+			for(int attempt = 1; attempt < result.attempts; attempt++){
+				update_report_add_retry();
+			}
+			if(result.err != ESP_OK){
+				err = result.err;
+			}
+		}
+		if(err != ESP_OK){
+			ESP_LOGE(TAG, "Block could not be fetched from any gateway");
+			break;
+		}
+
+		// Walk the window in file order
+		bool expanded = false;
+		for(int i = 0; err == ESP_OK && i < count; i++){
+			const uint8_t *data;
+			size_t data_len;
+			int link_count;
+
+			err = ipfs_block_parse_node(window[i].codec, session.buffers[slots[i]], results[slots[i]].len, &data, &data_len, NULL, &link_count);
+			if(err != ESP_OK){
+				break;
+			}
+			if(!expanded){
+				if(data_len > 0 && write(data, data_len) != FW_UPDATE_OK){
+					err = ESP_FAIL;
+					break;
+				}
+				*bytes += data_len;
+				actions[i] = IPFS_BLOCK_WRITTEN;
+				if(link_count > 0){
+					actions[i] = IPFS_BLOCK_EXPAND;
+					expanded = true;
+				}
+			}
+			else{
+				actions[i] = (link_count > 0 && data_len == 0) ? IPFS_BLOCK_EXPAND : IPFS_BLOCK_REQUEUE;
+			}
+		}
+
+		// Put back what is left, the last block of the window first
+		for(int i = count - 1; err == ESP_OK && i >= 0; i--){
+			const uint8_t *data;
+			size_t data_len;
+			int link_count = 0;
+
+			if(actions[i] == IPFS_BLOCK_REQUEUE){
+				held[slots[i]] = true;
+				held_cids[slots[i]] = window[i];
+				pending[pending_count++] = window[i];
+			}
+			else if(actions[i] == IPFS_BLOCK_EXPAND){
+				ipfs_block_parse_node(window[i].codec, session.buffers[slots[i]], results[slots[i]].len, &data, &data_len, links, &link_count);
+				if(pending_count + link_count > IPFS_BLOCK_MAX_PENDING){
+					ESP_LOGE(TAG, "DAG too wide, more than %d blocks pending", IPFS_BLOCK_MAX_PENDING);
+					err = ESP_ERR_NO_MEM;
+					break;
+				}
+				for(int j = link_count - 1; j >= 0; j--){
+					pending[pending_count++] = links[j];
+				}
+			}
+		}
+	}
+
+	// Stop the workers and wait for them before releasing the session
+	for(int i = 0; i < workers; i++){
+		ipfs_block_job_t job = { .slot = -1 };
+		xQueueSend(session.jobs, &job, portMAX_DELAY);
+	}
+	for(int stopped = 0; stopped < workers; ){
+		ipfs_block_result_t result;
+		xQueueReceive(session.results, &result, portMAX_DELAY);
+		if(result.slot < 0){
+			stopped++;
+		}
+	}
+
+	for(int i = 0; i < IPFS_BLOCK_CONCURRENCY; i++){
+		free(session.buffers[i]);
+	}
+	if(session.jobs){
+		vQueueDelete(session.jobs);
+	}
+	if(session.results){
+		vQueueDelete(session.results);
+	}
+	free(links);
+	free(pending);
+
+	if(err == ESP_OK){
+		ESP_LOGI(TAG, "File fetched, %lu bytes verified block by block", (unsigned long)*bytes);
+	}
+	return err;
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup ipfs_block.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Task that fetches and verifies the blocks requested
+ * @param pvParameters Worker state, released by the task
+ */
+static void ipfs_block_worker_task(void *pvParameters){
+	ipfs_block_worker_t *worker = (ipfs_block_worker_t *)pvParameters;
+	ipfs_block_session_t *session = worker->session;
+	esp_http_client_handle_t client = NULL;
+	char cid_string[IPFS_CID_STRING_LEN + sizeof("?format=raw")];
+	char url[URL_LEN];
+	ipfs_block_job_t job;
+
+	while(xQueueReceive(session->jobs, &job, portMAX_DELAY) == pdTRUE && job.slot >= 0){
+		ipfs_block_result_t result = { .slot = job.slot, .err = ESP_FAIL, .len = 0, .attempts = 0 };
+
+		ipfs_block_cid_to_string(&job.cid, cid_string);
+		strcat(cid_string, "?format=raw");
+
+		// Each attempt goes to the next gateway, starting from a different one in each worker
+		for(int attempt = 0; attempt < IPFS_BLOCK_MAX_ATTEMPTS && result.err != ESP_OK; attempt++){
+			int gateway = session->order[(worker->id + attempt) % session->gateway_count];
+			uint8_t digest[IPFS_DIGEST_SIZE];
+
+			result.attempts++;
+			if(ipfs_gateway_build_url(gateway, cid_string, url, sizeof(url)) != ESP_OK){
+				continue;
+			}
+			if(client == NULL){
+				esp_http_client_config_t config = {
+					.url = url,
+					.event_handler = ipfs_block_event_handler,
+					.user_data = worker,
+					.crt_bundle_attach = esp_crt_bundle_attach,
+				};
+				client = esp_http_client_init(&config);
+				if(client == NULL){
+					continue;
+				}
+				esp_http_client_set_header(client, "Accept", "application/vnd.ipld.raw");
+			}
+			else{
+				// Same host keeps the connection alive, another host reconnects
+				esp_http_client_set_url(client, url);
+			}
+
+			worker->buffer = session->buffers[job.slot];
+			worker->len = 0;
+			worker->overflow = false;
+			if(esp_http_client_perform(client) != ESP_OK){
+				esp_http_client_cleanup(client);
+				client = NULL;
+				continue;
+			}
+			if(esp_http_client_get_status_code(client) != 200 || worker->overflow){
+				ESP_LOGE(TAG, "Block %s refused by %s, status %d", cid_string, url, esp_http_client_get_status_code(client));
+				continue;
+			}
+
+			// Use the block only if it is the one the CID names
+			mbedtls_sha256(worker->buffer, worker->len, digest, 0);
+			if(memcmp(digest, job.cid.digest, IPFS_DIGEST_SIZE) != 0){
+				ESP_LOGE(TAG, "Block from %s does not match its CID", url);
+				continue;
+			}
+			result.err = ESP_OK;
+			result.len = worker->len;
+		}
+		xQueueSend(session->results, &result, portMAX_DELAY);
+	}
+
+	if(client != NULL){
+		esp_http_client_cleanup(client);
+	}
+	ipfs_block_result_t stopped = { .slot = -1, .err = ESP_OK };
+	xQueueSend(session->results, &stopped, portMAX_DELAY);
+	free(worker);
+	vTaskDelete(NULL);
+}
+
+/**
+ * @brief Event handler that stores the block received by a worker
+ * @param evt Pointer to HTTP client event structure
+ * @return ESP_OK
+ */
+static esp_err_t ipfs_block_event_handler(esp_http_client_event_t *evt){
+	ipfs_block_worker_t *worker = (ipfs_block_worker_t *)evt->user_data;
+
+	if(evt->event_id == HTTP_EVENT_ON_CONNECTED){
+		metrics_count_connection(evt->client);
+	}
+	if(evt->event_id == HTTP_EVENT_ON_DATA && worker != NULL){
+		if(worker->len + evt->data_len > IPFS_BLOCK_MAX_SIZE){
+			worker->overflow = true;
+		}
+		else{
+			memcpy(worker->buffer + worker->len, evt->data, evt->data_len);
+			worker->len += evt->data_len;
+		}
+	}
+	return ESP_OK;
+}
+
+/**
+ * @brief Decodes a dag-pb or raw block
+ * @param codec Codec of the block
+ * @param block Block
+ * @param len Length of the block
+ * @param data File data held by the block
+ * @param data_len Length of the file data
+ * @param links Links of the block in order, or NULL to only count them
+ * @param link_count Number of links
+ * @return ESP_OK on success, or an error code if the block is not a UnixFS file node
+ */
+static esp_err_t ipfs_block_parse_node(uint32_t codec, const uint8_t *block, size_t len, const uint8_t **data, size_t *data_len, ipfs_cid_t *links, int *link_count){
+	const uint8_t *p = block;
+	const uint8_t *end = block + len;
+	const uint8_t *value;
+	size_t value_len;
+	uint64_t varint;
+	uint32_t field;
+
+	*data = NULL;
+	*data_len = 0;
+	*link_count = 0;
+
+	if(codec == IPFS_CODEC_RAW){
+		*data = block;
+		*data_len = len;
+		return ESP_OK;
+	}
+
+	// PBNode: Links = 2 (PBLink), Data = 1 (UnixFS Data)
+	while(p < end){
+		if(!ipfs_block_next_field(&p, end, &field, &value, &value_len, &varint)){
+			return ESP_ERR_INVALID_RESPONSE;
+		}
+		if(field == 2 && value != NULL){
+			// PBLink: Hash = 1
+			const uint8_t *lp = value;
+			const uint8_t *lend = value + value_len;
+			const uint8_t *hash = NULL;
+			size_t hash_len = 0;
+			while(lp < lend){
+				if(!ipfs_block_next_field(&lp, lend, &field, &value, &value_len, &varint)){
+					return ESP_ERR_INVALID_RESPONSE;
+				}
+				if(field == 1 && value != NULL){
+					hash = value;
+					hash_len = value_len;
+				}
+			}
+			if(*link_count >= IPFS_BLOCK_MAX_LINKS){
+				return ESP_ERR_INVALID_SIZE;
+			}
+			ipfs_cid_t cid;
+			if(hash == NULL || ipfs_block_decode_cid(hash, hash_len, (links != NULL) ? &links[*link_count] : &cid) != ESP_OK){
+				return ESP_ERR_NOT_SUPPORTED;
+			}
+			(*link_count)++;
+		}
+		else if(field == 1 && value != NULL){
+			// UnixFS Data: Type = 1, Data = 2
+			const uint8_t *up = value;
+			const uint8_t *uend = value + value_len;
+			uint64_t type = UNIXFS_TYPE_FILE;
+			while(up < uend){
+				if(!ipfs_block_next_field(&up, uend, &field, &value, &value_len, &varint)){
+					return ESP_ERR_INVALID_RESPONSE;
+				}
+				if(field == 1 && value == NULL){
+					type = varint;
+				}
+				else if(field == 2 && value != NULL){
+					*data = value;
+					*data_len = value_len;
+				}
+			}
+			if(type != UNIXFS_TYPE_FILE && type != UNIXFS_TYPE_RAW){
+				ESP_LOGE(TAG, "UnixFS node type %u is not a file", (unsigned)type);
+				return ESP_ERR_NOT_SUPPORTED;
+			}
+		}
+	}
+	return ESP_OK;
+}
+
+/**
+ * @brief Reads a protobuf field
+ * @param p Read position, moved past the field
+ * @param end End of the message
+ * @param field Field number
+ * @param value Value of a length-delimited field
+ * @param value_len Length of a length-delimited field
+ * @param varint Value of a varint field
+ * @return true if a field was read
+ */
+static bool ipfs_block_next_field(const uint8_t **p, const uint8_t *end, uint32_t *field, const uint8_t **value, size_t *value_len, uint64_t *varint){
+	uint64_t key;
+
+	*value = NULL;
+	*value_len = 0;
+	if(!ipfs_block_read_varint(p, end, &key)){
+		return false;
+	}
+	*field = key >> 3;
+
+	switch(key & 0x07){
+		case 0:
+			return ipfs_block_read_varint(p, end, varint);
+		case 1:
+			if(end - *p < 8){
+				return false;
+			}
+			*p += 8;
+			return true;
+		case 2:
+			if(!ipfs_block_read_varint(p, end, varint) || *varint > (uint64_t)(end - *p)){
+				return false;
+			}
+			*value = *p;
+			*value_len = *varint;
+			*p += *varint;
+			return true;
+		case 5:
+			if(end - *p < 4){
+				return false;
+			}
+			*p += 4;
+			return true;
+		default:
+			return false;
+	}
+}
+
+/**
+ * @brief Reads an unsigned varint
+ * @param p Read position, moved past the varint
+ * @param end End of the buffer
+ * @param value Value read
+ * @return true on success
+ */
+static bool ipfs_block_read_varint(const uint8_t **p, const uint8_t *end, uint64_t *value){
+	*value = 0;
+	for(int shift = 0; shift < 64 && *p < end; shift += 7){
+		uint8_t byte = *(*p)++;
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if((byte & 0x80) == 0){
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Decodes the binary form of a CID
+ * @param bytes Binary CID
+ * @param len Length of the binary CID
+ * @param cid Decoded CID
+ * @return ESP_OK on success, or an error code if the CID is not supported
+ */
+static esp_err_t ipfs_block_decode_cid(const uint8_t *bytes, size_t len, ipfs_cid_t *cid){
+	const uint8_t *p = bytes;
+	const uint8_t *end = bytes + len;
+	uint64_t version, codec, code, digest_len;
+
+	// CIDv0 is the bare sha2-256 multihash of a dag-pb block
+	if(len == 2 + IPFS_DIGEST_SIZE && bytes[0] == IPFS_MULTIHASH_SHA2_256 && bytes[1] == IPFS_DIGEST_SIZE){
+		cid->codec = IPFS_CODEC_DAG_PB;
+		memcpy(cid->digest, bytes + 2, IPFS_DIGEST_SIZE);
+		return ESP_OK;
+	}
+
+	if(!ipfs_block_read_varint(&p, end, &version) || version != 1 ||
+	   !ipfs_block_read_varint(&p, end, &codec) ||
+	   !ipfs_block_read_varint(&p, end, &code) ||
+	   !ipfs_block_read_varint(&p, end, &digest_len)){
+		return ESP_ERR_INVALID_ARG;
+	}
+	if(codec != IPFS_CODEC_RAW && codec != IPFS_CODEC_DAG_PB){
+		ESP_LOGE(TAG, "Unsupported codec 0x%llx", (unsigned long long)codec);
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+	if(code != IPFS_MULTIHASH_SHA2_256 || digest_len != IPFS_DIGEST_SIZE || end - p < IPFS_DIGEST_SIZE){
+		ESP_LOGE(TAG, "Unsupported multihash 0x%llx", (unsigned long long)code);
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+	cid->codec = codec;
+	memcpy(cid->digest, p, IPFS_DIGEST_SIZE);
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Encodes a CID as a CIDv1 base32 string
+ * @param cid CID
+ * @param text Buffer with IPFS_CID_STRING_LEN bytes
+ */
+static void ipfs_block_cid_to_string(const ipfs_cid_t *cid, char *text){
+	uint8_t bytes[IPFS_CID_BYTES_LEN] = { 0x01, cid->codec, IPFS_MULTIHASH_SHA2_256, IPFS_DIGEST_SIZE };
+	uint32_t buffer = 0;
+	int bits = 0;
+	int pos = 0;
+
+	memcpy(bytes + 4, cid->digest, IPFS_DIGEST_SIZE);
+	text[pos++] = 'b';
+	for(int i = 0; i < sizeof(bytes); i++){
+		buffer = (buffer << 8) | bytes[i];
+		bits += 8;
+		while(bits >= 5){
+			bits -= 5;
+			text[pos++] = BASE32_ALPHABET[(buffer >> bits) & 0x1F];
+		}
+	}
+	if(bits > 0){
+		text[pos++] = BASE32_ALPHABET[(buffer << (5 - bits)) & 0x1F];
+	}
+	text[pos] = '\0';
+}
+
+/**
+ * @brief Finds the buffer that keeps a block of an earlier window
+ * @param held Buffers that keep a block
+ * @param held_cids CID of the block kept in each buffer
+ * @param cid CID of the block
+ * @return Index of the buffer, or -1 if the block must be fetched
+ */
+static int ipfs_block_find_held(const bool *held, const ipfs_cid_t *held_cids, const ipfs_cid_t *cid){
+	for(int i = 0; i < IPFS_BLOCK_CONCURRENCY; i++){
+		if(held[i] && held_cids[i].codec == cid->codec && memcmp(held_cids[i].digest, cid->digest, IPFS_DIGEST_SIZE) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+/** @} */
@@ -0,0 +1,99 @@
+/**
+*************************************************************************
+* @file       ipfs_block.h
+* @brief      Header file for the ipfs_block.h module.
+* @details    This file contains declarations and prototypes for the
+*             ipfs_block.h module, which fetches a file from IPFS
+*             gateways block by block (trustless gateway format,
+*             application/vnd.ipld.raw), checking the multihash of each
+*             block against its CID before using it.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_IPFS_BLOCK_H_
+#define MAIN_API_IPFS_BLOCK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "api/fw_update.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/**
+ * @brief Multicodec of the blocks supported
+ */
+#define IPFS_CODEC_RAW    0x55
+#define IPFS_CODEC_DAG_PB 0x70
+
+/**
+ * @brief Size of a sha2-256 digest
+ */
+#define IPFS_DIGEST_SIZE  32
+
+/* Public Types --------------------------------------------------------------*/
+
+/**
+ * @brief Decoded CID, only sha2-256 multihashes are supported
+ */
+typedef struct ipfs_cid {
+    uint32_t codec;                   /**< IPFS_CODEC_RAW or IPFS_CODEC_DAG_PB */
+    uint8_t digest[IPFS_DIGEST_SIZE]; /**< sha2-256 digest of the block */
+} ipfs_cid_t;
+
+/**
+ * @brief Callback that receives the file data, in order
+ * @param data Data of the file
+ * @param len Length of the data
+ * @return FW_UPDATE_OK to continue, any other value aborts the fetch
+ */
+typedef fw_update_ret_e (*ipfs_block_write_cb_t)(const uint8_t *data, size_t len);
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup ipfs_block.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Decodes a CIDv0 (base58btc "Qm...") or CIDv1 (base32 "b...") string
+ * @param text CID string
+ * @param cid Decoded CID
+ * @return ESP_OK on success, or an error code if the CID is not supported
+ */
+esp_err_t ipfs_block_parse_cid(const char *text, ipfs_cid_t *cid);
+
+/**
+ * @brief Encodes a binary CID (CIDv0 multihash or CIDv1) as a CIDv1 base32 string
+ * @param bytes Binary CID
+ * @param len Length of the binary CID
+ * @param text Buffer where the CID string will be stored
+ * @param size Size of the buffer
+ * @return ESP_OK on success, or an error code if the CID is not supported
+ */
+esp_err_t ipfs_block_cid_to_text(const uint8_t *bytes, size_t len, char *text, size_t size);
+
+/**
+ * @brief Fetches a UnixFS file walking its DAG and passes the data to write in order
+ * @param text CID string of the file
+ * @param write Callback that receives the file data
+ * @param bytes Number of bytes passed to write
+ * @return ESP_OK on success, or an error code on failure
+ */
+esp_err_t ipfs_block_fetch_file(const char *text, ipfs_block_write_cb_t write, uint32_t *bytes);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_IPFS_BLOCK_H_ */
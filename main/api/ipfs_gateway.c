@@ -0,0 +1,561 @@
+/**
+*************************************************************************
+* @file       ipfs_gateway.c
+* @brief      Source file for the ipfs_gateway.c module.
+* @details    This file contains the implementation of functions for
+*             the ipfs_gateway.c module. Each gateway of the race is
+*             opened by its own short-lived task; the first one to
+*             answer the headers keeps its connection and the others
+*             close theirs as soon as they return.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// FreeRTOS Includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+// ESP Includes
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_crt_bundle.h"
+#include "esp_http_client.h"
+#include "nvs.h"
+
+// Application Includes
+#include "tasks_common.h"
+#include "api/ipfs_gateway.h"
+#include "api/metrics.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+// NVS namespace and key used to store the gateway statistics
+#define IPFS_GATEWAY_NVS_NAMESPACE "ipfs_gateway"
+#define IPFS_GATEWAY_NVS_KEY       "gateways"
+
+// Slots kept free for the local peers of the peer cache
+#if PEER_CACHE_ENABLED
+#define IPFS_GATEWAY_PEER_MAX PEER_CACHE_MAX_PEERS
+#else
+#define IPFS_GATEWAY_PEER_MAX 0
+#endif
+
+/* Typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief Gateway and the statistics of the previous downloads
+ */
+typedef struct ipfs_gateway {
+    char url[IPFS_GATEWAY_URL_LEN]; /**< Base URL, ending with "/ipfs/" */
+    uint32_t throughput;            /**< Moving average of the throughput in bytes/s, 0 if never measured */
+    uint16_t failures;              /**< Consecutive failures */
+} ipfs_gateway_t;
+
+/**
+ * @brief State shared by the racers and the task waiting for them
+ */
+typedef struct ipfs_gateway_race_ctx {
+    portMUX_TYPE lock;     /**< Protects the fields below */
+    int refs;              /**< Owners still using the context */
+    bool decided;          /**< Set by the winner, or by the waiting task on timeout */
+    QueueHandle_t results; /**< Results of the racers */
+} ipfs_gateway_race_ctx_t;
+
+/**
+ * @brief Parameters of one racer
+ */
+typedef struct ipfs_gateway_racer {
+    ipfs_gateway_race_ctx_t *race; /**< Shared race state */
+    int index;                     /**< Index of the gateway */
+    char url[URL_LEN];             /**< URL of the resource on the gateway */
+} ipfs_gateway_racer_t;
+
+/**
+ * @brief Result of one racer
+ */
+typedef struct ipfs_gateway_result {
+    int index;                       /**< Index of the gateway */
+    esp_err_t err;                   /**< ESP_OK for the winner */
+    esp_http_client_handle_t client; /**< Client of the winner, NULL otherwise */
+    int content_length;              /**< Content length answered by the winner */
+} ipfs_gateway_result_t;
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "ipfs_gateway";
+
+/**
+ * @brief Gateway list, configured gateways first and local peers last
+ */
+static ipfs_gateway_t g_gateways[IPFS_GATEWAY_MAX];
+static int g_gateway_count = 0;
+
+/**
+ * @brief Marks the local peers, which are raced first and never saved
+ */
+static bool g_peer[IPFS_GATEWAY_MAX];
+static int g_peer_count = 0;
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Saves the gateway list into NVS
+ */
+static void ipfs_gateway_save(void);
+
+/**
+ * @brief Finds a gateway in the list
+ * @param base_url Base URL of the gateway
+ * @return Index of the gateway, or -1 if not found
+ */
+static int ipfs_gateway_find(const char *base_url);
+
+/**
+ * @brief Task that opens one gateway of the race
+ * @param pvParameters Racer parameters, released by the task
+ */
+static void ipfs_gateway_racer_task(void *pvParameters);
+
+/**
+ * @brief Drops one reference to the race context, releasing it with the last one
+ * @param race Race context
+ */
+static void ipfs_gateway_race_release(ipfs_gateway_race_ctx_t *race);
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup ipfs_gateway.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Loads the gateways from IPFS_GATEWAY_LIST and their statistics from NVS
+ */
+void ipfs_gateway_init(void){
+	static const char *configured[] = IPFS_GATEWAY_LIST;
+	ipfs_gateway_t stored[IPFS_GATEWAY_MAX];
+	size_t size = sizeof(stored);
+	int stored_count = 0;
+	nvs_handle_t nvs_handle;
+
+	g_gateway_count = 0;
+	g_peer_count = 0;
+	memset(g_gateways, 0x00, sizeof(g_gateways));
+	memset(g_peer, 0x00, sizeof(g_peer));
+	for(int i = 0; i < sizeof(configured) / sizeof(configured[0]); i++){
+		ipfs_gateway_add(configured[i]);
+	}
+
+	if(nvs_open(IPFS_GATEWAY_NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK){
+		if(nvs_get_blob(nvs_handle, IPFS_GATEWAY_NVS_KEY, stored, &size) == ESP_OK){
+			stored_count = size / sizeof(ipfs_gateway_t);
+		}
+		nvs_close(nvs_handle);
+	}
+
+	// Keep the statistics, and the gateways learned from the metadata
+	for(int i = 0; i < stored_count; i++){
+		stored[i].url[IPFS_GATEWAY_URL_LEN - 1] = '\0';
+		if(ipfs_gateway_add(stored[i].url)){
+			int index = ipfs_gateway_find(stored[i].url);
+			g_gateways[index].throughput = stored[i].throughput;
+			g_gateways[index].failures = stored[i].failures;
+		}
+	}
+	ESP_LOGI(TAG, "IPFS gateways: %d", g_gateway_count);
+}
+
+/**
+ * @brief Adds a gateway published in the metadata
+ * @param base_url Base URL of the gateway, ending with "/ipfs/"
+ * @return true if the gateway is in the list
+ */
+bool ipfs_gateway_add(const char *base_url){
+	if(base_url == NULL || strlen(base_url) == 0 || strlen(base_url) >= IPFS_GATEWAY_URL_LEN){
+		return false;
+	}
+	if(ipfs_gateway_find(base_url) >= 0){
+		return true;
+	}
+	if(g_gateway_count - g_peer_count >= IPFS_GATEWAY_MAX - IPFS_GATEWAY_PEER_MAX){
+		ESP_LOGI(TAG, "Gateway list full, ignoring %s", base_url);
+		return false;
+	}
+	strcpy(g_gateways[g_gateway_count].url, base_url);
+	g_gateways[g_gateway_count].throughput = 0;
+	g_gateways[g_gateway_count].failures = 0;
+	g_peer[g_gateway_count] = false;
+	g_gateway_count++;
+
+	return true;
+}
+
+/**
+ * @brief Replaces the local peers serving the next download
+ * @param urls Base URLs of the peers, ending with "/ipfs/"
+ * @param count Number of peers
+ * @note The indexes of the gateways may change, so it must not be called during a download.
+ */
+void ipfs_gateway_set_peers(const char urls[][IPFS_GATEWAY_URL_LEN], int count){
+	int kept = 0;
+
+	// Drop the peers of the previous download
+	for(int i = 0; i < g_gateway_count; i++){
+		if(!g_peer[i]){
+			g_gateways[kept] = g_gateways[i];
+			g_peer[kept] = false;
+			kept++;
+		}
+	}
+	g_gateway_count = kept;
+	g_peer_count = 0;
+
+	for(int i = 0; i < count && g_gateway_count < IPFS_GATEWAY_MAX; i++){
+		if(ipfs_gateway_find(urls[i]) >= 0){
+			continue;
+		}
+		snprintf(g_gateways[g_gateway_count].url, IPFS_GATEWAY_URL_LEN, "%s", urls[i]);
+		g_gateways[g_gateway_count].throughput = 0;
+		g_gateways[g_gateway_count].failures = 0;
+		g_peer[g_gateway_count] = true;
+		g_gateway_count++;
+		g_peer_count++;
+	}
+}
+
+/**
+ * @brief Builds the URL of a CID on a gateway
+ * @param index Index of the gateway in the list
+ * @param cid CID of the resource
+ * @param url Buffer where the URL will be stored
+ * @param url_len Size of the buffer
+ * @return ESP_OK on success, or an error code on failure
+ */
+esp_err_t ipfs_gateway_build_url(int index, const char *cid, char *url, size_t url_len){
+	if(index < 0 || index >= g_gateway_count || cid == NULL){
+		return ESP_ERR_INVALID_ARG;
+	}
+	if(snprintf(url, url_len, "%s%s", g_gateways[index].url, cid) >= url_len){
+		return ESP_ERR_INVALID_SIZE;
+	}
+	return ESP_OK;
+}
+
+/**
+ * @brief Opens the CID on the best ranked gateways at once and keeps the first one to answer
+ * @param cid CID of the resource
+ * @param conn Connection that won the race
+ * @return ESP_OK on success, or an error code if no gateway answered
+ * @note A racer still connecting when the race is decided cannot be
+ *       interrupted, it closes its connection when it returns, at most
+ *       IPFS_GATEWAY_RACE_TIMEOUT_MS later.
+ */
+esp_err_t ipfs_gateway_race(const char *cid, ipfs_gateway_conn_t *conn){
+	int order[IPFS_GATEWAY_MAX];
+	int count = ipfs_gateway_rank(order);
+
+	if(count > IPFS_GATEWAY_RACE_COUNT){
+		count = IPFS_GATEWAY_RACE_COUNT;
+	}
+	if(count == 0){
+		ESP_LOGE(TAG, "No IPFS gateway configured");
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	ipfs_gateway_race_ctx_t *race = calloc(1, sizeof(ipfs_gateway_race_ctx_t));
+	if(race == NULL){
+		return ESP_ERR_NO_MEM;
+	}
+	race->results = xQueueCreate(count, sizeof(ipfs_gateway_result_t));
+	if(race->results == NULL){
+		free(race);
+		return ESP_ERR_NO_MEM;
+	}
+	portMUX_INITIALIZE(&race->lock);
+	race->refs = 1;
+	race->decided = false;
+	conn->opened_at = esp_timer_get_time();
+
+	// Start one racer for each gateway
+	int started = 0;
+	for(int i = 0; i < count; i++){
+		ipfs_gateway_racer_t *racer = calloc(1, sizeof(ipfs_gateway_racer_t));
+		if(racer == NULL || ipfs_gateway_build_url(order[i], cid, racer->url, sizeof(racer->url)) != ESP_OK){
+			free(racer);
+			continue;
+		}
+		racer->race = race;
+		racer->index = order[i];
+
+		// The racer may finish and release itself before xTaskCreate returns
+		ESP_LOGI(TAG, "Racing %s", racer->url);
+		taskENTER_CRITICAL(&race->lock);
+		race->refs++;
+		taskEXIT_CRITICAL(&race->lock);
+		if(xTaskCreate(&ipfs_gateway_racer_task, "ipfs_racer", IPFS_GATEWAY_RACE_TASK_STACK_SIZE, racer, IPFS_GATEWAY_RACE_TASK_PRIORITY, NULL) != pdPASS){
+			taskENTER_CRITICAL(&race->lock);
+			race->refs--;
+			taskEXIT_CRITICAL(&race->lock);
+			free(racer);
+			continue;
+		}
+		started++;
+	}
+
+	// Wait for the first gateway to answer
+	esp_err_t err = ESP_ERR_TIMEOUT;
+	TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(IPFS_GATEWAY_RACE_TIMEOUT_MS);
+	bool closed = false;
+	int answered = 0;
+	while(answered < started){
+		ipfs_gateway_result_t result;
+		TickType_t now = xTaskGetTickCount();
+		TickType_t wait = closed ? portMAX_DELAY : ((now < deadline) ? deadline - now : 0);
+
+		if(xQueueReceive(race->results, &result, wait) != pdTRUE){
+			// Close the race, unless a winner is already sending its result
+			bool decided;
+			taskENTER_CRITICAL(&race->lock);
+			decided = race->decided;
+			race->decided = true;
+			taskEXIT_CRITICAL(&race->lock);
+			if(!decided){
+				break;
+			}
+			closed = true;
+			continue;
+		}
+		answered++;
+		if(result.err == ESP_OK){
+			conn->client = result.client;
+			conn->index = result.index;
+			conn->content_length = result.content_length;
+			ESP_LOGI(TAG, "Gateway %s answered first in %lld ms", g_gateways[result.index].url, (long long)((esp_timer_get_time() - conn->opened_at) / 1000));
+			err = ESP_OK;
+			break;
+		}
+		if(result.err != ESP_ERR_INVALID_STATE){
+			ipfs_gateway_record_failure(result.index);
+		}
+	}
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "No IPFS gateway answered");
+	}
+	ipfs_gateway_race_release(race);
+
+	return err;
+}
+
+/**
+ * @brief Fills order with the gateway indexes from the best to the worst
+ * @param order Array with IPFS_GATEWAY_MAX positions
+ * @return Number of gateways
+ * @note Local peers come first, then the gateways never measured, so a
+ *       new gateway gets into the race; the others are ordered by
+ *       throughput and failures.
+ */
+int ipfs_gateway_rank(int *order){
+	for(int i = 0; i < g_gateway_count; i++){
+		order[i] = i;
+	}
+
+	// Insertion sort, the list is a handful of entries
+	for(int i = 1; i < g_gateway_count; i++){
+		int current = order[i];
+		const ipfs_gateway_t *gw = &g_gateways[current];
+		bool gw_new = (gw->throughput == 0 && gw->failures == 0);
+		int j = i - 1;
+
+		while(j >= 0){
+			const ipfs_gateway_t *other = &g_gateways[order[j]];
+			bool other_new = (other->throughput == 0 && other->failures == 0);
+			bool before = (g_peer[current] && !g_peer[order[j]]) ||
+			              (g_peer[current] == g_peer[order[j]] && ((gw_new && !other_new) ||
+			              (gw_new == other_new && (gw->throughput > other->throughput ||
+			              (gw->throughput == other->throughput && gw->failures < other->failures)))));
+			if(!before){
+				break;
+			}
+			order[j + 1] = order[j];
+			j--;
+		}
+		order[j + 1] = current;
+	}
+	return g_gateway_count;
+}
+
+/**
+ * @brief Stores the throughput of a finished download
+ * @param index Index of the gateway in the list
+ * @param bytes Bytes downloaded
+ * @param elapsed_ms Duration of the download in milliseconds
+ */
+void ipfs_gateway_record(int index, uint32_t bytes, uint32_t elapsed_ms){
+	if(index < 0 || index >= g_gateway_count){
+		return;
+	}
+	uint32_t throughput = (uint64_t)bytes * 1000 / (elapsed_ms ? elapsed_ms : 1);
+
+	// Moving average, so one slow download does not drop a good gateway
+	if(g_gateways[index].throughput == 0){
+		g_gateways[index].throughput = throughput;
+	}
+	else{
+		g_gateways[index].throughput = (3 * (uint64_t)g_gateways[index].throughput + throughput) / 4;
+	}
+	g_gateways[index].failures = 0;
+	ESP_LOGI(TAG, "Gateway %s: %lu B/s", g_gateways[index].url, (unsigned long)g_gateways[index].throughput);
+	ipfs_gateway_save();
+}
+
+/**
+ * @brief Stores a failure of a gateway, lowering its rank
+ * @param index Index of the gateway in the list
+ */
+void ipfs_gateway_record_failure(int index){
+	if(index < 0 || index >= g_gateway_count){
+		return;
+	}
+	g_gateways[index].throughput /= 2;
+	if(g_gateways[index].failures < UINT16_MAX){
+		g_gateways[index].failures++;
+	}
+	ESP_LOGI(TAG, "Gateway %s failed %u times", g_gateways[index].url, g_gateways[index].failures);
+	ipfs_gateway_save();
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup ipfs_gateway.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Saves the gateway list into NVS
+ */
+static void ipfs_gateway_save(void){
+	ipfs_gateway_t stored[IPFS_GATEWAY_MAX];
+	int stored_count = 0;
+	nvs_handle_t nvs_handle;
+
+	// The local peers change with each download, they are not kept
+	for(int i = 0; i < g_gateway_count; i++){
+		if(!g_peer[i]){
+			stored[stored_count++] = g_gateways[i];
+		}
+	}
+	esp_err_t err = nvs_open(IPFS_GATEWAY_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
+		return;
+	}
+	err = nvs_set_blob(nvs_handle, IPFS_GATEWAY_NVS_KEY, stored, stored_count * sizeof(ipfs_gateway_t));
+	if(err == ESP_OK){
+		err = nvs_commit(nvs_handle);
+	}
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "Failed to save the gateways: %s", esp_err_to_name(err));
+	}
+	nvs_close(nvs_handle);
+}
+
+/**
+ * @brief Finds a gateway in the list
+ * @param base_url Base URL of the gateway
+ * @return Index of the gateway, or -1 if not found
+ */
+static int ipfs_gateway_find(const char *base_url){
+	for(int i = 0; i < g_gateway_count; i++){
+		if(strcmp(g_gateways[i].url, base_url) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Task that opens one gateway of the race
+ * @param pvParameters Racer parameters, released by the task
+ */
+static void ipfs_gateway_racer_task(void *pvParameters){
+	ipfs_gateway_racer_t *racer = (ipfs_gateway_racer_t *)pvParameters;
+	ipfs_gateway_race_ctx_t *race = racer->race;
+	ipfs_gateway_result_t result = {
+		.index = racer->index,
+		.err = ESP_FAIL,
+		.client = NULL,
+		.content_length = 0,
+	};
+	esp_http_client_config_t config = {
+		.url = racer->url,
+		.timeout_ms = IPFS_GATEWAY_RACE_TIMEOUT_MS,
+		.crt_bundle_attach = esp_crt_bundle_attach,
+	};
+
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	if(client != NULL && esp_http_client_open(client, 0) == ESP_OK){
+		metrics_count_connection(client);
+		result.content_length = esp_http_client_fetch_headers(client);
+		if(result.content_length >= 0 && esp_http_client_get_status_code(client) == 200){
+			result.err = ESP_OK;
+		}
+	}
+
+	// Only the first racer to answer keeps its connection
+	if(result.err == ESP_OK){
+		taskENTER_CRITICAL(&race->lock);
+		if(race->decided){
+			result.err = ESP_ERR_INVALID_STATE;
+		}
+		race->decided = true;
+		taskEXIT_CRITICAL(&race->lock);
+	}
+	if(result.err == ESP_OK){
+		result.client = client;
+	}
+	else if(client != NULL){
+		esp_http_client_cleanup(client);
+	}
+
+	xQueueSend(race->results, &result, 0);
+	ipfs_gateway_race_release(race);
+	free(racer);
+	vTaskDelete(NULL);
+}
+
+/**
+ * @brief Drops one reference to the race context, releasing it with the last one
+ * @param race Race context
+ */
+static void ipfs_gateway_race_release(ipfs_gateway_race_ctx_t *race){
+	bool last;
+	taskENTER_CRITICAL(&race->lock);
+	last = (--race->refs == 0);
+	taskEXIT_CRITICAL(&race->lock);
+
+	if(last){
+		vQueueDelete(race->results);
+		free(race);
+	}
+}
+
+/** @} */
@@ -0,0 +1,119 @@
+/**
+*************************************************************************
+* @file       ipfs_gateway.h
+* @brief      Header file for the ipfs_gateway.h module.
+* @details    This file contains declarations and prototypes for the
+*             ipfs_gateway.h module, which keeps the list of IPFS
+*             gateways, ranks them by the throughput measured in the
+*             previous downloads and races the best ones to open the
+*             firmware download.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_IPFS_GATEWAY_H_
+#define MAIN_API_IPFS_GATEWAY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_http_client.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/**
+ * @brief Maximum length of a gateway base URL
+ */
+#define IPFS_GATEWAY_URL_LEN 96
+
+/* Public Types --------------------------------------------------------------*/
+
+/**
+ * @brief Connection that won the race
+ */
+typedef struct ipfs_gateway_conn {
+    esp_http_client_handle_t client; /**< Client with the headers already fetched */
+    int index;                       /**< Index of the gateway in the list */
+    int content_length;              /**< Content length answered by the gateway */
+    int64_t opened_at;               /**< Time the race started, in microseconds */
+} ipfs_gateway_conn_t;
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup ipfs_gateway.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Loads the gateways from IPFS_GATEWAY_LIST and their statistics from NVS
+ */
+void ipfs_gateway_init(void);
+
+/**
+ * @brief Adds a gateway published in the metadata
+ * @param base_url Base URL of the gateway, ending with "/ipfs/"
+ * @return true if the gateway is in the list
+ */
+bool ipfs_gateway_add(const char *base_url);
+
+/**
+ * @brief Replaces the local peers serving the next download
+ * @param urls Base URLs of the peers, ending with "/ipfs/"
+ * @param count Number of peers
+ */
+void ipfs_gateway_set_peers(const char urls[][IPFS_GATEWAY_URL_LEN], int count);
+
+/**
+ * @brief Builds the URL of a CID on a gateway
+ * @param index Index of the gateway in the list
+ * @param cid CID of the resource
+ * @param url Buffer where the URL will be stored
+ * @param url_len Size of the buffer
+ * @return ESP_OK on success, or an error code on failure
+ */
+esp_err_t ipfs_gateway_build_url(int index, const char *cid, char *url, size_t url_len);
+
+/**
+ * @brief Fills order with the gateway indexes from the best to the worst
+ * @param order Array with IPFS_GATEWAY_MAX positions
+ * @return Number of gateways
+ */
+int ipfs_gateway_rank(int *order);
+
+/**
+ * @brief Opens the CID on the best ranked gateways at once and keeps the first one to answer
+ * @param cid CID of the resource
+ * @param conn Connection that won the race
+ * @return ESP_OK on success, or an error code if no gateway answered
+ */
+esp_err_t ipfs_gateway_race(const char *cid, ipfs_gateway_conn_t *conn);
+
+/**
+ * @brief Stores the throughput of a finished download
+ * @param index Index of the gateway in the list
+ * @param bytes Bytes downloaded
+ * @param elapsed_ms Duration of the download in milliseconds
+ */
+void ipfs_gateway_record(int index, uint32_t bytes, uint32_t elapsed_ms);
+
+/**
+ * @brief Stores a failure of a gateway, lowering its rank
+ * @param index Index of the gateway in the list
+ */
+void ipfs_gateway_record_failure(int index);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_IPFS_GATEWAY_H_ */
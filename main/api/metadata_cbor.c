@@ -0,0 +1,589 @@
+/**
+*************************************************************************
+* @file       metadata_cbor.c
+* @brief      Source file for the metadata_cbor.c module.
+* @details    This file contains the implementation of functions for
+*             the metadata_cbor.c module. The decoder reads the response
+*             in a single pass and only copies the values it keeps;
+*             items of unknown keys are skipped, so the server can add
+*             fields. Indefinite lengths are not accepted.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+// ESP Includes
+#include "esp_err.h"
+#include "esp_log.h"
+
+// Application Includes
+#include "api/metadata_cbor.h"
+#include "api/update_report.h"
+#include "api/ipfs_block.h"
+#include "api/ipfs_gateway.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+// Major types used by the exchange
+#define CBOR_MAJOR_UINT  0
+#define CBOR_MAJOR_NINT  1
+#define CBOR_MAJOR_BYTES 2
+#define CBOR_MAJOR_TEXT  3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP   5
+#define CBOR_MAJOR_TAG   6
+
+// Deepest nesting skipped in an unknown item
+#define CBOR_MAX_DEPTH 8
+
+/* Typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief Reader of the response, advanced item by item
+ */
+typedef struct metadata_cbor_reader {
+    const uint8_t *p;   /**< Next byte */
+    const uint8_t *end; /**< End of the response */
+} metadata_cbor_reader_t;
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "metadata_cbor";
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Writes the initial byte and the argument of an item
+ * @param writer Writer
+ * @param major Major type
+ * @param value Argument: the value, the length or the count
+ */
+static void metadata_cbor_put_head(metadata_cbor_writer_t *writer, uint8_t major, uint64_t value);
+
+/**
+ * @brief Reads the initial byte and the argument of an item
+ * @param reader Reader
+ * @param major Major type
+ * @param value Argument: the value, the length or the count
+ * @return true on success, false if the item is truncated or has an indefinite length
+ */
+static bool metadata_cbor_get_head(metadata_cbor_reader_t *reader, uint8_t *major, uint64_t *value);
+
+/**
+ * @brief Reads a byte or text string, pointing into the response
+ * @param reader Reader
+ * @param major CBOR_MAJOR_BYTES or CBOR_MAJOR_TEXT
+ * @param data First byte of the string
+ * @param len Length of the string
+ * @return true on success, false if the item is not a string of that type
+ */
+static bool metadata_cbor_get_string(metadata_cbor_reader_t *reader, uint8_t major, const uint8_t **data, size_t *len);
+
+/**
+ * @brief Reads a text string into a buffer, truncating it
+ * @param reader Reader
+ * @param text Buffer where the null terminated string will be stored
+ * @param size Size of the buffer
+ * @return true on success, false if the item is not a text string
+ */
+static bool metadata_cbor_get_text(metadata_cbor_reader_t *reader, char *text, size_t size);
+
+/**
+ * @brief Reads a binary CID into its string form
+ * @param reader Reader
+ * @param text Buffer where the CID string will be stored
+ * @param size Size of the buffer
+ * @return true on success, false if the item is not a supported CID
+ */
+static bool metadata_cbor_get_cid(metadata_cbor_reader_t *reader, char *text, size_t size);
+
+/**
+ * @brief Skips an item, its content included
+ * @param reader Reader
+ * @param depth Nesting left
+ * @return true on success, false if the item is malformed
+ */
+static bool metadata_cbor_skip(metadata_cbor_reader_t *reader, int depth);
+
+/**
+ * @brief Decodes the "latestFirmware" map
+ * @param reader Reader
+ * @param firmware_info Firmware metadata
+ * @return true on success, false if the map is malformed
+ */
+static bool metadata_cbor_decode_firmware(metadata_cbor_reader_t *reader, firmware_metadata_info_t *firmware_info);
+
+/**
+ * @brief Compares a key with a name
+ * @param key Key
+ * @param len Length of the key
+ * @param name Null terminated name
+ * @return true if they are equal
+ */
+static bool metadata_cbor_key_is(const uint8_t *key, size_t len, const char *name);
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup metadata_cbor.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Starts a writer on a buffer
+ * @param writer Writer
+ * @param buffer Buffer where the item will be written
+ * @param size Size of the buffer
+ */
+void metadata_cbor_writer_init(metadata_cbor_writer_t *writer, uint8_t *buffer, size_t size){
+	writer->buffer = buffer;
+	writer->size = size;
+	writer->len = 0;
+	writer->overflow = false;
+}
+
+/**
+ * @brief Writes the header of a map
+ * @param writer Writer
+ * @param count Number of key/value pairs that follow
+ */
+void metadata_cbor_put_map(metadata_cbor_writer_t *writer, size_t count){
+	metadata_cbor_put_head(writer, CBOR_MAJOR_MAP, count);
+}
+
+/**
+ * @brief Writes the header of an array
+ * @param writer Writer
+ * @param count Number of items that follow
+ */
+void metadata_cbor_put_array(metadata_cbor_writer_t *writer, size_t count){
+	metadata_cbor_put_head(writer, CBOR_MAJOR_ARRAY, count);
+}
+
+/**
+ * @brief Writes an unsigned or negative integer
+ * @param writer Writer
+ * @param value Value
+ */
+void metadata_cbor_put_int(metadata_cbor_writer_t *writer, int64_t value){
+	if(value < 0){
+		metadata_cbor_put_head(writer, CBOR_MAJOR_NINT, (uint64_t)(-1 - value));
+	}
+	else{
+		metadata_cbor_put_head(writer, CBOR_MAJOR_UINT, (uint64_t)value);
+	}
+}
+
+/**
+ * @brief Writes a text string
+ * @param writer Writer
+ * @param text Null terminated UTF-8 string
+ */
+void metadata_cbor_put_text(metadata_cbor_writer_t *writer, const char *text){
+	size_t len = strlen(text);
+
+	metadata_cbor_put_head(writer, CBOR_MAJOR_TEXT, len);
+	if(writer->overflow || writer->size - writer->len < len){
+		writer->overflow = true;
+		return;
+	}
+	memcpy(&writer->buffer[writer->len], text, len);
+	writer->len += len;
+}
+
+/**
+ * @brief Encodes the register-device request, pending update reports included
+ * @param buffer Buffer where the request will be written
+ * @param size Size of the buffer
+ * @return Length of the request, or 0 if it does not fit into the buffer
+ */
+size_t metadata_cbor_encode_request(uint8_t *buffer, size_t size){
+	metadata_cbor_writer_t writer;
+	bool reports = update_report_pending() > 0;
+
+	metadata_cbor_writer_init(&writer, buffer, size);
+	metadata_cbor_put_map(&writer, reports ? 3 : 2);
+	metadata_cbor_put_text(&writer, "hardwareVersion");
+	metadata_cbor_put_text(&writer, HARDWARE_MODEL);
+	metadata_cbor_put_text(&writer, "softwareVersion");
+	metadata_cbor_put_text(&writer, FIRMWARE_VERSION);
+	if(reports){
+		metadata_cbor_put_text(&writer, "updateReports");
+		update_report_attach_cbor(&writer);
+	}
+	if(writer.overflow){
+		ESP_LOGE(TAG, "Request does not fit into %u bytes", (unsigned)size);
+		return 0;
+	}
+
+	return writer.len;
+}
+
+/**
+ * @brief Checks whether a response is CBOR, telling it from JSON and plain text
+ * @param data Response
+ * @param len Length of the response
+ * @return true if the response is a CBOR map
+ */
+bool metadata_cbor_is_cbor(const uint8_t *data, size_t len){
+	// A map starts with 0xA0 to 0xBF, never the first byte of ASCII or UTF-8 text
+	return len > 0 && (data[0] >> 5) == CBOR_MAJOR_MAP;
+}
+
+/**
+ * @brief Decodes the register-device response into the firmware metadata
+ * @param data Response
+ * @param len Length of the response
+ * @param firmware_info Firmware metadata, fields missing in the response are left empty
+ * @return ESP_OK on success, or an error code if the response is malformed or names an unsupported integrityAlgorithm
+ */
+esp_err_t metadata_cbor_decode_response(const uint8_t *data, size_t len, firmware_metadata_info_t *firmware_info){
+	metadata_cbor_reader_t reader = { .p = data, .end = data + len };
+	const uint8_t *key;
+	size_t key_len;
+	uint8_t major;
+	uint64_t count;
+
+	firmware_info->status[0] = '\0';
+	firmware_info->integrityHash[0] = '\0';
+	memset(firmware_info->integrityDigest, 0x00, sizeof(firmware_info->integrityDigest));
+	firmware_info->integrityAlgorithm = FW_UPDATE_HASH_SHA256;
+	firmware_info->manifestCid[0] = '\0';
+	firmware_info->chunkSize = FW_MANIFEST_DEFAULT_CHUNK_SIZE;
+
+	if(!metadata_cbor_get_head(&reader, &major, &count) || major != CBOR_MAJOR_MAP){
+		ESP_LOGE(TAG, "Response is not a map");
+		return ESP_ERR_INVALID_RESPONSE;
+	}
+	for(uint64_t i = 0; i < count; i++){
+		if(!metadata_cbor_get_string(&reader, CBOR_MAJOR_TEXT, &key, &key_len)){
+			ESP_LOGE(TAG, "Malformed response");
+			return ESP_ERR_INVALID_RESPONSE;
+		}
+
+		bool ok;
+		if(metadata_cbor_key_is(key, key_len, "message")){
+			ok = metadata_cbor_get_text(&reader, firmware_info->status, sizeof(firmware_info->status));
+		}
+		else if(metadata_cbor_key_is(key, key_len, "latestFirmware")){
+			ok = metadata_cbor_decode_firmware(&reader, firmware_info);
+		}
+		else{
+			ok = metadata_cbor_skip(&reader, CBOR_MAX_DEPTH);
+		}
+		if(!ok){
+			ESP_LOGE(TAG, "Malformed value of \"%.*s\"", (int)key_len, (const char *)key);
+			return ESP_ERR_INVALID_RESPONSE;
+		}
+	}
+
+	return ESP_OK;
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup metadata_cbor.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Writes the initial byte and the argument of an item
+ * @param writer Writer
+ * @param major Major type
+ * @param value Argument: the value, the length or the count
+ */
+static void metadata_cbor_put_head(metadata_cbor_writer_t *writer, uint8_t major, uint64_t value){
+	uint8_t head[9];
+	size_t n;
+
+	// Shortest form, as required for the deterministic encoding
+	if(value < 24){
+		head[0] = (major << 5) | value;
+		n = 1;
+	}
+	else if(value <= UINT8_MAX){
+		head[0] = (major << 5) | 24;
+		n = 2;
+	}
+	else if(value <= UINT16_MAX){
+		head[0] = (major << 5) | 25;
+		n = 3;
+	}
+	else if(value <= UINT32_MAX){
+		head[0] = (major << 5) | 26;
+		n = 5;
+	}
+	else{
+		head[0] = (major << 5) | 27;
+		n = 9;
+	}
+	for(size_t i = n - 1; i > 0; i--){
+		head[i] = value & 0xFF;
+		value >>= 8;
+	}
+
+	if(writer->overflow || writer->size - writer->len < n){
+		writer->overflow = true;
+		return;
+	}
+	memcpy(&writer->buffer[writer->len], head, n);
+	writer->len += n;
+}
+
+/**
+ * @brief Reads the initial byte and the argument of an item
+ * @param reader Reader
+ * @param major Major type
+ * @param value Argument: the value, the length or the count
+ * @return true on success, false if the item is truncated or has an indefinite length
+ */
+static bool metadata_cbor_get_head(metadata_cbor_reader_t *reader, uint8_t *major, uint64_t *value){
+	if(reader->p >= reader->end){
+		return false;
+	}
+	uint8_t initial = *reader->p++;
+	uint8_t info = initial & 0x1F;
+
+	*major = initial >> 5;
+	if(info < 24){
+		*value = info;
+		return true;
+	}
+	if(info > 27){
+		return false;
+	}
+	size_t n = 1 << (info - 24);
+	if(reader->end - reader->p < n){
+		return false;
+	}
+	*value = 0;
+	for(size_t i = 0; i < n; i++){
+		*value = (*value << 8) | *reader->p++;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Reads a byte or text string, pointing into the response
+ * @param reader Reader
+ * @param major CBOR_MAJOR_BYTES or CBOR_MAJOR_TEXT
+ * @param data First byte of the string
+ * @param len Length of the string
+ * @return true on success, false if the item is not a string of that type
+ */
+static bool metadata_cbor_get_string(metadata_cbor_reader_t *reader, uint8_t major, const uint8_t **data, size_t *len){
+	uint8_t item_major;
+	uint64_t value;
+
+	if(!metadata_cbor_get_head(reader, &item_major, &value) || item_major != major || value > (uint64_t)(reader->end - reader->p)){
+		return false;
+	}
+	*data = reader->p;
+	*len = value;
+	reader->p += value;
+
+	return true;
+}
+
+/**
+ * @brief Reads a text string into a buffer, truncating it
+ * @param reader Reader
+ * @param text Buffer where the null terminated string will be stored
+ * @param size Size of the buffer
+ * @return true on success, false if the item is not a text string
+ */
+static bool metadata_cbor_get_text(metadata_cbor_reader_t *reader, char *text, size_t size){
+	const uint8_t *data;
+	size_t len;
+
+	if(!metadata_cbor_get_string(reader, CBOR_MAJOR_TEXT, &data, &len)){
+		return false;
+	}
+	if(len > size - 1){
+		len = size - 1;
+	}
+	memcpy(text, data, len);
+	text[len] = '\0';
+
+	return true;
+}
+
+/**
+ * @brief Reads a binary CID into its string form
+ * @param reader Reader
+ * @param text Buffer where the CID string will be stored
+ * @param size Size of the buffer
+ * @return true on success, false if the item is not a supported CID
+ */
+static bool metadata_cbor_get_cid(metadata_cbor_reader_t *reader, char *text, size_t size){
+	const uint8_t *data;
+	size_t len;
+
+	return metadata_cbor_get_string(reader, CBOR_MAJOR_BYTES, &data, &len) &&
+	       ipfs_block_cid_to_text(data, len, text, size) == ESP_OK;
+}
+
+/**
+ * @brief Skips an item, its content included
+ * @param reader Reader
+ * @param depth Nesting left
+ * @return true on success, false if the item is malformed
+ */
+static bool metadata_cbor_skip(metadata_cbor_reader_t *reader, int depth){
+	uint8_t major;
+	uint64_t value;
+
+	if(depth == 0 || !metadata_cbor_get_head(reader, &major, &value)){
+		return false;
+	}
+	switch(major){
+		case CBOR_MAJOR_BYTES:
+		case CBOR_MAJOR_TEXT:
+			if(value > (uint64_t)(reader->end - reader->p)){
+				return false;
+			}
+			reader->p += value;
+			return true;
+
+		case CBOR_MAJOR_MAP:
+			value *= 2;
+			// fall through
+		case CBOR_MAJOR_ARRAY:
+			for(uint64_t i = 0; i < value; i++){
+				if(!metadata_cbor_skip(reader, depth - 1)){
+					return false;
+				}
+			}
+			return true;
+
+		case CBOR_MAJOR_TAG:
+			return metadata_cbor_skip(reader, depth - 1);
+
+		default:
+			// Integers and simple values are all in the head
+			return true;
+	}
+}
+
+/**
+ * @brief Decodes the "latestFirmware" map
+ * @param reader Reader
+ * @param firmware_info Firmware metadata
+ * @return true on success, false if the map is malformed
+ */
+static bool metadata_cbor_decode_firmware(metadata_cbor_reader_t *reader, firmware_metadata_info_t *firmware_info){
+	const uint8_t *key;
+	size_t key_len;
+	const uint8_t *data;
+	size_t len;
+	uint8_t major;
+	uint64_t count;
+	uint64_t value;
+
+	if(!metadata_cbor_get_head(reader, &major, &count) || major != CBOR_MAJOR_MAP){
+		return false;
+	}
+	for(uint64_t i = 0; i < count; i++){
+		if(!metadata_cbor_get_string(reader, CBOR_MAJOR_TEXT, &key, &key_len)){
+			return false;
+		}
+
+		bool ok = true;
+		if(metadata_cbor_key_is(key, key_len, "version")){
+			ok = metadata_cbor_get_text(reader, firmware_info->version, sizeof(firmware_info->version));
+		}
+		else if(metadata_cbor_key_is(key, key_len, "author")){
+			ok = metadata_cbor_get_text(reader, firmware_info->author, sizeof(firmware_info->author));
+		}
+		else if(metadata_cbor_key_is(key, key_len, "hardwareModel")){
+			ok = metadata_cbor_get_text(reader, firmware_info->hardwareModel, sizeof(firmware_info->hardwareModel));
+		}
+		else if(metadata_cbor_key_is(key, key_len, "timestamp")){
+			ok = metadata_cbor_get_text(reader, firmware_info->timestamp, sizeof(firmware_info->timestamp));
+		}
+		else if(metadata_cbor_key_is(key, key_len, "description")){
+			ok = metadata_cbor_get_text(reader, firmware_info->description, sizeof(firmware_info->description));
+		}
+		else if(metadata_cbor_key_is(key, key_len, "integrityHash")){
+			// Raw digest, the hex form is only kept for the logs
+			ok = metadata_cbor_get_string(reader, CBOR_MAJOR_BYTES, &data, &len) && len == FW_UPDATE_DIGEST_SIZE;
+			if(ok){
+				memcpy(firmware_info->integrityDigest, data, FW_UPDATE_DIGEST_SIZE);
+				for(size_t j = 0; j < FW_UPDATE_DIGEST_SIZE; j++){
+					sprintf(&firmware_info->integrityHash[2 * j], "%02x", data[j]);
+				}
+			}
+		}
+		else if(metadata_cbor_key_is(key, key_len, "integrityAlgorithm")){
+			char name[16];
+			ok = metadata_cbor_get_text(reader, name, sizeof(name));
+			if(ok){
+				firmware_info->integrityAlgorithm = fw_update_parse_hash_algorithm(name);
+				// The image could not be verified, the response is refused before the download
+				ok = (firmware_info->integrityAlgorithm != FW_UPDATE_HASH_UNKNOWN);
+			}
+		}
+		else if(metadata_cbor_key_is(key, key_len, "cid")){
+			ok = metadata_cbor_get_cid(reader, firmware_info->cid, sizeof(firmware_info->cid));
+		}
+		else if(metadata_cbor_key_is(key, key_len, "manifestCid")){
+			ok = metadata_cbor_get_cid(reader, firmware_info->manifestCid, sizeof(firmware_info->manifestCid));
+		}
+		else if(metadata_cbor_key_is(key, key_len, "chunkSize")){
+			ok = metadata_cbor_get_head(reader, &major, &value) && major == CBOR_MAJOR_UINT;
+			if(ok && value > 0 && value <= UINT32_MAX){
+				firmware_info->chunkSize = value;
+			}
+		}
+		else if(metadata_cbor_key_is(key, key_len, "gateways")){
+			ok = metadata_cbor_get_head(reader, &major, &value) && major == CBOR_MAJOR_ARRAY;
+			for(uint64_t j = 0; ok && j < value; j++){
+				char url[IPFS_GATEWAY_URL_LEN];
+				ok = metadata_cbor_get_string(reader, CBOR_MAJOR_TEXT, &data, &len);
+				if(ok && len < sizeof(url)){
+					memcpy(url, data, len);
+					url[len] = '\0';
+					ipfs_gateway_add(url);
+				}
+			}
+		}
+		else{
+			ok = metadata_cbor_skip(reader, CBOR_MAX_DEPTH);
+		}
+		if(!ok){
+			ESP_LOGE(TAG, "Malformed value of \"%.*s\"", (int)key_len, (const char *)key);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Compares a key with a name
+ * @param key Key
+ * @param len Length of the key
+ * @param name Null terminated name
+ * @return true if they are equal
+ */
+static bool metadata_cbor_key_is(const uint8_t *key, size_t len, const char *name){
+	return strlen(name) == len && memcmp(key, name, len) == 0;
+}
+
+/** @} */
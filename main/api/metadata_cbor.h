@@ -0,0 +1,123 @@
+/**
+*************************************************************************
+* @file       metadata_cbor.h
+* @brief      Header file for the metadata_cbor.h module.
+* @details    This file contains declarations and prototypes for the
+*             metadata_cbor.h module, the CBOR (RFC 8949) encoding of
+*             the register-device exchange. The request is written into
+*             a caller buffer and the response is decoded in place into
+*             firmware_metadata_info_t, with the integrity hash and the
+*             CIDs as raw byte strings and no heap allocation.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_METADATA_CBOR_H_
+#define MAIN_API_METADATA_CBOR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "api/fw_update.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/**
+ * @brief Media type of the CBOR exchange
+ */
+#define METADATA_CBOR_CONTENT_TYPE "application/cbor"
+
+/* Public Types --------------------------------------------------------------*/
+
+/**
+ * @brief Writer of a CBOR item into a fixed buffer
+ */
+typedef struct metadata_cbor_writer {
+    uint8_t *buffer; /**< Buffer where the item is written */
+    size_t size;     /**< Size of the buffer */
+    size_t len;      /**< Bytes written */
+    bool overflow;   /**< The item did not fit into the buffer */
+} metadata_cbor_writer_t;
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup metadata_cbor.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Starts a writer on a buffer
+ * @param writer Writer
+ * @param buffer Buffer where the item will be written
+ * @param size Size of the buffer
+ */
+void metadata_cbor_writer_init(metadata_cbor_writer_t *writer, uint8_t *buffer, size_t size);
+
+/**
+ * @brief Writes the header of a map
+ * @param writer Writer
+ * @param count Number of key/value pairs that follow
+ */
+void metadata_cbor_put_map(metadata_cbor_writer_t *writer, size_t count);
+
+/**
+ * @brief Writes the header of an array
+ * @param writer Writer
+ * @param count Number of items that follow
+ */
+void metadata_cbor_put_array(metadata_cbor_writer_t *writer, size_t count);
+
+/**
+ * @brief Writes an unsigned or negative integer
+ * @param writer Writer
+ * @param value Value
+ */
+void metadata_cbor_put_int(metadata_cbor_writer_t *writer, int64_t value);
+
+/**
+ * @brief Writes a text string
+ * @param writer Writer
+ * @param text Null terminated UTF-8 string
+ */
+void metadata_cbor_put_text(metadata_cbor_writer_t *writer, const char *text);
+
+/**
+ * @brief Encodes the register-device request, pending update reports included
+ * @param buffer Buffer where the request will be written
+ * @param size Size of the buffer
+ * @return Length of the request, or 0 if it does not fit into the buffer
+ */
+size_t metadata_cbor_encode_request(uint8_t *buffer, size_t size);
+
+/**
+ * @brief Checks whether a response is CBOR, telling it from JSON and plain text
+ * @param data Response
+ * @param len Length of the response
+ * @return true if the response is a CBOR map
+ */
+bool metadata_cbor_is_cbor(const uint8_t *data, size_t len);
+
+/**
+ * @brief Decodes the register-device response into the firmware metadata
+ * @param data Response
+ * @param len Length of the response
+ * @param firmware_info Firmware metadata, fields missing in the response are left empty
+ * @return ESP_OK on success, or an error code if the response is malformed or names an unsupported integrityAlgorithm
+ */
+esp_err_t metadata_cbor_decode_response(const uint8_t *data, size_t len, firmware_metadata_info_t *firmware_info);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_METADATA_CBOR_H_ */
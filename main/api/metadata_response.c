@@ -0,0 +1,162 @@
+/**
+*************************************************************************
+* @file       metadata_response.c
+* @brief      Source file for the metadata_response.c module.
+* @details    This file contains the implementation of functions for
+*             the metadata_response.c module. The answer is told apart
+*             by its first bytes: a CBOR map goes to metadata_cbor, the
+*             known plain text messages are copied as the status, and
+*             anything else is parsed as JSON.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+// ESP Includes
+#include "esp_err.h"
+#include "esp_log.h"
+#include "cJSON.h"
+
+// Application Includes
+#include "api/metadata_response.h"
+#include "api/metadata_cbor.h"
+#include "api/ipfs_gateway.h"
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup metadata_response.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Process the HTTP response and extract firmware information.
+ * @param response The response string from the server, null terminated.
+ * @param len The length of the response string.
+ * @param firmware_info Pointer to the firmware metadata information structure.
+ * @note An update is offered only when firmware_info->status is VERSION_OUTDATED.
+ */
+void metadata_response_process(const char *response, int len, firmware_metadata_info_t *firmware_info){
+    
+#if METADATA_CBOR_ENABLED
+    // The server answers in CBOR when it accepted the CBOR request
+    if (metadata_cbor_is_cbor((const uint8_t *)response, len)) {
+        // A malformed response, or an algorithm this firmware cannot verify, starts no download
+        if (metadata_cbor_decode_response((const uint8_t *)response, len, firmware_info) != ESP_OK) {
+            firmware_info->status[0] = '\0';
+        }
+        return;
+    }
+#endif
+
+    // Check if the response is a known plain text message
+    if (strstr(response, ERROR_HW_NOT_FOUND) || strstr(response, VERSION_UPDATED)) {
+        strncpy(firmware_info->status, response, sizeof(firmware_info->status) - 1);
+        firmware_info->status[sizeof(firmware_info->status) - 1] = '\0';  // Ensure null termination
+        return;
+    }
+
+    // Try to parse the response as JSON
+    cJSON *json = cJSON_Parse(response);
+    if (json == NULL) {
+        ESP_LOGE("JSON", "Error parsing JSON");
+        return;
+    }
+
+    // Extract the "message" field
+    cJSON *message = cJSON_GetObjectItem(json, "message");
+    if (cJSON_IsString(message) && (message->valuestring != NULL)) {
+        strncpy(firmware_info->status, message->valuestring, sizeof(firmware_info->status) - 1);
+        firmware_info->status[sizeof(firmware_info->status) - 1] = '\0';  // Ensure null termination
+
+        if (strcmp(firmware_info->status, VERSION_OUTDATED) == 0) {
+            // Extract the "latestFirmware" object
+            cJSON *latestFirmware = cJSON_GetObjectItem(json, "latestFirmware");
+            if (!cJSON_IsObject(latestFirmware)) {
+                ESP_LOGE("JSON", "Error: latestFirmware is not an object");
+                cJSON_Delete(json);
+                return;
+            }
+
+            // Extract the individual fields from the "latestFirmware" object and store them in the struct
+            cJSON *version = cJSON_GetObjectItem(latestFirmware, "version");
+            cJSON *author = cJSON_GetObjectItem(latestFirmware, "author");
+            cJSON *hardwareModel = cJSON_GetObjectItem(latestFirmware, "hardwareModel");
+            cJSON *integrityHash = cJSON_GetObjectItem(latestFirmware, "integrityHash");
+            cJSON *integrityAlgorithm = cJSON_GetObjectItem(latestFirmware, "integrityAlgorithm");
+            cJSON *timestamp = cJSON_GetObjectItem(latestFirmware, "timestamp");
+            cJSON *description = cJSON_GetObjectItem(latestFirmware, "description");
+            cJSON *cid = cJSON_GetObjectItem(latestFirmware, "cid");
+            cJSON *manifestCid = cJSON_GetObjectItem(latestFirmware, "manifestCid");
+            cJSON *chunkSize = cJSON_GetObjectItem(latestFirmware, "chunkSize");
+            cJSON *gateways = cJSON_GetObjectItem(latestFirmware, "gateways");
+
+            if (cJSON_IsString(version) && (version->valuestring != NULL)) {
+                strncpy(firmware_info->version, version->valuestring, sizeof(firmware_info->version) - 1);
+            }
+            if (cJSON_IsString(author) && (author->valuestring != NULL)) {
+                strncpy(firmware_info->author, author->valuestring, sizeof(firmware_info->author) - 1);
+            }
+            if (cJSON_IsString(hardwareModel) && (hardwareModel->valuestring != NULL)) {
+                strncpy(firmware_info->hardwareModel, hardwareModel->valuestring, sizeof(firmware_info->hardwareModel) - 1);
+            }
+            if (cJSON_IsString(integrityHash) && (integrityHash->valuestring != NULL)) {
+                strncpy(firmware_info->integrityHash, integrityHash->valuestring, sizeof(firmware_info->integrityHash) - 1);
+            }
+            // The verification uses the raw digest, decoded once here
+            memset(firmware_info->integrityDigest, 0x00, sizeof(firmware_info->integrityDigest));
+            if (strlen(firmware_info->integrityHash) == 2 * FW_UPDATE_DIGEST_SIZE) {
+                hex_string_to_bytes(firmware_info->integrityHash, (char *)firmware_info->integrityDigest);
+            }
+            else {
+                ESP_LOGE("JSON", "Error: integrityHash is not a 32-byte hash");
+            }
+            firmware_info->integrityAlgorithm = fw_update_parse_hash_algorithm(cJSON_IsString(integrityAlgorithm) ? integrityAlgorithm->valuestring : NULL);
+            if (firmware_info->integrityAlgorithm == FW_UPDATE_HASH_UNKNOWN) {
+                // The image could not be verified, so it is not downloaded
+                ESP_LOGE("JSON", "Error: integrityAlgorithm not supported, update refused");
+                firmware_info->status[0] = '\0';
+            }
+            if (cJSON_IsString(timestamp) && (timestamp->valuestring != NULL)) {
+                strncpy(firmware_info->timestamp, timestamp->valuestring, sizeof(firmware_info->timestamp) - 1);
+            }
+            if (cJSON_IsString(description) && (description->valuestring != NULL)) {
+                strncpy(firmware_info->description, description->valuestring, sizeof(firmware_info->description) - 1);
+            }
+            if (cJSON_IsString(cid) && (cid->valuestring != NULL)) {
+                strncpy(firmware_info->cid, cid->valuestring, sizeof(firmware_info->cid) - 1);
+            }	
+            firmware_info->manifestCid[0] = '\0';
+            if (cJSON_IsString(manifestCid) && (manifestCid->valuestring != NULL)) {
+                strncpy(firmware_info->manifestCid, manifestCid->valuestring, sizeof(firmware_info->manifestCid) - 1);
+            }
+            firmware_info->chunkSize = FW_MANIFEST_DEFAULT_CHUNK_SIZE;
+            if (cJSON_IsNumber(chunkSize) && chunkSize->valueint > 0) {
+                firmware_info->chunkSize = chunkSize->valueint;
+            }
+            if (cJSON_IsArray(gateways)) {
+                cJSON *gateway = NULL;
+                cJSON_ArrayForEach(gateway, gateways) {
+                    if (cJSON_IsString(gateway) && (gateway->valuestring != NULL)) {
+                        ipfs_gateway_add(gateway->valuestring);
+                    }
+                }
+            }
+        }
+    }
+
+    // Free the JSON object
+    cJSON_Delete(json);
+}
+
+/** @} */
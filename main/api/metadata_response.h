@@ -0,0 +1,53 @@
+/**
+*************************************************************************
+* @file       metadata_response.h
+* @brief      Header file for the metadata_response.h module.
+* @details    This file contains declarations and prototypes for the
+*             metadata_response.h module, the handling of the answer to
+*             the register-device request: a plain text message, a JSON
+*             object or, when the server accepted the CBOR request, a
+*             CBOR map. The module has no task and only needs cJSON and
+*             the CBOR decoder, so tools/fleet_client.c builds it for
+*             the host.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_METADATA_RESPONSE_H_
+#define MAIN_API_METADATA_RESPONSE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "api/fw_update.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/* Public Types --------------------------------------------------------------*/
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup metadata_response.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Process the HTTP response and extract firmware information.
+ * @param response The response string from the server, null terminated.
+ * @param len The length of the response string.
+ * @param firmware_info Pointer to the firmware metadata information structure.
+ * @note An update is offered only when firmware_info->status is VERSION_OUTDATED.
+ */
+void metadata_response_process(const char *response, int len, firmware_metadata_info_t *firmware_info);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_METADATA_RESPONSE_H_ */
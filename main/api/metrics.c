@@ -0,0 +1,319 @@
+/**
+*************************************************************************
+* @file       metrics.c
+* @brief      Source file for the metrics.c module.
+* @details    This file contains the implementation of functions for
+*             the metrics.c module. Each counter and histogram bucket is
+*             a 32-bit atomic updated with a relaxed add: the hot paths
+*             pay one atomic instruction and never block, and a scrape
+*             may see the counters of an update a few bytes apart. The
+*             histogram buckets are stored apart and summed when scraped.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+
+// FreeRTOS Includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// ESP Includes
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "esp_http_server.h"
+
+// Application Includes
+#include "tasks_common.h"
+#include "api/metrics.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+// Number of fw_update_ret_e codes
+#define METRICS_RESULT_COUNT (FW_UPDATE_CANCELLED + 1)
+
+// Number of histogram buckets, +Inf included
+#define METRICS_BUCKET_COUNT 10
+
+/* Typedefs --------------------------------------------------------------*/
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "metrics";
+
+/**
+ * @brief Names of the counters, with their help text
+ */
+static const char *const g_counter_names[METRICS_COUNTER_MAX][2] = {
+	{"fw_update_attempts_total", "Firmware updates started, downloaded or taken from the slot."},
+	{"fw_update_download_bytes_total", "Bytes of encrypted firmware received."},
+	{"wifi_reconnects_total", "Station connections after the first one."},
+	{"tls_handshakes_total", "TLS and DTLS sessions set up."},
+	{"fw_update_avoided_bytes_total", "Bytes of encrypted firmware not downloaded, the slot held the image."},
+};
+
+/**
+ * @brief Label of each fw_update_ret_e code
+ */
+static const char *const g_result_names[] = {
+	"ok", "partition_not_found", "partition_not_init", "partition_read_error",
+	"partition_write_error", "decrypt_error", "partition_not_closed", "hash_error",
+	"set_boot_partition_error", "download_error", "image_invalid", "image_wrong_chip",
+	"image_wrong_project", "image_secure_version", "image_not_newer", "cancelled",
+};
+_Static_assert(sizeof(g_result_names) / sizeof(g_result_names[0]) == METRICS_RESULT_COUNT, "a fw_update_ret_e code has no label");
+
+/**
+ * @brief Label of each update phase
+ */
+static const char *const g_phase_names[UPDATE_PHASE_MAX] = {"metadata", "download", "verify"};
+
+/**
+ * @brief Upper bounds of the histogram buckets in milliseconds, the last one is +Inf
+ */
+static const uint32_t g_bucket_ms[METRICS_BUCKET_COUNT - 1] = {100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000};
+
+/**
+ * @brief Tasks whose stack high water mark is exposed
+ */
+static const char *const g_task_names[] = {
+	"main_app_task", "https_app_task", "wifi_app_task", "binlog_task", "push_channel_task",
+};
+
+/**
+ * @brief Store, every field updated with relaxed atomic adds
+ */
+static atomic_uint g_counters[METRICS_COUNTER_MAX];
+static atomic_uint g_results[METRICS_RESULT_COUNT];
+static atomic_uint g_phase_buckets[UPDATE_PHASE_MAX][METRICS_BUCKET_COUNT];
+static atomic_uint g_phase_sum_ms[UPDATE_PHASE_MAX];
+
+/**
+ * @brief HTTP server of the endpoint
+ */
+static httpd_handle_t g_server = NULL;
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Serves GET /metrics in the Prometheus text format
+ * @param req HTTP request
+ * @return ESP_OK when the response was sent, or an error code to close the connection
+ */
+static esp_err_t metrics_get_handler(httpd_req_t *req);
+
+/**
+ * @brief Sends one formatted line of the response
+ * @param req HTTP request
+ * @param fmt Format of the line
+ * @return ESP_OK on success, or an error code if the connection failed
+ */
+static esp_err_t metrics_send(httpd_req_t *req, const char *fmt, ...);
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup metrics.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Starts the HTTP server of the metrics endpoint, GET /metrics
+ * @return ESP_OK on success, or an error code on failure
+ */
+esp_err_t metrics_start(void){
+	if(g_server != NULL){
+		return ESP_OK;
+	}
+
+	httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+	config.server_port = METRICS_PORT;
+	config.ctrl_port = METRICS_PORT + 1;
+	config.stack_size = METRICS_TASK_STACK_SIZE;
+	config.task_priority = METRICS_TASK_PRIORITY;
+	config.max_open_sockets = 2;
+	config.lru_purge_enable = true;
+	esp_err_t err = httpd_start(&g_server, &config);
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "httpd_start failed: %s", esp_err_to_name(err));
+		g_server = NULL;
+		return err;
+	}
+
+	static const httpd_uri_t uri = {
+		.uri = "/metrics",
+		.method = HTTP_GET,
+		.handler = metrics_get_handler,
+		.user_ctx = NULL,
+	};
+	httpd_register_uri_handler(g_server, &uri);
+	ESP_LOGI(TAG, "Metrics on port %d", METRICS_PORT);
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Adds a value to a counter
+ * @param counter Counter
+ * @param value Value added
+ */
+void metrics_add(metrics_counter_e counter, uint32_t value){
+	if(counter < METRICS_COUNTER_MAX){
+		atomic_fetch_add_explicit(&g_counters[counter], value, memory_order_relaxed);
+	}
+}
+
+/**
+ * @brief Counts the outcome of an update attempt
+ * @param result Result code of the attempt
+ */
+void metrics_count_result(fw_update_ret_e result){
+	if((unsigned)result < METRICS_RESULT_COUNT){
+		atomic_fetch_add_explicit(&g_results[result], 1, memory_order_relaxed);
+	}
+}
+
+/**
+ * @brief Adds the duration of a phase to its histogram
+ * @param phase Phase of the attempt
+ * @param ms Duration of the phase in milliseconds
+ */
+void metrics_observe_phase(update_phase_e phase, uint32_t ms){
+	int bucket = 0;
+
+	if(phase >= UPDATE_PHASE_MAX){
+		return;
+	}
+	while(bucket < METRICS_BUCKET_COUNT - 1 && ms > g_bucket_ms[bucket]){
+		bucket++;
+	}
+	atomic_fetch_add_explicit(&g_phase_buckets[phase][bucket], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&g_phase_sum_ms[phase], ms, memory_order_relaxed);
+}
+
+/**
+ * @brief Counts a TLS handshake when a connection of the client was opened over TLS
+ * @param client HTTP client just connected
+ */
+void metrics_count_connection(esp_http_client_handle_t client){
+	if(esp_http_client_get_transport_type(client) == HTTP_TRANSPORT_OVER_SSL){
+		metrics_add(METRICS_TLS_HANDSHAKES, 1);
+	}
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup metrics.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Serves GET /metrics in the Prometheus text format
+ * @param req HTTP request
+ * @return ESP_OK when the response was sent, or an error code to close the connection
+ */
+static esp_err_t metrics_get_handler(httpd_req_t *req){
+	esp_err_t err = ESP_OK;
+
+	httpd_resp_set_type(req, "text/plain; version=0.0.4");
+
+	for(int i = 0; i < METRICS_COUNTER_MAX && err == ESP_OK; i++){
+		err = metrics_send(req, "# HELP %s %s\n# TYPE %s counter\n%s %u\n", g_counter_names[i][0], g_counter_names[i][1],
+		                   g_counter_names[i][0], g_counter_names[i][0], atomic_load_explicit(&g_counters[i], memory_order_relaxed));
+	}
+
+	if(err == ESP_OK){
+		err = metrics_send(req, "# HELP fw_update_results_total Update attempts by result.\n# TYPE fw_update_results_total counter\n");
+	}
+	for(int i = 0; i < METRICS_RESULT_COUNT && err == ESP_OK; i++){
+		err = metrics_send(req, "fw_update_results_total{result=\"%s\"} %u\n", g_result_names[i],
+		                   atomic_load_explicit(&g_results[i], memory_order_relaxed));
+	}
+
+	// Prometheus buckets are cumulative
+	if(err == ESP_OK){
+		err = metrics_send(req, "# HELP fw_update_phase_duration_seconds Duration of the update phases.\n# TYPE fw_update_phase_duration_seconds histogram\n");
+	}
+	for(int phase = 0; phase < UPDATE_PHASE_MAX && err == ESP_OK; phase++){
+		uint32_t count = 0;
+		for(int b = 0; b < METRICS_BUCKET_COUNT && err == ESP_OK; b++){
+			count += atomic_load_explicit(&g_phase_buckets[phase][b], memory_order_relaxed);
+			if(b < METRICS_BUCKET_COUNT - 1){
+				err = metrics_send(req, "fw_update_phase_duration_seconds_bucket{phase=\"%s\",le=\"%u.%03u\"} %u\n", g_phase_names[phase],
+				                   (unsigned)(g_bucket_ms[b] / 1000), (unsigned)(g_bucket_ms[b] % 1000), (unsigned)count);
+			}
+			else{
+				err = metrics_send(req, "fw_update_phase_duration_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %u\n", g_phase_names[phase], (unsigned)count);
+			}
+		}
+		uint32_t sum_ms = atomic_load_explicit(&g_phase_sum_ms[phase], memory_order_relaxed);
+		if(err == ESP_OK){
+			err = metrics_send(req, "fw_update_phase_duration_seconds_sum{phase=\"%s\"} %u.%03u\n"
+			                   "fw_update_phase_duration_seconds_count{phase=\"%s\"} %u\n",
+			                   g_phase_names[phase], (unsigned)(sum_ms / 1000), (unsigned)(sum_ms % 1000), g_phase_names[phase], (unsigned)count);
+		}
+	}
+
+	// Gauges are read now, they cost nothing between scrapes
+	wifi_ap_record_t ap;
+	if(err == ESP_OK && esp_wifi_sta_get_ap_info(&ap) == ESP_OK){
+		err = metrics_send(req, "# HELP wifi_rssi_dbm RSSI of the access point.\n# TYPE wifi_rssi_dbm gauge\nwifi_rssi_dbm %d\n", ap.rssi);
+	}
+	if(err == ESP_OK){
+		err = metrics_send(req, "# HELP heap_free_bytes Free heap.\n# TYPE heap_free_bytes gauge\nheap_free_bytes %lu\n"
+		                   "# HELP heap_min_free_bytes Lowest free heap since boot.\n# TYPE heap_min_free_bytes gauge\nheap_min_free_bytes %lu\n",
+		                   (unsigned long)esp_get_free_heap_size(), (unsigned long)esp_get_minimum_free_heap_size());
+	}
+	if(err == ESP_OK){
+		err = metrics_send(req, "# HELP task_stack_high_water_bytes Lowest free stack of each task.\n# TYPE task_stack_high_water_bytes gauge\n");
+	}
+	for(int i = 0; i < sizeof(g_task_names) / sizeof(g_task_names[0]) && err == ESP_OK; i++){
+		TaskHandle_t task = xTaskGetHandle(g_task_names[i]);
+		if(task != NULL){
+			err = metrics_send(req, "task_stack_high_water_bytes{task=\"%s\"} %lu\n", g_task_names[i],
+			                   (unsigned long)uxTaskGetStackHighWaterMark(task));
+		}
+	}
+
+	if(err == ESP_OK){
+		err = httpd_resp_send_chunk(req, NULL, 0);
+	}
+	return err;
+}
+
+/**
+ * @brief Sends one formatted line of the response
+ * @param req HTTP request
+ * @param fmt Format of the line
+ * @return ESP_OK on success, or an error code if the connection failed
+ */
+static esp_err_t metrics_send(httpd_req_t *req, const char *fmt, ...){
+	char line[256];
+	va_list args;
+
+	va_start(args, fmt);
+	int len = vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+	if(len < 0 || len >= sizeof(line)){
+		return ESP_ERR_INVALID_SIZE;
+	}
+	return httpd_resp_send_chunk(req, line, len);
+}
+
+/** @} */
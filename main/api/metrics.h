@@ -0,0 +1,92 @@
+/**
+*************************************************************************
+* @file       metrics.h
+* @brief      Header file for the metrics.h module.
+* @details    This file contains declarations and prototypes for the
+*             metrics.h module, the counters and histograms of the device
+*             exposed over HTTP in the Prometheus text format. The store
+*             is made of atomic counters, so any task can update it
+*             without a lock; the gauges (heap, RSSI, stacks) are read
+*             when the endpoint is scraped.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_METRICS_H_
+#define MAIN_API_METRICS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_client.h"
+#include "api/fw_update.h"
+#include "api/update_report.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/* Public Types --------------------------------------------------------------*/
+
+/**
+ * @brief Counters of the store
+ */
+typedef enum metrics_counter {
+    METRICS_UPDATE_ATTEMPTS = 0, /**< Firmware updates started, downloaded or taken from the slot */
+    METRICS_DOWNLOAD_BYTES,      /**< Bytes of encrypted firmware received */
+    METRICS_WIFI_RECONNECTS,     /**< Station connections after the first one */
+    METRICS_TLS_HANDSHAKES,      /**< TLS and DTLS sessions set up */
+    METRICS_AVOIDED_BYTES,       /**< Bytes of encrypted firmware not downloaded, the slot held the image */
+    METRICS_COUNTER_MAX
+} metrics_counter_e;
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup metrics.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Starts the HTTP server of the metrics endpoint, GET /metrics
+ * @return ESP_OK on success, or an error code on failure
+ * @note Called on each station connection; only the first call starts it.
+ */
+esp_err_t metrics_start(void);
+
+/**
+ * @brief Adds a value to a counter
+ * @param counter Counter
+ * @param value Value added
+ */
+void metrics_add(metrics_counter_e counter, uint32_t value);
+
+/**
+ * @brief Counts the outcome of an update attempt
+ * @param result Result code of the attempt
+ */
+void metrics_count_result(fw_update_ret_e result);
+
+/**
+ * @brief Adds the duration of a phase to its histogram
+ * @param phase Phase of the attempt
+ * @param ms Duration of the phase in milliseconds
+ */
+void metrics_observe_phase(update_phase_e phase, uint32_t ms);
+
+/**
+ * @brief Counts a TLS handshake when a connection of the client was opened over TLS
+ * @param client HTTP client just connected
+ */
+void metrics_count_connection(esp_http_client_handle_t client);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_METRICS_H_ */
@@ -0,0 +1,512 @@
+/**
+*************************************************************************
+* @file       peer_cache.c
+* @brief      Source file for the peer_cache.c module.
+* @details    This file contains the implementation of functions for
+*             the peer_cache.c module. The OTA slot keeps the decrypted
+*             image, so it is encrypted again while it is sent, with the
+*             fleet key and IV: the bytes match the ones of the gateways,
+*             and the chunk manifest, the resume journal and the integrity
+*             hash work the same on the receiving device. CBC cannot start
+*             in the middle, so a Range request is encrypted from the
+*             start of the image and sent from the requested offset.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// FreeRTOS Includes
+#include "freertos/FreeRTOS.h"
+
+// ESP Includes
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_netif.h"
+#include "esp_partition.h"
+#include "esp_http_server.h"
+#include "mdns.h"
+#include "nvs.h"
+#include "mbedtls/aes.h"
+
+// Application Includes
+#include "tasks_common.h"
+#include "api/peer_cache.h"
+#include "api/fw_update.h"
+#include "api/ipfs_gateway.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+// NVS namespace and key used to store the image served to the peers
+#define PEER_CACHE_NVS_NAMESPACE "peer_cache"
+#define PEER_CACHE_NVS_KEY       "entry"
+
+// Path served by the peer cache, the same as on an IPFS gateway
+#define PEER_CACHE_PATH "/ipfs/"
+
+// Maximum number of answers read from the mDNS query
+#define PEER_CACHE_MAX_RESULTS 8
+
+/* Typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief Image served to the peers
+ */
+typedef struct peer_cache_entry {
+    char cid[FW_UPDATE_IMAGE_ID_LEN]; /**< CID of the image */
+    char label[17];                   /**< Label of the partition keeping the image */
+    uint32_t length;                  /**< Length of the decrypted image */
+} peer_cache_entry_t;
+
+/**
+ * @brief Buffers of one response, kept off the HTTP server stack
+ */
+typedef struct peer_cache_stream {
+    mbedtls_aes_context aes;                           /**< Encryption context */
+    unsigned char iv[16];                              /**< Chaining block */
+    uint8_t plain[PEER_CACHE_SEND_BLOCK_SIZE + 16];    /**< Piece read from the partition, padding included */
+    uint8_t cipher[PEER_CACHE_SEND_BLOCK_SIZE + 16];   /**< Piece encrypted */
+} peer_cache_stream_t;
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "peer_cache";
+
+/**
+ * @brief Fleet key and IV, the same ones the gateways' images are encrypted with
+ */
+static const unsigned char aes_key[KEY_SIZE] = AES_KEY;
+static const unsigned char aes_iv[16] = AES_IV;
+
+/**
+ * @brief Protects the entry, read by the HTTP server task
+ */
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Image served, and a counter changed each time it is replaced or forgotten
+ */
+static peer_cache_entry_t g_entry;
+static bool g_valid = false;
+static uint32_t g_generation = 0;
+
+/**
+ * @brief HTTP server and mDNS host name of this device
+ */
+static httpd_handle_t g_server = NULL;
+static char g_hostname[32];
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Saves the entry into NVS, or erases it when no image is served
+ */
+static void peer_cache_save(void);
+
+/**
+ * @brief Advertises the served CID over mDNS, or removes the service when none is served
+ */
+static void peer_cache_advertise(void);
+
+/**
+ * @brief Serves GET /ipfs/<cid> from the OTA partition, with Range support
+ * @param req HTTP request
+ * @return ESP_OK when the response was sent, ESP_FAIL to close the connection
+ */
+static esp_err_t peer_cache_get_handler(httpd_req_t *req);
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup peer_cache.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Starts the HTTP server and the mDNS responder, advertising the image kept in NVS
+ * @return ESP_OK on success, or an error code on failure
+ */
+esp_err_t peer_cache_start(void){
+	peer_cache_entry_t entry;
+	size_t size = sizeof(entry);
+	nvs_handle_t nvs_handle;
+	uint8_t mac[6];
+
+	if(g_server != NULL){
+		return ESP_OK;
+	}
+
+	// The image is served again after a reboot, from whichever slot keeps it
+	if(nvs_open(PEER_CACHE_NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK){
+		if(nvs_get_blob(nvs_handle, PEER_CACHE_NVS_KEY, &entry, &size) == ESP_OK && size == sizeof(entry)){
+			const esp_partition_t *partition;
+			entry.cid[sizeof(entry.cid) - 1] = '\0';
+			entry.label[sizeof(entry.label) - 1] = '\0';
+			partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, entry.label);
+			if(partition != NULL && entry.length > 0 && entry.length <= partition->size){
+				taskENTER_CRITICAL(&g_lock);
+				g_entry = entry;
+				g_valid = true;
+				taskEXIT_CRITICAL(&g_lock);
+			}
+		}
+		nvs_close(nvs_handle);
+	}
+
+	esp_err_t err = mdns_init();
+	if(err != ESP_OK && err != ESP_ERR_INVALID_STATE){
+		ESP_LOGE(TAG, "mdns_init failed: %s", esp_err_to_name(err));
+		return err;
+	}
+	esp_read_mac(mac, ESP_MAC_WIFI_STA);
+	snprintf(g_hostname, sizeof(g_hostname), "fwcache-%02x%02x%02x", mac[3], mac[4], mac[5]);
+	mdns_hostname_set(g_hostname);
+
+	httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+	config.server_port = PEER_CACHE_PORT;
+	config.ctrl_port = PEER_CACHE_PORT + 1;
+	config.stack_size = PEER_CACHE_TASK_STACK_SIZE;
+	config.task_priority = PEER_CACHE_TASK_PRIORITY;
+	config.uri_match_fn = httpd_uri_match_wildcard;
+	config.lru_purge_enable = true;
+	err = httpd_start(&g_server, &config);
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "httpd_start failed: %s", esp_err_to_name(err));
+		g_server = NULL;
+		return err;
+	}
+
+	static const httpd_uri_t uri = {
+		.uri = PEER_CACHE_PATH "*",
+		.method = HTTP_GET,
+		.handler = peer_cache_get_handler,
+		.user_ctx = NULL,
+	};
+	httpd_register_uri_handler(g_server, &uri);
+
+	ESP_LOGI(TAG, "Peer cache on %s.local:%d", g_hostname, PEER_CACHE_PORT);
+	peer_cache_advertise();
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Serves and advertises the image just verified in the OTA slot
+ * @param cid CID of the image
+ */
+void peer_cache_publish(const char *cid){
+	size_t length;
+	const esp_partition_t *partition = fw_update_get_image(&length);
+
+	if(partition == NULL || cid == NULL || strlen(cid) == 0 || strlen(cid) >= FW_UPDATE_IMAGE_ID_LEN){
+		return;
+	}
+	taskENTER_CRITICAL(&g_lock);
+	strcpy(g_entry.cid, cid);
+	snprintf(g_entry.label, sizeof(g_entry.label), "%s", partition->label);
+	g_entry.length = length;
+	g_valid = true;
+	g_generation++;
+	taskEXIT_CRITICAL(&g_lock);
+
+	ESP_LOGI(TAG, "Serving %s from %s, %u bytes", cid, partition->label, (unsigned)length);
+	peer_cache_save();
+	peer_cache_advertise();
+}
+
+/**
+ * @brief Stops serving the image of a partition, before it is overwritten
+ * @param partition Partition about to be written
+ */
+void peer_cache_forget(const esp_partition_t *partition){
+	bool forget;
+
+	if(partition == NULL){
+		return;
+	}
+	// A response being sent stops at its next piece
+	taskENTER_CRITICAL(&g_lock);
+	forget = g_valid && strcmp(g_entry.label, partition->label) == 0;
+	if(forget){
+		g_valid = false;
+		g_generation++;
+	}
+	taskEXIT_CRITICAL(&g_lock);
+
+	if(forget){
+		ESP_LOGI(TAG, "Stopped serving %s, the partition is being written", g_entry.cid);
+		peer_cache_save();
+		peer_cache_advertise();
+	}
+}
+
+/**
+ * @brief Looks for peers serving a CID and puts them in front of the IPFS gateways
+ * @param cid CID of the image
+ * @return Number of peers found
+ */
+int peer_cache_discover(const char *cid){
+	char urls[PEER_CACHE_MAX_PEERS][IPFS_GATEWAY_URL_LEN];
+	mdns_result_t *results = NULL;
+	int count = 0;
+
+	if(g_server == NULL){
+		return 0;
+	}
+	esp_err_t err = mdns_query_ptr(PEER_CACHE_SERVICE_TYPE, PEER_CACHE_SERVICE_PROTO, PEER_CACHE_QUERY_TIMEOUT_MS, PEER_CACHE_MAX_RESULTS, &results);
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "mdns_query_ptr failed: %s", esp_err_to_name(err));
+	}
+
+	for(mdns_result_t *r = results; r != NULL && count < PEER_CACHE_MAX_PEERS; r = r->next){
+		bool match = false;
+
+		if(r->hostname != NULL && strcmp(r->hostname, g_hostname) == 0){
+			continue;
+		}
+		for(size_t i = 0; i < r->txt_count; i++){
+			if(strcmp(r->txt[i].key, "cid") == 0 && r->txt[i].value != NULL && strcmp(r->txt[i].value, cid) == 0){
+				match = true;
+			}
+		}
+		for(mdns_ip_addr_t *a = r->addr; match && a != NULL; a = a->next){
+			if(a->addr.type == ESP_IPADDR_TYPE_V4){
+				snprintf(urls[count], IPFS_GATEWAY_URL_LEN, "http://" IPSTR ":%u" PEER_CACHE_PATH, IP2STR(&a->addr.u_addr.ip4), r->port);
+				ESP_LOGI(TAG, "Peer %s serves the image at %s", r->hostname ? r->hostname : "?", urls[count]);
+				count++;
+				break;
+			}
+		}
+	}
+	mdns_query_results_free(results);
+
+	// Peers of a previous download are replaced, even by none
+	ipfs_gateway_set_peers(urls, count);
+
+	return count;
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup peer_cache.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Saves the entry into NVS, or erases it when no image is served
+ */
+static void peer_cache_save(void){
+	peer_cache_entry_t entry;
+	bool valid;
+	nvs_handle_t nvs_handle;
+
+	taskENTER_CRITICAL(&g_lock);
+	entry = g_entry;
+	valid = g_valid;
+	taskEXIT_CRITICAL(&g_lock);
+
+	esp_err_t err = nvs_open(PEER_CACHE_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
+		return;
+	}
+	if(valid){
+		err = nvs_set_blob(nvs_handle, PEER_CACHE_NVS_KEY, &entry, sizeof(entry));
+	}
+	else{
+		err = nvs_erase_key(nvs_handle, PEER_CACHE_NVS_KEY);
+		if(err == ESP_ERR_NVS_NOT_FOUND){
+			err = ESP_OK;
+		}
+	}
+	if(err == ESP_OK){
+		err = nvs_commit(nvs_handle);
+	}
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "Failed to save the entry: %s", esp_err_to_name(err));
+	}
+	nvs_close(nvs_handle);
+}
+
+/**
+ * @brief Advertises the served CID over mDNS, or removes the service when none is served
+ */
+static void peer_cache_advertise(void){
+	char cid[FW_UPDATE_IMAGE_ID_LEN];
+	bool valid;
+
+	if(g_server == NULL){
+		return;
+	}
+	taskENTER_CRITICAL(&g_lock);
+	strcpy(cid, g_entry.cid);
+	valid = g_valid;
+	taskEXIT_CRITICAL(&g_lock);
+
+	bool exists = mdns_service_exists(PEER_CACHE_SERVICE_TYPE, PEER_CACHE_SERVICE_PROTO, NULL);
+	if(!valid){
+		if(exists){
+			mdns_service_remove(PEER_CACHE_SERVICE_TYPE, PEER_CACHE_SERVICE_PROTO);
+		}
+		return;
+	}
+	if(exists){
+		mdns_service_txt_item_set(PEER_CACHE_SERVICE_TYPE, PEER_CACHE_SERVICE_PROTO, "cid", cid);
+	}
+	else{
+		mdns_txt_item_t txt[] = {{"cid", cid}};
+		esp_err_t err = mdns_service_add(g_hostname, PEER_CACHE_SERVICE_TYPE, PEER_CACHE_SERVICE_PROTO, PEER_CACHE_PORT, txt, 1);
+		if(err != ESP_OK){
+			ESP_LOGE(TAG, "mdns_service_add failed: %s", esp_err_to_name(err));
+			return;
+		}
+	}
+	ESP_LOGI(TAG, "Advertising %s", cid);
+}
+
+/**
+ * @brief Serves GET /ipfs/<cid> from the OTA partition, with Range support
+ * @param req HTTP request
+ * @return ESP_OK when the response was sent, ESP_FAIL to close the connection
+ */
+static esp_err_t peer_cache_get_handler(httpd_req_t *req){
+	peer_cache_entry_t entry;
+	bool valid;
+	uint32_t generation;
+	char cid[FW_UPDATE_IMAGE_ID_LEN];
+	char range[48];
+	char header[192];
+
+	// The CID is the rest of the path, without a query
+	snprintf(cid, sizeof(cid), "%s", req->uri + strlen(PEER_CACHE_PATH));
+	cid[strcspn(cid, "?")] = '\0';
+
+	taskENTER_CRITICAL(&g_lock);
+	entry = g_entry;
+	valid = g_valid;
+	generation = g_generation;
+	taskEXIT_CRITICAL(&g_lock);
+
+	const esp_partition_t *partition = valid ? esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, entry.label) : NULL;
+	if(partition == NULL || strcmp(cid, entry.cid) != 0){
+		httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "CID not cached");
+		return ESP_FAIL;
+	}
+
+	// PKCS#7 always pads, a whole block when the length is already aligned
+	uint32_t encrypted_len = entry.length + 16 - entry.length % 16;
+	uint32_t start = 0;
+	uint32_t end = encrypted_len - 1;
+	bool partial = false;
+	if(httpd_req_get_hdr_value_str(req, "Range", range, sizeof(range)) == ESP_OK){
+		unsigned long first, last;
+		int fields = sscanf(range, "bytes=%lu-%lu", &first, &last);
+		if(fields >= 1){
+			if(first >= encrypted_len){
+				snprintf(header, sizeof(header), "bytes */%lu", (unsigned long)encrypted_len);
+				httpd_resp_set_status(req, "416 Range Not Satisfiable");
+				httpd_resp_set_hdr(req, "Content-Range", header);
+				httpd_resp_send(req, NULL, 0);
+				return ESP_OK;
+			}
+			start = first;
+			if(fields == 2 && last < end){
+				end = last;
+			}
+			partial = true;
+		}
+	}
+
+	// The length must be known: the gateway race takes no chunked answers
+	int header_len;
+	if(partial){
+		header_len = snprintf(header, sizeof(header), "HTTP/1.1 206 Partial Content\r\nContent-Type: application/octet-stream\r\n"
+		                      "Content-Length: %lu\r\nContent-Range: bytes %lu-%lu/%lu\r\n\r\n",
+		                      (unsigned long)(end - start + 1), (unsigned long)start, (unsigned long)end, (unsigned long)encrypted_len);
+	}
+	else{
+		header_len = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+		                      "Content-Length: %lu\r\nAccept-Ranges: bytes\r\n\r\n", (unsigned long)encrypted_len);
+	}
+
+	peer_cache_stream_t *stream = malloc(sizeof(peer_cache_stream_t));
+	if(stream == NULL){
+		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No memory");
+		return ESP_FAIL;
+	}
+	if(httpd_send(req, header, header_len) != header_len){
+		free(stream);
+		return ESP_FAIL;
+	}
+	ESP_LOGI(TAG, "Sending %s, bytes %lu-%lu", cid, (unsigned long)start, (unsigned long)end);
+
+	mbedtls_aes_init(&stream->aes);
+	mbedtls_aes_setkey_enc(&stream->aes, aes_key, KEY_SIZE * 8);
+	memcpy(stream->iv, aes_iv, 16);
+
+	esp_err_t ret = ESP_OK;
+	uint32_t offset = 0;
+	uint32_t pos = 0;
+	bool last_piece = false;
+	while(!last_piece && pos <= end){
+		size_t n = entry.length - offset;
+		if(n > PEER_CACHE_SEND_BLOCK_SIZE){
+			n = PEER_CACHE_SEND_BLOCK_SIZE;
+		}
+		last_piece = (offset + n == entry.length);
+		if(esp_partition_read(partition, offset, stream->plain, n) != ESP_OK){
+			ESP_LOGE(TAG, "esp_partition_read failed at %lu", (unsigned long)offset);
+			ret = ESP_FAIL;
+			break;
+		}
+		offset += n;
+		if(last_piece){
+			uint8_t padding = 16 - n % 16;
+			memset(&stream->plain[n], padding, padding);
+			n += padding;
+		}
+		mbedtls_aes_crypt_cbc(&stream->aes, MBEDTLS_AES_ENCRYPT, n, stream->iv, stream->plain, stream->cipher);
+
+		// Send the part of the piece inside the range
+		if(pos + n > start){
+			uint32_t from = (start > pos) ? start - pos : 0;
+			uint32_t to = (end < pos + n - 1) ? end - pos + 1 : n;
+			if(httpd_send(req, (const char *)&stream->cipher[from], to - from) != (int)(to - from)){
+				ret = ESP_FAIL;
+				break;
+			}
+		}
+		pos += n;
+
+		// The partition is being overwritten by an update of this device
+		taskENTER_CRITICAL(&g_lock);
+		bool replaced = (generation != g_generation);
+		taskEXIT_CRITICAL(&g_lock);
+		if(replaced){
+			ESP_LOGI(TAG, "Image replaced while it was sent");
+			ret = ESP_FAIL;
+			break;
+		}
+	}
+	mbedtls_aes_free(&stream->aes);
+	free(stream);
+
+	return ret;
+}
+
+/** @} */
@@ -0,0 +1,79 @@
+/**
+*************************************************************************
+* @file       peer_cache.h
+* @brief      Header file for the peer_cache.h module.
+* @details    This file contains declarations and prototypes for the
+*             peer_cache.h module, which lets the devices of a LAN share
+*             a verified image. A device that verified an image serves it
+*             over HTTP, with Range support, and advertises its CID over
+*             mDNS; the others race those peers before the IPFS gateways.
+*             The integrity hash of the metadata is still checked, so a
+*             peer is trusted no more than a gateway.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_PEER_CACHE_H_
+#define MAIN_API_PEER_CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/**
+ * @brief mDNS service type and protocol of the peer cache
+ */
+#define PEER_CACHE_SERVICE_TYPE  "_fwcache"
+#define PEER_CACHE_SERVICE_PROTO "_tcp"
+
+/* Public Types --------------------------------------------------------------*/
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup peer_cache.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Starts the HTTP server and the mDNS responder, advertising the image kept in NVS
+ * @return ESP_OK on success, or an error code on failure
+ * @note Called on each station connection; only the first call starts them.
+ */
+esp_err_t peer_cache_start(void);
+
+/**
+ * @brief Serves and advertises the image just verified in the OTA slot
+ * @param cid CID of the image
+ */
+void peer_cache_publish(const char *cid);
+
+/**
+ * @brief Stops serving the image of a partition, before it is overwritten
+ * @param partition Partition about to be written
+ */
+void peer_cache_forget(const esp_partition_t *partition);
+
+/**
+ * @brief Looks for peers serving a CID and puts them in front of the IPFS gateways
+ * @param cid CID of the image
+ * @return Number of peers found
+ */
+int peer_cache_discover(const char *cid);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_PEER_CACHE_H_ */
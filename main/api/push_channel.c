@@ -0,0 +1,255 @@
+/**
+*************************************************************************
+* @file       push_channel.c
+* @brief      Source file for the push_channel.c module.
+* @details    This file contains the implementation of functions for
+*             the push_channel.c module. Only the "event" field of the
+*             Server-Sent Events is used: a "firmware" event triggers the
+*             same metadata request as a reconnection, so the stream does
+*             not need to be trusted for the firmware details. The
+*             server must send the stream with chunked encoding, the only
+*             body of unknown length esp_http_client reads.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+// FreeRTOS Includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// ESP Includes
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_http_client.h"
+
+// Application Includes
+#include "tasks_common.h"
+#include "main_app.h"
+#include "api/push_channel.h"
+#include "api/metrics.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+// Event announcing a new firmware
+#define PUSH_CHANNEL_EVENT_FIRMWARE "firmware"
+
+/* Typedefs --------------------------------------------------------------*/
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "push_channel";
+
+/**
+ * @brief Flag to indicate the stream is open
+ */
+static volatile bool g_connected = false;
+
+/**
+ * @brief Time of the last check sent to the main application
+ */
+static int64_t g_last_check = 0;
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Task keeping the stream open, or polling while it is down
+ * @param pvParameters Parameter which can be passed to the task
+ */
+static void push_channel_task(void *pvParameters);
+
+/**
+ * @brief Opens the stream and reads its events until it drops
+ * @param reconnection true if the stream was open before
+ * @return true if the stream was opened
+ */
+static bool push_channel_listen(bool reconnection);
+
+/**
+ * @brief Processes one line of the stream
+ * @param line Line without the end of line
+ * @param event Buffer with the event type of the current message
+ * @param event_len Size of the event buffer
+ */
+static void push_channel_process_line(const char *line, char *event, size_t event_len);
+
+/**
+ * @brief Asks the main application to check for an update
+ * @param reason Reason of the check
+ */
+static void push_channel_request_check(push_channel_reason_e reason);
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup push_channel.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Starts the task keeping the push channel open
+ */
+void push_channel_start(void){
+#if PUSH_CHANNEL_ENABLED
+	ESP_LOGI(TAG, "STARTING PUSH CHANNEL");
+	g_last_check = esp_timer_get_time();
+	xTaskCreate(&push_channel_task, "push_channel_task", PUSH_CHANNEL_TASK_STACK_SIZE, NULL, PUSH_CHANNEL_TASK_PRIORITY, NULL);
+#endif
+}
+
+/**
+ * @brief Checks whether the push channel is open
+ * @return true if announcements are being received
+ */
+bool push_channel_is_connected(void){
+	return g_connected;
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup push_channel.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Task keeping the stream open, or polling while it is down
+ * @param pvParameters Parameter which can be passed to the task
+ */
+static void push_channel_task(void *pvParameters){
+	uint32_t retry_ms = PUSH_CHANNEL_RETRY_MS;
+	bool was_open = false;
+
+	for(;;){
+		if(push_channel_listen(was_open)){
+			was_open = true;
+			retry_ms = PUSH_CHANNEL_RETRY_MS;
+		}
+		else if(retry_ms < PUSH_CHANNEL_RETRY_MAX_MS){
+			retry_ms = (retry_ms * 2 < PUSH_CHANNEL_RETRY_MAX_MS) ? retry_ms * 2 : PUSH_CHANNEL_RETRY_MAX_MS;
+		}
+
+		// Without the stream nothing is announced, so fall back to polling
+		if(esp_timer_get_time() - g_last_check >= (int64_t)PUSH_CHANNEL_POLL_INTERVAL_MS * 1000){
+			push_channel_request_check(PUSH_CHANNEL_POLL);
+		}
+		vTaskDelay(pdMS_TO_TICKS(retry_ms));
+	}
+}
+
+/**
+ * @brief Opens the stream and reads its events until it drops
+ * @param reconnection true if the stream was open before
+ * @return true if the stream was opened
+ */
+static bool push_channel_listen(bool reconnection){
+	char buffer[128];
+	char line[PUSH_CHANNEL_LINE_LEN];
+	char event[32] = {0};
+	size_t line_len = 0;
+
+	esp_http_client_config_t config = {
+		.url = PUSH_CHANNEL_URL,
+		.cert_pem = (const char *)ca_cert_pem_start,
+		.cert_len = ca_cert_pem_end - ca_cert_pem_start,
+		.client_cert_pem = (const char *)client_cert_pem_start,
+		.client_cert_len = client_cert_pem_end - client_cert_pem_start,
+		.client_key_pem = (const char *)client_key_pem_start,
+		.client_key_len = client_key_pem_end - client_key_pem_start,
+		.skip_cert_common_name_check = true,
+		.timeout_ms = PUSH_CHANNEL_IDLE_TIMEOUT_MS,
+	};
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	if(client == NULL){
+		return false;
+	}
+	esp_http_client_set_header(client, "Accept", "text/event-stream");
+	esp_http_client_set_header(client, "Cache-Control", "no-cache");
+
+	if(esp_http_client_open(client, 0) != ESP_OK || esp_http_client_fetch_headers(client) < 0 ||
+	   esp_http_client_get_status_code(client) != 200){
+		ESP_LOGI(TAG, "Push channel unavailable, polling every %d s", PUSH_CHANNEL_POLL_INTERVAL_MS / 1000);
+		esp_http_client_cleanup(client);
+		return false;
+	}
+	ESP_LOGI(TAG, "PUSH CHANNEL OPEN");
+	metrics_count_connection(client);
+	g_connected = true;
+	if(reconnection){
+		push_channel_request_check(PUSH_CHANNEL_RECONNECTED);
+	}
+
+	// The server sends a comment line as heartbeat, a read timeout means the stream is dead
+	int bytes_read;
+	while((bytes_read = esp_http_client_read(client, buffer, sizeof(buffer))) > 0){
+		for(int i = 0; i < bytes_read; i++){
+			if(buffer[i] == '\n'){
+				if(line_len > 0 && line[line_len - 1] == '\r'){
+					line_len--;
+				}
+				line[line_len] = '\0';
+				push_channel_process_line(line, event, sizeof(event));
+				line_len = 0;
+			}
+			else if(line_len < sizeof(line) - 1){
+				line[line_len++] = buffer[i];
+			}
+		}
+	}
+
+	ESP_LOGI(TAG, "PUSH CHANNEL CLOSED");
+	g_connected = false;
+	esp_http_client_cleanup(client);
+	return true;
+}
+
+/**
+ * @brief Processes one line of the stream
+ * @param line Line without the end of line
+ * @param event Buffer with the event type of the current message
+ * @param event_len Size of the event buffer
+ */
+static void push_channel_process_line(const char *line, char *event, size_t event_len){
+	// A blank line dispatches the message
+	if(line[0] == '\0'){
+		if(strcmp(event, PUSH_CHANNEL_EVENT_FIRMWARE) == 0){
+			ESP_LOGI(TAG, "NEW FIRMWARE ANNOUNCED");
+			push_channel_request_check(PUSH_CHANNEL_ANNOUNCED);
+		}
+		event[0] = '\0';
+		return;
+	}
+	if(strncmp(line, "event:", 6) == 0){
+		const char *value = line + 6;
+		if(*value == ' '){
+			value++;
+		}
+		snprintf(event, event_len, "%s", value);
+	}
+}
+
+/**
+ * @brief Asks the main application to check for an update
+ * @param reason Reason of the check
+ */
+static void push_channel_request_check(push_channel_reason_e reason){
+	g_last_check = esp_timer_get_time();
+	main_app_send_message(MAIN_APP_MSG_CHECK_UPDATE, reason, 0, NULL);
+}
+
+/** @} */
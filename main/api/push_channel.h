@@ -0,0 +1,63 @@
+/**
+*************************************************************************
+* @file       push_channel.h
+* @brief      Header file for the push_channel.h module.
+* @details    This file contains declarations and prototypes for the
+*             push_channel.h module, a Server-Sent Events stream kept
+*             open with the metadata server. The server announces a new
+*             firmware on it and the main application checks for the
+*             update right away; while the stream is down the module
+*             polls the server instead.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_PUSH_CHANNEL_H_
+#define MAIN_API_PUSH_CHANNEL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+
+/* Public Macros -------------------------------------------------------------*/
+
+/* Public Types --------------------------------------------------------------*/
+
+/**
+ * @brief Reason of a MAIN_APP_MSG_CHECK_UPDATE message, sent in its code
+ */
+typedef enum push_channel_reason {
+    PUSH_CHANNEL_ANNOUNCED = 0, /**< The server announced a new firmware */
+    PUSH_CHANNEL_RECONNECTED,   /**< The stream is back, announcements may have been missed */
+    PUSH_CHANNEL_POLL,          /**< The stream is down, periodic check */
+} push_channel_reason_e;
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup push_channel.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Starts the task keeping the push channel open
+ */
+void push_channel_start(void);
+
+/**
+ * @brief Checks whether the push channel is open
+ * @return true if announcements are being received
+ */
+bool push_channel_is_connected(void);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_PUSH_CHANNEL_H_ */
@@ -0,0 +1,276 @@
+/**
+*************************************************************************
+* @file       self_check.c
+* @brief      Source file for the self_check.c module.
+* @details    This file contains the implementation of functions for
+*             the self_check.c module. The running partition is mapped
+*             with esp_partition_mmap in SELF_CHECK_WINDOW_SIZE windows and
+*             each window is hashed straight from the cache, with no copy
+*             and no read call per block.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// FreeRTOS Includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// ESP Includes
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include "mbedtls/sha256.h"
+
+// Application Includes
+#include "tasks_common.h"
+#include "api/self_check.h"
+#include "api/fw_update.h"
+#include "api/blake3.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+#if SELF_CHECK_WINDOW_SIZE % (64 * 1024) != 0
+#error "SELF_CHECK_WINDOW_SIZE must be a multiple of the 64 KiB MMU page"
+#endif
+
+/* Typedefs --------------------------------------------------------------*/
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "self_check";
+
+/**
+ * @brief Protects the result, read by other tasks
+ */
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Result of the self-check
+ */
+static self_check_result_t g_result = { .state = SELF_CHECK_PENDING, .source = "" };
+
+/**
+ * @brief Flag to indicate the task was started
+ */
+static bool g_started = false;
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Task that checks the running partition and deletes itself
+ * @param pvParameters parameter which can be passed to the task
+ */
+static void self_check_task(void *pvParameters);
+
+/**
+ * @brief Hashes the first bytes of a partition, one mapped window at a time
+ * @param partition Partition
+ * @param algorithm Algorithm of the hash
+ * @param len Bytes hashed from the start of the partition
+ * @param digest Hash, FW_UPDATE_DIGEST_SIZE bytes
+ * @return esp_err_t ESP_OK on success, or an error code on failure
+ */
+static esp_err_t self_check_hash(const esp_partition_t *partition, fw_update_hash_e algorithm, size_t len, uint8_t *digest);
+
+/**
+ * @brief Publishes the result of the self-check
+ * @param result Result
+ */
+static void self_check_set(const self_check_result_t *result);
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup self_check.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Starts the self-check task
+ * @return ESP_OK on success, or an error code on failure
+ * @note Called on each station connection; only the first call starts it.
+ */
+esp_err_t self_check_start(void){
+	if(g_started){
+		return ESP_OK;
+	}
+	if(xTaskCreate(&self_check_task, "self_check_task", SELF_CHECK_TASK_STACK_SIZE, NULL, SELF_CHECK_TASK_PRIORITY, NULL) != pdPASS){
+		ESP_LOGE(TAG, "Failed to create the self-check task");
+		return ESP_ERR_NO_MEM;
+	}
+	g_started = true;
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Gets the result of the self-check
+ * @param result Structure where the result will be stored
+ */
+void self_check_get(self_check_result_t *result){
+	taskENTER_CRITICAL(&g_lock);
+	*result = g_result;
+	taskEXIT_CRITICAL(&g_lock);
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup self_check.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Task that checks the running partition and deletes itself
+ * @param pvParameters parameter which can be passed to the task
+ */
+static void self_check_task(void *pvParameters){
+	self_check_result_t result = { .state = SELF_CHECK_RUNNING, .algorithm = FW_UPDATE_HASH_SHA256, .source = "" };
+	uint8_t expected[FW_UPDATE_DIGEST_SIZE];
+	uint8_t digest[FW_UPDATE_DIGEST_SIZE];
+	size_t len = 0;
+
+	const esp_partition_t *partition = esp_ota_get_running_partition();
+	self_check_set(&result);
+
+	// The digest of the update that installed the app covers the same bytes the server hashed
+	if(fw_update_get_slot_digest(partition, &result.algorithm, expected, &len) == FW_UPDATE_OK){
+		result.source = "record";
+	}
+	else{
+		// A factory app has no record, the image carries the SHA-256 of everything before it
+		esp_image_metadata_t metadata;
+		const esp_partition_pos_t pos = { .offset = partition->address, .size = partition->size };
+		if(esp_image_get_metadata(&pos, &metadata) == ESP_OK && metadata.image.hash_appended && metadata.image_len > FW_UPDATE_DIGEST_SIZE){
+			result.source = "appended";
+			result.algorithm = FW_UPDATE_HASH_SHA256;
+			memcpy(expected, metadata.image_digest, FW_UPDATE_DIGEST_SIZE);
+			len = metadata.image_len - FW_UPDATE_DIGEST_SIZE;
+		}
+	}
+
+	if(len == 0 || len > partition->size){
+		ESP_LOGI(TAG, "SELF CHECK: %s has no digest to check against", partition->label);
+		result.state = SELF_CHECK_NO_DIGEST;
+		self_check_set(&result);
+		vTaskDelete(NULL);
+		return;
+	}
+
+	int64_t start = esp_timer_get_time();
+	esp_err_t err = self_check_hash(partition, result.algorithm, len, digest);
+	result.elapsed_ms = (esp_timer_get_time() - start) / 1000;
+	result.bytes = len;
+	if(err != ESP_OK){
+		result.state = SELF_CHECK_ERROR;
+	}
+	else{
+		result.state = (memcmp(digest, expected, FW_UPDATE_DIGEST_SIZE) == 0) ? SELF_CHECK_PASSED : SELF_CHECK_FAILED;
+	}
+	self_check_set(&result);
+
+	if(result.state == SELF_CHECK_PASSED){
+		ESP_LOGI(TAG, "SELF CHECK: %s passed, %s of %lu bytes against the %s digest, %lu ms",
+		         partition->label, (result.algorithm == FW_UPDATE_HASH_BLAKE3) ? "blake3" : "sha256",
+		         (unsigned long)result.bytes, result.source, (unsigned long)result.elapsed_ms);
+	}
+	else{
+		ESP_LOGE(TAG, "SELF CHECK: %s %s, %s of %lu bytes against the %s digest, %lu ms",
+		         partition->label, (result.state == SELF_CHECK_FAILED) ? "FAILED" : "could not be read",
+		         (result.algorithm == FW_UPDATE_HASH_BLAKE3) ? "blake3" : "sha256",
+		         (unsigned long)result.bytes, result.source, (unsigned long)result.elapsed_ms);
+	}
+	// A record that does not match describes another image, e.g. the one before a serial reflash
+	if(result.state == SELF_CHECK_FAILED && strcmp(result.source, "record") == 0){
+		ESP_LOGW(TAG, "SELF CHECK: record of %s forgotten, the next boot checks the appended digest", partition->label);
+		fw_update_forget_slot(partition);
+	}
+
+	vTaskDelete(NULL);
+}
+
+/**
+ * @brief Hashes the first bytes of a partition, one mapped window at a time
+ * @param partition Partition
+ * @param algorithm Algorithm of the hash
+ * @param len Bytes hashed from the start of the partition
+ * @param digest Hash, FW_UPDATE_DIGEST_SIZE bytes
+ * @return esp_err_t ESP_OK on success, or an error code on failure
+ */
+static esp_err_t self_check_hash(const esp_partition_t *partition, fw_update_hash_e algorithm, size_t len, uint8_t *digest){
+	mbedtls_sha256_context sha256_ctx;
+	blake3_hasher_t *hasher = NULL;
+	esp_err_t err = ESP_OK;
+
+	if(algorithm == FW_UPDATE_HASH_BLAKE3){
+		hasher = malloc(sizeof(blake3_hasher_t));
+		if(hasher == NULL){
+			return ESP_ERR_NO_MEM;
+		}
+		blake3_hasher_init(hasher);
+	}
+	else{
+		mbedtls_sha256_init(&sha256_ctx);
+		mbedtls_sha256_starts(&sha256_ctx, 0);
+	}
+
+	// The window is hashed where the cache maps it, nothing is copied
+	for(size_t offset = 0; offset < len && err == ESP_OK; offset += SELF_CHECK_WINDOW_SIZE){
+		size_t n = (len - offset < SELF_CHECK_WINDOW_SIZE) ? len - offset : SELF_CHECK_WINDOW_SIZE;
+		esp_partition_mmap_handle_t handle;
+		const void *window;
+
+		err = esp_partition_mmap(partition, offset, n, ESP_PARTITION_MMAP_DATA, &window, &handle);
+		if(err != ESP_OK){
+			ESP_LOGE(TAG, "esp_partition_mmap failed at %u: %s", (unsigned)offset, esp_err_to_name(err));
+			break;
+		}
+		if(hasher != NULL){
+			blake3_hasher_update(hasher, window, n);
+		}
+		else{
+			mbedtls_sha256_update(&sha256_ctx, window, n);
+		}
+		esp_partition_munmap(handle);
+	}
+
+	if(hasher != NULL){
+		blake3_hasher_finalize(hasher, digest);
+		free(hasher);
+	}
+	else{
+		mbedtls_sha256_finish(&sha256_ctx, digest);
+		mbedtls_sha256_free(&sha256_ctx);
+	}
+	return err;
+}
+
+/**
+ * @brief Publishes the result of the self-check
+ * @param result Result
+ */
+static void self_check_set(const self_check_result_t *result){
+	taskENTER_CRITICAL(&g_lock);
+	g_result = *result;
+	taskEXIT_CRITICAL(&g_lock);
+}
+
+/** @} */
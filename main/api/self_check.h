@@ -0,0 +1,82 @@
+/**
+*************************************************************************
+* @file       self_check.h
+* @brief      Header file for the self_check.h module.
+* @details    This file contains declarations and prototypes for the
+*             self_check.h module, the boot-time integrity check of the
+*             running app. A low-priority task maps the running partition
+*             in large windows and hashes them in place, then compares the
+*             digest with the one recorded when the app was installed, or
+*             with the SHA-256 appended to the image, and reports the
+*             result and the time taken.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_SELF_CHECK_H_
+#define MAIN_API_SELF_CHECK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "esp_err.h"
+#include "api/fw_update.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/* Public Types --------------------------------------------------------------*/
+
+/**
+ * @brief State of the self-check
+ */
+typedef enum self_check_state {
+    SELF_CHECK_PENDING = 0, /**< Not started yet */
+    SELF_CHECK_RUNNING,     /**< Hashing the running partition */
+    SELF_CHECK_PASSED,      /**< The running app matches its digest */
+    SELF_CHECK_FAILED,      /**< The running app does not match its digest */
+    SELF_CHECK_NO_DIGEST,   /**< No recorded digest and no SHA-256 appended to the image */
+    SELF_CHECK_ERROR        /**< The partition could not be mapped */
+} self_check_state_e;
+
+/**
+ * @brief Result of the self-check
+ */
+typedef struct self_check_result {
+    self_check_state_e state;   /**< State of the check */
+    fw_update_hash_e algorithm; /**< Algorithm of the digest */
+    const char *source;         /**< Where the digest came from, "record" or "appended" */
+    uint32_t bytes;             /**< Bytes of the partition hashed */
+    uint32_t elapsed_ms;        /**< Time the hash took */
+} self_check_result_t;
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup self_check.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Starts the self-check task
+ * @return ESP_OK on success, or an error code on failure
+ * @note Called on each station connection; only the first call starts it.
+ */
+esp_err_t self_check_start(void);
+
+/**
+ * @brief Gets the result of the self-check
+ * @param result Structure where the result will be stored
+ */
+void self_check_get(self_check_result_t *result);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_SELF_CHECK_H_ */
@@ -0,0 +1,413 @@
+/**
+*************************************************************************
+* @file       session_arena.c
+* @brief      Source file for the session_arena.c module.
+* @details    This file contains the implementation of functions for
+*             the session_arena.c module. Blocks are taken from the top
+*             of the arena; a free of the top block rewinds it, and the
+*             arena starts over whenever no block is alive, so the TLS
+*             buffers of one connection are reused by the next one.
+*             When the arena is full the allocation goes to the heap.
+*             The hooks are process-wide, so only the tasks registered as
+*             owners of the cycle are served from the arena; any other
+*             task (push channel, gateway racers, peer server) uses the
+*             heap and never leaves a block behind the cycle.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+// FreeRTOS Includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// ESP Includes
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "mbedtls/platform.h"
+
+// Application Includes
+#include "cJSON.h"
+#include "api/session_arena.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+// Alignment of the blocks
+#define SESSION_ARENA_ALIGN(x) (((x) + 7) & ~7)
+
+// Flag in the block size marking a freed block
+#define SESSION_ARENA_FREED 0x80000000
+
+// Offset meaning no block
+#define SESSION_ARENA_NONE  0xFFFFFFFF
+
+/* Typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief Header placed before each block
+ */
+typedef struct session_arena_header {
+    uint32_t size; /**< Size requested, with SESSION_ARENA_FREED once freed */
+    uint32_t prev; /**< Offset of the previous block header */
+} session_arena_header_t;
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "session_arena";
+
+/**
+ * @brief Arena state, protected by g_lock
+ */
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t *g_arena = NULL;
+static bool g_active = false;
+static uint32_t g_used = 0;
+static uint32_t g_top = SESSION_ARENA_NONE;
+static uint32_t g_live = 0;
+
+/**
+ * @brief Tasks served by the arena, protected by g_lock
+ */
+static TaskHandle_t g_owners[SESSION_ARENA_MAX_OWNERS];
+
+/**
+ * @brief Statistics of the current cycle
+ */
+static session_arena_stats_t g_stats;
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Logs the free heap and its fragmentation
+ * @param when Moment of the report
+ * @param free_size Free heap in bytes
+ * @param fragmentation Fragmentation in percent
+ */
+static void session_arena_heap_report(const char *when, uint32_t *free_size, uint8_t *fragmentation);
+
+/**
+ * @brief Checks whether a pointer belongs to the arena
+ * @param ptr Pointer
+ * @return true if ptr is inside the arena
+ */
+static bool session_arena_owns(const void *ptr);
+
+/**
+ * @brief Checks whether the calling task is served by the arena
+ * @return true if the task was added with session_arena_add_owner()
+ * @note Called with g_lock taken.
+ */
+static bool session_arena_is_owner(void);
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup session_arena.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Installs the cJSON and mbedTLS allocation hooks
+ * @note The hooks stay installed; outside a cycle they use the heap.
+ */
+void session_arena_init(void){
+#if SESSION_ARENA_ENABLED
+	cJSON_Hooks hooks = {
+		.malloc_fn = session_arena_malloc,
+		.free_fn = session_arena_free,
+	};
+	cJSON_InitHooks(&hooks);
+#if defined(MBEDTLS_PLATFORM_MEMORY)
+	mbedtls_platform_set_calloc_free(session_arena_calloc, session_arena_free);
+#endif
+#endif
+}
+
+/**
+ * @brief Lets a task take its allocations from the arena during a cycle
+ * @param task Task handle, NULL for the calling task
+ * @note The hooks are process-wide; a task that is not an owner always uses the heap.
+ */
+void session_arena_add_owner(TaskHandle_t task){
+	int slot = -1;
+
+	if(task == NULL){
+		task = xTaskGetCurrentTaskHandle();
+	}
+	taskENTER_CRITICAL(&g_lock);
+	for(int i = 0; i < SESSION_ARENA_MAX_OWNERS; i++){
+		if(g_owners[i] == task){
+			slot = i;
+			break;
+		}
+		if(g_owners[i] == NULL && slot < 0){
+			slot = i;
+		}
+	}
+	if(slot >= 0){
+		g_owners[slot] = task;
+	}
+	taskEXIT_CRITICAL(&g_lock);
+
+	if(slot < 0){
+		ESP_LOGE(TAG, "No room for another owner, the task uses the heap");
+	}
+}
+
+/**
+ * @brief Stops serving a task from the arena, its blocks already taken stay valid
+ * @param task Task handle, NULL for the calling task
+ * @return true if the task was an owner, so a caller can add it back afterwards
+ */
+bool session_arena_remove_owner(TaskHandle_t task){
+	bool owner = false;
+
+	if(task == NULL){
+		task = xTaskGetCurrentTaskHandle();
+	}
+	taskENTER_CRITICAL(&g_lock);
+	for(int i = 0; i < SESSION_ARENA_MAX_OWNERS; i++){
+		if(g_owners[i] == task){
+			g_owners[i] = NULL;
+			owner = true;
+		}
+	}
+	taskEXIT_CRITICAL(&g_lock);
+
+	return owner;
+}
+
+/**
+ * @brief Starts an update cycle, allocating the arena
+ */
+void session_arena_begin(void){
+#if SESSION_ARENA_ENABLED
+	if(g_active){
+		session_arena_end();
+	}
+	memset(&g_stats, 0x00, sizeof(g_stats));
+	session_arena_heap_report("before", &g_stats.free_before, &g_stats.fragmentation_before);
+
+	// A block of the previous cycle is still alive, keep using the arena it holds
+	if(g_arena != NULL){
+		taskENTER_CRITICAL(&g_lock);
+		g_active = (g_arena != NULL);
+		g_stats.peak = g_used;
+		taskEXIT_CRITICAL(&g_lock);
+		ESP_LOGI(TAG, "Arena kept by %lu blocks of the previous cycle", (unsigned long)g_live);
+		return;
+	}
+	uint8_t *arena = heap_caps_malloc(SESSION_ARENA_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	if(arena == NULL){
+		ESP_LOGE(TAG, "Failed to allocate the arena, cycle runs on the heap");
+		return;
+	}
+
+	taskENTER_CRITICAL(&g_lock);
+	g_arena = arena;
+	g_used = 0;
+	g_top = SESSION_ARENA_NONE;
+	g_live = 0;
+	g_active = true;
+	taskEXIT_CRITICAL(&g_lock);
+#endif
+}
+
+/**
+ * @brief Ends the update cycle, releasing the arena once its last block is freed
+ */
+void session_arena_end(void){
+#if SESSION_ARENA_ENABLED
+	uint8_t *release = NULL;
+	uint32_t live;
+
+	taskENTER_CRITICAL(&g_lock);
+	g_active = false;
+	live = g_live;
+	if(g_live == 0){
+		release = g_arena;
+		g_arena = NULL;
+	}
+	taskEXIT_CRITICAL(&g_lock);
+
+	// A connection still open keeps the arena until it is closed
+	if(release != NULL){
+		free(release);
+	}
+	else if(live > 0){
+		ESP_LOGI(TAG, "%lu blocks still alive, arena released with the last one", (unsigned long)live);
+	}
+
+	session_arena_heap_report("after", &g_stats.free_after, &g_stats.fragmentation_after);
+	ESP_LOGI(TAG, "Arena peak %lu of %d bytes, %lu allocations, %lu on the heap",
+	         (unsigned long)g_stats.peak, SESSION_ARENA_SIZE,
+	         (unsigned long)g_stats.allocations, (unsigned long)g_stats.fallbacks);
+#endif
+}
+
+/**
+ * @brief Gets the statistics of the last update cycle
+ * @param stats Structure where the statistics will be stored
+ */
+void session_arena_get_stats(session_arena_stats_t *stats){
+	*stats = g_stats;
+}
+
+/**
+ * @brief Allocates a block from the arena, or from the heap outside a cycle
+ * @param size Size of the block
+ * @return Pointer to the block, or NULL on failure
+ */
+void *session_arena_malloc(size_t size){
+	uint32_t total = SESSION_ARENA_ALIGN(sizeof(session_arena_header_t) + size);
+	void *ptr = NULL;
+
+	taskENTER_CRITICAL(&g_lock);
+	bool served = g_active && session_arena_is_owner();
+	if(served && size < SESSION_ARENA_FREED && g_used + total <= SESSION_ARENA_SIZE){
+		session_arena_header_t *header = (session_arena_header_t *)(g_arena + g_used);
+		header->size = size;
+		header->prev = g_top;
+		g_top = g_used;
+		g_used += total;
+		g_live++;
+		g_stats.allocations++;
+		if(g_used > g_stats.peak){
+			g_stats.peak = g_used;
+		}
+		ptr = header + 1;
+	}
+	else if(served){
+		g_stats.fallbacks++;
+	}
+	taskEXIT_CRITICAL(&g_lock);
+
+	if(ptr == NULL){
+		ptr = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	}
+	return ptr;
+}
+
+/**
+ * @brief Allocates a zeroed block, as mbedTLS expects
+ * @param count Number of elements
+ * @param size Size of each element
+ * @return Pointer to the block, or NULL on failure
+ */
+void *session_arena_calloc(size_t count, size_t size){
+	if(size != 0 && count > SIZE_MAX / size){
+		return NULL;
+	}
+	void *ptr = session_arena_malloc(count * size);
+	if(ptr != NULL){
+		memset(ptr, 0x00, count * size);
+	}
+	return ptr;
+}
+
+/**
+ * @brief Frees a block from the arena or from the heap
+ * @param ptr Pointer to the block
+ */
+void session_arena_free(void *ptr){
+	uint8_t *release = NULL;
+
+	if(ptr == NULL){
+		return;
+	}
+	if(!session_arena_owns(ptr)){
+		free(ptr);
+		return;
+	}
+
+	taskENTER_CRITICAL(&g_lock);
+	session_arena_header_t *header = (session_arena_header_t *)ptr - 1;
+	header->size |= SESSION_ARENA_FREED;
+	g_live--;
+	if(g_live == 0){
+		// Nothing alive, start over, or release the arena if the cycle ended
+		g_used = 0;
+		g_top = SESSION_ARENA_NONE;
+		if(!g_active){
+			release = g_arena;
+			g_arena = NULL;
+		}
+	}
+	else{
+		// Rewind over the freed blocks on the top
+		while(g_top != SESSION_ARENA_NONE && (((session_arena_header_t *)(g_arena + g_top))->size & SESSION_ARENA_FREED)){
+			g_used = g_top;
+			g_top = ((session_arena_header_t *)(g_arena + g_top))->prev;
+		}
+	}
+	taskEXIT_CRITICAL(&g_lock);
+
+	if(release != NULL){
+		free(release);
+	}
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup session_arena.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Logs the free heap and its fragmentation
+ * @param when Moment of the report
+ * @param free_size Free heap in bytes
+ * @param fragmentation Fragmentation in percent
+ */
+static void session_arena_heap_report(const char *when, uint32_t *free_size, uint8_t *fragmentation){
+	size_t free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+	size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+	*free_size = free_heap;
+	*fragmentation = (free_heap > 0) ? 100 - (largest * 100) / free_heap : 0;
+	ESP_LOGI(TAG, "Heap %s the cycle: %u free, largest block %u, fragmentation %u%%",
+	         when, (unsigned)free_heap, (unsigned)largest, (unsigned)*fragmentation);
+}
+
+/**
+ * @brief Checks whether a pointer belongs to the arena
+ * @param ptr Pointer
+ * @return true if ptr is inside the arena
+ */
+static bool session_arena_owns(const void *ptr){
+	const uint8_t *arena = g_arena;
+	return arena != NULL && (const uint8_t *)ptr >= arena && (const uint8_t *)ptr < arena + SESSION_ARENA_SIZE;
+}
+
+/**
+ * @brief Checks whether the calling task is served by the arena
+ * @return true if the task was added with session_arena_add_owner()
+ * @note Called with g_lock taken.
+ */
+static bool session_arena_is_owner(void){
+	TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+	for(int i = 0; i < SESSION_ARENA_MAX_OWNERS; i++){
+		if(g_owners[i] == task){
+			return true;
+		}
+	}
+	return false;
+}
+
+/** @} */
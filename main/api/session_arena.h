@@ -0,0 +1,103 @@
+/**
+*************************************************************************
+* @file       session_arena.h
+* @brief      Header file for the session_arena.h module.
+* @details    This file contains declarations and prototypes for the
+*             session_arena.h module, an arena allocator used by cJSON
+*             and mbedTLS while an update cycle runs. The whole arena is
+*             one heap block, released in one step when the cycle ends,
+*             so the small allocations of the cycle do not fragment the
+*             heap.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_SESSION_ARENA_H_
+#define MAIN_API_SESSION_ARENA_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/* Public Types --------------------------------------------------------------*/
+
+/**
+ * @brief Statistics of the last update cycle
+ */
+typedef struct session_arena_stats {
+    uint32_t peak;                /**< Highest arena usage in bytes */
+    uint32_t allocations;         /**< Allocations served by the arena */
+    uint32_t fallbacks;           /**< Allocations served by the heap because the arena was full */
+    uint32_t free_before;         /**< Free heap when the cycle started */
+    uint32_t free_after;          /**< Free heap after the cycle released the arena */
+    uint8_t fragmentation_before; /**< Heap fragmentation in percent when the cycle started */
+    uint8_t fragmentation_after;  /**< Heap fragmentation in percent after the cycle */
+} session_arena_stats_t;
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup session_arena.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Installs the cJSON and mbedTLS allocation hooks
+ * @note The hooks stay installed; outside a cycle they use the heap.
+ */
+void session_arena_init(void);
+
+/**
+ * @brief Lets a task take its allocations from the arena during a cycle
+ * @param task Task handle, NULL for the calling task
+ * @note The hooks are process-wide; a task that is not an owner always uses the heap.
+ */
+void session_arena_add_owner(TaskHandle_t task);
+
+/**
+ * @brief Stops serving a task from the arena, its blocks already taken stay valid
+ * @param task Task handle, NULL for the calling task
+ * @return true if the task was an owner, so a caller can add it back afterwards
+ */
+bool session_arena_remove_owner(TaskHandle_t task);
+
+/**
+ * @brief Starts an update cycle, allocating the arena
+ */
+void session_arena_begin(void);
+
+/**
+ * @brief Ends the update cycle, releasing the arena once its last block is freed
+ */
+void session_arena_end(void);
+
+/**
+ * @brief Gets the statistics of the last update cycle
+ * @param stats Structure where the statistics will be stored
+ */
+void session_arena_get_stats(session_arena_stats_t *stats);
+
+/**
+ * @brief Allocation functions used by the hooks
+ */
+void *session_arena_malloc(size_t size);
+void *session_arena_calloc(size_t count, size_t size);
+void session_arena_free(void *ptr);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_SESSION_ARENA_H_ */
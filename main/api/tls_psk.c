@@ -0,0 +1,777 @@
+/**
+*************************************************************************
+* @file       tls_psk.c
+* @brief      Source file for the tls_psk.c module.
+* @details    This file contains the implementation of functions for
+*             the tls_psk.c module. Only what the register-device
+*             exchange needs is implemented: one POST per connection,
+*             closed by the server, answered with a Content-Length or a
+*             chunked body that fits the response buffer.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// ESP Includes
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+// Application Includes
+#include "api/tls_psk.h"
+#include "api/metrics.h"
+#include "api/session_arena.h"
+
+#if TLS_PSK_ENABLED
+#include "nvs.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/platform_util.h"
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3)
+#include "psa/crypto.h"
+#endif
+
+#if TLS_PSK_EPHEMERAL && !defined(MBEDTLS_KEY_EXCHANGE_ECDHE_PSK_ENABLED)
+#error "TLS_PSK_EPHEMERAL needs CONFIG_MBEDTLS_KEY_EXCHANGE_ECDHE_PSK"
+#endif
+#if !TLS_PSK_EPHEMERAL && !defined(MBEDTLS_KEY_EXCHANGE_PSK_ENABLED)
+#error "The PSK mode needs CONFIG_MBEDTLS_KEY_EXCHANGE_PSK"
+#endif
+
+/* Definitions ----------------------------------------------------------*/
+
+/**
+ * @brief Size of the request line and headers
+ */
+#define TLS_PSK_HEAD_LEN 256
+
+/**
+ * @brief Size of the response, headers included
+ */
+#define TLS_PSK_RX_LEN (HTTPS_RESPONSE_BUFFER_SIZE + 512)
+
+/**
+ * @brief Smallest key accepted, 128 bits
+ */
+#define TLS_PSK_KEY_MIN_LEN 16
+
+/* Typedefs --------------------------------------------------------------*/
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "tls_psk";
+
+/**
+ * @brief Ciphersuites of the PSK mode, the TLS 1.3 one first when it is built in
+ */
+static const int g_ciphersuites[] = {
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3)
+	MBEDTLS_TLS1_3_AES_128_GCM_SHA256,
+#endif
+#if TLS_PSK_EPHEMERAL
+	MBEDTLS_TLS_ECDHE_PSK_WITH_AES_128_CBC_SHA256,
+#else
+	MBEDTLS_TLS_PSK_WITH_AES_128_GCM_SHA256,
+	MBEDTLS_TLS_PSK_WITH_AES_128_CBC_SHA256,
+#endif
+	0
+};
+
+/**
+ * @brief Random generator shared by both configurations
+ */
+static bool g_seeded = false;
+static mbedtls_entropy_context g_entropy;
+static mbedtls_ctr_drbg_context g_ctr_drbg;
+
+/**
+ * @brief PSK configuration, built once; -1 when the device has no key, 0 until built or after a failure to retry
+ */
+static int g_configured = 0;
+static mbedtls_ssl_config g_conf;
+static char g_identity[TLS_PSK_IDENTITY_LEN];
+
+/**
+ * @brief Certificate configuration, built only for the benchmark
+ */
+static bool g_cert_configured = false;
+static mbedtls_ssl_config g_cert_conf;
+static mbedtls_x509_crt g_ca_cert;
+static mbedtls_x509_crt g_client_cert;
+static mbedtls_pk_context g_client_key;
+
+/**
+ * @brief Connection of the exchange in progress
+ */
+static mbedtls_ssl_context g_ssl;
+static mbedtls_net_context g_net;
+
+/**
+ * @brief Request headers and response, kept off the stack of the calling task
+ */
+static char g_head[TLS_PSK_HEAD_LEN];
+static char g_rx[TLS_PSK_RX_LEN];
+
+/**
+ * @brief Statistics of the exchange in progress, counted by the BIO
+ */
+static tls_psk_stats_t *g_stats = NULL;
+static bool g_last_was_received = true;
+static int64_t g_io_us = 0;
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Seeds the random generator
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t tls_psk_seed(void);
+
+/**
+ * @brief Loads the identity and the key from NVS and builds the PSK configuration
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND when the device has no key, or an error code on failure
+ * @note Only a missing key is kept until the next boot; any other failure is retried on the next request.
+ */
+static esp_err_t tls_psk_configure(void);
+
+/**
+ * @brief Builds the certificate configuration, same mutual authentication as the HTTPS path
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t tls_psk_configure_cert(void);
+
+/**
+ * @brief Opens the TCP connection and runs the TLS handshake
+ * @param conf Configuration of the connection
+ * @param host Address of the server
+ * @param port Port of the server
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t tls_psk_connect(const mbedtls_ssl_config *conf, const char *host, const char *port);
+
+/**
+ * @brief Closes the connection
+ */
+static void tls_psk_close(void);
+
+/**
+ * @brief Writes a buffer to the connection
+ * @param data Data
+ * @param len Length of the data
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t tls_psk_write(const uint8_t *data, size_t len);
+
+/**
+ * @brief Reads the response until its end or the end of the connection
+ * @param response Buffer where the body will be stored, null terminated
+ * @param size Size of the buffer
+ * @param len Length of the body
+ * @param status HTTP status of the response
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t tls_psk_read_response(char *response, size_t size, size_t *len, int *status);
+
+/**
+ * @brief Finds a header in the response head
+ * @param head Response head, null terminated
+ * @param name Name of the header, colon included
+ * @return Value of the header, or NULL when missing
+ */
+static const char *tls_psk_header(const char *head, const char *name);
+
+/**
+ * @brief Decodes a chunked body in place
+ * @param body Body
+ * @param len Length of the body
+ * @return Length of the decoded body
+ */
+static size_t tls_psk_dechunk(char *body, size_t len);
+
+/**
+ * @brief Splits the address and the port out of an HTTPS URL
+ * @param url URL
+ * @param host Buffer where the address will be stored
+ * @param host_size Size of the address buffer
+ * @param port Buffer where the port will be stored
+ * @param port_size Size of the port buffer
+ */
+static void tls_psk_split_url(const char *url, char *host, size_t host_size, char *port, size_t port_size);
+
+/**
+ * @brief BIO functions counting the records and the time spent in the socket
+ */
+static int tls_psk_bio_send(void *ctx, const unsigned char *buf, size_t len);
+static int tls_psk_bio_recv(void *ctx, unsigned char *buf, size_t len, uint32_t timeout);
+#endif
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup tls_psk.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Sends a POST over a new PSK connection and waits for its response
+ * @param path Path of the resource
+ * @param content_type Content type of the body
+ * @param body Body of the request
+ * @param body_len Length of the body
+ * @param response Buffer where the response body will be stored, null terminated
+ * @param size Size of the buffer
+ * @param len Length of the response body
+ * @param stats Cost of the exchange
+ * @return ESP_OK on a 2xx response, ESP_ERR_NOT_FOUND when the device has no key,
+ *         ESP_ERR_INVALID_STATE when the configuration failed and is retried on the next request, or an error code on failure
+ */
+esp_err_t tls_psk_post(const char *path, const char *content_type, const uint8_t *body, size_t body_len,
+                       char *response, size_t size, size_t *len, tls_psk_stats_t *stats){
+#if TLS_PSK_ENABLED
+	int64_t start = esp_timer_get_time();
+	esp_err_t err;
+
+	memset(stats, 0x00, sizeof(tls_psk_stats_t));
+	*len = 0;
+	if(g_configured == 0){
+		// The configuration outlives the update cycle, so it is not taken from the cycle arena
+		bool owner = session_arena_remove_owner(NULL);
+		tls_psk_configure();
+		if(owner){
+			session_arena_add_owner(NULL);
+		}
+	}
+	if(g_configured < 0){
+		return ESP_ERR_NOT_FOUND;
+	}
+	if(g_configured == 0){
+		// A transient failure, the configuration is built again on the next request
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	g_stats = stats;
+	g_last_was_received = true;
+	if((err = tls_psk_connect(&g_conf, TLS_PSK_SERVER_HOST, TLS_PSK_SERVER_PORT)) != ESP_OK){
+		g_stats = NULL;
+		return err;
+	}
+
+	// One request per connection, the PSK handshake is cheap enough to run each time
+	int head_len = snprintf(g_head, sizeof(g_head),
+	                        "POST /%s HTTP/1.1\r\nHost: %s\r\nContent-Type: %s\r\nAccept: %s%s\r\n"
+	                        "Content-Length: %u\r\nConnection: close\r\n\r\n",
+	                        path, TLS_PSK_SERVER_HOST, content_type, content_type,
+	                        (strcmp(content_type, "application/json") == 0) ? "" : ", application/json", (unsigned)body_len);
+	if(head_len >= (int)sizeof(g_head)){
+		ESP_LOGE(TAG, "Request head does not fit in %d bytes", TLS_PSK_HEAD_LEN);
+		err = ESP_ERR_INVALID_SIZE;
+	}
+	else if((err = tls_psk_write((const uint8_t *)g_head, head_len)) == ESP_OK &&
+	        (err = tls_psk_write(body, body_len)) == ESP_OK){
+		err = tls_psk_read_response(response, size, len, &stats->status);
+	}
+
+	tls_psk_close();
+	stats->latency_ms = (esp_timer_get_time() - start) / 1000;
+	g_stats = NULL;
+	if(err == ESP_OK && (stats->status < 200 || stats->status > 299)){
+		ESP_LOGE(TAG, "Response status %d", stats->status);
+		err = ESP_FAIL;
+	}
+
+	return err;
+#else
+	return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * @brief Times handshakes over the certificate path and over the PSK path and logs both
+ * @param rounds Handshakes of each kind
+ * @note The two paths go through the same socket accounting, so their CPU
+ *       times compare; the TLS_HANDSHAKE_BENCH line is meant for a log parser.
+ */
+void tls_psk_benchmark(int rounds){
+#if TLS_PSK_ENABLED
+	char cert_host[64];
+	char cert_port[8];
+
+	tls_psk_split_url(HTTPS_BLOCKCHAIN_SERVER_URL, cert_host, sizeof(cert_host), cert_port, sizeof(cert_port));
+	// Both configurations outlive the update cycle, so they are not taken from the cycle arena
+	bool owner = session_arena_remove_owner(NULL);
+	if(g_configured == 0){
+		tls_psk_configure();
+	}
+	tls_psk_configure_cert();
+	if(owner){
+		session_arena_add_owner(NULL);
+	}
+
+	const struct {
+		const char *name;
+		const mbedtls_ssl_config *conf;
+		bool ready;
+		const char *host;
+		const char *port;
+	} paths[] = {
+		{"cert", &g_cert_conf, g_cert_configured, cert_host, cert_port},
+		{"psk", &g_conf, g_configured > 0, TLS_PSK_SERVER_HOST, TLS_PSK_SERVER_PORT},
+	};
+
+	for(int p = 0; p < sizeof(paths) / sizeof(paths[0]); p++){
+		uint32_t total_ms = 0, max_ms = 0, total_cpu_ms = 0, max_cpu_ms = 0, total_bytes = 0, total_trips = 0;
+		int ok = 0;
+
+		if(!paths[p].ready){
+			ESP_LOGW(TAG, "%s path not configured, skipped", paths[p].name);
+			continue;
+		}
+		for(int i = 0; i < rounds; i++){
+			tls_psk_stats_t stats;
+
+			memset(&stats, 0x00, sizeof(stats));
+			g_stats = &stats;
+			g_last_was_received = true;
+			if(tls_psk_connect(paths[p].conf, paths[p].host, paths[p].port) == ESP_OK){
+				tls_psk_close();
+				ok++;
+				total_ms += stats.handshake_ms;
+				total_cpu_ms += stats.handshake_cpu_ms;
+				max_ms = (stats.handshake_ms > max_ms) ? stats.handshake_ms : max_ms;
+				max_cpu_ms = (stats.handshake_cpu_ms > max_cpu_ms) ? stats.handshake_cpu_ms : max_cpu_ms;
+				total_bytes += stats.bytes_sent + stats.bytes_received;
+				total_trips += stats.handshake_trips;
+			}
+			g_stats = NULL;
+		}
+
+		ESP_LOGI(TAG, "TLS_HANDSHAKE_BENCH {\"path\": \"%s\", \"rounds\": %d, \"ok\": %d, \"meanMs\": %lu, \"maxMs\": %lu, "
+		         "\"meanCpuMs\": %lu, \"maxCpuMs\": %lu, \"meanRoundTrips\": %lu, \"meanBytes\": %lu}",
+		         paths[p].name, rounds, ok, (unsigned long)(ok ? total_ms / ok : 0), (unsigned long)max_ms,
+		         (unsigned long)(ok ? total_cpu_ms / ok : 0), (unsigned long)max_cpu_ms,
+		         (unsigned long)(ok ? total_trips / ok : 0), (unsigned long)(ok ? total_bytes / ok : 0));
+	}
+#endif
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup tls_psk.c Private Functions
+ * @{
+ */
+
+#if TLS_PSK_ENABLED
+/**
+ * @brief Seeds the random generator
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t tls_psk_seed(void){
+	int ret;
+
+	if(g_seeded){
+		return ESP_OK;
+	}
+	mbedtls_entropy_init(&g_entropy);
+	mbedtls_ctr_drbg_init(&g_ctr_drbg);
+	if((ret = mbedtls_ctr_drbg_seed(&g_ctr_drbg, mbedtls_entropy_func, &g_entropy, NULL, 0)) != 0){
+		ESP_LOGE(TAG, "Random generator seed failed: -0x%04x", -ret);
+		mbedtls_ctr_drbg_free(&g_ctr_drbg);
+		mbedtls_entropy_free(&g_entropy);
+		return ESP_FAIL;
+	}
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3)
+	// The TLS 1.3 key schedule runs on PSA
+	if(psa_crypto_init() != PSA_SUCCESS){
+		ESP_LOGE(TAG, "PSA initialization failed");
+		mbedtls_ctr_drbg_free(&g_ctr_drbg);
+		mbedtls_entropy_free(&g_entropy);
+		return ESP_FAIL;
+	}
+#endif
+	g_seeded = true;
+	return ESP_OK;
+}
+
+/**
+ * @brief Loads the identity and the key from NVS and builds the PSK configuration
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND when the device has no key, or an error code on failure
+ * @note Only a missing key is kept until the next boot; any other failure is retried on the next request.
+ */
+static esp_err_t tls_psk_configure(void){
+	nvs_handle_t nvs_handle;
+	uint8_t key[TLS_PSK_KEY_LEN];
+	size_t key_len = sizeof(key);
+	size_t identity_len = sizeof(g_identity);
+	int ret;
+
+	esp_err_t err = nvs_open(TLS_PSK_NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
+	if(err == ESP_OK){
+		err = nvs_get_str(nvs_handle, TLS_PSK_NVS_IDENTITY_KEY, g_identity, &identity_len);
+		if(err == ESP_OK){
+			err = nvs_get_blob(nvs_handle, TLS_PSK_NVS_KEY_KEY, key, &key_len);
+		}
+		nvs_close(nvs_handle);
+	}
+	if(err == ESP_ERR_NVS_NOT_FOUND || (err == ESP_OK && key_len < TLS_PSK_KEY_MIN_LEN)){
+		// Not provisioned, the certificate path is used until the next boot
+		ESP_LOGW(TAG, "No pre-shared key provisioned: %s", (err != ESP_OK) ? esp_err_to_name(err) : "key too short");
+		mbedtls_platform_zeroize(key, sizeof(key));
+		g_configured = -1;
+		return ESP_ERR_NOT_FOUND;
+	}
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "Failed to read the pre-shared key: %s", esp_err_to_name(err));
+		mbedtls_platform_zeroize(key, sizeof(key));
+		return err;
+	}
+
+	mbedtls_ssl_config_init(&g_conf);
+	if(tls_psk_seed() != ESP_OK ||
+	   (ret = mbedtls_ssl_config_defaults(&g_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT)) != 0 ||
+	   (ret = mbedtls_ssl_conf_psk(&g_conf, key, key_len, (const unsigned char *)g_identity, strlen(g_identity))) != 0){
+		ESP_LOGE(TAG, "PSK configuration failed");
+		mbedtls_platform_zeroize(key, sizeof(key));
+		mbedtls_ssl_config_free(&g_conf);
+		return ESP_FAIL;
+	}
+	// mbedTLS keeps its own copy of the key
+	mbedtls_platform_zeroize(key, sizeof(key));
+
+	mbedtls_ssl_conf_ciphersuites(&g_conf, g_ciphersuites);
+	mbedtls_ssl_conf_rng(&g_conf, mbedtls_ctr_drbg_random, &g_ctr_drbg);
+	mbedtls_ssl_conf_read_timeout(&g_conf, TLS_PSK_READ_TIMEOUT_MS);
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3)
+	mbedtls_ssl_conf_max_tls_version(&g_conf, MBEDTLS_SSL_VERSION_TLS1_3);
+	mbedtls_ssl_conf_tls13_key_exchange_modes(&g_conf, TLS_PSK_EPHEMERAL ? MBEDTLS_SSL_TLS1_3_KEY_EXCHANGE_MODE_PSK_EPHEMERAL
+	                                                                      : MBEDTLS_SSL_TLS1_3_KEY_EXCHANGE_MODE_PSK);
+#endif
+
+	ESP_LOGI(TAG, "Pre-shared key of identity %s loaded", g_identity);
+	g_configured = 1;
+	return ESP_OK;
+}
+
+/**
+ * @brief Builds the certificate configuration, same mutual authentication as the HTTPS path
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t tls_psk_configure_cert(void){
+	int ret;
+
+	if(g_cert_configured){
+		return ESP_OK;
+	}
+	mbedtls_ssl_config_init(&g_cert_conf);
+	mbedtls_x509_crt_init(&g_ca_cert);
+	mbedtls_x509_crt_init(&g_client_cert);
+	mbedtls_pk_init(&g_client_key);
+
+	if(tls_psk_seed() != ESP_OK ||
+	   (ret = mbedtls_x509_crt_parse(&g_ca_cert, (const unsigned char *)ca_cert_pem_start, ca_cert_pem_end - ca_cert_pem_start)) != 0 ||
+	   (ret = mbedtls_x509_crt_parse(&g_client_cert, (const unsigned char *)client_cert_pem_start, client_cert_pem_end - client_cert_pem_start)) != 0 ||
+	   (ret = mbedtls_pk_parse_key(&g_client_key, (const unsigned char *)client_key_pem_start, client_key_pem_end - client_key_pem_start,
+	                               NULL, 0, mbedtls_ctr_drbg_random, &g_ctr_drbg)) != 0 ||
+	   (ret = mbedtls_ssl_config_defaults(&g_cert_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT)) != 0 ||
+	   (ret = mbedtls_ssl_conf_own_cert(&g_cert_conf, &g_client_cert, &g_client_key)) != 0){
+		// Release what was parsed, the next call initializes everything again
+		ESP_LOGE(TAG, "Certificate configuration failed");
+		mbedtls_ssl_config_free(&g_cert_conf);
+		mbedtls_x509_crt_free(&g_ca_cert);
+		mbedtls_x509_crt_free(&g_client_cert);
+		mbedtls_pk_free(&g_client_key);
+		return ESP_FAIL;
+	}
+
+	mbedtls_ssl_conf_authmode(&g_cert_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+	mbedtls_ssl_conf_ca_chain(&g_cert_conf, &g_ca_cert, NULL);
+	mbedtls_ssl_conf_rng(&g_cert_conf, mbedtls_ctr_drbg_random, &g_ctr_drbg);
+	mbedtls_ssl_conf_read_timeout(&g_cert_conf, TLS_PSK_READ_TIMEOUT_MS);
+
+	g_cert_configured = true;
+	return ESP_OK;
+}
+
+/**
+ * @brief Opens the TCP connection and runs the TLS handshake
+ * @param conf Configuration of the connection
+ * @param host Address of the server
+ * @param port Port of the server
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t tls_psk_connect(const mbedtls_ssl_config *conf, const char *host, const char *port){
+	int64_t start = esp_timer_get_time();
+	int ret;
+
+	mbedtls_net_init(&g_net);
+	mbedtls_ssl_init(&g_ssl);
+	if((ret = mbedtls_net_connect(&g_net, host, port, MBEDTLS_NET_PROTO_TCP)) != 0 ||
+	   (ret = mbedtls_ssl_setup(&g_ssl, conf)) != 0){
+		ESP_LOGE(TAG, "TLS setup failed: -0x%04x", -ret);
+		tls_psk_close();
+		return ESP_FAIL;
+	}
+	// The HTTPS path skips the common name check too
+	mbedtls_ssl_set_hostname(&g_ssl, NULL);
+	mbedtls_ssl_set_bio(&g_ssl, &g_net, tls_psk_bio_send, NULL, tls_psk_bio_recv);
+
+	// Wall time minus the time blocked in the socket is the cryptography
+	int64_t tcp_done = esp_timer_get_time();
+	g_io_us = 0;
+	while((ret = mbedtls_ssl_handshake(&g_ssl)) != 0){
+		if(ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE){
+			ESP_LOGE(TAG, "TLS handshake failed: -0x%04x", -ret);
+			tls_psk_close();
+			return ESP_FAIL;
+		}
+	}
+	int64_t end = esp_timer_get_time();
+
+	if(g_stats != NULL){
+		g_stats->handshake_ms = (end - start) / 1000;
+		g_stats->handshake_cpu_ms = (end - tcp_done - g_io_us) / 1000;
+		g_stats->handshake_trips = g_stats->round_trips;
+	}
+	metrics_add(METRICS_TLS_HANDSHAKES, 1);
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Closes the connection
+ */
+static void tls_psk_close(void){
+	mbedtls_ssl_close_notify(&g_ssl);
+	mbedtls_ssl_free(&g_ssl);
+	mbedtls_net_free(&g_net);
+}
+
+/**
+ * @brief Writes a buffer to the connection
+ * @param data Data
+ * @param len Length of the data
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t tls_psk_write(const uint8_t *data, size_t len){
+	size_t written = 0;
+
+	while(written < len){
+		int ret = mbedtls_ssl_write(&g_ssl, &data[written], len - written);
+		if(ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE){
+			continue;
+		}
+		if(ret < 0){
+			ESP_LOGE(TAG, "TLS write failed: -0x%04x", -ret);
+			return ESP_FAIL;
+		}
+		written += ret;
+	}
+	return ESP_OK;
+}
+
+/**
+ * @brief Reads the response until its end or the end of the connection
+ * @param response Buffer where the body will be stored, null terminated
+ * @param size Size of the buffer
+ * @param len Length of the body
+ * @param status HTTP status of the response
+ * @return ESP_OK on success, or an error code on failure
+ */
+static esp_err_t tls_psk_read_response(char *response, size_t size, size_t *len, int *status){
+	size_t total = 0;
+	char *body = NULL;
+	long content_length = -1;
+	bool chunked = false;
+
+	while(total < sizeof(g_rx) - 1){
+		int ret = mbedtls_ssl_read(&g_ssl, (unsigned char *)&g_rx[total], sizeof(g_rx) - 1 - total);
+		if(ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE){
+			continue;
+		}
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3)
+		if(ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET){
+			continue;
+		}
+#endif
+		if(ret == 0 || ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY){
+			break;
+		}
+		if(ret < 0){
+			ESP_LOGE(TAG, "TLS read failed: -0x%04x", -ret);
+			return ESP_FAIL;
+		}
+		total += ret;
+		g_rx[total] = '\0';
+
+		// The head is text, a CBOR body may hold zero bytes only after it
+		if(body == NULL && (body = strstr(g_rx, "\r\n\r\n")) != NULL){
+			body += 4;
+			const char *value = tls_psk_header(g_rx, "Content-Length:");
+			if(value != NULL){
+				content_length = strtol(value, NULL, 10);
+			}
+			value = tls_psk_header(g_rx, "Transfer-Encoding:");
+			chunked = (value != NULL && strncasecmp(value, "chunked", 7) == 0);
+		}
+		if(body != NULL){
+			size_t body_len = &g_rx[total] - body;
+			if(content_length >= 0 && body_len >= (size_t)content_length){
+				break;
+			}
+			if(chunked && body_len >= 5 && memcmp(&g_rx[total - 5], "0\r\n\r\n", 5) == 0){
+				break;
+			}
+		}
+	}
+
+	if(body == NULL || sscanf(g_rx, "HTTP/1.%*d %d", status) != 1){
+		ESP_LOGE(TAG, "Malformed response");
+		return ESP_FAIL;
+	}
+	size_t body_len = &g_rx[total] - body;
+	if(chunked){
+		body_len = tls_psk_dechunk(body, body_len);
+	}
+	else if(content_length >= 0 && body_len > (size_t)content_length){
+		body_len = content_length;
+	}
+	if(body_len > size - 1){
+		ESP_LOGE(TAG, "Response of %u bytes does not fit", (unsigned)body_len);
+		return ESP_ERR_INVALID_SIZE;
+	}
+	memcpy(response, body, body_len);
+	response[body_len] = '\0';
+	*len = body_len;
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Finds a header in the response head
+ * @param head Response head, null terminated
+ * @param name Name of the header, colon included
+ * @return Value of the header, or NULL when missing
+ */
+static const char *tls_psk_header(const char *head, const char *name){
+	size_t name_len = strlen(name);
+
+	for(const char *line = strstr(head, "\r\n"); line != NULL && line[2] != '\r'; line = strstr(line + 2, "\r\n")){
+		if(strncasecmp(line + 2, name, name_len) == 0){
+			const char *value = line + 2 + name_len;
+			while(*value == ' '){
+				value++;
+			}
+			return value;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Decodes a chunked body in place
+ * @param body Body
+ * @param len Length of the body
+ * @return Length of the decoded body
+ */
+static size_t tls_psk_dechunk(char *body, size_t len){
+	size_t in = 0;
+	size_t out = 0;
+
+	while(in < len){
+		// Size line in hex, extensions after it ignored
+		size_t line = in;
+		while(line + 1 < len && !(body[line] == '\r' && body[line + 1] == '\n')){
+			line++;
+		}
+		if(line + 1 >= len){
+			break;
+		}
+		unsigned long chunk = strtoul(&body[in], NULL, 16);
+		in = line + 2;
+		if(chunk == 0 || in + chunk > len){
+			break;
+		}
+		memmove(&body[out], &body[in], chunk);
+		out += chunk;
+		in += chunk + 2;
+	}
+	return out;
+}
+
+/**
+ * @brief Splits the address and the port out of an HTTPS URL
+ * @param url URL
+ * @param host Buffer where the address will be stored
+ * @param host_size Size of the address buffer
+ * @param port Buffer where the port will be stored
+ * @param port_size Size of the port buffer
+ */
+static void tls_psk_split_url(const char *url, char *host, size_t host_size, char *port, size_t port_size){
+	const char *start = strstr(url, "://");
+	start = (start != NULL) ? start + 3 : url;
+	size_t host_len = strcspn(start, ":/");
+
+	snprintf(host, host_size, "%.*s", (int)host_len, start);
+	if(start[host_len] == ':'){
+		snprintf(port, port_size, "%.*s", (int)strcspn(&start[host_len + 1], "/"), &start[host_len + 1]);
+	}
+	else{
+		snprintf(port, port_size, "443");
+	}
+}
+
+/**
+ * @brief BIO function sending a record
+ */
+static int tls_psk_bio_send(void *ctx, const unsigned char *buf, size_t len){
+	int64_t start = esp_timer_get_time();
+	int ret = mbedtls_net_send(ctx, buf, len);
+	g_io_us += esp_timer_get_time() - start;
+	if(ret > 0 && g_stats != NULL){
+		// A flight sent after an answer is a new round trip
+		if(g_last_was_received){
+			g_stats->round_trips++;
+			g_last_was_received = false;
+		}
+		g_stats->bytes_sent += ret;
+	}
+	return ret;
+}
+
+/**
+ * @brief BIO function receiving a record
+ */
+static int tls_psk_bio_recv(void *ctx, unsigned char *buf, size_t len, uint32_t timeout){
+	int64_t start = esp_timer_get_time();
+	int ret = mbedtls_net_recv_timeout(ctx, buf, len, timeout);
+	g_io_us += esp_timer_get_time() - start;
+	if(ret > 0 && g_stats != NULL){
+		g_last_was_received = true;
+		g_stats->bytes_received += ret;
+	}
+	return ret;
+}
+#endif
+
+/** @} */
@@ -0,0 +1,96 @@
+/**
+*************************************************************************
+* @file       tls_psk.h
+* @brief      Header file for the tls_psk.h module.
+* @details    This file contains declarations and prototypes for the
+*             tls_psk.h module, an HTTPS client authenticated with a
+*             pre-shared key, used for the register-device exchange. The
+*             identity and the key of the device are provisioned in NVS;
+*             the handshake skips the certificate chain and the signature,
+*             so it costs far less CPU than the certificate path.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_TLS_PSK_H_
+#define MAIN_API_TLS_PSK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/**
+ * @brief NVS namespace and keys of the provisioned identity and key
+ */
+#define TLS_PSK_NVS_NAMESPACE    "tls_psk"
+#define TLS_PSK_NVS_IDENTITY_KEY "identity"
+#define TLS_PSK_NVS_KEY_KEY      "key"
+
+/**
+ * @brief Largest identity, terminator included, and largest key
+ */
+#define TLS_PSK_IDENTITY_LEN 65
+#define TLS_PSK_KEY_LEN      32
+
+/* Public Types --------------------------------------------------------------*/
+
+/**
+ * @brief Cost of the last exchange, handshake included
+ */
+typedef struct tls_psk_stats {
+    uint32_t latency_ms;       /**< Time from the connection to the end of the response */
+    uint32_t handshake_ms;     /**< Time of the TCP connection and the TLS handshake */
+    uint32_t handshake_cpu_ms; /**< Part of the handshake spent outside the socket calls */
+    uint16_t round_trips;      /**< Flights sent that waited for an answer, TCP connection excluded */
+    uint16_t handshake_trips;  /**< Round trips spent in the TLS handshake */
+    uint32_t bytes_sent;       /**< Bytes of TLS records sent */
+    uint32_t bytes_received;   /**< Bytes of TLS records received */
+    int status;                /**< HTTP status of the response */
+} tls_psk_stats_t;
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup tls_psk.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Sends a POST over a new PSK connection and waits for its response
+ * @param path Path of the resource
+ * @param content_type Content type of the body
+ * @param body Body of the request
+ * @param body_len Length of the body
+ * @param response Buffer where the response body will be stored, null terminated
+ * @param size Size of the buffer
+ * @param len Length of the response body
+ * @param stats Cost of the exchange
+ * @return ESP_OK on a 2xx response, ESP_ERR_NOT_FOUND when the device has no key,
+ *         ESP_ERR_INVALID_STATE when the configuration failed and is retried on the next request, or an error code on failure
+ */
+esp_err_t tls_psk_post(const char *path, const char *content_type, const uint8_t *body, size_t body_len,
+                       char *response, size_t size, size_t *len, tls_psk_stats_t *stats);
+
+/**
+ * @brief Times handshakes over the certificate path and over the PSK path and logs both
+ * @param rounds Handshakes of each kind
+ * @note The two paths go through the same socket accounting, so their CPU
+ *       times compare; the TLS_HANDSHAKE_BENCH line is meant for a log parser.
+ */
+void tls_psk_benchmark(int rounds);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_TLS_PSK_H_ */
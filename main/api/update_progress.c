@@ -0,0 +1,283 @@
+/**
+*************************************************************************
+* @file       update_progress.c
+* @brief      Source file for the update_progress.c module.
+* @details    This file contains the implementation of functions for
+*             the update_progress.c module. The rate is sampled every
+*             UPDATE_PROGRESS_SAMPLE_MS and smoothed with an exponential
+*             moving average (weight 1/4), which also sets how often the
+*             observers hear about the transfer.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdint.h>
+#include <string.h>
+
+// FreeRTOS Includes
+#include "freertos/FreeRTOS.h"
+
+// ESP Includes
+#include "esp_log.h"
+#include "esp_timer.h"
+
+// Application Includes
+#include "api/update_progress.h"
+#include "api/update_throttle.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+/* Typedefs --------------------------------------------------------------*/
+
+/**
+ * @brief Registered observer
+ */
+typedef struct update_progress_observer {
+    update_progress_cb_t cb; /**< Callback, NULL if the entry is free */
+    void *arg;               /**< Argument passed to the callback */
+} update_progress_observer_t;
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "update_progress";
+
+/**
+ * @brief Protects the observers and the snapshot, read by other tasks
+ */
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Registered observers
+ */
+static update_progress_observer_t g_observers[UPDATE_PROGRESS_MAX_OBSERVERS];
+
+/**
+ * @brief Current snapshot of the update
+ */
+static update_progress_t g_progress = { .state = UPDATE_PROGRESS_IDLE };
+
+/**
+ * @brief Flag set by update_progress_cancel()
+ */
+static volatile bool g_cancelled = false;
+
+/**
+ * @brief Start of the current rate sample and the bytes at that time
+ */
+static int64_t g_sample_start = 0;
+static uint32_t g_sample_bytes = 0;
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Calls the observers with the current snapshot
+ */
+static void update_progress_notify(void);
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup update_progress.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Registers an observer of the update
+ * @param cb Callback
+ * @param arg Argument passed to the callback
+ * @return ESP_OK on success, or ESP_ERR_NO_MEM if UPDATE_PROGRESS_MAX_OBSERVERS are registered
+ */
+esp_err_t update_progress_register(update_progress_cb_t cb, void *arg){
+	esp_err_t err = ESP_ERR_NO_MEM;
+
+	if(cb == NULL){
+		return ESP_ERR_INVALID_ARG;
+	}
+	taskENTER_CRITICAL(&g_lock);
+	for(int i = 0; i < UPDATE_PROGRESS_MAX_OBSERVERS; i++){
+		if(g_observers[i].cb == NULL){
+			g_observers[i].cb = cb;
+			g_observers[i].arg = arg;
+			err = ESP_OK;
+			break;
+		}
+	}
+	taskEXIT_CRITICAL(&g_lock);
+
+	return err;
+}
+
+/**
+ * @brief Removes an observer of the update
+ * @param cb Callback given at registration
+ */
+void update_progress_unregister(update_progress_cb_t cb){
+	taskENTER_CRITICAL(&g_lock);
+	for(int i = 0; i < UPDATE_PROGRESS_MAX_OBSERVERS; i++){
+		if(g_observers[i].cb == cb){
+			g_observers[i].cb = NULL;
+		}
+	}
+	taskEXIT_CRITICAL(&g_lock);
+}
+
+/**
+ * @brief Gets a snapshot of the update
+ * @param progress Structure where the snapshot will be stored
+ */
+void update_progress_get(update_progress_t *progress){
+	taskENTER_CRITICAL(&g_lock);
+	*progress = g_progress;
+	taskEXIT_CRITICAL(&g_lock);
+}
+
+/**
+ * @brief Cancels the running update, which stops at the next chunk boundary
+ */
+void update_progress_cancel(void){
+	ESP_LOGI(TAG, "Update cancellation requested");
+	g_cancelled = true;
+
+	// A paused update would never reach the check
+	if(update_throttle_is_paused()){
+		update_throttle_resume();
+	}
+}
+
+/**
+ * @brief Checks whether the update was cancelled
+ * @return true if update_progress_cancel() was called for this update
+ */
+bool update_progress_is_cancelled(void){
+	return g_cancelled;
+}
+
+/**
+ * @brief Changes the state of the update, notifying the observers
+ * @param state New state
+ */
+void update_progress_set_state(update_progress_state_e state){
+	taskENTER_CRITICAL(&g_lock);
+	if(state == UPDATE_PROGRESS_CHECKING){
+		memset(&g_progress, 0x00, sizeof(g_progress));
+		g_cancelled = false;
+	}
+	g_progress.state = state;
+	if(state != UPDATE_PROGRESS_DOWNLOADING){
+		g_progress.eta_ms = 0;
+	}
+	taskEXIT_CRITICAL(&g_lock);
+
+	update_progress_notify();
+}
+
+/**
+ * @brief Finishes the update with its result, notifying the observers
+ * @param result Result code of the update
+ */
+void update_progress_finish(fw_update_ret_e result){
+	taskENTER_CRITICAL(&g_lock);
+	g_progress.result = result;
+	taskEXIT_CRITICAL(&g_lock);
+
+	if(result == FW_UPDATE_OK){
+		update_progress_set_state(UPDATE_PROGRESS_DONE);
+	}
+	else if(result == FW_UPDATE_CANCELLED){
+		update_progress_set_state(UPDATE_PROGRESS_CANCELLED);
+	}
+	else{
+		update_progress_set_state(UPDATE_PROGRESS_FAILED);
+	}
+}
+
+/**
+ * @brief Starts counting the transfer
+ * @param offset Bytes already received, when the transfer is resumed
+ */
+void update_progress_begin_transfer(size_t offset){
+	taskENTER_CRITICAL(&g_lock);
+	g_progress.bytes = offset;
+	g_progress.rate_bps = 0;
+	g_progress.eta_ms = 0;
+	taskEXIT_CRITICAL(&g_lock);
+
+	g_sample_start = esp_timer_get_time();
+	g_sample_bytes = offset;
+}
+
+/**
+ * @brief Sets the size of the image
+ * @param total Size of the image in bytes
+ */
+void update_progress_set_total(size_t total){
+	taskENTER_CRITICAL(&g_lock);
+	g_progress.total = total;
+	taskEXIT_CRITICAL(&g_lock);
+}
+
+/**
+ * @brief Accounts bytes received, updating the rate and notifying the observers periodically
+ * @param bytes Bytes received since the last call
+ */
+void update_progress_add_bytes(size_t bytes){
+	int64_t now = esp_timer_get_time();
+	int64_t elapsed_ms = (now - g_sample_start) / 1000;
+	bool sample = elapsed_ms >= UPDATE_PROGRESS_SAMPLE_MS;
+
+	taskENTER_CRITICAL(&g_lock);
+	g_progress.bytes += bytes;
+	if(sample){
+		uint32_t rate = (uint64_t)(g_progress.bytes - g_sample_bytes) * 1000 / elapsed_ms;
+		g_progress.rate_bps = (g_progress.rate_bps == 0) ? rate : (g_progress.rate_bps * 3 + rate) / 4;
+		g_progress.eta_ms = (g_progress.total > g_progress.bytes && g_progress.rate_bps > 0) ?
+		                    (uint64_t)(g_progress.total - g_progress.bytes) * 1000 / g_progress.rate_bps : 0;
+		g_sample_bytes = g_progress.bytes;
+	}
+	taskEXIT_CRITICAL(&g_lock);
+
+	if(sample){
+		g_sample_start = now;
+		update_progress_notify();
+	}
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup update_progress.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Calls the observers with the current snapshot
+ */
+static void update_progress_notify(void){
+	update_progress_observer_t observers[UPDATE_PROGRESS_MAX_OBSERVERS];
+	update_progress_t progress;
+
+	// The callbacks run outside the critical section
+	taskENTER_CRITICAL(&g_lock);
+	memcpy(observers, g_observers, sizeof(observers));
+	progress = g_progress;
+	taskEXIT_CRITICAL(&g_lock);
+
+	for(int i = 0; i < UPDATE_PROGRESS_MAX_OBSERVERS; i++){
+		if(observers[i].cb != NULL){
+			observers[i].cb(&progress, observers[i].arg);
+		}
+	}
+}
+
+/** @} */
@@ -0,0 +1,144 @@
+/**
+*************************************************************************
+* @file       update_progress.h
+* @brief      Header file for the update_progress.h module.
+* @details    This file contains declarations and prototypes for the
+*             update_progress.h module, which lets the application follow
+*             a running update: observers are called on each state change
+*             and periodically while the firmware is transferred, with a
+*             moving-average rate and an ETA. The update can be cancelled
+*             at any time; it stops at the next chunk boundary.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_UPDATE_PROGRESS_H_
+#define MAIN_API_UPDATE_PROGRESS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "api/fw_update.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/* Public Types --------------------------------------------------------------*/
+
+/**
+ * @brief State of the update
+ */
+typedef enum update_progress_state {
+    UPDATE_PROGRESS_IDLE = 0,    /**< No update running */
+    UPDATE_PROGRESS_CHECKING,    /**< Metadata request */
+    UPDATE_PROGRESS_DOWNLOADING, /**< Download and streaming decryption */
+    UPDATE_PROGRESS_VERIFYING,   /**< Integrity verification */
+    UPDATE_PROGRESS_DONE,        /**< Image verified in the OTA slot */
+    UPDATE_PROGRESS_FAILED,      /**< Update failed, see result */
+    UPDATE_PROGRESS_CANCELLED    /**< Update cancelled by update_progress_cancel() */
+} update_progress_state_e;
+
+/**
+ * @brief Snapshot of the update
+ */
+typedef struct update_progress {
+    update_progress_state_e state; /**< Current state */
+    uint32_t bytes;                /**< Bytes of the image received, resumed part included */
+    uint32_t total;                /**< Size of the image, 0 when unknown */
+    uint32_t rate_bps;             /**< Moving average of the transfer rate in bytes per second */
+    uint32_t eta_ms;               /**< Estimated time to the end of the transfer, 0 when unknown */
+    int32_t result;                /**< fw_update_ret_e of a finished update */
+} update_progress_t;
+
+/**
+ * @brief Observer of the update
+ * @param progress Snapshot of the update
+ * @param arg Argument given at registration
+ * @note Called from the task running the update, so it must return quickly.
+ */
+typedef void (*update_progress_cb_t)(const update_progress_t *progress, void *arg);
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup update_progress.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Registers an observer of the update
+ * @param cb Callback
+ * @param arg Argument passed to the callback
+ * @return ESP_OK on success, or ESP_ERR_NO_MEM if UPDATE_PROGRESS_MAX_OBSERVERS are registered
+ */
+esp_err_t update_progress_register(update_progress_cb_t cb, void *arg);
+
+/**
+ * @brief Removes an observer of the update
+ * @param cb Callback given at registration
+ */
+void update_progress_unregister(update_progress_cb_t cb);
+
+/**
+ * @brief Gets a snapshot of the update
+ * @param progress Structure where the snapshot will be stored
+ */
+void update_progress_get(update_progress_t *progress);
+
+/**
+ * @brief Cancels the running update, which stops at the next chunk boundary
+ * @note A paused update is resumed so it reaches the check. The request is
+ *       kept until the next update check starts.
+ */
+void update_progress_cancel(void);
+
+/**
+ * @brief Checks whether the update was cancelled
+ * @return true if update_progress_cancel() was called for this update
+ */
+bool update_progress_is_cancelled(void);
+
+/**
+ * @brief Changes the state of the update, notifying the observers
+ * @param state New state
+ * @note UPDATE_PROGRESS_CHECKING starts a new update and clears a cancellation.
+ */
+void update_progress_set_state(update_progress_state_e state);
+
+/**
+ * @brief Finishes the update with its result, notifying the observers
+ * @param result Result code of the update
+ */
+void update_progress_finish(fw_update_ret_e result);
+
+/**
+ * @brief Starts counting the transfer
+ * @param offset Bytes already received, when the transfer is resumed
+ */
+void update_progress_begin_transfer(size_t offset);
+
+/**
+ * @brief Sets the size of the image
+ * @param total Size of the image in bytes
+ */
+void update_progress_set_total(size_t total);
+
+/**
+ * @brief Accounts bytes received, updating the rate and notifying the observers periodically
+ * @param bytes Bytes received since the last call
+ */
+void update_progress_add_bytes(size_t bytes);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_UPDATE_PROGRESS_H_ */
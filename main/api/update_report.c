@@ -0,0 +1,323 @@
+/**
+*************************************************************************
+* @file       update_report.c
+* @brief      Source file for the update_report.c module.
+* @details    This file contains the implementation of functions for 
+*             the update_report.c module. Reports are only written to
+*             NVS when an attempt finishes and when the server accepts
+*             a batch, never on each event.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdio.h>
+#include <string.h>
+
+// ESP Includes
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+// Application Includes
+#include "api/update_report.h"
+#include "api/metrics.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+// NVS namespace and key used to store the report queue
+#define UPDATE_REPORT_NVS_NAMESPACE "update_report"
+#define UPDATE_REPORT_NVS_KEY       "reports"
+
+/* Typedefs --------------------------------------------------------------*/
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "update_report";
+
+/**
+ * @brief Queue of reports waiting to be sent, oldest first
+ */
+static update_report_t g_reports[UPDATE_REPORT_QUEUE_LEN];
+static int g_report_count = 0;
+
+/**
+ * @brief Number of reports attached to the last request
+ */
+static int g_attached = 0;
+
+/**
+ * @brief Attempt in progress and the start time of each phase
+ */
+static update_report_t g_current;
+static int64_t g_phase_start[UPDATE_PHASE_MAX];
+
+/**
+ * @brief Last finished attempt, kept after its report is sent
+ */
+static update_report_t g_last;
+static bool g_last_valid = false;
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Saves the report queue into NVS
+ */
+static void update_report_save(void);
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup update_report.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Loads the pending reports from NVS
+ */
+void update_report_init(void){
+	nvs_handle_t nvs_handle;
+	size_t size = sizeof(g_reports);
+	
+	g_report_count = 0;
+	if(nvs_open(UPDATE_REPORT_NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK){
+		if(nvs_get_blob(nvs_handle, UPDATE_REPORT_NVS_KEY, g_reports, &size) == ESP_OK){
+			g_report_count = size / sizeof(update_report_t);
+		}
+		nvs_close(nvs_handle);
+	}
+	ESP_LOGI(TAG, "Pending update reports: %d", g_report_count);
+}
+
+/**
+ * @brief Starts a new attempt, discarding the one in progress if not finished
+ */
+void update_report_begin(void){
+	memset(&g_current, 0x00, sizeof(g_current));
+	memset(g_phase_start, 0x00, sizeof(g_phase_start));
+}
+
+/**
+ * @brief Sets the version of the firmware being installed
+ * @param version Firmware version from the metadata
+ */
+void update_report_set_version(const char *version){
+	strncpy(g_current.version, version, sizeof(g_current.version) - 1);
+}
+
+/**
+ * @brief Marks the start of a phase
+ * @param phase Phase of the attempt
+ */
+void update_report_phase_start(update_phase_e phase){
+	if(phase < UPDATE_PHASE_MAX){
+		g_phase_start[phase] = esp_timer_get_time();
+	}
+}
+
+/**
+ * @brief Marks the end of a phase, storing its duration
+ * @param phase Phase of the attempt
+ */
+void update_report_phase_end(update_phase_e phase){
+	if(phase < UPDATE_PHASE_MAX && g_phase_start[phase] != 0){
+		g_current.phase_ms[phase] = (esp_timer_get_time() - g_phase_start[phase]) / 1000;
+		metrics_observe_phase(phase, g_current.phase_ms[phase]);
+	}
+}
+
+/**
+ * @brief Sets the number of bytes transferred
+ * @param bytes Bytes transferred
+ */
+void update_report_set_bytes(uint32_t bytes){
+	g_current.bytes = bytes;
+}
+
+/**
+ * @brief Counts one retry in the attempt in progress
+ */
+void update_report_add_retry(void){
+	g_current.retries++;
+}
+
+/**
+ * @brief Finishes the attempt in progress and queues its report in NVS
+ * @param result Result code of the attempt
+ */
+void update_report_finish(fw_update_ret_e result){
+	g_current.result = result;
+	metrics_count_result(result);
+	
+	// Bounded queue, drop the oldest report
+	if(g_report_count == UPDATE_REPORT_QUEUE_LEN){
+		memmove(&g_reports[0], &g_reports[1], (UPDATE_REPORT_QUEUE_LEN - 1) * sizeof(update_report_t));
+		g_report_count--;
+		if(g_attached > 0){
+			g_attached--;
+		}
+		ESP_LOGI(TAG, "Report queue full, oldest report dropped");
+	}
+	g_reports[g_report_count++] = g_current;
+	update_report_save();
+	g_last = g_current;
+	g_last_valid = true;
+	
+	ESP_LOGI(TAG, "Report queued: result %d, %lu bytes, %d retries", (int)result, (unsigned long)g_current.bytes, g_current.retries);
+	update_report_begin();
+}
+
+/**
+ * @brief Gets the number of reports waiting to be sent
+ * @return Number of pending reports
+ */
+int update_report_pending(void){
+	return g_report_count;
+}
+
+/**
+ * @brief Gets the report of the last finished attempt
+ * @param report Structure where the report will be stored
+ * @return true if an attempt finished since boot
+ */
+bool update_report_get_last(update_report_t *report){
+	if(g_last_valid){
+		*report = g_last;
+	}
+	return g_last_valid;
+}
+
+/**
+ * @brief Attaches the pending reports to a JSON payload
+ * @param payload JSON object, the reports are added as "updateReports" before its closing brace
+ * @param size Size of the payload buffer
+ * @return Number of reports attached
+ */
+int update_report_attach(char *payload, size_t size){
+	g_attached = 0;
+	
+	char *end = strrchr(payload, '}');
+	if(end == NULL || g_report_count == 0){
+		return 0;
+	}
+	
+	// Room left, keeping space for "]}" and the terminator
+	size_t pos = end - payload;
+	int n = snprintf(&payload[pos], size - pos, ", \"updateReports\": [");
+	if(n < 0 || pos + n + 3 > size){
+		strcpy(end, "}");
+		return 0;
+	}
+	pos += n;
+	
+	for(int i = 0; i < g_report_count; i++){
+		const update_report_t *report = &g_reports[i];
+		n = snprintf(&payload[pos], size - pos,
+				"%s{\"result\": %ld, \"version\": \"%s\", \"metadataMs\": %lu, \"downloadMs\": %lu, \"verifyMs\": %lu, \"bytes\": %lu, \"retries\": %u}",
+				(i > 0) ? ", " : "", (long)report->result, report->version,
+				(unsigned long)report->phase_ms[UPDATE_PHASE_METADATA], (unsigned long)report->phase_ms[UPDATE_PHASE_DOWNLOAD],
+				(unsigned long)report->phase_ms[UPDATE_PHASE_VERIFY], (unsigned long)report->bytes, report->retries);
+		if(n < 0 || pos + n + 3 > size){
+			break;
+		}
+		pos += n;
+		g_attached++;
+	}
+	strcpy(&payload[pos], "]}");
+	
+	return g_attached;
+}
+
+/**
+ * @brief Writes the pending reports as a CBOR array
+ * @param writer Writer of the request, the array is the value of its "updateReports" key
+ * @return Number of reports attached, 0 if they did not fit
+ */
+int update_report_attach_cbor(metadata_cbor_writer_t *writer){
+	g_attached = 0;
+	
+	// Same fields as the JSON reports, integers keep their binary form
+	metadata_cbor_put_array(writer, g_report_count);
+	for(int i = 0; i < g_report_count; i++){
+		const update_report_t *report = &g_reports[i];
+		metadata_cbor_put_map(writer, 7);
+		metadata_cbor_put_text(writer, "result");
+		metadata_cbor_put_int(writer, report->result);
+		metadata_cbor_put_text(writer, "version");
+		metadata_cbor_put_text(writer, report->version);
+		metadata_cbor_put_text(writer, "metadataMs");
+		metadata_cbor_put_int(writer, report->phase_ms[UPDATE_PHASE_METADATA]);
+		metadata_cbor_put_text(writer, "downloadMs");
+		metadata_cbor_put_int(writer, report->phase_ms[UPDATE_PHASE_DOWNLOAD]);
+		metadata_cbor_put_text(writer, "verifyMs");
+		metadata_cbor_put_int(writer, report->phase_ms[UPDATE_PHASE_VERIFY]);
+		metadata_cbor_put_text(writer, "bytes");
+		metadata_cbor_put_int(writer, report->bytes);
+		metadata_cbor_put_text(writer, "retries");
+		metadata_cbor_put_int(writer, report->retries);
+	}
+	if(!writer->overflow){
+		g_attached = g_report_count;
+	}
+	
+	return g_attached;
+}
+
+/**
+ * @brief Removes the reports attached to the last request, after the server accepted it
+ */
+void update_report_ack(void){
+	if(g_attached == 0){
+		return;
+	}
+	memmove(&g_reports[0], &g_reports[g_attached], (g_report_count - g_attached) * sizeof(update_report_t));
+	g_report_count -= g_attached;
+	g_attached = 0;
+	update_report_save();
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup update_report.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Saves the report queue into NVS
+ */
+static void update_report_save(void){
+	nvs_handle_t nvs_handle;
+	esp_err_t err = nvs_open(UPDATE_REPORT_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "nvs_open failed: %s", esp_err_to_name(err));
+		return;
+	}
+	
+	if(g_report_count > 0){
+		err = nvs_set_blob(nvs_handle, UPDATE_REPORT_NVS_KEY, g_reports, g_report_count * sizeof(update_report_t));
+	}
+	else{
+		err = nvs_erase_key(nvs_handle, UPDATE_REPORT_NVS_KEY);
+	}
+	if(err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND){
+		err = nvs_commit(nvs_handle);
+	}
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "Failed to save the reports: %s", esp_err_to_name(err));
+	}
+	nvs_close(nvs_handle);
+}
+
+/** @} */
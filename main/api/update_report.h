@@ -0,0 +1,145 @@
+/**
+*************************************************************************
+* @file       update_report.h
+* @brief      Header file for the update_report.h module.
+* @details    This file contains declarations and prototypes for the 
+*             update_report.h module, which records the outcome of each
+*             update attempt in a bounded NVS queue and attaches the
+*             pending reports to the next metadata request.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_UPDATE_REPORT_H_
+#define MAIN_API_UPDATE_REPORT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "api/fw_update.h"
+#include "api/metadata_cbor.h"
+
+/* Public Macros -------------------------------------------------------------*/
+
+/* Public Types --------------------------------------------------------------*/
+
+/**
+ * @brief Phases of an update attempt
+ */
+typedef enum update_phase {
+    UPDATE_PHASE_METADATA = 0, /**< Metadata request until the response */
+    UPDATE_PHASE_DOWNLOAD,     /**< Download and streaming decryption */
+    UPDATE_PHASE_VERIFY,       /**< Integrity verification */
+    UPDATE_PHASE_MAX
+} update_phase_e;
+
+/**
+ * @brief Report of one update attempt
+ */
+typedef struct update_report {
+    int32_t result;                       /**< Result code from fw_update_ret_e */
+    char version[20];                     /**< Version of the firmware being installed */
+    uint32_t phase_ms[UPDATE_PHASE_MAX];  /**< Duration of each phase in milliseconds */
+    uint32_t bytes;                       /**< Bytes transferred */
+    uint16_t retries;                     /**< Retries (chunks fetched again, restarts) */
+} update_report_t;
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup update_report.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Loads the pending reports from NVS
+ */
+void update_report_init(void);
+
+/**
+ * @brief Starts a new attempt, discarding the one in progress if not finished
+ */
+void update_report_begin(void);
+
+/**
+ * @brief Sets the version of the firmware being installed
+ * @param version Firmware version from the metadata
+ */
+void update_report_set_version(const char *version);
+
+/**
+ * @brief Marks the start of a phase
+ * @param phase Phase of the attempt
+ */
+void update_report_phase_start(update_phase_e phase);
+
+/**
+ * @brief Marks the end of a phase, storing its duration
+ * @param phase Phase of the attempt
+ */
+void update_report_phase_end(update_phase_e phase);
+
+/**
+ * @brief Sets the number of bytes transferred
+ * @param bytes Bytes transferred
+ */
+void update_report_set_bytes(uint32_t bytes);
+
+/**
+ * @brief Counts one retry in the attempt in progress
+ */
+void update_report_add_retry(void);
+
+/**
+ * @brief Finishes the attempt in progress and queues its report in NVS
+ * @param result Result code of the attempt
+ * @note The oldest report is dropped when the queue is full.
+ */
+void update_report_finish(fw_update_ret_e result);
+
+/**
+ * @brief Gets the number of reports waiting to be sent
+ * @return Number of pending reports
+ */
+int update_report_pending(void);
+
+/**
+ * @brief Gets the report of the last finished attempt
+ * @param report Structure where the report will be stored
+ * @return true if an attempt finished since boot
+ */
+bool update_report_get_last(update_report_t *report);
+
+/**
+ * @brief Attaches the pending reports to a JSON payload
+ * @param payload JSON object, the reports are added as "updateReports" before its closing brace
+ * @param size Size of the payload buffer
+ * @return Number of reports attached
+ * @note Reports that do not fit are kept for the next request.
+ */
+int update_report_attach(char *payload, size_t size);
+
+/**
+ * @brief Writes the pending reports as a CBOR array
+ * @param writer Writer of the request, the array is the value of its "updateReports" key
+ * @return Number of reports attached, 0 if they did not fit
+ */
+int update_report_attach_cbor(metadata_cbor_writer_t *writer);
+
+/**
+ * @brief Removes the reports attached to the last request, after the server accepted it
+ */
+void update_report_ack(void);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* MAIN_API_UPDATE_REPORT_H_ */
@@ -0,0 +1,232 @@
+/**
+*************************************************************************
+* @file       update_throttle.c
+* @brief      Source file for the update_throttle.c module.
+* @details    This file contains the implementation of functions for
+*             the update_throttle.c module. The CPU budget counts the
+*             time between checkpoints as busy, including the time spent
+*             waiting for the network, so it is a conservative bound.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @note       Toyotech - All rights reserved
+*************************************************************************
+*/
+
+/* Includes -------------------------------------------------------------*/
+#include "sysconfig.h"
+
+// Standard C Includes
+#include <stdint.h>
+
+// FreeRTOS Includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+
+// ESP Includes
+#include "esp_log.h"
+#include "esp_timer.h"
+
+// Application Includes
+#include "tasks_common.h"
+#include "api/update_throttle.h"
+
+/* Definitions ----------------------------------------------------------*/
+
+// Event group bit set while the update is allowed to run
+#define UPDATE_THROTTLE_RUN_BIT BIT0
+
+// The idle share is computed as a multiple of the busy one
+#if UPDATE_THROTTLE_DUTY_CYCLE <= 0 || UPDATE_THROTTLE_DUTY_CYCLE > 100
+#error "UPDATE_THROTTLE_DUTY_CYCLE must be between 1 and 100"
+#endif
+
+/* Typedefs --------------------------------------------------------------*/
+
+/* Private variables -----------------------------------------------------*/
+/**
+ * @brief Tag used for ESP serial console messages
+ */
+static const char TAG [] = "update_throttle";
+
+/**
+ * @brief Event group holding the run bit
+ */
+static EventGroupHandle_t g_throttle_events = NULL;
+
+/**
+ * @brief Flag to indicate the background mode
+ */
+static bool g_background = UPDATE_BACKGROUND_MODE;
+
+/**
+ * @brief Task running the throttled operation and its original priority
+ */
+static TaskHandle_t g_task = NULL;
+static UBaseType_t g_task_priority = 0;
+
+/**
+ * @brief Bandwidth window: start time and bytes since then
+ */
+static int64_t g_window_start = 0;
+static uint64_t g_window_bytes = 0;
+
+/**
+ * @brief Start time of the current CPU slice
+ */
+static int64_t g_slice_start = 0;
+
+/* Function prototypes ---------------------------------------------------*/
+
+/**
+ * @brief Sleeps for at least one tick
+ * @param us Time to sleep in microseconds
+ */
+static void update_throttle_sleep(int64_t us);
+
+/* Public Functions ------------------------------------------------------*/
+
+/**
+ * @defgroup update_throttle.c Public Functions
+ * @{
+ */
+
+/**
+ * @brief Initializes the throttle in the mode set by UPDATE_BACKGROUND_MODE
+ */
+void update_throttle_init(void){
+	g_throttle_events = xEventGroupCreate();
+	xEventGroupSetBits(g_throttle_events, UPDATE_THROTTLE_RUN_BIT);
+	g_background = UPDATE_BACKGROUND_MODE;
+}
+
+/**
+ * @brief Enables or disables the background mode
+ * @param enabled true to follow the bandwidth and CPU budgets
+ */
+void update_throttle_set_background(bool enabled){
+	g_background = enabled;
+	ESP_LOGI(TAG, "Background update mode %s", enabled ? "enabled" : "disabled");
+}
+
+/**
+ * @brief Checks whether the background mode is enabled
+ * @return true if the update follows the budgets
+ */
+bool update_throttle_is_background(void){
+	return g_background;
+}
+
+/**
+ * @brief Pauses the update at its next checkpoint
+ */
+void update_throttle_pause(void){
+	ESP_LOGI(TAG, "Update paused");
+	xEventGroupClearBits(g_throttle_events, UPDATE_THROTTLE_RUN_BIT);
+}
+
+/**
+ * @brief Resumes a paused update
+ */
+void update_throttle_resume(void){
+	ESP_LOGI(TAG, "Update resumed");
+	xEventGroupSetBits(g_throttle_events, UPDATE_THROTTLE_RUN_BIT);
+}
+
+/**
+ * @brief Checks whether the update is paused
+ * @return true if paused
+ */
+bool update_throttle_is_paused(void){
+	return (xEventGroupGetBits(g_throttle_events) & UPDATE_THROTTLE_RUN_BIT) == 0;
+}
+
+/**
+ * @brief Starts a throttled operation in the calling task
+ * @note In background mode the task priority drops to UPDATE_BACKGROUND_TASK_PRIORITY.
+ */
+void update_throttle_begin(void){
+	g_window_start = esp_timer_get_time();
+	g_window_bytes = 0;
+	g_slice_start = g_window_start;
+	g_task = xTaskGetCurrentTaskHandle();
+	g_task_priority = uxTaskPriorityGet(g_task);
+
+	// Below the foreground tasks, so they preempt the update
+	if(g_background){
+		vTaskPrioritySet(g_task, UPDATE_BACKGROUND_TASK_PRIORITY);
+	}
+}
+
+/**
+ * @brief Accounts the work done since the last checkpoint and yields to keep the budgets
+ * @param bytes Bytes transferred since the last checkpoint
+ * @note Only the task that called update_throttle_begin() owns the budgets; any other
+ *       task, such as a hash helper, only waits here while the update is paused.
+ */
+void update_throttle_checkpoint(size_t bytes){
+	bool owner = (xTaskGetCurrentTaskHandle() == g_task);
+	
+	// Wait here while paused, the state of the operation stays as it is
+	if(update_throttle_is_paused()){
+		ESP_LOGI(TAG, "Waiting for resume");
+		xEventGroupWaitBits(g_throttle_events, UPDATE_THROTTLE_RUN_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+		if(!owner){
+			return;
+		}
+		g_window_start = esp_timer_get_time();
+		g_window_bytes = 0;
+		g_slice_start = g_window_start;
+	}
+	if(!g_background || !owner){
+		return;
+	}
+
+	// Bandwidth cap: do not get ahead of the bytes allowed so far
+	int64_t now = esp_timer_get_time();
+	g_window_bytes += bytes;
+	int64_t allowed_at = g_window_start + (int64_t)(g_window_bytes * 1000000ULL / UPDATE_THROTTLE_BANDWIDTH_BPS);
+	if(allowed_at > now){
+		update_throttle_sleep(allowed_at - now);
+		g_slice_start = esp_timer_get_time();
+		return;
+	}
+
+	// CPU duty cycle: after a busy slice, give the idle share of it to the other tasks
+	int64_t busy = now - g_slice_start;
+	if(busy >= (int64_t)UPDATE_THROTTLE_SLICE_MS * 1000 * UPDATE_THROTTLE_DUTY_CYCLE / 100){
+		update_throttle_sleep(busy * (100 - UPDATE_THROTTLE_DUTY_CYCLE) / UPDATE_THROTTLE_DUTY_CYCLE);
+		g_slice_start = esp_timer_get_time();
+	}
+}
+
+/**
+ * @brief Ends the throttled operation, restoring the task priority
+ */
+void update_throttle_end(void){
+	if(g_task != NULL){
+		vTaskPrioritySet(g_task, g_task_priority);
+		g_task = NULL;
+	}
+}
+
+/** @} */
+
+/* Private Functions -----------------------------------------------------*/
+
+/**
+ * @defgroup update_throttle.c Private Functions
+ * @{
+ */
+
+/**
+ * @brief Sleeps for at least one tick
+ * @param us Time to sleep in microseconds
+ */
+static void update_throttle_sleep(int64_t us){
+	TickType_t ticks = pdMS_TO_TICKS(us / 1000);
+	vTaskDelay(ticks > 0 ? ticks : 1);
+}
+
+/** @} */
@@ -0,0 +1,95 @@
+/**
+*************************************************************************
+* @file       update_throttle.h
+* @brief      Header file for the update_throttle.h module.
+* @details    This file contains declarations and prototypes for the
+*             update_throttle.h module, which runs the update in the
+*             background: the download and decryption loops call a
+*             checkpoint that keeps them under a bandwidth cap and a CPU
+*             duty cycle, and waits there while the update is paused.
+* @author     Airton Y. C. Toyofuku
+* @version    1.0.0
+* @date       18 de out. de 2026
+* @copyright  Toyotech - All rights reserved
+*************************************************************************
+*/
+#ifndef MAIN_API_UPDATE_THROTTLE_H_
+#define MAIN_API_UPDATE_THROTTLE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Public Macros -------------------------------------------------------------*/
+
+/* Public Types --------------------------------------------------------------*/
+
+/* Public Function Prototypes -------------------------------------------------*/
+/**
+ * @defgroup update_throttle.h Public Functions
+ * @{
+ */
+
+/**
+ * @brief Initializes the throttle in the mode set by UPDATE_BACKGROUND_MODE
+ */
+void update_throttle_init(void);
+
+/**
+ * @brief Enables or disables the background mode
+ * @param enabled true to follow the bandwidth and CPU budgets
+ */
+void update_throttle_set_background(bool enabled);
+
+/**
+ * @brief Checks whether the background mode is enabled
+ * @return true if the update follows the budgets
+ */
+bool update_throttle_is_background(void);
+
+/**
+ * @brief Pauses the update at its next checkpoint
+ */
+void update_throttle_pause(void);
+
+/**
+ * @brief Resumes a paused update
+ */
+void update_throttle_resume(void);
+
+/**
+ * @brief Checks whether the update is paused
+ * @return true if paused
+ */
+bool update_throttle_is_paused(void);
+
+/**
+ * @brief Starts a throttled operation in the calling task
+ * @note In background mode the task priority drops to UPDATE_BACKGROUND_TASK_PRIORITY.
+ */
+void update_throttle_begin(void);
+
+/**
+ * @brief Accounts the work done since the last checkpoint and yields to keep the budgets
+ * @param bytes Bytes transferred since the last checkpoint
+ * @note Only the task that called update_throttle_begin() owns the budgets; any other
+ *       task, such as a hash helper, only waits here while the update is paused.
+ */
+void update_throttle_checkpoint(size_t bytes);
+
+/**
+ * @brief Ends the throttled operation, restoring the task priority
+ */
+void update_throttle_end(void);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAIN_API_UPDATE_THROTTLE_H_ */
@@ -20,6 +20,8 @@
 #include "freertos/event_groups.h"
 #include "freertos/idf_additions.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
 
 // ESP Includes
 #include "esp_event.h"
@@ -30,6 +32,7 @@
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_wifi.h"
+#include "nvs.h"
 #include "lwip/netdb.h"
 
 // Application Includes
@@ -38,11 +41,34 @@
 #include "main_app.h"
 #include "api/wifi_app.h"
 #include "api/https_app.h"
+#include "api/metrics.h"
 
 /* Definitions ----------------------------------------------------------*/
 
+// NVS namespace and key used to store the candidate list
+#define WIFI_APP_NVS_NAMESPACE      "wifi_app"
+#define WIFI_APP_NVS_CANDIDATES_KEY "candidates"
+
+// RSSI assigned to candidates that were not found in the last scan
+#define WIFI_APP_RSSI_NOT_SEEN      (-127)
+
+// Score (in dB) added for each step of the authentication mode ranking
+#define WIFI_APP_AUTH_SCORE_WEIGHT  2
+
 /* Typedefs --------------------------------------------------------------*/
 
+/**
+ * @brief Scan result associated with a candidate, used for ranking
+ */
+typedef struct wifi_app_ranked_ap {
+	uint8_t index;             /**< Index of the candidate in the candidate list */
+	int8_t rssi;               /**< Best RSSI seen for the candidate */
+	uint8_t channel;           /**< Primary channel of the best AP */
+	uint8_t bssid[6];          /**< BSSID of the best AP */
+	bool seen;                 /**< True if the candidate was found in the last scan */
+	wifi_auth_mode_t authmode; /**< Authentication mode of the best AP */
+} wifi_app_ranked_ap_t;
+
 /* Private variables -----------------------------------------------------*/
 
 // Tag used for ESP serial console messages
@@ -60,6 +86,31 @@ static QueueHandle_t wifi_app_queue_handle;
 // netif objects for the station
 esp_netif_t* esp_netif_sta = NULL;
 
+// Candidate list loaded from NVS
+static wifi_app_candidate_t g_candidates[MAX_WIFI_CANDIDATES];
+static uint8_t g_candidate_count = 0;
+
+// Mutex protecting the candidate list
+static SemaphoreHandle_t g_candidates_mutex;
+
+// Candidates ranked by the last scan and the position currently in use
+static wifi_app_ranked_ap_t g_ranked[MAX_WIFI_CANDIDATES];
+static uint8_t g_ranked_count = 0;
+static uint8_t g_ranked_pos = 0;
+
+// Roaming control flags
+static volatile bool g_roaming_allowed = true;
+static volatile bool g_roaming = false;
+static volatile bool g_sta_connected = false;
+static bool g_sta_connected_once = false;
+
+// Set while the station reconnects after a roam, with the address it had before
+static bool g_roam_pending = false;
+static uint32_t g_last_ip = 0;
+
+// Timer used to trigger the periodic roaming check
+static TimerHandle_t g_roam_timer;
+
 /* Function prototypes ---------------------------------------------------*/
 
 /**
@@ -88,10 +139,37 @@ static void wifi_app_event_handler_init(void);
 static void wifi_app_event_handler(void* arg_data, esp_event_base_t event_base, int32_t event_id, void* event_data);
 
 /**
- * @brief Initializes the WiFi sta settings.
+ * @brief Loads the candidate list from NVS, seeding it with the defaults on first boot
+ */
+static void wifi_app_load_candidates(void);
+
+/**
+ * @brief Saves the candidate list into NVS
+ * @return ESP_OK on success, or an NVS error code
+ */
+static esp_err_t wifi_app_save_candidates(void);
+
+/**
+ * @brief Scans the channels and ranks the candidates by RSSI and authentication mode
+ */
+static void wifi_app_scan_and_rank(void);
+
+/**
+ * @brief Initializes the WiFi sta settings with the ranked candidate in use.
  */
 static void wifi_app_soft_sta_config(void);
 
+/**
+ * @brief Checks the current link and roams to a better candidate if needed
+ */
+static void wifi_app_roam_check(void);
+
+/**
+ * @brief Timer callback that requests the periodic roaming check
+ * @param timer Handle of the timer
+ */
+static void wifi_app_roam_timer_callback(TimerHandle_t timer);
+
 /**
  * @brief Connects the ESP32 to an external AP using the updated station configuration
  */
@@ -128,6 +206,10 @@ void wifi_app_start (void){
 	// Allocate memory for the wifi configuration
 	wifi_config = (wifi_config_t*)malloc(sizeof(wifi_config_t));
 	memset(wifi_config, 0x00, sizeof(wifi_config_t));
+	
+	// Load the candidate networks
+	g_candidates_mutex = xSemaphoreCreateMutex();
+	wifi_app_load_candidates();
 		 
 	// Create message queue
 	wifi_app_queue_handle = xQueueCreate(3, sizeof(wifi_app_queue_message_t));
@@ -137,35 +219,31 @@ void wifi_app_start (void){
 }
 
 /**
- * @brief Initializes the WiFi sta settings.
+ * @brief Initializes the WiFi sta settings with the ranked candidate in use.
  */
 static void wifi_app_soft_sta_config(void){
-	char *ssid_str = NULL, *pass_str = NULL;
-	size_t len_ssid = 0, len_pass = 0;
-	
-	// Get SSID header
-	len_ssid = strlen(PERSONAL_SSID) + 1;
-	if (len_ssid > 1){
-		ssid_str = malloc(len_ssid);
-		strcpy(ssid_str, PERSONAL_SSID);
-		//printf("ssid_str %s len_ssid %d\n", ssid_str, len_ssid);
-	}
+	wifi_config_t* wifi_config = wifi_app_get_wifi_config();
+	memset(wifi_config, 0x00, sizeof(wifi_config_t));
 	
-	// Get Password header
-	len_pass = strlen(PERSONAL_PASS) + 1;
-	if (len_pass > 1){
-		pass_str = malloc(len_pass);
-		strcpy(pass_str, PERSONAL_PASS);
-		//printf("pass_str %s len_pass %d\n", pass_str, len_pass);
+	if(g_ranked_count == 0){
+		ESP_LOGE(TAG, "No WiFi candidate available");
+		return;
 	}
+	const wifi_app_ranked_ap_t *ap = &g_ranked[g_ranked_pos];
 	
-    // Update the Wifi networks configuration and let the wifi application know
-	wifi_config_t* wifi_config = wifi_app_get_wifi_config();
-	memset(wifi_config, 0x00, sizeof(wifi_config_t));
-	memcpy(wifi_config->sta.ssid, ssid_str, len_ssid);
-	memcpy(wifi_config->sta.password, pass_str, len_pass);
-	//printf("Connect to  %s - %s\n", wifi_config->sta.ssid, wifi_config->sta.password);
-	ESP_LOGI(TAG, "Connect to  %s - %s", wifi_config->sta.ssid, wifi_config->sta.password);
+	// Update the Wifi networks configuration and let the wifi application know
+	xSemaphoreTake(g_candidates_mutex, portMAX_DELAY);
+	strncpy((char*)wifi_config->sta.ssid, g_candidates[ap->index].ssid, sizeof(wifi_config->sta.ssid));
+	strncpy((char*)wifi_config->sta.password, g_candidates[ap->index].password, sizeof(wifi_config->sta.password));
+	xSemaphoreGive(g_candidates_mutex);
+	
+	// Pin the best AP found in the scan, so the driver skips its own full scan
+	if(ap->seen){
+		wifi_config->sta.bssid_set = true;
+		memcpy(wifi_config->sta.bssid, ap->bssid, sizeof(ap->bssid));
+		wifi_config->sta.channel = ap->channel;
+	}
+	ESP_LOGI(TAG, "Connect to  %s (rssi %d, channel %d)", wifi_config->sta.ssid, ap->rssi, ap->channel);
 }
 
 /**
@@ -184,6 +262,71 @@ wifi_config_t* wifi_app_get_wifi_config(void){
 	return wifi_config;
 }
 
+/**
+ * @brief Adds (or updates) a network in the candidate list and saves it in NVS
+ * @param ssid SSID of the network
+ * @param password Password of the network
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the list is full, or an NVS error code
+ */
+esp_err_t wifi_app_add_candidate(const char *ssid, const char *password){
+	if(ssid == NULL || password == NULL || strlen(ssid) == 0 || strlen(ssid) > MAX_SSID_LENGTH || strlen(password) > MAX_PASSWORD_LENGTH){
+		return ESP_ERR_INVALID_ARG;
+	}
+	
+	xSemaphoreTake(g_candidates_mutex, portMAX_DELAY);
+	int i;
+	for(i = 0; i < g_candidate_count; i++){
+		if(strcmp(g_candidates[i].ssid, ssid) == 0){
+			break;
+		}
+	}
+	if(i == MAX_WIFI_CANDIDATES){
+		xSemaphoreGive(g_candidates_mutex);
+		ESP_LOGE(TAG, "Candidate list full");
+		return ESP_ERR_NO_MEM;
+	}
+	memset(&g_candidates[i], 0x00, sizeof(wifi_app_candidate_t));
+	strcpy(g_candidates[i].ssid, ssid);
+	strcpy(g_candidates[i].password, password);
+	if(i == g_candidate_count){
+		g_candidate_count++;
+	}
+	esp_err_t err = wifi_app_save_candidates();
+	xSemaphoreGive(g_candidates_mutex);
+	
+	return err;
+}
+
+/**
+ * @brief Removes a network from the candidate list and saves it in NVS
+ * @param ssid SSID of the network
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if not in the list, or an NVS error code
+ */
+esp_err_t wifi_app_remove_candidate(const char *ssid){
+	esp_err_t err = ESP_ERR_NOT_FOUND;
+	
+	xSemaphoreTake(g_candidates_mutex, portMAX_DELAY);
+	for(int i = 0; i < g_candidate_count; i++){
+		if(strcmp(g_candidates[i].ssid, ssid) == 0){
+			memmove(&g_candidates[i], &g_candidates[i + 1], (g_candidate_count - i - 1) * sizeof(wifi_app_candidate_t));
+			g_candidate_count--;
+			err = wifi_app_save_candidates();
+			break;
+		}
+	}
+	xSemaphoreGive(g_candidates_mutex);
+	
+	return err;
+}
+
+/**
+ * @brief Allows or blocks roaming to a better AP
+ * @param allowed true when the application is idle and the link can be switched
+ */
+void wifi_app_set_roaming_allowed(bool allowed){
+	g_roaming_allowed = allowed;
+}
+
 /** @} */
 
 /* Private Functions -----------------------------------------------------*/
@@ -209,9 +352,14 @@ static void wifi_app_task(void *pvParameters){
 	// Start WiFi
 	ESP_ERROR_CHECK(esp_wifi_start());
 	
-	// Configure the WiFi Network
+	// Rank the candidates and configure the best WiFi Network
+	wifi_app_scan_and_rank();
 	wifi_app_soft_sta_config();
 	
+	// Start the idle roaming check
+	g_roam_timer = xTimerCreate("wifi_roam_timer", pdMS_TO_TICKS(WIFI_ROAM_CHECK_PERIOD_MS), pdTRUE, NULL, wifi_app_roam_timer_callback);
+	xTimerStart(g_roam_timer, 0);
+	
 	// Connect to the WiFi Network
 	wifi_app_send_message(WIFI_APP_MSG_CONNECTING_STA);
 	
@@ -234,10 +382,20 @@ static void wifi_app_task(void *pvParameters){
 
 				case WIFI_APP_MSG_STA_DISCONNECTED:
 				ESP_LOGI(TAG, "WIFI_APP_MSG_STA_DISCONNECTED");
+				// Move to the next ranked candidate, scanning again when the list is exhausted
+				g_ranked_pos++;
+				if(g_ranked_pos >= g_ranked_count){
+					wifi_app_scan_and_rank();
+				}
+				wifi_app_soft_sta_config();
 				// Notify that is disconnected
 				main_app_send_message(MAIN_APP_MSG_STA_DISCONNECTED, 0,0, NULL);
 				break;			
 				
+				case WIFI_APP_MSG_ROAM_CHECK:
+				wifi_app_roam_check();
+				break;
+				
 				default:
 				break;
 			}
@@ -297,6 +455,16 @@ static void wifi_app_event_handler(void* arg_data, esp_event_base_t event_base,
 			
 			case WIFI_EVENT_STA_DISCONNECTED:
 			ESP_LOGI(TAG, "WIFI_EVENT_STA_DISCONNECTED");
+			g_sta_connected = false;
+			if (g_roaming){
+				// Disconnection requested by the roaming check, connect to the new AP
+				g_roaming = false;
+				g_roam_pending = true;
+				wifi_app_send_message(WIFI_APP_MSG_CONNECTING_STA);
+				break;
+			}
+			// A real disconnection, the next address is a reconnect even if it is the same
+			g_roam_pending = false;
 			wifi_event_sta_disconnected_t *wifi_event_sta_disconnected = (wifi_event_sta_disconnected_t*)malloc(sizeof(wifi_event_sta_disconnected_t));
 			*wifi_event_sta_disconnected = *((wifi_event_sta_disconnected_t*)event_data);
 			//printf("WIFI_EVENT_STA_DISCONNECTED, reason code %d\n", wifi_event_sta_disconnected->reason);
@@ -315,6 +483,20 @@ static void wifi_app_event_handler(void* arg_data, esp_event_base_t event_base,
 		switch(event_id){
 			case IP_EVENT_STA_GOT_IP:
 			ESP_LOGI(TAG,"IP_EVENT_STA_GOT_IP");
+			g_sta_connected = true;
+			uint32_t ip = ((ip_event_got_ip_t*)event_data)->ip_info.ip.addr;
+			bool roamed = g_roam_pending && ip == g_last_ip;
+			g_roam_pending = false;
+			g_last_ip = ip;
+			if(roamed){
+				// Same address on the new AP, the device registration and the counters still hold
+				ESP_LOGI(TAG, "Roam completed, address kept");
+				break;
+			}
+			if(g_sta_connected_once){
+				metrics_add(METRICS_WIFI_RECONNECTS, 1);
+			}
+			g_sta_connected_once = true;
 			wifi_app_send_message(WIFI_APP_MSG_STA_CONNECTED_GOT_IP);
 			break;
 		}
@@ -336,4 +518,181 @@ static void wifi_app_default_wifi_init(void){
 	esp_netif_sta = esp_netif_create_default_wifi_sta();
 }
 
+/**
+ * @brief Loads the candidate list from NVS, seeding it with the defaults on first boot
+ */
+static void wifi_app_load_candidates(void){
+	nvs_handle_t nvs_handle;
+	size_t size = sizeof(g_candidates);
+	
+	g_candidate_count = 0;
+	if(nvs_open(WIFI_APP_NVS_NAMESPACE, NVS_READONLY, &nvs_handle) == ESP_OK){
+		if(nvs_get_blob(nvs_handle, WIFI_APP_NVS_CANDIDATES_KEY, g_candidates, &size) == ESP_OK){
+			g_candidate_count = size / sizeof(wifi_app_candidate_t);
+		}
+		nvs_close(nvs_handle);
+	}
+	
+	if(g_candidate_count == 0){
+		static const char *default_candidates[][2] = WIFI_DEFAULT_CANDIDATES;
+		size_t n = sizeof(default_candidates) / sizeof(default_candidates[0]);
+		memset(g_candidates, 0x00, sizeof(g_candidates));
+		for(size_t i = 0; i < n && i < MAX_WIFI_CANDIDATES; i++){
+			strncpy(g_candidates[i].ssid, default_candidates[i][0], MAX_SSID_LENGTH);
+			strncpy(g_candidates[i].password, default_candidates[i][1], MAX_PASSWORD_LENGTH);
+			g_candidate_count++;
+		}
+		wifi_app_save_candidates();
+		ESP_LOGI(TAG, "Candidate list seeded with %d default networks", g_candidate_count);
+	}
+	else{
+		ESP_LOGI(TAG, "Candidate list loaded with %d networks", g_candidate_count);
+	}
+}
+
+/**
+ * @brief Saves the candidate list into NVS
+ * @return ESP_OK on success, or an NVS error code
+ */
+static esp_err_t wifi_app_save_candidates(void){
+	nvs_handle_t nvs_handle;
+	esp_err_t err = nvs_open(WIFI_APP_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "nvs_open failed: %s", esp_err_to_name(err));
+		return err;
+	}
+	
+	if(g_candidate_count > 0){
+		err = nvs_set_blob(nvs_handle, WIFI_APP_NVS_CANDIDATES_KEY, g_candidates, g_candidate_count * sizeof(wifi_app_candidate_t));
+	}
+	else{
+		err = nvs_erase_key(nvs_handle, WIFI_APP_NVS_CANDIDATES_KEY);
+	}
+	if(err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND){
+		err = nvs_commit(nvs_handle);
+	}
+	nvs_close(nvs_handle);
+	
+	return err;
+}
+
+/**
+ * @brief Ranks an authentication mode, stronger modes get a higher score
+ * @param authmode Authentication mode reported by the scan
+ * @return Rank of the authentication mode
+ */
+static int wifi_app_auth_score(wifi_auth_mode_t authmode){
+	switch(authmode){
+		case WIFI_AUTH_WPA3_PSK:		return 5;
+		case WIFI_AUTH_WPA2_WPA3_PSK:	return 4;
+		case WIFI_AUTH_WPA2_PSK:		return 3;
+		case WIFI_AUTH_WPA_WPA2_PSK:	return 2;
+		case WIFI_AUTH_WPA_PSK:			return 1;
+		default:						return 0;
+	}
+}
+
+/**
+ * @brief Computes the ranking score of a candidate
+ * @param ap Ranked candidate
+ * @return Score, higher is better
+ */
+static int wifi_app_rank_score(const wifi_app_ranked_ap_t *ap){
+	return ap->rssi + WIFI_APP_AUTH_SCORE_WEIGHT * wifi_app_auth_score(ap->authmode);
+}
+
+/**
+ * @brief Scans the channels and ranks the candidates by RSSI and authentication mode
+ */
+static void wifi_app_scan_and_rank(void){
+	uint16_t record_count = MAX_SCAN_RECORDS;
+	wifi_ap_record_t *records = calloc(MAX_SCAN_RECORDS, sizeof(wifi_ap_record_t));
+	
+	// Blocking scan on all channels
+	if(records == NULL || esp_wifi_scan_start(NULL, true) != ESP_OK || esp_wifi_scan_get_ap_records(&record_count, records) != ESP_OK){
+		ESP_LOGE(TAG, "WiFi scan failed");
+		record_count = 0;
+	}
+	
+	xSemaphoreTake(g_candidates_mutex, portMAX_DELAY);
+	g_ranked_count = g_candidate_count;
+	for(int i = 0; i < g_candidate_count; i++){
+		wifi_app_ranked_ap_t *ap = &g_ranked[i];
+		memset(ap, 0x00, sizeof(wifi_app_ranked_ap_t));
+		ap->index = i;
+		ap->rssi = WIFI_APP_RSSI_NOT_SEEN;
+		
+		// Keeps the strongest AP advertising the candidate SSID
+		for(int j = 0; j < record_count; j++){
+			if(strcmp((char*)records[j].ssid, g_candidates[i].ssid) == 0 && (!ap->seen || records[j].rssi > ap->rssi)){
+				ap->seen = true;
+				ap->rssi = records[j].rssi;
+				ap->channel = records[j].primary;
+				ap->authmode = records[j].authmode;
+				memcpy(ap->bssid, records[j].bssid, sizeof(ap->bssid));
+			}
+		}
+	}
+	xSemaphoreGive(g_candidates_mutex);
+	free(records);
+	
+	// Insertion sort by score, candidates not seen keep their configured order at the end
+	for(int i = 1; i < g_ranked_count; i++){
+		wifi_app_ranked_ap_t key = g_ranked[i];
+		int j = i - 1;
+		while(j >= 0 && wifi_app_rank_score(&g_ranked[j]) < wifi_app_rank_score(&key)){
+			g_ranked[j + 1] = g_ranked[j];
+			j--;
+		}
+		g_ranked[j + 1] = key;
+	}
+	g_ranked_pos = 0;
+	
+	for(int i = 0; i < g_ranked_count; i++){
+		ESP_LOGI(TAG, "Candidate %d: %s rssi %d auth %d", i, g_candidates[g_ranked[i].index].ssid, g_ranked[i].rssi, g_ranked[i].authmode);
+	}
+}
+
+/**
+ * @brief Checks the current link and roams to a better candidate if needed
+ */
+static void wifi_app_roam_check(void){
+	wifi_ap_record_t current;
+	
+	if(!g_roaming_allowed || !g_sta_connected){
+		return;
+	}
+	if(esp_wifi_sta_get_ap_info(&current) != ESP_OK || current.rssi >= WIFI_ROAM_RSSI_THRESHOLD){
+		return;
+	}
+	ESP_LOGI(TAG, "Weak link (rssi %d), looking for a better AP", current.rssi);
+	
+	wifi_app_scan_and_rank();
+	const wifi_app_ranked_ap_t *best = &g_ranked[0];
+	if(g_ranked_count == 0 || !best->seen || memcmp(best->bssid, current.bssid, sizeof(best->bssid)) == 0){
+		return;
+	}
+	if(best->rssi < current.rssi + WIFI_ROAM_RSSI_HYSTERESIS || !g_roaming_allowed){
+		return;
+	}
+	
+	// Switch to the best AP, the disconnection event triggers the new connection
+	ESP_LOGI(TAG, "Roaming from rssi %d to rssi %d", current.rssi, best->rssi);
+	wifi_app_soft_sta_config();
+	g_roaming = true;
+	esp_wifi_disconnect();
+}
+
+/**
+ * @brief Timer callback that requests the periodic roaming check
+ * @param timer Handle of the timer
+ */
+static void wifi_app_roam_timer_callback(TimerHandle_t timer){
+	wifi_app_queue_message_t msg;
+	msg.msgID = WIFI_APP_MSG_ROAM_CHECK;
+	
+	// The timer task must not block, skip this check if the queue is full
+	xQueueSend(wifi_app_queue_handle, &msg, 0);
+}
+
 /** @} */
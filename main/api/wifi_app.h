@@ -36,6 +36,8 @@ typedef void (*wifi_connected_event_callback_t)(void);
 #define MAX_SSID_LENGTH             32              /**< IEEE standard maximum SSID length */
 #define MAX_PASSWORD_LENGTH         64              /**< IEEE standard maximum password length */
 #define MAX_CONNECTION_RETRIES      5               /**< Maximum number of retries on disconnect */
+#define MAX_WIFI_CANDIDATES         5               /**< Maximum number of APs in the candidate list */
+#define MAX_SCAN_RECORDS            20              /**< Maximum number of scan records evaluated */
 
 /**
  * @brief Netif object for the station
@@ -56,9 +58,18 @@ typedef enum wifi_app_message {
     WIFI_APP_MSG_STA_CONNECTED_GOT_IP,          /**< Message ID for station connected and got IP */
     WIFI_APP_MSG_USER_REQUESTED_STA_DISCONNECT, /**< Message ID for user requested station disconnect */
     WIFI_APP_MSG_LOAD_SAVED_CREDENTIALS,        /**< Message ID for loading saved credentials */
-    WIFI_APP_MSG_STA_DISCONNECTED               /**< Message ID for station disconnected */
+    WIFI_APP_MSG_STA_DISCONNECTED,              /**< Message ID for station disconnected */
+    WIFI_APP_MSG_ROAM_CHECK                     /**< Message ID for the periodic roaming check */
 } wifi_app_message_e;
 
+/**
+ * @brief Network candidate stored in NVS
+ */
+typedef struct wifi_app_candidate {
+    char ssid[MAX_SSID_LENGTH + 1];         /**< SSID of the network */
+    char password[MAX_PASSWORD_LENGTH + 1]; /**< Password of the network */
+} wifi_app_candidate_t;
+
 /**
  * @brief Structure for the message queue
  * @note Expand this based on application requirements e.g. add another type and parameter as required
@@ -91,6 +102,28 @@ void wifi_app_start(void);
  * @return Pointer to the WiFi configuration
  */
 wifi_config_t* wifi_app_get_wifi_config(void);
+
+/**
+ * @brief Adds (or updates) a network in the candidate list and saves it in NVS
+ * @param ssid SSID of the network
+ * @param password Password of the network
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the list is full, or an NVS error code
+ */
+esp_err_t wifi_app_add_candidate(const char *ssid, const char *password);
+
+/**
+ * @brief Removes a network from the candidate list and saves it in NVS
+ * @param ssid SSID of the network
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if not in the list, or an NVS error code
+ */
+esp_err_t wifi_app_remove_candidate(const char *ssid);
+
+/**
+ * @brief Allows or blocks roaming to a better AP
+ * @param allowed true when the application is idle and the link can be switched
+ * @note Roaming is blocked while a metadata check or a firmware download is running.
+ */
+void wifi_app_set_roaming_allowed(bool allowed);
  
 /** @} */
 
@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 // Include Systems configuration
@@ -40,11 +41,23 @@
 // Application Includes
 #include "portmacro.h"
 #include "tasks_common.h"
-#include "cJSON.h"
 #include "main_app.h"
 #include "api/wifi_app.h"
 #include "api/https_app.h"
 #include "api/fw_update.h"
+#include "api/fw_manifest.h"
+#include "api/binlog.h"
+#include "api/update_report.h"
+#include "api/ipfs_gateway.h"
+#include "api/session_arena.h"
+#include "api/update_throttle.h"
+#include "api/push_channel.h"
+#include "api/metadata_cbor.h"
+#include "api/metadata_response.h"
+#include "api/update_progress.h"
+#include "api/peer_cache.h"
+#include "api/self_check.h"
+#include "api/metrics.h"
 
 // Tests Includes
 #include "main_test.h"
@@ -85,6 +98,11 @@ char url_string[URL_LEN] = {0};
  */
 char payload_string[PAYLOAD_LEN] = {0};
 
+/**
+ * @brief String buffer for the CID of the firmware chunk manifest
+ */
+char manifest_cid_string[URL_LEN] = {0};
+
 
 /* Function prototypes ---------------------------------------------------*/
 
@@ -95,17 +113,15 @@ char payload_string[PAYLOAD_LEN] = {0};
 static void main_app_task(void *pvParameters);
 
 /**
- * @brief Process the HTTP response and extract firmware information.
- * @param response The response string from the server.
- * @param len The length of the response string.
- * @param firmware_info Pointer to the firmware metadata information structure.
+ * @brief Starts the firmware download.
  */
-void main_app_process_response(const char *response, int len, firmware_metadata_info_t *firmware_info);
+void main_app_start_firmware_download(void); 
 
 /**
- * @brief Starts the firmware download.
+ * @brief Copies the CID of the firmware into url_string.
+ * @return true if the metadata published a CID
  */
-void main_app_start_firmware_download(void); 
+static bool main_app_select_firmware_cid(void);
 
 
 /* Public Functions ------------------------------------------------------*/ 
@@ -127,7 +143,15 @@ void app_main(void){
 		ret = nvs_flash_init();
 	}
 	ESP_ERROR_CHECK(ret);
+	
+#if BINLOG_ENABLED
+	// Start the deferred binary logger before the hot paths run
+	binlog_start();
+#endif
 
+	// Route the cJSON and mbedTLS allocations through the update cycle arena
+	session_arena_init();
+	
 	printf(APP_HEADER);
 	printf(APP_VERSION);
 	printf(APP_HEADER);
@@ -135,6 +159,15 @@ void app_main(void){
 	// Select the test to be executed
 	main_test_init();
 	
+	// Load the update reports not sent yet
+	update_report_init();
+	
+	// Load the IPFS gateways ranked by the previous downloads
+	ipfs_gateway_init();
+	
+	// Select the foreground or background update mode
+	update_throttle_init();
+	
     // Create message queue
     main_app_queue_handle = xQueueCreate(3, sizeof(main_app_queue_message_t));
 	
@@ -166,25 +199,55 @@ static void main_app_task(void *pvParameters){
 	
 	ESP_LOGI(TAG, "STARTING MAIN APPLICATION");
 	
+	// The metadata is parsed here, so this task is served by the cycle arena
+	session_arena_add_owner(NULL);
+	
 	while(1){
 		if(xQueueReceive(main_app_queue_handle, &msg, portMAX_DELAY)){
 			switch(msg.msgID){
+				case MAIN_APP_MSG_CHECK_UPDATE:
+					ESP_LOGI(TAG, "MAIN_APP_MSG_CHECK_UPDATE %d", msg.code);
+					
+					// A firmware transfer is running, the announcement is handled by its status report
+					if(state == MAIN_APP_DOWNLOAD_FW || state == MAIN_APP_DECRYPT_FW){
+						break;
+					}
+					/* fall through */
 				case MAIN_APP_MSG_STA_CONNECTED:
 				case MAIN_APP_RELOAD:
 					ESP_LOGI(TAG, "MAIN_APP_MSG_STA_CONNECTED");	
+#if PEER_CACHE_ENABLED
+					// Serve the verified image to the neighbors, started once
+					peer_cache_start();
+#endif
+#if METRICS_ENABLED
+					metrics_start();
+#endif
+#if SELF_CHECK_ENABLED
+					// Checked once per boot, in the background, now that the boot is over
+					self_check_start();
+#endif
 					
+					if(state == MAIN_APP_UPDATE_STATUS){
+						// Inform if the OTA was ok or not, the reports go with the next metadata request
+						ESP_LOGI(TAG, "Pending update reports: %d", update_report_pending());
+						state = MAIN_APP_CHECK_FW;
+					}
 					if(state == MAIN_APP_IDLE){
 						state = MAIN_APP_CHECK_FW;
 					}
 					// Check if there is an update available
 					if(state == MAIN_APP_CHECK_FW){
 						main_test_update_log("INIT METADATA ACCESS T0");
+						session_arena_begin();
+						update_report_begin();
+						update_report_phase_start(UPDATE_PHASE_METADATA);
+						update_progress_set_state(UPDATE_PROGRESS_CHECKING);
+						wifi_app_set_roaming_allowed(false);
 						strcpy((char*)url_string, ADDRESS_REGISTER_DEVICE);
 						strcpy((char*)payload_string, PAYLOAD_REGISTER_DEVICE);
+						update_report_attach(payload_string, PAYLOAD_LEN);
 	    				https_app_send_message(HTTPS_APP_MSG_SEND_REQUEST, url_string, payload_string, 0, NULL);
-					} 
-					if(state == MAIN_APP_UPDATE_STATUS){
-						// Inform if the OTA was ok or not
 					}
 				break;
 	 			
@@ -201,11 +264,20 @@ static void main_app_task(void *pvParameters){
 	 			
 	 			case MAIN_APP_MSG_HTTPS_RECEIVED:
 		 			ESP_LOGI(TAG, "MAIN_APP_MSG_HTTPS_RECEIVED");
-		 			if(msg.code == HTTPS_RECEIVED_MSG_SUCCESS){
-						 ESP_LOGI(TAG, "Message Received: %.*s",msg.len, (char*) msg.data);
+		 			// The code is the HTTP status of the answer to the metadata request
+		 			if(msg.code >= HTTPS_RECEIVED_MSG_SUCCESS && msg.code < HTTPS_RECEIVED_MSG_SUCCESS + 100){
+						 if(metadata_cbor_is_cbor((const uint8_t *)msg.data, msg.len)){
+							 ESP_LOGI(TAG, "Message Received: %d bytes of CBOR", msg.len);
+						 }
+						 else{
+							 ESP_LOGI(TAG, "Message Received: %.*s",msg.len, (char*) msg.data);
+						 }
 						 
 						 if(state == MAIN_APP_CHECK_FW){
-	    					main_app_process_response((char*) msg.data, msg.len, &firmware_info);
+							// The server accepted the request that carried the reports, so they were delivered
+							update_report_ack();
+							update_report_phase_end(UPDATE_PHASE_METADATA);
+	    					metadata_response_process((char*) msg.data, msg.len, &firmware_info);
 	    					 
 	    					 // Log the extracted firmware information
 	    					ESP_LOGI("Firmware Info", "Status: %s", firmware_info.status);
@@ -218,21 +290,57 @@ static void main_app_task(void *pvParameters){
 				        		ESP_LOGI("Firmware Info", "Timestamp: %s", firmware_info.timestamp);
 				        		ESP_LOGI("Firmware Info", "Description: %s", firmware_info.description);
 				        		ESP_LOGI("Firmware Info", "CID: %s", firmware_info.cid);
+				        		ESP_LOGI("Firmware Info", "Manifest CID: %s", firmware_info.manifestCid);
+				        		update_report_set_version(firmware_info.version);
 				        		state = MAIN_APP_DOWNLOAD_FW;
-				    		}				 
+				    		}
+				    		else{
+								// No update, the cycle ends here
+								session_arena_end();
+								update_progress_set_state(UPDATE_PROGRESS_IDLE);
+							}				 
 						 }
 					 }
 					 else{
 						ESP_LOGI(TAG,"HTTPS ERROR CODE %d",msg.code);
+						session_arena_end();
+						update_progress_set_state(UPDATE_PROGRESS_IDLE);
 					}
 	 			break;
 	 			
 	 			case MAIN_APP_MSG_HTTPS_DISCONNECTED:
 		 			ESP_LOGI(TAG, "MAIN_APP_MSG_HTTPS_DISCONNECTED");
 		 			if(state == MAIN_APP_DOWNLOAD_FW){
+						 uint32_t avoided;
+						 // The slot may still hold this release from an earlier cycle, verified then
+						 // With a manifest the integrity hash is its root, the key of the record fw_manifest_verify_image() left
+						 fw_update_hash_e algorithm = (strlen(firmware_info.manifestCid) > 0) ? FW_UPDATE_HASH_MANIFEST : firmware_info.integrityAlgorithm;
+						 if(fw_update_reuse_slot(algorithm, firmware_info.integrityDigest, &avoided) == FW_UPDATE_OK){
+							main_test_update_log("FIRMWARE ALREADY IN THE SLOT T5");
+							// The attempt counts as one, its result is reported like a download's
+							metrics_add(METRICS_UPDATE_ATTEMPTS, 1);
+							update_report_set_bytes(0);
+							update_report_finish(FW_UPDATE_OK);
+							update_progress_finish(FW_UPDATE_OK);
+#if PEER_CACHE_ENABLED
+							if(main_app_select_firmware_cid()){
+								peer_cache_publish((char*)url_string);
+							}
+#endif
+							session_arena_end();
+							state = MAIN_APP_UPDATE_STATUS;
+							wifi_app_set_roaming_allowed(true);
+							//apply_firmware_update();
+							main_test_update_loop();
+							break;
+						 }
 						 main_app_start_firmware_download();
 						 state = MAIN_APP_DECRYPT_FW;
 					 }
+					 else if(state != MAIN_APP_DECRYPT_FW){
+						 // No transfer pending, the link can be switched to a better AP
+						 wifi_app_set_roaming_allowed(true);
+					 }
 					 //main_test_update_loop(); // For Certificate Error test
 	 			break;
 	 			
@@ -240,22 +348,45 @@ static void main_app_task(void *pvParameters){
 	 				ESP_LOGI(TAG, "MAIN_APP_FW_DONWLOADED");
 	 				if(state == MAIN_APP_DECRYPT_FW){
 						main_test_update_log("INIT FIRMWARE DOWNLOADED T3");
-	 					if(decrypt_firmware_from_storage(msg.len) == FW_UPDATE_OK){
+						update_report_phase_end(UPDATE_PHASE_DOWNLOAD);
+						update_report_set_bytes(msg.len);
+						// The firmware is decrypted into the inactive OTA slot while it is downloaded
+	 					if(msg.code == FW_UPDATE_OK){
 							 main_test_update_log("INIT DECRYPT PROCESS T4");
-							 if(calculate_sha256_hash_from_ota(firmware_info.integrityHash) == FW_UPDATE_OK){
+							 update_report_phase_start(UPDATE_PHASE_VERIFY);
+							 update_progress_set_state(UPDATE_PROGRESS_VERIFYING);
+							 // With a manifest the chunks were checked against the published root, the decrypted image against its leaf
+							 fw_update_ret_e verified = fw_manifest_is_active() ? fw_manifest_verify_image() : fw_update_verify_hash(firmware_info.integrityAlgorithm, firmware_info.integrityDigest);
+							 if(verified == FW_UPDATE_OK){
 								main_test_update_log("INIT FIRMWRARE HASH T5");
+								update_report_phase_end(UPDATE_PHASE_VERIFY);
 								ESP_LOGI(TAG, "Initialize Firmware Update");
+								update_report_finish(FW_UPDATE_OK);
+								update_progress_finish(FW_UPDATE_OK);
+#if PEER_CACHE_ENABLED
+								peer_cache_publish((char*)url_string);
+#endif
 							 	//apply_firmware_update();
 							 	main_test_update_loop();
 							 	
 							 }
-							 else
+							 else{
+								update_report_phase_end(UPDATE_PHASE_VERIFY);
+								update_report_finish(FW_UPDATE_HASH_ERROR);
+								update_progress_finish(FW_UPDATE_HASH_ERROR);
 							 	main_test_update_loop(); // For HASH Error test
+							 }
 						 }
-						 else
+						 else{
+							update_report_finish(msg.code);
+							update_progress_finish(msg.code);
 						 	main_test_update_loop(); // For Decrypt Error test
+						 }
 	 				}
-	 				state = MAIN_APP_IDLE;
+	 				fw_manifest_release();
+	 				session_arena_end();
+	 				state = MAIN_APP_UPDATE_STATUS;
+	 				wifi_app_set_roaming_allowed(true);
 	 			break;
 	 			
 	 			default:
@@ -287,7 +418,18 @@ BaseType_t main_app_send_message(main_app_message_e msgID, int code, int len, co
 	msg.data = NULL;
 	
 	if(data) {
-         msg.data = strdup(data);
+         // Responses may be binary (CBOR), so len bytes are copied when given
+         if(len > 0){
+             char *copy = malloc(len + 1);
+             if(copy){
+                 memcpy(copy, data, len);
+                 copy[len] = '\0';
+             }
+             msg.data = copy;
+         }
+         else{
+             msg.data = strdup(data);
+         }
          if (msg.data == NULL) {
              ESP_LOGI(TAG, "Failed to allocate memory for Data");
              return pdFALSE;
@@ -301,94 +443,44 @@ BaseType_t main_app_send_message(main_app_message_e msgID, int code, int len, co
 	}
 	return result;
 }
-	
-/**
- * @brief Process the HTTP response and extract firmware information.
- * @param response The response string from the server.
- * @param len The length of the response string.
- * @param firmware_info Pointer to the firmware metadata information structure.
- */
-void main_app_process_response(const char *response, int len, firmware_metadata_info_t *firmware_info){
-    
-    // Check if the response is a known plain text message
-    if (strstr(response, ERROR_HW_NOT_FOUND) || strstr(response, VERSION_UPDATED)) {
-        strncpy(firmware_info->status, response, len);
-        firmware_info->status[sizeof(firmware_info->status) - 1] = '\0';  // Ensure null termination
-        return;
-    }
-
-    // Try to parse the response as JSON
-    cJSON *json = cJSON_Parse(response);
-    if (json == NULL) {
-        ESP_LOGE("JSON", "Error parsing JSON");
-        return;
-    }
-
-    // Extract the "message" field
-    cJSON *message = cJSON_GetObjectItem(json, "message");
-    if (cJSON_IsString(message) && (message->valuestring != NULL)) {
-        strncpy(firmware_info->status, message->valuestring, sizeof(firmware_info->status) - 1);
-        firmware_info->status[sizeof(firmware_info->status) - 1] = '\0';  // Ensure null termination
-
-        if (strcmp(firmware_info->status, VERSION_OUTDATED) == 0) {
-            // Extract the "latestFirmware" object
-            cJSON *latestFirmware = cJSON_GetObjectItem(json, "latestFirmware");
-            if (!cJSON_IsObject(latestFirmware)) {
-                ESP_LOGE("JSON", "Error: latestFirmware is not an object");
-                cJSON_Delete(json);
-                return;
-            }
-
-            // Extract the individual fields from the "latestFirmware" object and store them in the struct
-            cJSON *version = cJSON_GetObjectItem(latestFirmware, "version");
-            cJSON *author = cJSON_GetObjectItem(latestFirmware, "author");
-            cJSON *hardwareModel = cJSON_GetObjectItem(latestFirmware, "hardwareModel");
-            cJSON *integrityHash = cJSON_GetObjectItem(latestFirmware, "integrityHash");
-            cJSON *timestamp = cJSON_GetObjectItem(latestFirmware, "timestamp");
-            cJSON *description = cJSON_GetObjectItem(latestFirmware, "description");
-            cJSON *cid = cJSON_GetObjectItem(latestFirmware, "cid");
-
-            if (cJSON_IsString(version) && (version->valuestring != NULL)) {
-                strncpy(firmware_info->version, version->valuestring, sizeof(firmware_info->version) - 1);
-            }
-            if (cJSON_IsString(author) && (author->valuestring != NULL)) {
-                strncpy(firmware_info->author, author->valuestring, sizeof(firmware_info->author) - 1);
-            }
-            if (cJSON_IsString(hardwareModel) && (hardwareModel->valuestring != NULL)) {
-                strncpy(firmware_info->hardwareModel, hardwareModel->valuestring, sizeof(firmware_info->hardwareModel) - 1);
-            }
-            if (cJSON_IsString(integrityHash) && (integrityHash->valuestring != NULL)) {
-                strncpy(firmware_info->integrityHash, integrityHash->valuestring, sizeof(firmware_info->integrityHash) - 1);
-            }
-            if (cJSON_IsString(timestamp) && (timestamp->valuestring != NULL)) {
-                strncpy(firmware_info->timestamp, timestamp->valuestring, sizeof(firmware_info->timestamp) - 1);
-            }
-            if (cJSON_IsString(description) && (description->valuestring != NULL)) {
-                strncpy(firmware_info->description, description->valuestring, sizeof(firmware_info->description) - 1);
-            }
-            if (cJSON_IsString(cid) && (cid->valuestring != NULL)) {
-                strncpy(firmware_info->cid, cid->valuestring, sizeof(firmware_info->cid) - 1);
-            }	
-        }
-    }
-
-    // Free the JSON object
-    cJSON_Delete(json);
-}
 
 /**
  * @brief Starts the firmware download.
  */
 void main_app_start_firmware_download(void){
 	main_test_update_log("INIT FIRMWARE IPFS DOWNLOAD T2");
-	strcpy((char*)url_string, HTTPS_IPFS_SERVER_URL);
-	//strcat((char*)url_string, "QmeYizCjAByRsLYvqGXwP3Vu1mpUyipGD8DMV6DZedfTtP"); // Curto 128
-	//strcat((char*)url_string, "QmW3a4Vu3zkyeLAkMnUGe6ejkCXTmeTnhs9jQ5iTT584hE"); // Longo 128
-	//strcat((char*)url_string, "QmUzRXXm4VgHPc42NkJYo8fzQ4Dv6pRFkPkpfZugbFwhL4"); // Curto 256
-	strcat((char*)url_string, "QmYmXS2FE72kciXwf9qCVtgNvrH1nsx2aua4cGu1kSDNH8"); //longo 256
-	//strcat((char*)url_string, firmware_info.cid);
-	ESP_LOGI(TAG, "Firmware url: %s",url_string);
+	update_report_phase_start(UPDATE_PHASE_DOWNLOAD);
+	update_progress_set_state(UPDATE_PROGRESS_DOWNLOADING);
+	metrics_add(METRICS_UPDATE_ATTEMPTS, 1);
+	// The gateway is chosen by the HTTPS task, racing the ones in the list
+	if(!main_app_select_firmware_cid()){
+		main_app_send_message(MAIN_APP_FW_DONWLOADED, FW_UPDATE_DOWNLOAD_ERROR, 0, NULL);
+		return;
+	}
+	ESP_LOGI(TAG, "Firmware CID: %s",url_string);
+	
+	// When a manifest is published, the integrity hash is its Merkle root
+	if(strlen(firmware_info.manifestCid) > 0 && fw_manifest_expect(firmware_info.integrityDigest, firmware_info.chunkSize) == FW_UPDATE_OK){
+		strcpy((char*)manifest_cid_string, firmware_info.manifestCid);
+		ESP_LOGI(TAG, "Manifest CID: %s",manifest_cid_string);
+		https_app_send_message(HTTPS_APP_MSG_DOWNLOAD_FW, url_string, manifest_cid_string, 0, NULL);
+		return;
+	}
 	https_app_send_message(HTTPS_APP_MSG_DOWNLOAD_FW, url_string, NULL, 0, NULL);
 }
 
+/**
+ * @brief Copies the CID of the firmware into url_string.
+ * @return true if the metadata published a CID
+ */
+static bool main_app_select_firmware_cid(void){
+	url_string[0] = '\0';
+	if(firmware_info.cid[0] == '\0'){
+		ESP_LOGE(TAG, "The metadata has no firmware CID");
+		return false;
+	}
+	strcat((char*)url_string, firmware_info.cid);
+	return true;
+}
+
 /** @} */
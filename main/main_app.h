@@ -35,7 +35,8 @@ typedef enum main_app_message {
     MAIN_APP_MSG_HTTPS_RECEIVED,     /**< HTTPS message received */
     MAIN_APP_MSG_HTTPS_DISCONNECTED, /**< HTTPS disconnected */
     MAIN_APP_FW_DONWLOADED,           /**< Firmware downloaded */
-    MAIN_APP_RELOAD
+    MAIN_APP_RELOAD,
+    MAIN_APP_MSG_CHECK_UPDATE        /**< Check requested by the push channel, code is a push_channel_reason_e */
 } main_app_message_e;
 
 /**
@@ -16,8 +16,14 @@
 #include "sysconfig.h"
 #include "main_test.h"
 #include "main_app.h"
+#include "tasks_common.h"
+#include "api/update_report.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
 
 /* Definitions ----------------------------------------------------------*/
 
@@ -41,8 +47,31 @@ test_type_e test_type = NO_TEST;
 
 uint8_t test_state = 0;
 
+/**
+ * @brief Lateness of the probe task wake-ups, in microseconds
+ */
+static int64_t g_latency_sum = 0;
+static int64_t g_latency_max = 0;
+static uint32_t g_latency_count = 0;
+
+/**
+ * @brief Start time of the current test cycle
+ */
+static int64_t g_cycle_start = 0;
+
 /* Function prototypes ---------------------------------------------------*/
 
+/**
+ * @brief Periodic task standing for the foreground work, measuring how late it wakes up
+ * @param pvParameters Parameter which can be passed to the task
+ */
+static void main_test_latency_task(void *pvParameters);
+
+/**
+ * @brief Prints the timings and memory peaks of the cycle that just finished
+ */
+static void main_test_performance_report(void);
+
 /* Public Functions ------------------------------------------------------*/
 
 /**
@@ -56,6 +85,7 @@ uint8_t test_state = 0;
 void main_test_init(void) {
 	
 	test_state = 0;
+	g_cycle_start = esp_timer_get_time();
 	
     if (CONFIDENTIALITY_TEST_ENABLED) {
         ESP_LOGI(TAG,"Initializing Confidentiality Test...");
@@ -81,6 +111,15 @@ void main_test_init(void) {
         ESP_LOGI(TAG,"Initializing Update Time Test...");
         test_type = UPDATE_TIME_TEST;
     }
+    if (FOREGROUND_LATENCY_TEST_ENABLED) {
+        ESP_LOGI(TAG,"Initializing Foreground Latency Test...");
+        test_type = FOREGROUND_LATENCY_TEST;
+        xTaskCreate(&main_test_latency_task, "latency_task", LATENCY_TEST_TASK_STACK_SIZE, NULL, LATENCY_TEST_TASK_PRIORITY, NULL);
+    }
+    if (PERFORMANCE_TEST_ENABLED) {
+        ESP_LOGI(TAG,"Initializing Performance Test...");
+        test_type = PERFORMANCE_TEST;
+    }
 }
 
 void main_test_update_log(char* msg_log){
@@ -89,9 +128,21 @@ void main_test_update_log(char* msg_log){
 
 void main_test_update_loop(void){
 	    ESP_LOGI(TAG,"TEST LOOP %d", test_loop);
+		if(test_type == FOREGROUND_LATENCY_TEST && g_latency_count > 0){
+			ESP_LOGI(TAG,"FOREGROUND LATENCY: avg %lld us, max %lld us, %lu wake-ups",
+			         (long long)(g_latency_sum / g_latency_count), (long long)g_latency_max, (unsigned long)g_latency_count);
+			g_latency_sum = 0;
+			g_latency_max = 0;
+			g_latency_count = 0;
+		}
+		if(test_type == PERFORMANCE_TEST){
+			main_test_performance_report();
+		}
 		test_loop--;
 		if(test_loop >= 0)
 			main_app_send_message(MAIN_APP_RELOAD, 0 ,0, NULL);
+		else if(test_type == PERFORMANCE_TEST)
+			ESP_LOGI(TAG,"PERF_DONE");
 }
 
 /** @} */
@@ -103,10 +154,51 @@ void main_test_update_loop(void){
  * @{
  */
 
-/*
- * @brief  
- * @param  
- * @return 
+/**
+ * @brief Periodic task standing for the foreground work, measuring how late it wakes up
+ * @param pvParameters Parameter which can be passed to the task
  */
+static void main_test_latency_task(void *pvParameters){
+	TickType_t last_wake = xTaskGetTickCount();
+	int64_t expected = esp_timer_get_time();
+	
+	for(;;){
+		vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(FOREGROUND_LATENCY_PERIOD_MS));
+		expected += FOREGROUND_LATENCY_PERIOD_MS * 1000;
+		
+		int64_t late = esp_timer_get_time() - expected;
+		if(late < 0){
+			late = 0;
+		}
+		g_latency_sum += late;
+		g_latency_count++;
+		if(late > g_latency_max){
+			g_latency_max = late;
+		}
+	}
+}
+
+/**
+ * @brief Prints the timings and memory peaks of the cycle that just finished
+ * @note The heap peak is the lowest free heap since boot, so it only grows
+ *       over the run; the stack values are the high water marks, in bytes
+ *       left as ESP-IDF reports them.
+ */
+static void main_test_performance_report(void){
+	update_report_t report = {0};
+	int64_t now = esp_timer_get_time();
+	TaskHandle_t https_task = xTaskGetHandle("https_app_task");
+	
+	update_report_get_last(&report);
+	ESP_LOGI(TAG,"PERF_CYCLE {\"cycle\": %d, \"result\": %ld, \"cycleMs\": %lu, \"metadataMs\": %lu, \"downloadMs\": %lu, \"verifyMs\": %lu, "
+	         "\"bytes\": %lu, \"retries\": %u, \"freeHeap\": %lu, \"minFreeHeap\": %lu, \"mainStackBytes\": %lu, \"httpsStackBytes\": %lu}",
+	         TEST_LOOP - test_loop, (long)report.result, (unsigned long)((now - g_cycle_start) / 1000),
+	         (unsigned long)report.phase_ms[UPDATE_PHASE_METADATA], (unsigned long)report.phase_ms[UPDATE_PHASE_DOWNLOAD],
+	         (unsigned long)report.phase_ms[UPDATE_PHASE_VERIFY], (unsigned long)report.bytes, report.retries,
+	         (unsigned long)esp_get_free_heap_size(), (unsigned long)esp_get_minimum_free_heap_size(),
+	         (unsigned long)uxTaskGetStackHighWaterMark(NULL),
+	         (unsigned long)(https_task ? uxTaskGetStackHighWaterMark(https_task) : 0));
+	g_cycle_start = now;
+}
 
 /** @} */
@@ -30,6 +30,8 @@ extern "C" {
 #define FAIL_TEST_ENABLED            0  /**< Enable Fail Test */
 #define POWER_TEST_ENABLED           0  /**< Enable Power Test */
 #define UPDATE_TIME_TEST_ENABLED     0  /**< Enable Update Time Test */
+#define FOREGROUND_LATENCY_TEST_ENABLED 0  /**< Enable Foreground Latency Test */
+#define PERFORMANCE_TEST_ENABLED     0  /**< Enable Performance Test, read by tools/perf_suite.py */
 
 
 /**
@@ -37,6 +39,11 @@ extern "C" {
  */
 #define TEST_LOOP 50  /**< Number of times each test will be performed */
 
+/**
+ * @brief Period of the task probed by the foreground latency test
+ */
+#define FOREGROUND_LATENCY_PERIOD_MS 10
+
 /* Public Types --------------------------------------------------------------*/
 /**
  * @brief Enumeration for each test process
@@ -48,7 +55,9 @@ typedef enum test_type{
     INTEGRITY_TEST,         /**< Integrity test */
     FAIL_TEST,              /**< Fail test */
     POWER_TEST,             /**< Power consumption test */
-    UPDATE_TIME_TEST        /**< Update time test */
+    UPDATE_TIME_TEST,       /**< Update time test */
+    FOREGROUND_LATENCY_TEST,/**< Latency of a periodic task while updating */
+    PERFORMANCE_TEST        /**< Timings and memory peaks of each cycle, one line per cycle */
 } test_type_e;
 
 
@@ -35,17 +35,110 @@ extern "C" {
  */
 #define PRINT_INFO 0
 
+/**
+ * @brief Replaces the hot path text logs by deferred binary records
+ * @note Decode the console output with tools/binlog_decode.py and the ELF file.
+ */
+#define BINLOG_ENABLED 0
+
+/**
+ * @brief Most verbose level queued by the binary logger
+ */
+#define BINLOG_LEVEL ESP_LOG_INFO
+
+/**
+ * @brief Size of the binary log ring buffer in bytes
+ */
+#define BINLOG_BUFFER_SIZE 4096
+
+/**
+ * @brief Maximum number of characters copied for each %s argument
+ */
+#define BINLOG_MAX_STRING_LEN 48
+
+/**
+ * @brief Idle time after which the binary log drain flushes the console
+ */
+#define BINLOG_FLUSH_PERIOD_MS 100
+
+/**
+ * @brief Enables the debug logs of esp-tls (slows down the TLS handshake)
+ */
+#define HTTPS_TLS_DEBUG 0
+
+/**
+ * @brief Prepares the TLS setup while Wi-Fi associates and keeps the metadata connection alive
+ * @note Set to 0 to measure the boot-to-first-metadata-byte latency without it
+ */
+#define HTTPS_TLS_PREWARM 1
+
+/**
+ * @brief Authenticates the register-device exchange with the pre-shared key provisioned in NVS
+ * @note Needs CONFIG_MBEDTLS_PSK_MODES with the key exchange below (CONFIG_MBEDTLS_KEY_EXCHANGE_ECDHE_PSK
+ *       or CONFIG_MBEDTLS_KEY_EXCHANGE_PSK); TLS 1.3 is negotiated when CONFIG_MBEDTLS_SSL_PROTO_TLS1_3
+ *       is set. The certificate path stays as the fallback when the device has no key or the exchange fails.
+ */
+#define TLS_PSK_ENABLED 0
+
+/**
+ * @brief Key exchange of the PSK mode: 1 for ECDHE-PSK, with forward secrecy; 0 for plain PSK, the cheapest
+ */
+#define TLS_PSK_EPHEMERAL 1
+
+/**
+ * @brief Address and port of the PSK listener of the metadata server
+ */
+#define TLS_PSK_SERVER_HOST "18.230.239.105"
+#define TLS_PSK_SERVER_PORT "3443"
+
+/**
+ * @brief Path of the register-device resource on the PSK listener
+ */
+#define TLS_PSK_REGISTER_PATH "register-device"
+
+/**
+ * @brief Time to wait for each read of the PSK exchange
+ */
+#define TLS_PSK_READ_TIMEOUT_MS 10000
+
+/**
+ * @brief Handshakes of each kind, certificate and PSK, timed after boot to compare both paths; 0 to skip
+ */
+#define TLS_PSK_BENCHMARK_ROUNDS 0
+
 /**
  * @brief WiFi Configuration SSID
  */
-#define PERSONAL_SSID "Apto 172"
-//#define PERSONAL_SSID "iPhone Airton"
+#define PERSONAL_SSID "NomeDaSuaRedeWiFi"
 
 /**
  * @brief WiFi Configuration Password
  */
-#define PERSONAL_PASS "30082023"
-//#define PERSONAL_PASS "2153818aa"
+#define PERSONAL_PASS "SuaSenhaWiFi"
+
+/**
+ * @brief Default WiFi candidate list, used to seed the NVS list on first boot
+ * @note Each entry is {SSID, Password}. The list stored in NVS takes precedence; add the
+ *       other networks there with wifi_app_add_candidate() instead of listing them here.
+ */
+#define WIFI_DEFAULT_CANDIDATES { \
+	{PERSONAL_SSID, PERSONAL_PASS}, \
+}
+
+/**
+ * @brief RSSI (dBm) below which the station looks for a better AP while idle
+ */
+#define WIFI_ROAM_RSSI_THRESHOLD -75
+
+/**
+ * @brief Minimum RSSI gain (dB) a candidate must offer before roaming to it
+ */
+#define WIFI_ROAM_RSSI_HYSTERESIS 8
+
+/**
+ * @brief Period of the idle roaming check in milliseconds
+ */
+#define WIFI_ROAM_CHECK_PERIOD_MS 30000
 
 #if AES_128
 #define KEY_SIZE 16
@@ -68,6 +161,56 @@ extern "C" {
 #define AES_IV {0x17, 0xfa, 0xfe, 0xb9, 0x31, 0x0a, 0x23, 0x16, 0x5d, 0x7f, 0x3d, 0x8f, 0xf5, 0x6c, 0x5f, 0x87}
 //#define AES_IV {0x27, 0xfa, 0xfe, 0xb9, 0x31, 0x0a, 0x23, 0x16, 0x5d, 0x7f, 0x3d, 0x8f, 0xf5, 0x6c, 0x5f, 0x87}
 
+/**
+ * @brief Size of the buffer of decrypted data written into the OTA slot at once
+ * @note Keep it a multiple of the flash sector, the journal commits one buffer at a time.
+ */
+#define FW_UPDATE_WRITE_BUFFER_SIZE 4096
+
+/**
+ * @brief Journals the sectors written into the OTA slot, to resume after a power cut
+ * @note The journal is saved after each FW_UPDATE_WRITE_BUFFER_SIZE bytes, so a power cut
+ *       loses at most one buffer; NVS spreads the writes over its pages.
+ */
+#define FW_UPDATE_JOURNAL_ENABLED 1
+
+/**
+ * @brief Checks the image and app headers in the first decrypted buffer, before anything is written
+ * @note The app version (PROJECT_VER) must follow FIRMWARE_VERSION for the version check.
+ */
+#define FW_UPDATE_IMAGE_CHECK_ENABLED 0
+
+/**
+ * @brief Size of the BLAKE3 subtrees the verification is split into, one share of them per core
+ * @note A power of two multiple of the 1024-byte BLAKE3 chunk; it is also the granularity
+ *       of a range check.
+ */
+#define FW_UPDATE_BLAKE3_SUBTREE_SIZE (64 * 1024)
+
+/**
+ * @brief Skips the download when the target slot holds a verified image with the published integrity hash
+ */
+#define FW_UPDATE_SLOT_REUSE_ENABLED 1
+
+/**
+ * @brief Windows of the slot hashed by the spot-check of a reused image, and their size
+ * @note The first window covers the image headers, the last one the end of the hashed range.
+ */
+#define FW_UPDATE_SPOT_CHECK_WINDOWS 4
+#define FW_UPDATE_SPOT_CHECK_WINDOW_SIZE 4096
+
+/**
+ * @brief Checks the running app against its recorded digest at each boot, in a background task once Wi-Fi is up
+ * @note The digest is the slot record of the update that installed the app, or the SHA-256 appended to the image.
+ */
+#define SELF_CHECK_ENABLED 1
+
+/**
+ * @brief Size of the windows of the running partition mapped and hashed at once
+ * @note A multiple of the 64 KiB MMU page; each window takes that much of the free data address space.
+ */
+#define SELF_CHECK_WINDOW_SIZE (256 * 1024)
+
 /**
  * @brief Length of URL buffer
  */
@@ -76,7 +219,58 @@ extern "C" {
 /**
  * @brief Length of payload buffer
  */
-#define PAYLOAD_LEN 255
+#define PAYLOAD_LEN 1024
+
+/**
+ * @brief Maximum number of update reports kept in NVS until they are sent
+ */
+#define UPDATE_REPORT_QUEUE_LEN 6
+
+/**
+ * @brief Enables the arena used by cJSON and mbedTLS during an update cycle
+ */
+#define SESSION_ARENA_ENABLED 1
+
+/**
+ * @brief Size of the update cycle arena, allocations beyond it go to the heap
+ */
+#define SESSION_ARENA_SIZE (48 * 1024)
+
+/**
+ * @brief Maximum number of tasks served by the arena, the other tasks always use the heap
+ */
+#define SESSION_ARENA_MAX_OWNERS 4
+
+/**
+ * @brief Runs the update in the background, under the bandwidth and CPU budgets below
+ */
+#define UPDATE_BACKGROUND_MODE 0
+
+/**
+ * @brief Bandwidth budget of a background update in bytes per second
+ */
+#define UPDATE_THROTTLE_BANDWIDTH_BPS (32 * 1024)
+
+/**
+ * @brief Share of the CPU, in percent, a background update may take
+ * @note From 1 to 100.
+ */
+#define UPDATE_THROTTLE_DUTY_CYCLE 50
+
+/**
+ * @brief Length of the busy slice of a background update in milliseconds
+ */
+#define UPDATE_THROTTLE_SLICE_MS 20
+
+/**
+ * @brief Maximum number of update progress observers
+ */
+#define UPDATE_PROGRESS_MAX_OBSERVERS 4
+
+/**
+ * @brief Period of the transfer rate samples, and of the progress notifications
+ */
+#define UPDATE_PROGRESS_SAMPLE_MS 500
 
 /**
  * @brief URL of the HTTPS Blockchain Server
@@ -88,13 +282,131 @@ extern "C" {
  */
 #define HTTPS_IPFS_SERVER_URL "http://177.71.161.69:8080/ipfs/"
 
+/**
+ * @brief IPFS gateways raced for the firmware download, the metadata may add others in "gateways"
+ */
+#define IPFS_GATEWAY_LIST {HTTPS_IPFS_SERVER_URL, "https://ipfs.io/ipfs/", "https://dweb.link/ipfs/"}
+
+/**
+ * @brief Maximum number of IPFS gateways, PEER_CACHE_MAX_PEERS of them kept for the local peers
+ */
+#define IPFS_GATEWAY_MAX 8
+
+/**
+ * @brief Number of gateways opened at once, each one holds a connection until the race is decided
+ */
+#define IPFS_GATEWAY_RACE_COUNT 3
+
+/**
+ * @brief Time for a gateway to answer the headers before it loses the race
+ */
+#define IPFS_GATEWAY_RACE_TIMEOUT_MS 10000
+
+/**
+ * @brief Enables the trustless download, block by block with the CID of each block checked
+ * @note The firmware must be added with small blocks, e.g. "ipfs add --chunker=size-16384 --raw-leaves"
+ */
+#define IPFS_BLOCK_FETCH_ENABLED 0
+
+/**
+ * @brief Number of blocks fetched at once, each one with its own buffer and connection
+ */
+#define IPFS_BLOCK_CONCURRENCY 3
+
+/**
+ * @brief Maximum size of a block, leaves and internal nodes
+ */
+#define IPFS_BLOCK_MAX_SIZE (16384 + 1024)
+
+/**
+ * @brief Maximum number of links of a DAG node
+ */
+#define IPFS_BLOCK_MAX_LINKS 256
+
+/**
+ * @brief Maximum number of blocks waiting to be walked
+ */
+#define IPFS_BLOCK_MAX_PENDING 512
+
+/**
+ * @brief Number of gateways a block is requested from before the download fails
+ */
+#define IPFS_BLOCK_MAX_ATTEMPTS 3
+
+/**
+ * @brief Enables the LAN peer cache: a verified image is served to the neighbors, which race them before the gateways
+ * @note Needs the mdns component (main/idf_component.yml).
+ */
+#define PEER_CACHE_ENABLED 0
+
+/**
+ * @brief TCP port of the peer cache HTTP server, the next one is its control port
+ */
+#define PEER_CACHE_PORT 8070
+
+/**
+ * @brief Maximum number of local peers raced with the gateways
+ */
+#define PEER_CACHE_MAX_PEERS 2
+
+/**
+ * @brief Time the mDNS query waits for the peers to answer
+ */
+#define PEER_CACHE_QUERY_TIMEOUT_MS 1500
+
+/**
+ * @brief Size of the pieces read from the partition, encrypted and sent to a peer
+ */
+#define PEER_CACHE_SEND_BLOCK_SIZE 1024
+
+/**
+ * @brief Enables the metrics endpoint, GET /metrics in the Prometheus text format
+ */
+#define METRICS_ENABLED 0
+
+/**
+ * @brief TCP port of the metrics endpoint, the next one is its control port
+ */
+#define METRICS_PORT 9100
+
+/**
+ * @brief Image file read instead of the gateways, to replay a captured download; empty to download
+ * @note A path in a mounted VFS (SPIFFS, an SD card, or the host file system on the linux target).
+ */
+#define IMAGE_SOURCE_REPLAY_PATH ""
+
+/**
+ * @brief Chunk manifest file of the replayed image, used when the metadata publishes a manifest
+ */
+#define IMAGE_SOURCE_REPLAY_MANIFEST_PATH ""
+
+/**
+ * @brief Chunk size used when the metadata publishes a manifest without "chunkSize"
+ */
+#define FW_MANIFEST_DEFAULT_CHUNK_SIZE 4096
+
+/**
+ * @brief Maximum number of chunks in a firmware manifest
+ */
+#define FW_MANIFEST_MAX_CHUNKS 1024
+
+/**
+ * @brief Maximum size of a chunk covered by the firmware manifest
+ */
+#define FW_MANIFEST_MAX_CHUNK_SIZE 16384
+
+/**
+ * @brief Number of times a chunk that failed verification is fetched again
+ */
+#define FW_MANIFEST_MAX_REFETCH 3
+
 /**
  * @brief Size of the HTTPS response buffer
  */
 #define HTTPS_RESPONSE_BUFFER_SIZE 2048
 
 /**
- * @brief HTTP status code for successful message receipt
+ * @brief HTTP status code for successful message receipt, the first of the 2xx range
  */
 #define HTTPS_RECEIVED_MSG_SUCCESS 200
 
@@ -108,6 +420,85 @@ extern "C" {
  */
 #define PAYLOAD_REGISTER_DEVICE "{\"hardwareVersion\": \"" HARDWARE_MODEL "\", \"softwareVersion\": \"" FIRMWARE_VERSION "\"}"
 
+/**
+ * @brief Sends the register-device request as CBOR, JSON stays as the fallback when the server refuses it
+ */
+#define METADATA_CBOR_ENABLED 1
+
+/**
+ * @brief Size of the CBOR register-device request, pending update reports included
+ */
+#define METADATA_CBOR_REQUEST_LEN 1024
+
+/**
+ * @brief Sends the register-device request over CoAP/DTLS, HTTPS stays as the fallback
+ * @note Needs CONFIG_MBEDTLS_SSL_PROTO_DTLS, and CONFIG_MBEDTLS_SSL_DTLS_CONNECTION_ID for the connection ID.
+ */
+#define COAP_TRANSPORT_ENABLED 0
+
+/**
+ * @brief Address and port of the CoAP server
+ */
+#define COAP_SERVER_HOST "18.230.239.105"
+#define COAP_SERVER_PORT "5684"
+
+/**
+ * @brief Path of the register-device resource on the CoAP server
+ */
+#define COAP_REGISTER_PATH "register-device"
+
+/**
+ * @brief Initial acknowledgement timeout and number of retransmissions of a request
+ */
+#define COAP_ACK_TIMEOUT_MS 2000
+#define COAP_MAX_RETRANSMIT 4
+
+/**
+ * @brief Time to wait for a separate response after the empty acknowledgement
+ */
+#define COAP_RESPONSE_TIMEOUT_MS 10000
+
+/**
+ * @brief Longest retransmission timeout of the DTLS handshake
+ */
+#define COAP_HANDSHAKE_TIMEOUT_MAX_MS 16000
+
+/**
+ * @brief Largest datagram, request and response must fit in one
+ */
+#define COAP_MESSAGE_LEN 1280
+
+/**
+ * @brief Keeps a Server-Sent Events stream open to receive the firmware announcements
+ */
+#define PUSH_CHANNEL_ENABLED 1
+
+/**
+ * @brief Address of the event stream, tools/push_server.py serves a local one for testing
+ */
+#define PUSH_CHANNEL_URL ""HTTPS_BLOCKCHAIN_SERVER_URL"/events?hardwareVersion=" HARDWARE_MODEL
+
+/**
+ * @brief Time without data, heartbeats included, after which the stream is reopened
+ */
+#define PUSH_CHANNEL_IDLE_TIMEOUT_MS 60000
+
+/**
+ * @brief First and longest delay between attempts to open the stream
+ */
+#define PUSH_CHANNEL_RETRY_MS     5000
+#define PUSH_CHANNEL_RETRY_MAX_MS 60000
+
+/**
+ * @brief Interval of the update checks while the stream is down
+ */
+#define PUSH_CHANNEL_POLL_INTERVAL_MS (15 * 60 * 1000)
+
+/**
+ * @brief Longest line of the stream, longer lines are truncated
+ */
+#define PUSH_CHANNEL_LINE_LEN 256
+
 /**
  * @brief Error message for hardware version not found
  */
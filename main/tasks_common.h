@@ -59,6 +59,101 @@ extern "C" {
  */
 #define HTTPS_APP_TASK_PRIORITY         5
 
+/** 
+ * @brief Stack size for the peer cache HTTP server task
+ */
+#define PEER_CACHE_TASK_STACK_SIZE        4096
+
+/**
+ * @brief Priority for the peer cache HTTP server task
+ */
+#define PEER_CACHE_TASK_PRIORITY          4
+
+/** 
+ * @brief Stack size for the metrics HTTP server task
+ */
+#define METRICS_TASK_STACK_SIZE           4096
+
+/**
+ * @brief Priority for the metrics HTTP server task
+ */
+#define METRICS_TASK_PRIORITY             3
+
+/** 
+ * @brief Stack size for the binary log drain task
+ */
+#define BINLOG_TASK_STACK_SIZE          2048
+
+/**
+ * @brief Priority for the binary log drain task
+ */
+#define BINLOG_TASK_PRIORITY            1
+
+/** 
+ * @brief Stack size for each IPFS gateway racer task
+ */
+#define IPFS_GATEWAY_RACE_TASK_STACK_SIZE 6144
+
+/**
+ * @brief Priority for the IPFS gateway racer tasks
+ */
+#define IPFS_GATEWAY_RACE_TASK_PRIORITY   5
+
+/** 
+ * @brief Stack size for each IPFS block worker task
+ */
+#define IPFS_BLOCK_TASK_STACK_SIZE        6144
+
+/**
+ * @brief Priority for the IPFS block worker tasks
+ */
+#define IPFS_BLOCK_TASK_PRIORITY          5
+
+/**
+ * @brief Stack size for the push channel task
+ */
+#define PUSH_CHANNEL_TASK_STACK_SIZE      6144
+
+/**
+ * @brief Priority for the push channel task
+ */
+#define PUSH_CHANNEL_TASK_PRIORITY        4
+
+/**
+ * @brief Stack size for each BLAKE3 verification helper task
+ */
+#define FW_UPDATE_HASH_TASK_STACK_SIZE    3072
+
+/**
+ * @brief Priority for the BLAKE3 verification helper tasks
+ */
+#define FW_UPDATE_HASH_TASK_PRIORITY      5
+
+/**
+ * @brief Stack size for the boot-time integrity self-check task
+ */
+#define SELF_CHECK_TASK_STACK_SIZE        6144
+
+/**
+ * @brief Priority for the boot-time integrity self-check task, just above the idle task
+ */
+#define SELF_CHECK_TASK_PRIORITY          1
+
+/**
+ * @brief Priority of the task running a background update, below the application tasks
+ */
+#define UPDATE_BACKGROUND_TASK_PRIORITY   2
+
+/**
+ * @brief Stack size for the foreground latency test task
+ */
+#define LATENCY_TEST_TASK_STACK_SIZE      2048
+
+/**
+ * @brief Priority for the foreground latency test task, the same as the application tasks
+ */
+#define LATENCY_TEST_TASK_PRIORITY        5
+
 /* Public Function Prototypes -------------------------------------------------*/
 
 /**
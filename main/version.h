@@ -25,13 +25,19 @@ extern "C" {
 
 /** 
  * @brief Hardware model identifier
+ * @note A host build (tools/fleet_client.c) sets it per virtual device
  */
+#ifndef HARDWARE_MODEL
 #define HARDWARE_MODEL    "ModelX"
+#endif
 
 /** 
  * @brief Firmware version identifier
+ * @note A host build (tools/fleet_client.c) sets it per virtual device
  */
+#ifndef FIRMWARE_VERSION
 #define FIRMWARE_VERSION  "4.1"
+#endif
 
 /**
  * @brief Converts a macro value to a string
@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+"""
+Decodes the deferred binary log (BINLOG_ENABLED) back to text.
+
+The device writes records framed as
+    sync(0xB1 0x0C) len(1) type|level(1) timestamp_ms(4) tag(4) fmt(4) args...
+where tag and fmt are addresses of strings in the firmware flash. They are
+resolved with the ELF file of the same build. After the sync, the bytes
+0x0A, 0x0D and 0x7D are sent as 0x7D followed by the byte XOR 0x20, so the
+line ending translation of the console does not touch the record; len
+counts the record before escaping. Any text between records
+(bootloader, ESP_LOG output) is passed through unchanged.
+
+Usage: binlog_decode.py <firmware.elf> [capture_file | serial_port [baud]]
+       (reads stdin when no capture is given)
+"""
+import re
+import struct
+import sys
+
+SYNC = b"\xb1\x0c"
+ESCAPE = 0x7D
+ESCAPE_XOR = 0x20
+HEADER = struct.Struct("<2sBBIII")
+TYPE_PRINTF = 0x0
+TYPE_HEX = 0x1
+LEVELS = {1: "E", 2: "W", 3: "I", 4: "D", 5: "V"}
+CONVERSION = re.compile(r"%([-+ #0]*)(\d+|\*)?(?:\.(\d+))?(hh|h|ll|l|z|j|t)?([diouxXcspfFeEgG%])")
+
+
+class Elf32:
+    """Minimal ELF32 little endian reader, enough to resolve string addresses."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1:
+            raise ValueError("not an ELF32 file")
+        shoff, = struct.unpack_from("<I", self.data, 0x20)
+        shentsize, shnum = struct.unpack_from("<HH", self.data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            (_, sh_type, _, addr, offset, size) = struct.unpack_from("<IIIIII", self.data, shoff + i * shentsize)
+            # Skip NOBITS (.bss) and sections not loaded at an address
+            if sh_type != 8 and addr != 0 and size != 0:
+                self.sections.append((addr, offset, size))
+        self.cache = {}
+
+    def string(self, addr):
+        if addr in self.cache:
+            return self.cache[addr]
+        for base, offset, size in self.sections:
+            if base <= addr < base + size:
+                start = offset + addr - base
+                end = self.data.index(b"\x00", start)
+                text = self.data[start:end].decode("utf-8", "replace")
+                self.cache[addr] = text
+                return text
+        return "<0x%08x>" % addr
+
+
+def format_record(fmt, args):
+    out = []
+    pos = 0
+    idx = 0
+    for m in CONVERSION.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+        flags, width, precision, _, conv = m.groups()
+        if conv == "%":
+            out.append("%")
+            continue
+        spec = "%" + (flags or "") + (width or "") + ("." + precision if precision else "")
+        if idx >= len(args):
+            out.append("<?>")
+            continue
+        if conv == "s":
+            n = args[idx]
+            value = args[idx + 1:idx + 1 + n].decode("utf-8", "replace")
+            idx += 1 + n
+            out.append((spec + "s") % value)
+        elif conv in "fFeEgG":
+            value, = struct.unpack_from("<d", args, idx)
+            idx += 8
+            out.append((spec + conv) % value)
+        else:
+            raw, = struct.unpack_from("<I", args, idx)
+            idx += 4
+            if conv in "di":
+                out.append((spec + "d") % struct.unpack("<i", struct.pack("<I", raw))[0])
+            elif conv == "u":
+                out.append((spec + "d") % raw)
+            elif conv == "c":
+                out.append((spec + "c") % chr(raw & 0xFF))
+            elif conv == "p":
+                out.append("0x%08x" % raw)
+            else:
+                out.append((spec + conv) % raw)
+    out.append(fmt[pos:])
+    return "".join(out)
+
+
+def unescape(buf, pos, count):
+    """Takes count record bytes from buf at pos, returns them and the position after, or None if incomplete."""
+    out = bytearray()
+    while len(out) < count:
+        if pos >= len(buf):
+            return None, pos
+        byte = buf[pos]
+        pos += 1
+        if byte == ESCAPE:
+            if pos >= len(buf):
+                return None, pos
+            byte = buf[pos] ^ ESCAPE_XOR
+            pos += 1
+        out.append(byte)
+    return bytes(out), pos
+
+
+def decode(elf, stream, write):
+    buf = b""
+    while True:
+        data = stream.read(256)
+        if not data:
+            break
+        buf += data
+        while True:
+            i = buf.find(SYNC)
+            if i < 0:
+                # Keep a possible partial sync byte at the end
+                keep = 1 if buf.endswith(SYNC[:1]) else 0
+                write(buf[:len(buf) - keep].decode("utf-8", "replace"))
+                buf = buf[len(buf) - keep:]
+                break
+            if i > 0:
+                write(buf[:i].decode("utf-8", "replace"))
+                buf = buf[i:]
+            header, _ = unescape(buf, len(SYNC), HEADER.size - len(SYNC))
+            if header is None:
+                break
+            _, length, type_level, ts, tag, fmt = HEADER.unpack(SYNC + header)
+            if length < HEADER.size:
+                write(buf[:1].decode("utf-8", "replace"))
+                buf = buf[1:]
+                continue
+            record, end = unescape(buf, len(SYNC), length - len(SYNC))
+            if record is None:
+                break
+            args = record[HEADER.size - len(SYNC):]
+            buf = buf[end:]
+            level = LEVELS.get(type_level & 0x0F, "?")
+            label = elf.string(fmt)
+            if (type_level >> 4) == TYPE_HEX:
+                text = label + " " + args.hex()
+            else:
+                text = format_record(label, args)
+            write("%s (%d) %s: %s\n" % (level, ts, elf.string(tag), text))
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        return 1
+    elf = Elf32(sys.argv[1])
+    if len(sys.argv) > 2 and sys.argv[2].startswith(("/dev/", "COM")):
+        import serial  # pyserial
+        stream = serial.Serial(sys.argv[2], int(sys.argv[3]) if len(sys.argv) > 3 else 115200)
+    elif len(sys.argv) > 2:
+        stream = open(sys.argv[2], "rb")
+    else:
+        stream = sys.stdin.buffer
+
+    def write(text):
+        sys.stdout.write(text)
+        sys.stdout.flush()
+
+    try:
+        decode(elf, stream, write)
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,243 @@
+/*
+ * Host build of the device's metadata exchange, driven by fleet_load.py.
+ *
+ * Links the firmware's own main/api/metadata_response.c (the handling of
+ * the register-device answer, cJSON and plain text) and
+ * main/api/metadata_cbor.c (the CBOR request and decoder), so the load
+ * generator encodes and parses exactly what a device does. The ESP-IDF
+ * headers those modules include come from tools/host, and cJSON from the
+ * json component of ESP-IDF. tools/host/fleet_identity.h turns
+ * HARDWARE_MODEL and FIRMWARE_VERSION into variables, so one binary
+ * encodes the request of every identity of the fleet.
+ *
+ * Reads one command per line on stdin and answers one line on stdout:
+ *     request MODEL VERSION   hex of metadata_cbor_encode_request() for
+ *                             that identity, or "error"
+ *     response HEX            JSON object with the firmware_metadata_info_t
+ *                             left by metadata_response_process()
+ * Logs of the device modules go to stderr.
+ *
+ * Build:
+ *     cc -O2 -I tools/host -I main -I $IDF_PATH/components/json/cJSON \
+ *        -include tools/host/fleet_identity.h -o tools/fleet_client \
+ *        tools/fleet_client.c main/api/metadata_response.c main/api/metadata_cbor.c \
+ *        $IDF_PATH/components/json/cJSON/cJSON.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "sysconfig.h"
+#include "api/fw_update.h"
+#include "api/ipfs_block.h"
+#include "api/ipfs_gateway.h"
+#include "api/metadata_cbor.h"
+#include "api/metadata_response.h"
+#include "api/update_report.h"
+
+/* Identity of the virtual device, see tools/host/fleet_identity.h */
+
+const char *fleet_client_model = "";
+const char *fleet_client_version = "";
+
+/*
+ * Host definitions of the functions the two modules call in modules bound
+ * to the flash, the HTTP client or the tasks. The ones that parse copy the
+ * device code; keep them in step with it.
+ */
+
+static char gateways[IPFS_GATEWAY_MAX][IPFS_GATEWAY_URL_LEN];
+static int gateway_count;
+
+/* A virtual device has delivered its reports, update_report.c */
+int update_report_pending(void)
+{
+    return 0;
+}
+
+int update_report_attach_cbor(metadata_cbor_writer_t *writer)
+{
+    metadata_cbor_put_array(writer, 0);
+    return 0;
+}
+
+/* The gateways published in the answer are reported, ipfs_gateway.c keeps them */
+bool ipfs_gateway_add(const char *base_url)
+{
+    if (gateway_count >= IPFS_GATEWAY_MAX || strlen(base_url) >= IPFS_GATEWAY_URL_LEN) {
+        return false;
+    }
+    strcpy(gateways[gateway_count++], base_url);
+    return true;
+}
+
+/* fw_update.c */
+fw_update_hash_e fw_update_parse_hash_algorithm(const char *name)
+{
+    if (name == NULL || name[0] == '\0' || strcasecmp(name, "sha256") == 0 || strcasecmp(name, "sha2-256") == 0) {
+        return FW_UPDATE_HASH_SHA256;
+    }
+    if (strcasecmp(name, "blake3") == 0) {
+        return FW_UPDATE_HASH_BLAKE3;
+    }
+    return FW_UPDATE_HASH_UNKNOWN;
+}
+
+void hex_string_to_bytes(const char *hex_string, char *byte_array)
+{
+    size_t len = strlen(hex_string);
+    for (size_t i = 0; i < len; i += 2) {
+        char byte_str[3] = {hex_string[i], hex_string[i + 1], '\0'};
+        byte_array[i / 2] = (uint8_t)strtol(byte_str, NULL, 16);
+    }
+}
+
+/* ipfs_block.c: a CIDv0 or CIDv1 (raw or dag-pb, sha2-256) as a CIDv1 base32 string */
+esp_err_t ipfs_block_cid_to_text(const uint8_t *bytes, size_t len, char *text, size_t size)
+{
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz234567";
+    uint8_t cid[4 + IPFS_DIGEST_SIZE] = {0x01, IPFS_CODEC_DAG_PB, 0x12, IPFS_DIGEST_SIZE};
+    uint32_t buffer = 0;
+    int bits = 0;
+    size_t pos = 0;
+
+    if (size < 1 + (sizeof(cid) * 8 + 4) / 5 + 1) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (len == 2 + IPFS_DIGEST_SIZE && bytes[0] == 0x12 && bytes[1] == IPFS_DIGEST_SIZE) {
+        memcpy(cid + 4, bytes + 2, IPFS_DIGEST_SIZE);
+    } else if (len >= sizeof(cid) && bytes[0] == 0x01 && (bytes[1] == IPFS_CODEC_RAW || bytes[1] == IPFS_CODEC_DAG_PB) &&
+               bytes[2] == 0x12 && bytes[3] == IPFS_DIGEST_SIZE) {
+        memcpy(cid + 4, bytes + 4, IPFS_DIGEST_SIZE);
+        cid[1] = bytes[1];
+    } else {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    text[pos++] = 'b';
+    for (size_t i = 0; i < sizeof(cid); i++) {
+        buffer = (buffer << 8) | cid[i];
+        bits += 8;
+        while (bits >= 5) {
+            bits -= 5;
+            text[pos++] = alphabet[(buffer >> bits) & 0x1F];
+        }
+    }
+    if (bits > 0) {
+        text[pos++] = alphabet[(buffer << (5 - bits)) & 0x1F];
+    }
+    text[pos] = '\0';
+    return ESP_OK;
+}
+
+/* Commands */
+
+static void put_json_text(const char *value)
+{
+    putchar('"');
+    for (const unsigned char *c = (const unsigned char *)value; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            printf("\\%c", *c);
+        } else if (*c < 0x20) {
+            printf("\\u%04x", *c);
+        } else {
+            putchar(*c);
+        }
+    }
+    putchar('"');
+}
+
+static void put_json_string(const char *key, const char *value, int first)
+{
+    printf("%s\"%s\": ", first ? "{" : ", ", key);
+    put_json_text(value);
+}
+
+static void request(char *model, char *version)
+{
+    uint8_t buffer[METADATA_CBOR_REQUEST_LEN];
+
+    fleet_client_model = model;
+    fleet_client_version = version;
+    size_t len = metadata_cbor_encode_request(buffer, sizeof(buffer));
+    if (len == 0) {
+        printf("error\n");
+        return;
+    }
+    for (size_t i = 0; i < len; i++) {
+        printf("%02x", buffer[i]);
+    }
+    putchar('\n');
+}
+
+static void response(const char *hex)
+{
+    static const char *algorithms[] = {"sha256", "blake3", "unknown"};
+    firmware_metadata_info_t info;
+    size_t len = strlen(hex) / 2;
+    char *body = malloc(len + 1);
+
+    if (body == NULL) {
+        printf("{}\n");
+        return;
+    }
+    for (size_t i = 0; i < len; i++) {
+        unsigned byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+            len = i;
+            break;
+        }
+        body[i] = (char)byte;
+    }
+    // The device hands over the answer null terminated
+    body[len] = '\0';
+    memset(&info, 0x00, sizeof(info));
+    gateway_count = 0;
+    metadata_response_process(body, (int)len, &info);
+    free(body);
+
+    put_json_string("status", info.status, 1);
+    put_json_string("version", info.version, 0);
+    put_json_string("cid", info.cid, 0);
+    put_json_string("manifestCid", info.manifestCid, 0);
+    put_json_string("integrityHash", info.integrityHash, 0);
+    put_json_string("integrityAlgorithm", algorithms[info.integrityAlgorithm], 0);
+    printf(", \"chunkSize\": %u, \"gateways\": [", (unsigned)info.chunkSize);
+    for (int i = 0; i < gateway_count; i++) {
+        printf("%s", i ? ", " : "");
+        put_json_text(gateways[i]);
+    }
+    printf("]}\n");
+}
+
+int main(void)
+{
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t n;
+
+    while ((n = getline(&line, &size, stdin)) > 0) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *command = strtok(line, " ");
+        if (command == NULL) {
+            continue;
+        }
+        if (strcmp(command, "request") == 0) {
+            char *model = strtok(NULL, " ");
+            char *version = strtok(NULL, " ");
+            if (model && version) {
+                request(model, version);
+            } else {
+                printf("error\n");
+            }
+        } else if (strcmp(command, "response") == 0) {
+            char *hex = strtok(NULL, " ");
+            response(hex ? hex : "");
+        } else {
+            printf("error\n");
+        }
+        fflush(stdout);
+    }
+    free(line);
+    return 0;
+}
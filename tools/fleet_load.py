@@ -0,0 +1,302 @@
+#!/usr/bin/env python3
+"""
+Fleet load generator for the metadata server and the IPFS gateway.
+
+Runs N virtual devices, each one doing the update cycle of the firmware:
+the register-device POST of https_app_perform_request() (JSON, or CBOR as
+with METADATA_CBOR_ENABLED, over mutual TLS with the device certificate),
+the handling of the answer, and, when an update is published, the plain
+download loop of http_app_download_firmware(): one GET on the gateway
+read in HTTPS_RESPONSE_BUFFER_SIZE pieces. Defaults (URLs, buffer size,
+identity, answer strings) are read from main/sysconfig.h and
+main/version.h, so the generator follows the firmware configuration.
+
+The CBOR request and the parsing of the answer are not done here: they
+run in tools/fleet_client, a host build of the firmware's own
+metadata_cbor.c and metadata_response.c (see the build line in
+tools/fleet_client.c), so the virtual devices take the decisions a
+device would take.
+
+Each virtual device gets an identity (hardwareVersion/softwareVersion)
+from --identity, round-robin, and starts at a time given by the arrival
+pattern over --window seconds:
+    burst    all devices at once
+    uniform  evenly spaced
+    poisson  exponential gaps, the rate of a fleet of independent devices
+    ramp     the rate grows linearly from 0, to find where latency bends
+--cycles repeats the cycle every --interval seconds per device.
+
+The report gives throughput and p50/p90/p95/p99/max of the metadata
+latency, the download time and the start lag (a virtual device started
+late because all --workers were busy: raise --workers if it grows).
+
+Usage: fleet_load.py --devices 1000 [--arrival poisson] [--window 60]
+                     [--identity ModelX:4.1 --identity ModelY:1.0]
+                     [--cycles 1] [--interval 60] [--workers 256]
+                     [--download] [--cbor] [--client tools/fleet_client]
+                     [--server URL] [--gateway URL]
+                     [--cert device-cert.pem --key device-key.pem --ca ca-cert.pem]
+                     [--out report.json]
+"""
+import argparse
+import heapq
+import json
+import os
+import random
+import re
+import ssl
+import subprocess
+import sys
+import threading
+import time
+import urllib.error
+import urllib.request
+from concurrent.futures import ThreadPoolExecutor
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "main")
+
+
+def firmware_defines():
+    """Reads the string and integer #defines of sysconfig.h and version.h."""
+    defines = {}
+    for name in ("version.h", "sysconfig.h"):
+        try:
+            with open(os.path.join(ROOT, name)) as f:
+                text = f.read()
+        except OSError:
+            continue
+        for key, value in re.findall(r'^#define\s+(\w+)\s+("[^"\n]*"|\d+)\s*$', text, re.M):
+            defines[key] = value.strip('"') if value.startswith('"') else int(value)
+    return defines
+
+
+class FleetClient:
+    """Runs tools/fleet_client and passes it the requests to encode and the answers to parse."""
+
+    def __init__(self, path):
+        self.lock = threading.Lock()
+        self.process = subprocess.Popen([path], stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True)
+        self.requests = {}
+
+    def call(self, line):
+        with self.lock:
+            self.process.stdin.write(line + "\n")
+            self.process.stdin.flush()
+            answer = self.process.stdout.readline().strip()
+        if not answer or answer == "error":
+            raise ValueError(line.split(" ", 1)[0] + " failed")
+        return answer
+
+    def cbor_request(self, model, version):
+        """metadata_cbor_encode_request() of the identity."""
+        key = (model, version)
+        if key not in self.requests:
+            self.requests[key] = bytes.fromhex(self.call("request %s %s" % key))
+        return self.requests[key]
+
+    def process_response(self, body):
+        """metadata_response_process(): the firmware_metadata_info_t it leaves, as a dict."""
+        return json.loads(self.call("response " + body.hex()))
+
+    def close(self):
+        self.process.stdin.close()
+        self.process.wait()
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.metadata_ms, self.download_ms, self.lag_ms = [], [], []
+        self.outcomes = {}
+        self.bytes = 0
+
+    def add(self, key, value):
+        with self.lock:
+            getattr(self, key).append(value)
+
+    def outcome(self, name, nbytes=0):
+        with self.lock:
+            self.outcomes[name] = self.outcomes.get(name, 0) + 1
+            self.bytes += nbytes
+
+
+def tls_context(args):
+    context = ssl.create_default_context(cafile=args.ca) if args.ca else ssl.create_default_context()
+    # The devices connect by address: skip_cert_common_name_check
+    context.check_hostname = False
+    if not args.ca:
+        context.verify_mode = ssl.CERT_NONE
+    if args.cert:
+        context.load_cert_chain(args.cert, args.key)
+    return context
+
+
+def device_cycle(device, args, defines, context, client, stats):
+    model, version = device["identity"]
+    if args.cbor:
+        body = client.cbor_request(model, version)
+        headers = {"Content-Type": "application/cbor", "Accept": "application/cbor, application/json"}
+    else:
+        body = json.dumps({"hardwareVersion": model, "softwareVersion": version}).encode()
+        headers = {"Content-Type": "application/json"}
+    request = urllib.request.Request(args.server.rstrip("/") + "/register-device", data=body, headers=headers, method="POST")
+
+    started = time.monotonic()
+    try:
+        with urllib.request.urlopen(request, timeout=args.timeout, context=context) as response:
+            answer = response.read()
+    except urllib.error.HTTPError as e:
+        stats.outcome("metadata_http_%d" % e.code)
+        return
+    except OSError as e:
+        stats.outcome("metadata_" + type(e).__name__)
+        return
+    stats.add("metadata_ms", (time.monotonic() - started) * 1000)
+    try:
+        info = client.process_response(answer)
+    except ValueError:
+        stats.outcome("metadata_unparsable")
+        return
+    # As main_app_task: only VERSION_OUTDATED starts the download
+    status, cid = info["status"], info["cid"]
+    if status != defines.get("VERSION_OUTDATED", "Update available") or not cid or not args.download:
+        stats.outcome("up_to_date" if status == defines.get("VERSION_UPDATED") else "no_download")
+        return
+
+    # The plain download loop: one GET, read in HTTPS_RESPONSE_BUFFER_SIZE pieces
+    started = time.monotonic()
+    received = 0
+    try:
+        with urllib.request.urlopen(args.gateway + (args.cid or cid), timeout=args.timeout, context=context) as response:
+            while True:
+                piece = response.read(args.buffer)
+                if not piece:
+                    break
+                received += len(piece)
+    except OSError as e:
+        stats.outcome("download_" + type(e).__name__, received)
+        return
+    stats.add("download_ms", (time.monotonic() - started) * 1000)
+    stats.outcome("downloaded", received)
+
+
+def arrivals(args):
+    """Start offsets in seconds of the first cycle of each device."""
+    n, window = args.devices, args.window
+    if args.arrival == "burst" or n == 1:
+        return [0.0] * n
+    if args.arrival == "uniform":
+        return [window * i / n for i in range(n)]
+    if args.arrival == "ramp":
+        # Rate proportional to t: the i-th device starts at window * sqrt(i / n)
+        return [window * (i / n) ** 0.5 for i in range(n)]
+    offsets, t = [], 0.0
+    for _ in range(n):
+        t += random.expovariate(n / window)
+        offsets.append(t)
+    return offsets
+
+
+def percentiles(values):
+    if not values:
+        return None
+    ordered = sorted(values)
+
+    def rank(p):
+        return ordered[max(1, -(-len(ordered) * p // 100)) - 1]
+    return {"p50": rank(50), "p90": rank(90), "p95": rank(95), "p99": rank(99), "max": ordered[-1], "count": len(ordered)}
+
+
+def main():
+    defines = firmware_defines()
+    cert_dir = os.path.join(ROOT, "cert")
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--devices", type=int, default=100, help="number of virtual devices")
+    parser.add_argument("--identity", action="append", help="MODEL:VERSION, repeat for a mixed fleet")
+    parser.add_argument("--arrival", choices=("burst", "uniform", "poisson", "ramp"), default="poisson")
+    parser.add_argument("--window", type=float, default=60.0, help="seconds over which the devices arrive")
+    parser.add_argument("--cycles", type=int, default=1, help="update cycles per device")
+    parser.add_argument("--interval", type=float, default=60.0, help="seconds between the cycles of a device")
+    parser.add_argument("--workers", type=int, default=256, help="cycles running at once")
+    parser.add_argument("--download", action="store_true", help="download the published image")
+    parser.add_argument("--cbor", action="store_true", help="send the request in CBOR")
+    parser.add_argument("--client", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "fleet_client"),
+                        help="host build of the firmware's metadata exchange, see tools/fleet_client.c")
+    parser.add_argument("--server", default=defines.get("HTTPS_BLOCKCHAIN_SERVER_URL"), help="metadata server")
+    parser.add_argument("--gateway", default=defines.get("HTTPS_IPFS_SERVER_URL"), help="gateway base URL, ending with /ipfs/")
+    parser.add_argument("--cid", help="download this CID instead of the published one")
+    parser.add_argument("--buffer", type=int, default=defines.get("HTTPS_RESPONSE_BUFFER_SIZE", 2048))
+    parser.add_argument("--timeout", type=float, default=30.0)
+    default_cert = os.path.join(cert_dir, "device-cert.pem")
+    parser.add_argument("--cert", default=default_cert if os.path.exists(default_cert) else None)
+    parser.add_argument("--key", default=os.path.join(cert_dir, "device-key.pem"))
+    default_ca = os.path.join(cert_dir, "ca-cert.pem")
+    parser.add_argument("--ca", default=default_ca if os.path.exists(default_ca) else None)
+    parser.add_argument("--out", help="write the report as JSON")
+    parser.add_argument("--seed", type=int, help="seed of the arrival pattern")
+    args = parser.parse_args()
+    if args.seed is not None:
+        random.seed(args.seed)
+
+    identities = [tuple(i.split(":", 1)) for i in (args.identity or [])]
+    if not identities:
+        identities = [(defines.get("HARDWARE_MODEL", "ModelX"), defines.get("FIRMWARE_VERSION", "1.0"))]
+    if not os.access(args.client, os.X_OK):
+        parser.error("%s not found, build it as in tools/fleet_client.c" % args.client)
+    context = tls_context(args)
+    client = FleetClient(args.client)
+    stats = Stats()
+
+    # (start offset, device index, cycle) in start order
+    schedule = []
+    for index, offset in enumerate(arrivals(args)):
+        for cycle in range(args.cycles):
+            schedule.append((offset + cycle * args.interval, index, cycle))
+    heapq.heapify(schedule)
+    devices = [{"identity": identities[i % len(identities)]} for i in range(args.devices)]
+
+    print("%d devices, %d cycles each, %s arrival over %.0f s, %d identities" %
+          (args.devices, args.cycles, args.arrival, args.window, len(identities)), flush=True)
+
+    begin = time.monotonic()
+
+    def run(due, index):
+        stats.add("lag_ms", max(0.0, (time.monotonic() - begin - due) * 1000))
+        device_cycle(devices[index], args, defines, context, client, stats)
+
+    with ThreadPoolExecutor(max_workers=args.workers) as pool:
+        while schedule:
+            due, index, _ = heapq.heappop(schedule)
+            delay = due - (time.monotonic() - begin)
+            if delay > 0:
+                time.sleep(delay)
+            pool.submit(run, due, index)
+    elapsed = time.monotonic() - begin
+    client.close()
+
+    total = sum(stats.outcomes.values())
+    report = {
+        "devices": args.devices, "cycles": total, "elapsedS": round(elapsed, 3),
+        "cyclesPerS": round(total / elapsed, 2) if elapsed else 0,
+        "downloadMBps": round(stats.bytes / elapsed / 1e6, 3) if elapsed else 0,
+        "outcomes": stats.outcomes,
+        "metadataMs": percentiles(stats.metadata_ms),
+        "downloadMs": percentiles(stats.download_ms),
+        "startLagMs": percentiles(stats.lag_ms),
+    }
+    print("%d cycles in %.1f s: %.1f cycles/s, %.2f MB/s downloaded" % (total, elapsed, report["cyclesPerS"], report["downloadMBps"]))
+    for name, count in sorted(stats.outcomes.items()):
+        print("  %-24s %d" % (name, count))
+    for key in ("metadataMs", "downloadMs", "startLagMs"):
+        p = report[key]
+        if p:
+            print("%-11s p50 %7.1f  p90 %7.1f  p95 %7.1f  p99 %7.1f  max %7.1f ms" % (key, p["p50"], p["p90"], p["p95"], p["p99"], p["max"]))
+    if args.out:
+        with open(args.out, "w") as f:
+            json.dump(report, f, indent=2)
+    failures = sum(c for name, c in stats.outcomes.items() if name not in ("downloaded", "up_to_date", "no_download"))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""
+Builds the chunk manifest of an encrypted firmware image.
+
+The manifest is the concatenation of the SHA-256 leaf hashes of each chunk,
+leaf = SHA-256(0x00 || chunk), followed by the leaf of the decrypted image,
+SHA-256(0x02 || SHA-256(decrypted image)). Inner nodes are
+SHA-256(0x01 || left || right) and an odd node is promoted unchanged. The
+Merkle root must be published as "integrityHash" and the manifest CID as
+"manifestCid" in the metadata.
+
+Usage: fw_manifest.py <encrypted_image> <decrypted_image> <manifest_out> [chunk_size]
+"""
+import hashlib
+import sys
+
+
+def leaf_hashes(data, chunk_size):
+    return [hashlib.sha256(b"\x00" + data[i:i + chunk_size]).digest()
+            for i in range(0, len(data), chunk_size)]
+
+
+def image_leaf(plain):
+    return hashlib.sha256(b"\x02" + hashlib.sha256(plain).digest()).digest()
+
+
+def merkle_root(level):
+    while len(level) > 1:
+        nxt = []
+        for i in range(0, len(level), 2):
+            if i + 1 == len(level):
+                nxt.append(level[i])
+            else:
+                nxt.append(hashlib.sha256(b"\x01" + level[i] + level[i + 1]).digest())
+        level = nxt
+    return level[0]
+
+
+def main():
+    if len(sys.argv) < 4:
+        print(__doc__)
+        return 1
+    chunk_size = int(sys.argv[4]) if len(sys.argv) > 4 else 4096
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+    with open(sys.argv[2], "rb") as f:
+        plain = f.read()
+    leaves = leaf_hashes(data, chunk_size) + [image_leaf(plain)]
+    with open(sys.argv[3], "wb") as f:
+        f.write(b"".join(leaves))
+    print("chunks:        %d" % (len(leaves) - 1))
+    print("chunkSize:     %d" % chunk_size)
+    print("integrityHash: %s" % merkle_root(leaves).hex())
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,285 @@
+/*
+ * Host throughput comparison of the firmware integrity hashes.
+ *
+ * Hashes a buffer (random data, or an image file) with a portable SHA-256,
+ * with main/api/blake3.c in one pass, and with blake3.c split by subtree
+ * across threads, the way the device splits the verification across its
+ * cores. Prints MB/s of each and the digests, which must agree between the
+ * BLAKE3 runs; the digests of a file are the integrityHash of each
+ * algorithm.
+ *
+ * Then checks fw_update_verify_range(): the chaining values of the subtrees
+ * are kept, a range is hashed again from the subtrees covering it, and a
+ * byte flipped inside the range must be caught while one flipped outside
+ * must not.
+ *
+ * Both hashes are plain C (no SHA extensions, no BLAKE3 SIMD), so the ratio
+ * compares the algorithms. On the device, SHA-256 runs on the SHA
+ * accelerator when CONFIG_MBEDTLS_HARDWARE_SHA is set; compare the
+ * verifyMs of the PERF_CYCLE lines there.
+ *
+ * Build: cc -O2 -I main -o hash_bench tools/hash_bench.c main/api/blake3.c -lpthread
+ * Usage: hash_bench [--size MiB | --file image] [--threads N] [--subtree KiB] [--rounds N]
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "api/blake3.h"
+
+/* SHA-256, FIPS 180-4 */
+
+static const uint32_t k256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t h[8], const uint8_t *p)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = hh + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + k256[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+static void sha256(const uint8_t *data, size_t len, uint8_t out[32])
+{
+    uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    uint8_t tail[128] = {0};
+    size_t full = len & ~(size_t)63;
+    for (size_t i = 0; i < full; i += 64) {
+        sha256_block(h, data + i);
+    }
+    size_t rest = len - full;
+    memcpy(tail, data + full, rest);
+    tail[rest] = 0x80;
+    size_t tail_len = (rest < 56) ? 64 : 128;
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++) {
+        tail[tail_len - 1 - i] = bits >> (8 * i);
+    }
+    for (size_t i = 0; i < tail_len; i += 64) {
+        sha256_block(h, tail + i);
+    }
+    for (int i = 0; i < 8; i++) {
+        out[4 * i] = h[i] >> 24; out[4 * i + 1] = h[i] >> 16; out[4 * i + 2] = h[i] >> 8; out[4 * i + 3] = h[i];
+    }
+}
+
+/* BLAKE3 split by subtree, as calculate_blake3_hash_from_ota() does */
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t subtree;
+    size_t first, last;
+    uint8_t *cvs;
+} worker_t;
+
+static void *blake3_worker(void *arg)
+{
+    worker_t *w = arg;
+    for (size_t i = w->first; i < w->last; i++) {
+        blake3_hasher_t hasher;
+        size_t off = i * w->subtree;
+        size_t n = (w->len - off < w->subtree) ? w->len - off : w->subtree;
+        blake3_hasher_init_subtree(&hasher, off / BLAKE3_CHUNK_LEN);
+        blake3_hasher_update(&hasher, w->data + off, n);
+        blake3_hasher_finalize_subtree(&hasher, &w->cvs[i * BLAKE3_OUT_LEN]);
+    }
+    return NULL;
+}
+
+static void blake3_parallel(const uint8_t *data, size_t len, size_t subtree, int threads, uint8_t out[32], uint8_t *cvs)
+{
+    size_t count = (len + subtree - 1) / subtree;
+    if (count <= 1) {
+        blake3_hash(data, len, out);
+        if (cvs) memcpy(cvs, out, BLAKE3_OUT_LEN);
+        return;
+    }
+    uint8_t *own = cvs ? NULL : malloc(count * BLAKE3_OUT_LEN);
+    if (own) cvs = own;
+    pthread_t tid[64];
+    worker_t w[64];
+    for (int t = 0; t < threads; t++) {
+        w[t] = (worker_t){data, len, subtree, count * t / threads, count * (t + 1) / threads, cvs};
+        pthread_create(&tid[t], NULL, blake3_worker, &w[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tid[t], NULL);
+    }
+    blake3_join_subtrees(cvs, count, out);
+    free(own);
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Range check against the kept chaining values, as fw_update_verify_range() does */
+
+static int verify_range(const uint8_t *data, size_t len, size_t subtree, const uint8_t *cvs, size_t offset, size_t n)
+{
+    size_t count = (len + subtree - 1) / subtree;
+    uint8_t cv[BLAKE3_OUT_LEN];
+    for (size_t i = offset / subtree; i <= (offset + n - 1) / subtree; i++) {
+        size_t off = i * subtree;
+        size_t m = (len - off < subtree) ? len - off : subtree;
+        if (count == 1) {
+            blake3_hash(data, len, cv);
+        } else {
+            blake3_hasher_t hasher;
+            blake3_hasher_init_subtree(&hasher, off / BLAKE3_CHUNK_LEN);
+            blake3_hasher_update(&hasher, data + off, m);
+            blake3_hasher_finalize_subtree(&hasher, cv);
+        }
+        if (memcmp(cv, &cvs[i * BLAKE3_OUT_LEN], BLAKE3_OUT_LEN) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int check_ranges(uint8_t *data, size_t len, size_t subtree, const uint8_t *cvs)
+{
+    // A range straddling a subtree boundary, or the middle of a short image
+    size_t offset = (len > subtree) ? subtree - 1000 : len / 4;
+    size_t n = (len - offset < 2000) ? len - offset : 2000;
+    size_t outside = (offset + n + subtree < len) ? offset + n + subtree : 0;
+    int ok = 1;
+
+    if (!verify_range(data, len, subtree, cvs, offset, n)) {
+        fprintf(stderr, "range %zu+%zu of an intact image rejected\n", offset, n);
+        ok = 0;
+    }
+    data[offset + n / 2] ^= 1;
+    if (verify_range(data, len, subtree, cvs, offset, n)) {
+        fprintf(stderr, "range %zu+%zu with a flipped byte accepted\n", offset, n);
+        ok = 0;
+    }
+    data[offset + n / 2] ^= 1;
+    if (outside) {
+        data[outside] ^= 1;
+        if (!verify_range(data, len, subtree, cvs, offset, n)) {
+            fprintf(stderr, "range %zu+%zu rejected for a byte flipped at %zu\n", offset, n, outside);
+            ok = 0;
+        }
+        data[outside] ^= 1;
+    }
+    double t0 = now_s();
+    verify_range(data, len, subtree, cvs, offset, n);
+    double t1 = now_s();
+    if (ok) {
+        printf("range %zu+%zu verified in %.3f ms against the kept chaining values\n", offset, n, (t1 - t0) * 1e3);
+    }
+    return ok;
+}
+
+static void hex(const char *name, const uint8_t d[32])
+{
+    printf("%-16s", name);
+    for (int i = 0; i < 32; i++) {
+        printf("%02x", d[i]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    size_t size = 4 << 20, subtree = 64 << 10;
+    int threads = 2, rounds = 5;
+    const char *file = NULL;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--size")) size = (size_t)atoi(argv[i + 1]) << 20;
+        else if (!strcmp(argv[i], "--file")) file = argv[i + 1];
+        else if (!strcmp(argv[i], "--threads")) threads = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--subtree")) subtree = (size_t)atoi(argv[i + 1]) << 10;
+        else if (!strcmp(argv[i], "--rounds")) rounds = atoi(argv[i + 1]);
+        else { fprintf(stderr, "unknown option %s\n", argv[i]); return 2; }
+    }
+    // The subtree must be a power of two chunks
+    if (subtree < BLAKE3_CHUNK_LEN || (subtree & (subtree - 1)) || threads < 1 || threads > 64 || rounds < 1) {
+        fprintf(stderr, "subtree must be a power of two KiB, threads 1 to 64\n");
+        return 2;
+    }
+
+    uint8_t *data;
+    if (file) {
+        FILE *f = fopen(file, "rb");
+        if (!f) { perror(file); return 2; }
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        data = malloc(size ? size : 1);
+        if (fread(data, 1, size, f) != size) { perror(file); return 2; }
+        fclose(f);
+    } else {
+        data = malloc(size);
+        srand(1);
+        for (size_t i = 0; i < size; i++) data[i] = rand();
+    }
+
+    uint8_t d_sha[32], d_b3[32], d_b3p[32];
+    double best[3] = {1e9, 1e9, 1e9};
+    for (int r = 0; r < rounds; r++) {
+        double t0 = now_s();
+        sha256(data, size, d_sha);
+        double t1 = now_s();
+        blake3_hash(data, size, d_b3);
+        double t2 = now_s();
+        blake3_parallel(data, size, subtree, threads, d_b3p, NULL);
+        double t3 = now_s();
+        if (t1 - t0 < best[0]) best[0] = t1 - t0;
+        if (t2 - t1 < best[1]) best[1] = t2 - t1;
+        if (t3 - t2 < best[2]) best[2] = t3 - t2;
+    }
+
+    double mb = size / 1e6;
+    printf("%zu bytes, best of %d rounds\n", size, rounds);
+    printf("%-28s %8.1f MB/s\n", "SHA-256", mb / best[0]);
+    printf("%-28s %8.1f MB/s  (%.2fx SHA-256)\n", "BLAKE3, 1 thread", mb / best[1], best[0] / best[1]);
+    char label[64];
+    snprintf(label, sizeof(label), "BLAKE3, %d threads, %zu KiB", threads, subtree >> 10);
+    printf("%-28s %8.1f MB/s  (%.2fx SHA-256)\n", label, mb / best[2], best[0] / best[2]);
+    hex("sha256", d_sha);
+    hex("blake3", d_b3);
+    if (memcmp(d_b3, d_b3p, 32) != 0) {
+        hex("blake3 split", d_b3p);
+        fprintf(stderr, "BLAKE3 split by subtree does not match the single pass\n");
+        return 1;
+    }
+
+    uint8_t *cvs = malloc(((size + subtree - 1) / subtree + 1) * BLAKE3_OUT_LEN);
+    blake3_parallel(data, size, subtree, threads, d_b3p, cvs);
+    int ok = (size > 0) ? check_ranges(data, size, subtree, cvs) : 1;
+    free(cvs);
+    return ok ? 0 : 1;
+}
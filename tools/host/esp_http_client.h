@@ -0,0 +1,7 @@
+/*
+ * Host stand-in of the ESP-IDF esp_http_client.h, for tools/fleet_client.c.
+ * The headers of the device only pass clients by handle.
+ */
+#pragma once
+
+typedef struct esp_http_client *esp_http_client_handle_t;
@@ -0,0 +1,7 @@
+/*
+ * Host stand-in of the ESP-IDF esp_partition.h, for tools/fleet_client.c.
+ * The headers of the device only pass partitions by pointer.
+ */
+#pragma once
+
+typedef struct esp_partition esp_partition_t;
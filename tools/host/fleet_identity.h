@@ -0,0 +1,12 @@
+/*
+ * Identity of the virtual device of tools/fleet_client.c, included ahead
+ * of every source: HARDWARE_MODEL and FIRMWARE_VERSION of main/version.h
+ * become variables set per request.
+ */
+#pragma once
+
+extern const char *fleet_client_model;
+extern const char *fleet_client_version;
+
+#define HARDWARE_MODEL   fleet_client_model
+#define FIRMWARE_VERSION fleet_client_version
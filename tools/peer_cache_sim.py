@@ -0,0 +1,319 @@
+#!/usr/bin/env python3
+"""
+Simulated devices of the LAN peer cache (PEER_CACHE_ENABLED), so several
+of them run on one Linux host next to, or instead of, real devices.
+
+Each simulated device answers mDNS (224.0.0.251:5353) for the
+"_fwcache._tcp" service with a "cid=<cid>" TXT record, and serves the
+encrypted image at GET /ipfs/<cid> on its own port, with Range support,
+as a device does from its OTA slot. "fetch" behaves like a device being
+updated: it races nothing, but tries the peers found over mDNS before the
+gateway, resumes with Range on the next source when one fails, checks the
+SHA-256 of the whole image and then serves it to the next devices.
+
+On one host the devices talk over the loopback interface (--iface). If
+"browse" finds nothing, enable multicast on it once:
+    sudo ip link set lo multicast on
+    sudo ip route add 224.0.0.0/4 dev lo
+
+Usage: peer_cache_sim.py serve  --image fw.enc --cid <cid> --port 8101 [--name dev1]
+       peer_cache_sim.py fetch  --cid <cid> --sha256 <hex> --port 8102 [--name dev2]
+                                [--gateway http://<host>:8080/ipfs/] [--out fw.enc]
+       peer_cache_sim.py browse [--cid <cid>]
+       common options: [--iface 127.0.0.1] [--timeout 1.5]
+
+The SHA-256 checked by "fetch" is the one of the encrypted image, since the
+simulation has no AES; a device checks the metadata integrityHash of the
+decrypted one.
+"""
+import argparse
+import hashlib
+import random
+import re
+import socket
+import struct
+import sys
+import threading
+import time
+import urllib.request
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+MDNS_GROUP = "224.0.0.251"
+MDNS_PORT = 5353
+SERVICE = "_fwcache._tcp.local"
+TYPE_A, TYPE_PTR, TYPE_TXT, TYPE_SRV, TYPE_ANY = 1, 12, 16, 33, 255
+TTL = 120
+
+
+def encode_name(name):
+    out = b""
+    for label in name.rstrip(".").split("."):
+        out += bytes([len(label)]) + label.encode()
+    return out + b"\x00"
+
+
+def decode_name(data, offset):
+    labels = []
+    end = None
+    for _ in range(128):  # bounds a malicious pointer loop
+        length = data[offset]
+        if length & 0xC0 == 0xC0:
+            if end is None:
+                end = offset + 2
+            offset = ((length & 0x3F) << 8) | data[offset + 1]
+            continue
+        offset += 1
+        if length == 0:
+            break
+        labels.append(data[offset:offset + length].decode(errors="replace"))
+        offset += length
+    return ".".join(labels), (end if end is not None else offset)
+
+
+def record(name, rtype, rdata, unique=True):
+    rclass = 0x8001 if unique else 0x0001  # cache-flush bit on the unique records
+    return encode_name(name) + struct.pack(">HHIH", rtype, rclass, TTL, len(rdata)) + rdata
+
+
+def parse_message(data):
+    """Returns (id, flags, questions, records), each record (name, type, rdata, offset)."""
+    msg_id, flags, qd, an, ns, ar = struct.unpack(">HHHHHH", data[:12])
+    offset = 12
+    questions = []
+    for _ in range(qd):
+        name, offset = decode_name(data, offset)
+        qtype, _qclass = struct.unpack(">HH", data[offset:offset + 4])
+        offset += 4
+        questions.append((name.lower(), qtype))
+    records = []
+    for _ in range(an + ns + ar):
+        name, offset = decode_name(data, offset)
+        rtype, _rclass, _ttl, rdlen = struct.unpack(">HHIH", data[offset:offset + 10])
+        offset += 10
+        records.append((name, rtype, data[offset:offset + rdlen], offset))
+        offset += rdlen
+    return msg_id, flags, questions, records
+
+
+def mdns_socket(iface, bind_port):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    if hasattr(socket, "SO_REUSEPORT"):
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(iface))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 255)
+    sock.bind(("", bind_port))
+    if bind_port == MDNS_PORT:
+        membership = socket.inet_aton(MDNS_GROUP) + socket.inet_aton(iface)
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    return sock
+
+
+class Responder(threading.Thread):
+    """Answers the mDNS questions about the service of one simulated device."""
+
+    def __init__(self, name, address, port, cid, iface):
+        super().__init__(daemon=True)
+        self.instance = "%s.%s" % (name, SERVICE)
+        self.host = "%s.local" % name
+        self.address, self.port, self.cid = address, port, cid
+        self.sock = mdns_socket(iface, MDNS_PORT)
+
+    def answer(self, msg_id, question_wire):
+        txt = ("cid=%s" % self.cid).encode()
+        answers = [record(SERVICE, TYPE_PTR, encode_name(self.instance), unique=False)]
+        additional = [
+            record(self.instance, TYPE_SRV, struct.pack(">HHH", 0, 0, self.port) + encode_name(self.host)),
+            record(self.instance, TYPE_TXT, bytes([len(txt)]) + txt),
+            record(self.host, TYPE_A, socket.inet_aton(self.address)),
+        ]
+        header = struct.pack(">HHHHHH", msg_id, 0x8400, 1 if question_wire else 0, len(answers), 0, len(additional))
+        return header + question_wire + b"".join(answers) + b"".join(additional)
+
+    def run(self):
+        names = (SERVICE.lower(), self.instance.lower(), self.host.lower())
+        while True:
+            data, sender = self.sock.recvfrom(9000)
+            try:
+                msg_id, flags, questions, _ = parse_message(data)
+            except (struct.error, IndexError):
+                continue
+            if flags & 0x8000 or not any(q[0] in names and q[1] in (TYPE_A, TYPE_PTR, TYPE_TXT, TYPE_SRV, TYPE_ANY) for q in questions):
+                continue
+            if sender[1] != MDNS_PORT:
+                # Legacy unicast query (RFC 6762 6.7): answer the sender, echoing the question
+                self.sock.sendto(self.answer(msg_id, record_question(SERVICE)), sender)
+            else:
+                self.sock.sendto(self.answer(0, b""), (MDNS_GROUP, MDNS_PORT))
+
+
+def record_question(name, qtype=TYPE_PTR):
+    return encode_name(name) + struct.pack(">HH", qtype, 1)
+
+
+def browse(iface, timeout):
+    """Returns [(instance, url, cid)] of the peers answering within timeout."""
+    sock = mdns_socket(iface, 0)
+    query = struct.pack(">HHHHHH", random.randint(1, 0xFFFF), 0, 1, 0, 0, 0) + record_question(SERVICE)
+    sock.sendto(query, (MDNS_GROUP, MDNS_PORT))
+    sock.settimeout(0.1)
+    ptrs, srvs, txts, addrs = set(), {}, {}, {}
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            data, _ = sock.recvfrom(9000)
+            _, _, _, records = parse_message(data)
+        except socket.timeout:
+            continue
+        except (struct.error, IndexError):
+            continue
+        for name, rtype, rdata, offset in records:
+            if rtype == TYPE_PTR and name.lower() == SERVICE.lower():
+                ptrs.add(decode_name(data, offset)[0])
+            elif rtype == TYPE_SRV:
+                srvs[name] = (struct.unpack(">H", rdata[4:6])[0], decode_name(data, offset + 6)[0])
+            elif rtype == TYPE_TXT:
+                items, i = {}, 0
+                while i < len(rdata):
+                    item = rdata[i + 1:i + 1 + rdata[i]].decode(errors="replace")
+                    key, _, value = item.partition("=")
+                    items[key] = value
+                    i += 1 + rdata[i]
+                txts[name] = items
+            elif rtype == TYPE_A:
+                addrs[name] = socket.inet_ntoa(rdata)
+    sock.close()
+    peers = []
+    for instance in sorted(ptrs):
+        if instance in srvs and srvs[instance][1] in addrs:
+            port, host = srvs[instance]
+            url = "http://%s:%d/ipfs/" % (addrs[host], port)
+            peers.append((instance, url, txts.get(instance, {}).get("cid", "")))
+    return peers
+
+
+def make_handler(image, cid):
+    class PeerHandler(BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def log_message(self, fmt, *args):
+            sys.stderr.write("[%s] %s\n" % (self.server.server_port, fmt % args))
+
+        def do_GET(self):
+            if self.path.split("?")[0] != "/ipfs/" + cid:
+                self.send_error(404, "CID not cached")
+                return
+            start, end = 0, len(image) - 1
+            match = re.match(r"bytes=(\d+)-(\d*)", self.headers.get("Range", ""))
+            if match:
+                start = int(match.group(1))
+                if start >= len(image):
+                    self.send_response(416)
+                    self.send_header("Content-Range", "bytes */%d" % len(image))
+                    self.send_header("Content-Length", "0")
+                    self.end_headers()
+                    return
+                if match.group(2):
+                    end = min(end, int(match.group(2)))
+                self.send_response(206)
+                self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, len(image)))
+            else:
+                self.send_response(200)
+                self.send_header("Accept-Ranges", "bytes")
+            self.send_header("Content-Type", "application/octet-stream")
+            self.send_header("Content-Length", str(end - start + 1))
+            self.end_headers()
+            self.wfile.write(image[start:end + 1])
+
+    return PeerHandler
+
+
+def serve(image, args):
+    server = ThreadingHTTPServer((args.address, args.port), make_handler(image, args.cid))
+    Responder(args.name, args.address, args.port, args.cid, args.iface).start()
+    print("%s serving %s (%d bytes) on %s:%d" % (args.name, args.cid, len(image), args.address, args.port), flush=True)
+    server.serve_forever()
+
+
+def download(url, offset):
+    request = urllib.request.Request(url)
+    if offset:
+        request.add_header("Range", "bytes=%d-" % offset)
+    with urllib.request.urlopen(request, timeout=10) as response:
+        if offset and response.status != 206:
+            raise IOError("range not honored")
+        return response.read()
+
+
+def fetch(args):
+    sources = []
+    for instance, url, cid in browse(args.iface, args.timeout):
+        if cid == args.cid and not instance.startswith(args.name + "."):
+            sources.append(("peer " + instance.split(".")[0], url))
+    if args.gateway:
+        sources.append(("gateway", args.gateway))
+
+    image = b""
+    for label, base in sources:
+        started = time.time()
+        try:
+            image += download(base + args.cid, len(image))
+        except (OSError, IOError) as e:
+            print("%s failed after %d bytes: %s" % (label, len(image), e))
+            continue
+        digest = hashlib.sha256(image).hexdigest()
+        if digest != args.sha256.lower():
+            # A peer is trusted no more than a gateway: start again from the next source
+            print("%s served a wrong image (%s)" % (label, digest))
+            image = b""
+            continue
+        print("%s: %d bytes in %.2f s, hash ok" % (label, len(image), time.time() - started), flush=True)
+        break
+    else:
+        print("no source served a valid image")
+        return 1
+
+    if args.out:
+        with open(args.out, "wb") as f:
+            f.write(image)
+    if args.port:
+        serve(image, args)
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("mode", choices=("serve", "fetch", "browse"))
+    parser.add_argument("--image", help="encrypted image served by 'serve'")
+    parser.add_argument("--cid", help="CID of the image")
+    parser.add_argument("--sha256", help="SHA-256 of the encrypted image, checked by 'fetch'")
+    parser.add_argument("--gateway", help="IPFS gateway base URL, tried after the peers")
+    parser.add_argument("--out", help="file where 'fetch' stores the image")
+    parser.add_argument("--port", type=int, default=0, help="HTTP port of this device, 'fetch' only serves when set")
+    parser.add_argument("--name", default="sim-%04x" % random.randint(0, 0xFFFF), help="mDNS host and instance name")
+    parser.add_argument("--address", default="127.0.0.1", help="address advertised in the A record")
+    parser.add_argument("--iface", default="127.0.0.1", help="address of the interface used for mDNS")
+    parser.add_argument("--timeout", type=float, default=1.5, help="time waiting for mDNS answers")
+    args = parser.parse_args()
+
+    if args.mode == "browse":
+        for instance, url, cid in browse(args.iface, args.timeout):
+            if not args.cid or cid == args.cid:
+                print("%s %s%s" % (instance, url, cid))
+        return 0
+    if not args.cid:
+        parser.error("--cid is required")
+    if args.mode == "serve":
+        if not args.image:
+            parser.error("--image is required")
+        with open(args.image, "rb") as f:
+            serve(f.read(), args)
+        return 0
+    if not args.sha256:
+        parser.error("--sha256 is required")
+    return fetch(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
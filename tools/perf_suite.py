@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""
+Update-time regression gate built on the PERFORMANCE_TEST mode.
+
+Serves a local stand-in for the metadata server and the IPFS gateway, then
+reads the device console (serial port or stdin) and collects the
+"PERF_CYCLE {...}" line printed after each update cycle. When TEST_LOOP
+cycles ran (or "PERF_DONE" is seen) it writes p50/p95/max of each timing
+and the memory peaks to a JSON summary. With a baseline, it exits with 1 if
+a p95 timing grew, or a memory margin shrank, more than the threshold.
+
+Device setup: PERFORMANCE_TEST_ENABLED in main_test.h, and both
+HTTPS_BLOCKCHAIN_SERVER_URL and HTTPS_IPFS_SERVER_URL ("<url>/ipfs/")
+pointed at http://<host>:<http-port>.
+
+Usage: perf_suite.py --image <encrypted_image> --hash <sha256_hex>
+                     [--serial /dev/ttyUSB0 | < console.log]
+                     [--cycles N] [--baseline base.json] [--threshold 10]
+                     [--out summary.json] [--save-baseline base.json]
+"""
+import argparse
+import json
+import re
+import sys
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+TIMINGS = ("cycleMs", "metadataMs", "downloadMs", "verifyMs")
+# Lower is worse: free heap and stack high water marks, in bytes
+MARGINS = ("minFreeHeap", "mainStackBytes", "httpsStackBytes")
+CYCLE_RE = re.compile(r"PERF_CYCLE (\{.*\})")
+ANSI_RE = re.compile(r"\x1b\[[0-9;]*m")
+
+
+def make_handler(image, metadata):
+    class StandInHandler(BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def log_message(self, fmt, *args):
+            pass
+
+        def do_POST(self):
+            self.rfile.read(int(self.headers.get("Content-Length", 0)))
+            if not self.path.startswith("/register-device"):
+                self.send_error(404)
+                return
+            body = json.dumps(metadata).encode()
+            self.send_response(200)
+            self.send_header("Content-Type", "application/json")
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def do_GET(self):
+            if "/ipfs/" not in self.path:
+                self.send_error(404)
+                return
+            start = 0
+            match = re.match(r"bytes=(\d+)-", self.headers.get("Range", ""))
+            if match and int(match.group(1)) < len(image):
+                start = int(match.group(1))
+                self.send_response(206)
+                self.send_header("Content-Range", "bytes %d-%d/%d" % (start, len(image) - 1, len(image)))
+            else:
+                self.send_response(200)
+            self.send_header("Content-Type", "application/octet-stream")
+            self.send_header("Content-Length", str(len(image) - start))
+            self.end_headers()
+            self.wfile.write(image[start:])
+
+    return StandInHandler
+
+
+def console_lines(args):
+    if args.serial:
+        import serial  # pyserial, only needed to read the port directly
+        port = serial.Serial(args.serial, args.baud, timeout=1)
+        while True:
+            line = port.readline()
+            if line:
+                yield line.decode(errors="replace")
+    else:
+        yield from sys.stdin
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    rank = max(1, -(-len(ordered) * p // 100))  # nearest rank
+    return ordered[rank - 1]
+
+
+def summarize(cycles):
+    summary = {"cycles": len(cycles), "failures": sum(1 for c in cycles if c["result"] != 0)}
+    for key in TIMINGS:
+        values = [c[key] for c in cycles]
+        summary[key] = {"p50": percentile(values, 50), "p95": percentile(values, 95), "max": max(values)}
+    for key in MARGINS:
+        summary[key] = {"min": min(c[key] for c in cycles)}
+    return summary
+
+
+def compare(summary, baseline, threshold):
+    regressions = []
+    for key in TIMINGS:
+        limit = baseline[key]["p95"] * (1 + threshold / 100.0)
+        if summary[key]["p95"] > limit:
+            regressions.append("%s p95 %d ms > %d ms" % (key, summary[key]["p95"], limit))
+    for key in MARGINS:
+        limit = baseline[key]["min"] * (1 - threshold / 100.0)
+        if summary[key]["min"] < limit:
+            regressions.append("%s min %d < %d" % (key, summary[key]["min"], limit))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--image", required=True, help="encrypted firmware served by the stand-in gateway")
+    parser.add_argument("--hash", required=True, help="integrityHash published in the metadata")
+    parser.add_argument("--version", default="99.0", help="version published in the metadata")
+    parser.add_argument("--cid", default="QmYmXS2FE72kciXwf9qCVtgNvrH1nsx2aua4cGu1kSDNH8")
+    parser.add_argument("--http-port", type=int, default=8080)
+    parser.add_argument("--serial", help="console port, stdin is read when omitted")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--cycles", type=int, default=50, help="cycles to collect, TEST_LOOP on the device")
+    parser.add_argument("--baseline", help="summary of a reference run")
+    parser.add_argument("--threshold", type=float, default=10.0, help="allowed regression in percent")
+    parser.add_argument("--out", default="perf_summary.json")
+    parser.add_argument("--save-baseline", help="also write the summary as a new baseline")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+    metadata = {
+        "message": "Update available",
+        "latestFirmware": {
+            "version": args.version, "author": "perf_suite", "hardwareModel": "ModelX",
+            "integrityHash": args.hash, "timestamp": "0", "description": "stand-in release",
+            "cid": args.cid,
+        },
+    }
+    server = ThreadingHTTPServer(("", args.http_port), make_handler(image, metadata))
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    print("stand-in server on port %d, waiting for %d cycles" % (args.http_port, args.cycles))
+
+    cycles = []
+    for line in console_lines(args):
+        line = ANSI_RE.sub("", line)
+        match = CYCLE_RE.search(line)
+        if match:
+            cycles.append(json.loads(match.group(1)))
+            print("cycle %d: %d ms, result %d" % (len(cycles), cycles[-1]["cycleMs"], cycles[-1]["result"]))
+        if len(cycles) >= args.cycles or "PERF_DONE" in line:
+            break
+    server.shutdown()
+    if not cycles:
+        print("no PERF_CYCLE line received")
+        return 1
+
+    summary = summarize(cycles)
+    with open(args.out, "w") as f:
+        json.dump(summary, f, indent=2)
+    if args.save_baseline:
+        with open(args.save_baseline, "w") as f:
+            json.dump(summary, f, indent=2)
+    for key in TIMINGS:
+        print("%-11s p50 %6d  p95 %6d  max %6d ms" % (key, summary[key]["p50"], summary[key]["p95"], summary[key]["max"]))
+    for key in MARGINS:
+        print("%-11s min %6d" % (key, summary[key]["min"]))
+
+    failed = summary["failures"] > 0
+    if failed:
+        print("FAIL: %d cycles did not finish the update" % summary["failures"])
+    if args.baseline:
+        with open(args.baseline) as f:
+            regressions = compare(summary, json.load(f), args.threshold)
+        for regression in regressions:
+            print("REGRESSION: " + regression)
+        failed = failed or bool(regressions)
+    print("FAIL" if failed else "PASS")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
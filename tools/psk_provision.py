@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""
+Provisions the pre-shared key of a device for the TLS-PSK metadata channel.
+
+Writes an NVS CSV with the identity and the key in the "tls_psk" namespace,
+for nvs_partition_gen.py, and appends the identity and the key to the
+keystore read by the PSK listener of the metadata server.
+
+With --master, the key is HMAC-SHA256(master, identity), so the server may
+derive it instead of keeping a table; without it, the key is random.
+
+The generated partition replaces the whole NVS, so flash it at the factory,
+before the first boot:
+
+    python $IDF_PATH/components/nvs_flash/nvs_partition_generator/nvs_partition_gen.py \\
+        generate psk.csv psk.bin 0x5000
+    esptool.py write_flash 0x9000 psk.bin
+
+Usage: psk_provision.py <identity> [--master HEX] [--key-len N]
+                        [--csv psk.csv] [--keystore psk_keys.csv]
+"""
+import argparse
+import hashlib
+import hmac
+import os
+import sys
+
+NVS_NAMESPACE = "tls_psk"
+NVS_IDENTITY_KEY = "identity"
+NVS_KEY_KEY = "key"
+IDENTITY_MAX = 64
+KEY_MIN, KEY_MAX = 16, 32
+
+
+def derive_key(identity, master, key_len):
+    if master is None:
+        return os.urandom(key_len)
+    return hmac.new(master, identity.encode(), hashlib.sha256).digest()[:key_len]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Provision the TLS-PSK key of a device")
+    parser.add_argument("identity", help="PSK identity of the device, e.g. its serial number")
+    parser.add_argument("--master", help="fleet master secret in hex, derives the key from the identity")
+    parser.add_argument("--key-len", type=int, default=KEY_MAX, help="key length in bytes (16 to 32)")
+    parser.add_argument("--csv", default="psk.csv", help="NVS CSV written for nvs_partition_gen.py")
+    parser.add_argument("--keystore", default="psk_keys.csv", help="server keystore the key is appended to")
+    args = parser.parse_args()
+
+    if not 0 < len(args.identity.encode()) <= IDENTITY_MAX or "," in args.identity:
+        sys.exit("identity must have 1 to %d bytes and no comma" % IDENTITY_MAX)
+    if not KEY_MIN <= args.key_len <= KEY_MAX:
+        sys.exit("key length must be %d to %d bytes" % (KEY_MIN, KEY_MAX))
+    master = bytes.fromhex(args.master) if args.master else None
+
+    key = derive_key(args.identity, master, args.key_len)
+
+    with open(args.csv, "w") as f:
+        f.write("key,type,encoding,value\n")
+        f.write("%s,namespace,,\n" % NVS_NAMESPACE)
+        f.write("%s,data,string,%s\n" % (NVS_IDENTITY_KEY, args.identity))
+        f.write("%s,data,hex2bin,%s\n" % (NVS_KEY_KEY, key.hex()))
+    # The device side and the server side must hold the same key
+    with open(args.keystore, "a") as f:
+        f.write("%s,%s\n" % (args.identity, key.hex()))
+
+    print("identity %s: %d-byte key written to %s and appended to %s"
+          % (args.identity, len(key), args.csv, args.keystore))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+"""
+Local stand-in for the push channel of the metadata server.
+
+Serves a Server-Sent Events stream on /events and sends a heartbeat comment
+every 15 s. Each line typed on the console announces a new firmware to all
+connected devices; typing "drop" closes the streams, to exercise the
+reconnection and the polling fallback.
+
+Point PUSH_CHANNEL_URL at "http://<host>:<port>/events" to use it.
+
+Usage: push_server.py [port]
+"""
+import queue
+import sys
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+HEARTBEAT_S = 15
+clients = []
+clients_lock = threading.Lock()
+
+
+class EventHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def do_GET(self):
+        if not self.path.startswith("/events"):
+            self.send_error(404)
+            return
+        self.send_response(200)
+        self.send_header("Content-Type", "text/event-stream")
+        self.send_header("Cache-Control", "no-cache")
+        self.send_header("Transfer-Encoding", "chunked")
+        self.end_headers()
+
+        events = queue.Queue()
+        with clients_lock:
+            clients.append(events)
+        print("device connected: %s %s" % (self.client_address[0], self.path))
+        try:
+            while True:
+                try:
+                    event = events.get(timeout=HEARTBEAT_S)
+                except queue.Empty:
+                    event = ": heartbeat\n\n"
+                if event is None:
+                    self.wfile.write(b"0\r\n\r\n")
+                    break
+                # esp_http_client reads a body of unknown length only when it is chunked
+                data = event.encode()
+                self.wfile.write(b"%x\r\n%s\r\n" % (len(data), data))
+                self.wfile.flush()
+        except OSError:
+            pass
+        finally:
+            with clients_lock:
+                clients.remove(events)
+            print("device disconnected: %s" % self.client_address[0])
+
+    def log_message(self, fmt, *args):
+        pass
+
+
+def broadcast(event):
+    with clients_lock:
+        for events in clients:
+            events.put(event)
+
+
+def main():
+    port = int(sys.argv[1]) if len(sys.argv) > 1 else 8081
+    server = ThreadingHTTPServer(("", port), EventHandler)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    print("push channel on port %d, <enter> announces a firmware, 'drop' closes the streams" % port)
+    for line in sys.stdin:
+        if line.strip() == "drop":
+            broadcast(None)
+        else:
+            broadcast("event: firmware\ndata: {\"version\": \"%s\"}\n\n" % line.strip())
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())